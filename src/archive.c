@@ -0,0 +1,1323 @@
+/*
+    Copyright 2013 Stover Enterprises, LLC (An Alabama Limited Liability Corporation)
+    Written by C. Thomas Stover
+
+    This file is part of the program Build Matrix.
+    See http://buildmatrix.stoverenterprises.com for more information.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "prototypes.h"
+
+/* Builds older than the "archiveage" configuration value (in days) are moved, along with
+   their scores and parameters, out of buildmatrix.sqlite3 and into one database file per
+   "archiveperiod" (year or month) next to it, buildmatrix-2013.sqlite3 for example. The
+   archives table in the main database records the build_id and build_time range of each file.
+
+   Readers that need history call attach_archives() with the range they are interested in,
+   and then query the temporary views all_builds, all_scores and all_parameters. Everything
+   else keeps working against the (now small) main database only. */
+
+#define ARCHIVE_SQL_SIZE 32768
+
+char *archive_tables[] = { "builds", "scores", "parameters", NULL };
+
+int table_columns(struct buildmatrix_context *ctx, const char *schema, const char *table,
+                  char ***names, char ***types, int *n_columns)
+{
+ char sql[256];
+ int code;
+ struct sqlite3_stmt *statement = NULL;
+
+ *names = NULL;
+ *types = NULL;
+ *n_columns = 0;
+
+ snprintf(sql, 256, "PRAGMA %s.table_info(%s);", schema, table);
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: table_columns(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ {
+  if( (add_to_string_array(names, *n_columns,
+                           (const char *) sqlite3_column_text(statement, 1), -1, 0) != 0) ||
+      (add_to_string_array(types, *n_columns,
+                           (const char *) sqlite3_column_text(statement, 2), -1, 0) != 0) )
+  {
+   sqlite3_finalize(statement);
+   return 1;
+  }
+  (*n_columns)++;
+ }
+
+ if(code != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: table_columns(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+int has_column(char **names, int n_columns, const char *name)
+{
+ int i;
+
+ for(i=0; i<n_columns; i++)
+ {
+  if(strcmp(names[i], name) == 0)
+   return 1;
+ }
+
+ return 0;
+}
+
+/* writes the main columns of table as a select list against schema, with NULL for any column
+   the archive predates */
+int archive_select_list(struct buildmatrix_context *ctx, const char *schema, const char *table,
+                        char *sql, int size)
+{
+ char **names, **types, **archive_names, **archive_types;
+ int n_columns, n_archive_columns, i, sql_length = 0;
+
+ if(table_columns(ctx, "main", table, &names, &types, &n_columns))
+  return -1;
+
+ if(table_columns(ctx, schema, table, &archive_names, &archive_types, &n_archive_columns))
+ {
+  free_string_array(names, n_columns);
+  free_string_array(types, n_columns);
+  return -1;
+ }
+
+ for(i=0; i<n_columns; i++)
+ {
+  if(has_column(archive_names, n_archive_columns, names[i]))
+   sql_length += snprintf(sql + sql_length, size - sql_length, "%s%s",
+                          i == 0 ? "" : ", ", names[i]);
+  else
+   sql_length += snprintf(sql + sql_length, size - sql_length, "%sNULL AS %s",
+                          i == 0 ? "" : ", ", names[i]);
+
+  if(sql_length >= size)
+   break;
+ }
+
+ free_string_array(names, n_columns);
+ free_string_array(types, n_columns);
+ if(n_archive_columns > 0)
+ {
+  free_string_array(archive_names, n_archive_columns);
+  free_string_array(archive_types, n_archive_columns);
+ }
+
+ if(sql_length >= size)
+ {
+  fprintf(stderr, "%s: archive_select_list(): column list for %s.%s too long\n",
+          ctx->error_prefix, schema, table);
+  return -1;
+ }
+
+ return sql_length;
+}
+
+int create_archive_views(struct buildmatrix_context *ctx)
+{
+ char *sql, *errmsg;
+ const char *schema;
+ int i, sql_length, length, code;
+ struct sqlite3_stmt *statement = NULL;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: create_archive_views()\n", ctx->error_prefix);
+
+ if((sql = malloc(ARCHIVE_SQL_SIZE)) == NULL)
+ {
+  fprintf(stderr, "%s: create_archive_views(): malloc(%d) failed\n",
+          ctx->error_prefix, ARCHIVE_SQL_SIZE);
+  return 1;
+ }
+
+ for(i=0; archive_tables[i] != NULL; i++)
+ {
+  sql_length = snprintf(sql, ARCHIVE_SQL_SIZE,
+                        "DROP VIEW IF EXISTS temp.all_%s; CREATE TEMP VIEW all_%s AS "
+                        "SELECT * FROM main.%s",
+                        archive_tables[i], archive_tables[i], archive_tables[i]);
+
+  if(sqlite3_prepare_v2(ctx->db_ctx, "PRAGMA database_list;", -1, &statement, NULL) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: create_archive_views(): sqlite3_prepare(PRAGMA database_list) failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   free(sql);
+   return 1;
+  }
+
+  while((code = sqlite3_step(statement)) == SQLITE_ROW)
+  {
+   schema = (const char *) sqlite3_column_text(statement, 1);
+   if(strncmp(schema, "archive_", 8) != 0)
+    continue;
+
+   sql_length += snprintf(sql + sql_length, ARCHIVE_SQL_SIZE - sql_length, " UNION ALL SELECT ");
+   if( (sql_length >= ARCHIVE_SQL_SIZE) ||
+       ((length = archive_select_list(ctx, schema, archive_tables[i], sql + sql_length,
+                                      ARCHIVE_SQL_SIZE - sql_length)) == -1) )
+   {
+    fprintf(stderr, "%s: create_archive_views(): could not build all_%s\n",
+            ctx->error_prefix, archive_tables[i]);
+    sqlite3_finalize(statement);
+    free(sql);
+    return 1;
+   }
+   sql_length += length;
+   sql_length += snprintf(sql + sql_length, ARCHIVE_SQL_SIZE - sql_length, " FROM %s.%s",
+                          schema, archive_tables[i]);
+  }
+
+  sqlite3_finalize(statement);
+
+  if(code != SQLITE_DONE)
+  {
+   fprintf(stderr, "%s: create_archive_views(): sqlite3_step() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   free(sql);
+   return 1;
+  }
+
+  snprintf(sql + sql_length, ARCHIVE_SQL_SIZE - sql_length, ";");
+
+  if(sqlite3_exec(ctx->db_ctx, sql, NULL, NULL, &errmsg) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: create_archive_views(): could not create all_%s, '%s'\n",
+           ctx->error_prefix, archive_tables[i], errmsg);
+   sqlite3_free(errmsg);
+   free(sql);
+   return 1;
+  }
+ }
+
+ free(sql);
+ return 0;
+}
+
+int archives_table_exists(struct buildmatrix_context *ctx, int *exists)
+{
+ char *sql;
+ struct sqlite3_stmt *statement = NULL;
+
+ sql = "SELECT COUNT(*) FROM main.sqlite_master WHERE type = 'table' AND name = 'archives';";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: archives_table_exists(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(sqlite3_step(statement) != SQLITE_ROW)
+ {
+  fprintf(stderr, "%s: archives_table_exists(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ *exists = sqlite3_column_int(statement, 0);
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+int archive_views_exist(struct buildmatrix_context *ctx, int *exists)
+{
+ char *sql;
+ struct sqlite3_stmt *statement = NULL;
+
+ sql = "SELECT COUNT(*) FROM temp.sqlite_master WHERE type = 'view' AND name = 'all_builds';";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: archive_views_exist(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(sqlite3_step(statement) != SQLITE_ROW)
+ {
+  fprintf(stderr, "%s: archive_views_exist(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ *exists = sqlite3_column_int(statement, 0);
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+int attach_archive_file(struct buildmatrix_context *ctx, const char *filename, const char *schema)
+{
+ char path[4096], sql[128];
+ struct sqlite3_stmt *statement = NULL;
+
+ if(ctx->verbose)
+  fprintf(stderr, "%s: attaching %s as %s\n", ctx->error_prefix, filename, schema);
+
+ snprintf(path, 4096, "%s/%s", ctx->local_project_directory, filename);
+ snprintf(sql, 128, "ATTACH DATABASE ? AS %s;", schema);
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: attach_archive_file(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(sqlite3_bind_text(statement, 1, path, strlen(path), SQLITE_TRANSIENT) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: attach_archive_file(): sqlite3_bind_text() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ if(sqlite3_step(statement) != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: attach_archive_file(): could not attach %s, '%s'\n",
+          ctx->error_prefix, path, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+/* Projects from before build ids were AUTOINCREMENT handed build 1 out again once every build
+   had been archived, so an archive can hold ids that main.builds reuses. Reading such an
+   archive through the all_* views would mix the two builds' scores and parameters. Build
+   times don't follow build ids, so id ranges can legitimately interleave; only ids present
+   in both count. The range test keeps this to index lookups for the usual disjoint case. */
+int archive_collision(struct buildmatrix_context *ctx, const char *schema, int *build_id)
+{
+ char sql[512];
+ struct sqlite3_stmt *statement = NULL;
+ int code;
+
+ *build_id = 0;
+
+ snprintf(sql, 512, "SELECT m.build_id FROM main.builds AS m "
+          "WHERE m.build_id BETWEEN (SELECT MIN(build_id) FROM %s.builds) "
+          "AND (SELECT MAX(build_id) FROM %s.builds) "
+          "AND m.build_id IN (SELECT build_id FROM %s.builds) LIMIT 1;",
+          schema, schema, schema);
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: archive_collision(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if((code = sqlite3_step(statement)) == SQLITE_ROW)
+  *build_id = sqlite3_column_int(statement, 0);
+
+ sqlite3_finalize(statement);
+
+ if( (code != SQLITE_ROW) && (code != SQLITE_DONE) )
+ {
+  fprintf(stderr, "%s: archive_collision(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ return 0;
+}
+
+/* how many more archives can be attached, keeping one back for find_archived_build() and
+   archive_period() */
+int archive_slots(struct buildmatrix_context *ctx, int *n_slots)
+{
+ char *sql;
+ struct sqlite3_stmt *statement = NULL;
+
+ sql = "SELECT COUNT(*) FROM pragma_database_list WHERE name NOT IN ('main', 'temp');";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: archive_slots(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(sqlite3_step(statement) != SQLITE_ROW)
+ {
+  fprintf(stderr, "%s: archive_slots(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ *n_slots = sqlite3_limit(ctx->db_ctx, SQLITE_LIMIT_ATTACHED, -1) -
+            sqlite3_column_int(statement, 0) - 1;
+ if(*n_slots < 0)
+  *n_slots = 0;
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+/* Makes room for attach_archives() by detaching the archives a previous call attached that
+   don't overlap the range now asked for. The all_* views are left for the caller to rebuild. */
+int detach_archives_outside(struct buildmatrix_context *ctx, long long int since_time,
+                            long long int until_time, int first_build_id, int last_build_id)
+{
+ char *sql, detach_sql[128], **schemas = NULL;
+ int code, i, n_schemas = 0, failed = 0;
+ struct sqlite3_stmt *statement = NULL;
+
+ sql = "SELECT name FROM pragma_database_list WHERE name LIKE 'archive\\_%' ESCAPE '\\' "
+       "AND CAST(substr(name, 9) AS INTEGER) NOT IN (SELECT archive_id FROM main.archives "
+       "WHERE (?1 = 0 OR last_time >= ?1) AND (?2 = 0 OR first_time < ?2) AND "
+       "(?3 = 0 OR last_build_id >= ?3) AND (?4 = 0 OR first_build_id <= ?4));";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: detach_archives_outside(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if( (sqlite3_bind_int64(statement, 1, since_time) != SQLITE_OK) ||
+     (sqlite3_bind_int64(statement, 2, until_time) != SQLITE_OK) ||
+     (sqlite3_bind_int(statement, 3, first_build_id) != SQLITE_OK) ||
+     (sqlite3_bind_int(statement, 4, last_build_id) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: detach_archives_outside(): sqlite3_bind() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ /* DETACH can't run while the select is still stepping */
+ while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ {
+  if(add_to_string_array(&schemas, n_schemas,
+                         (const char *) sqlite3_column_text(statement, 0), -1, 0) != 0)
+  {
+   failed = 1;
+   break;
+  }
+  n_schemas++;
+ }
+
+ if( (failed == 0) && (code != SQLITE_DONE) )
+ {
+  fprintf(stderr, "%s: detach_archives_outside(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  failed = 1;
+ }
+
+ sqlite3_finalize(statement);
+
+ for(i=0; (failed == 0) && (i<n_schemas); i++)
+ {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: detaching %s\n", ctx->error_prefix, schemas[i]);
+
+  snprintf(detach_sql, 128, "DETACH DATABASE %s;", schemas[i]);
+  if(sqlite3_exec(ctx->db_ctx, detach_sql, NULL, NULL, NULL) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: detach_archives_outside(): could not detach %s, '%s'\n",
+           ctx->error_prefix, schemas[i], sqlite3_errmsg(ctx->db_ctx));
+   failed = 1;
+  }
+ }
+
+ if(n_schemas > 0)
+  free_string_array(schemas, n_schemas);
+
+ return failed;
+}
+
+/* Attaches the archives overlapping the given time and build_id ranges (0 for open ended)
+   and points the all_* views at them. Archives already attached stay attached. */
+int attach_archives(struct buildmatrix_context *ctx, long long int since_time,
+                    long long int until_time, int first_build_id, int last_build_id)
+{
+ char *sql, schema[64], **schemas = NULL, **filenames = NULL;
+ int exists, code, i, n_archives = 0, n_slots, collision, failed = 0;
+ struct sqlite3_stmt *statement = NULL;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: attach_archives(%lld, %lld, %d, %d)\n", ctx->error_prefix,
+          since_time, until_time, first_build_id, last_build_id);
+
+ if(archives_table_exists(ctx, &exists))
+  return 1;
+
+ if(exists == 0)
+ {
+  if(archive_views_exist(ctx, &exists))
+   return 1;
+
+  if(exists)
+   return 0;
+
+  return create_archive_views(ctx);
+ }
+
+ sql = "SELECT archive_id, filename FROM main.archives "
+       "WHERE (?1 = 0 OR last_time >= ?1) AND (?2 = 0 OR first_time < ?2) AND "
+       "(?3 = 0 OR last_build_id >= ?3) AND (?4 = 0 OR first_build_id <= ?4) "
+       "AND archive_id NOT IN (SELECT CAST(substr(name, 9) AS INTEGER) FROM pragma_database_list "
+                              "WHERE name LIKE 'archive\\_%' ESCAPE '\\') "
+       "ORDER BY CASE WHEN ?3 > 0 AND ?4 = 0 THEN first_build_id ELSE -last_time END;";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: attach_archives(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if( (sqlite3_bind_int64(statement, 1, since_time) != SQLITE_OK) ||
+     (sqlite3_bind_int64(statement, 2, until_time) != SQLITE_OK) ||
+     (sqlite3_bind_int(statement, 3, first_build_id) != SQLITE_OK) ||
+     (sqlite3_bind_int(statement, 4, last_build_id) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: attach_archives(): sqlite3_bind() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ /* ATTACH can't run while the select is still stepping */
+ while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ {
+  if(sqlite3_column_type(statement, 1) != SQLITE_TEXT)
+  {
+   fprintf(stderr, "%s: attach_archives(): archives.filename is not text\n",
+           ctx->error_prefix);
+   sqlite3_finalize(statement);
+   if(n_archives > 0)
+   {
+    free_string_array(schemas, n_archives);
+    free_string_array(filenames, n_archives);
+   }
+   return 1;
+  }
+
+  snprintf(schema, 64, "archive_%d", sqlite3_column_int(statement, 0));
+
+  if( (add_to_string_array(&schemas, n_archives, schema, -1, 0) != 0) ||
+      (add_to_string_array(&filenames, n_archives,
+                           (const char *) sqlite3_column_text(statement, 1), -1, 0) != 0) )
+  {
+   sqlite3_finalize(statement);
+   return 1;
+  }
+  n_archives++;
+ }
+
+ sqlite3_finalize(statement);
+
+ if(code != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: attach_archives(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  failed = 1;
+ }
+
+ if( (failed == 0) && (archive_slots(ctx, &n_slots)) )
+  failed = 1;
+
+ if( (failed == 0) && (n_archives > n_slots) )
+ {
+  if( (detach_archives_outside(ctx, since_time, until_time, first_build_id, last_build_id)) ||
+      (archive_slots(ctx, &n_slots)) )
+   failed = 1;
+ }
+
+ /* Past SQLite's limit on attached databases, an open ended build_id range (a pull walking
+    forward) keeps the archives nearest its start and reaches the rest on later calls. Any
+    other range keeps the newest archives, and says so. */
+ if( (failed == 0) && (n_archives > n_slots) )
+ {
+  if( (first_build_id > 0) && (last_build_id == 0) )
+  {
+   if(ctx->verbose)
+    fprintf(stderr, "%s: attaching %d of %d archives past build %d\n", ctx->error_prefix,
+            n_slots, n_archives, first_build_id);
+  } else {
+   fprintf(stderr, "%s: %d archives overlap the range asked for, but only %d more can be "
+           "attached, so the oldest are left out. Try narrowing it with --since and --until.\n",
+           ctx->error_prefix, n_archives, n_slots);
+  }
+ }
+
+ for(i=0; (failed == 0) && (i<n_archives) && (i<n_slots); i++)
+ {
+  if( (attach_archive_file(ctx, filenames[i], schemas[i])) ||
+      (archive_collision(ctx, schemas[i], &collision)) )
+  {
+   failed = 1;
+   break;
+  }
+
+  if(collision > 0)
+  {
+   fprintf(stderr, "%s: leaving out %s, build %d is in both it and the main database\n",
+           ctx->error_prefix, filenames[i], collision);
+   snprintf(schema, 64, "DETACH DATABASE %s;", schemas[i]);
+   if(sqlite3_exec(ctx->db_ctx, schema, NULL, NULL, NULL) != SQLITE_OK)
+   {
+    fprintf(stderr, "%s: attach_archives(): could not detach %s, '%s'\n",
+            ctx->error_prefix, schemas[i], sqlite3_errmsg(ctx->db_ctx));
+    failed = 1;
+   }
+  }
+ }
+
+ if(n_archives > 0)
+ {
+  free_string_array(schemas, n_archives);
+  free_string_array(filenames, n_archives);
+ }
+
+ if(failed)
+  return 1;
+
+ /* nothing new attached, the views from last time still cover everything */
+ if(n_archives == 0)
+ {
+  if(archive_views_exist(ctx, &exists))
+   return 1;
+
+  if(exists)
+   return 0;
+ }
+
+ return create_archive_views(ctx);
+}
+
+/* A unique identifier says nothing about which archive holds the build, so each one is
+   searched in turn, newest first, attaching it only for as long as that takes. This keeps a
+   lookup within the attach limit no matter how many archives there are. */
+int find_archived_build(struct buildmatrix_context *ctx, const char *unique_identifier,
+                        int *build_id)
+{
+ char *sql, search_sql[256], schema[64], **schemas = NULL, **filenames = NULL;
+ int exists, code, i, n_archives = 0, attached, collision, failed = 0;
+ struct sqlite3_stmt *statement = NULL;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: find_archived_build(%s)\n", ctx->error_prefix, unique_identifier);
+
+ *build_id = -1;
+
+ if(archives_table_exists(ctx, &exists))
+  return 1;
+
+ if(exists == 0)
+  return 0;
+
+ sql = "SELECT archive_id, filename, archive_id IN "
+       "(SELECT CAST(substr(name, 9) AS INTEGER) FROM pragma_database_list "
+       "WHERE name LIKE 'archive\\_%' ESCAPE '\\') "
+       "FROM main.archives ORDER BY last_time DESC;";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: find_archived_build(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ /* ATTACH can't run while the select is still stepping. An archive that is already attached
+    is remembered by an empty filename. */
+ while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ {
+  if(sqlite3_column_type(statement, 1) != SQLITE_TEXT)
+  {
+   fprintf(stderr, "%s: find_archived_build(): archives.filename is not text\n",
+           ctx->error_prefix);
+   failed = 1;
+   break;
+  }
+
+  snprintf(schema, 64, "archive_%d", sqlite3_column_int(statement, 0));
+
+  if( (add_to_string_array(&schemas, n_archives, schema, -1, 0) != 0) ||
+      (add_to_string_array(&filenames, n_archives,
+                           sqlite3_column_int(statement, 2) ? "" :
+                           (const char *) sqlite3_column_text(statement, 1), -1, 0) != 0) )
+  {
+   failed = 1;
+   break;
+  }
+  n_archives++;
+ }
+
+ if( (failed == 0) && (code != SQLITE_DONE) )
+ {
+  fprintf(stderr, "%s: find_archived_build(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  failed = 1;
+ }
+
+ sqlite3_finalize(statement);
+ statement = NULL;
+
+ for(i=0; (failed == 0) && (*build_id < 1) && (i<n_archives); i++)
+ {
+  attached = filenames[i][0] == 0;
+
+  if( (attached == 0) && (attach_archive_file(ctx, filenames[i], schemas[i])) )
+  {
+   failed = 1;
+   break;
+  }
+
+  /* attach_archives() leaves such an archive out, so a build found there couldn't be read */
+  if(archive_collision(ctx, schemas[i], &collision))
+  {
+   failed = 1;
+  } else if(collision > 0) {
+   if(ctx->verbose)
+    fprintf(stderr, "%s: not searching %s, build %d is in both it and the main database\n",
+            ctx->error_prefix, schemas[i], collision);
+  } else {
+   snprintf(search_sql, 256, "SELECT build_id FROM %s.builds WHERE unique_identifier = ?;",
+            schemas[i]);
+
+   if( (sqlite3_prepare_v2(ctx->db_ctx, search_sql, -1, &statement, NULL) != SQLITE_OK) ||
+       (sqlite3_bind_text(statement, 1, unique_identifier, strlen(unique_identifier),
+                          SQLITE_TRANSIENT) != SQLITE_OK) )
+   {
+    fprintf(stderr, "%s: find_archived_build(): could not search %s, '%s'\n",
+            ctx->error_prefix, schemas[i], sqlite3_errmsg(ctx->db_ctx));
+    failed = 1;
+   } else if((code = sqlite3_step(statement)) == SQLITE_ROW) {
+    if(ctx->verbose)
+     fprintf(stderr, "%s: build %s is in %s\n", ctx->error_prefix, unique_identifier,
+             filenames[i][0] == 0 ? schemas[i] : filenames[i]);
+    *build_id = sqlite3_column_int(statement, 0);
+   } else if(code != SQLITE_DONE) {
+    fprintf(stderr, "%s: find_archived_build(): sqlite3_step() failed, '%s'\n",
+            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+    failed = 1;
+   }
+
+   sqlite3_finalize(statement);
+   statement = NULL;
+  }
+
+  /* whoever wants the build attaches its archive again through attach_archives() */
+  if(attached == 0)
+  {
+   snprintf(search_sql, 256, "DETACH DATABASE %s;", schemas[i]);
+   if(sqlite3_exec(ctx->db_ctx, search_sql, NULL, NULL, NULL) != SQLITE_OK)
+   {
+    fprintf(stderr, "%s: find_archived_build(): could not detach %s, '%s'\n",
+            ctx->error_prefix, schemas[i], sqlite3_errmsg(ctx->db_ctx));
+    failed = 1;
+   }
+  }
+ }
+
+ if(n_archives > 0)
+ {
+  free_string_array(schemas, n_archives);
+  free_string_array(filenames, n_archives);
+ }
+
+ return failed;
+}
+
+/* Build ids have to stay unique across the main database and every archive, so builds is
+   AUTOINCREMENT. Projects created before that handed out MAX(build_id) + 1, which starts over
+   once everything is archived. Their builds table is rebuilt once with AUTOINCREMENT, and the
+   sequence is started past the last archived build. */
+int upgrade_build_id_sequence(struct buildmatrix_context *ctx)
+{
+ char *sql, *errmsg, *ddl = NULL, **index_sql = NULL;
+ const char *key;
+ int code, i, n_indexes = 0, exists, failed = 0;
+ size_t allocation_size;
+ struct sqlite3_stmt *statement = NULL;
+
+ sql = "SELECT type, sql FROM main.sqlite_master WHERE tbl_name = 'builds' AND sql IS NOT NULL "
+       "ORDER BY type = 'index';";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: upgrade_build_id_sequence(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ {
+  if(strcmp((const char *) sqlite3_column_text(statement, 0), "table") == 0)
+  {
+   /* the usual case, nothing to do */
+   if(strstr((const char *) sqlite3_column_text(statement, 1), "AUTOINCREMENT") != NULL)
+    break;
+
+   key = strstr((const char *) sqlite3_column_text(statement, 1), "build_id INTEGER PRIMARY KEY");
+   if( (key == NULL) || (ddl != NULL) )
+   {
+    fprintf(stderr, "%s: upgrade_build_id_sequence(): unexpected builds table definition\n",
+            ctx->error_prefix);
+    failed = 1;
+    break;
+   }
+
+   /* CREATE TABLE main.builds_upgrade (... build_id INTEGER PRIMARY KEY AUTOINCREMENT ...) */
+   key += 28;
+   allocation_size = strlen((const char *) sqlite3_column_text(statement, 1)) + 64;
+   if((ddl = malloc(allocation_size)) == NULL)
+   {
+    fprintf(stderr, "%s: upgrade_build_id_sequence(): malloc(%d) failed\n",
+            ctx->error_prefix, (int) allocation_size);
+    failed = 1;
+    break;
+   }
+   snprintf(ddl, allocation_size, "CREATE TABLE main.builds_upgrade %.*s AUTOINCREMENT%s;",
+            (int) (key - strchr((const char *) sqlite3_column_text(statement, 1), '(')),
+            strchr((const char *) sqlite3_column_text(statement, 1), '('), key);
+  } else {
+   if(add_to_string_array(&index_sql, n_indexes,
+                          (const char *) sqlite3_column_text(statement, 1), -1, 0) != 0)
+   {
+    failed = 1;
+    break;
+   }
+   n_indexes++;
+  }
+ }
+
+ if( (failed == 0) && (code != SQLITE_ROW) && (code != SQLITE_DONE) )
+ {
+  fprintf(stderr, "%s: upgrade_build_id_sequence(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  failed = 1;
+ }
+
+ sqlite3_finalize(statement);
+
+ if( (failed == 0) && (ddl != NULL) )
+ {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: making builds.build_id AUTOINCREMENT\n", ctx->error_prefix);
+
+  if(archives_table_exists(ctx, &exists))
+   failed = 2;
+
+  /* the all_* views name main.builds, and would stop the rename below */
+  if( (failed == 0) &&
+      (sqlite3_exec(ctx->db_ctx, "DROP VIEW IF EXISTS temp.all_builds; "
+                    "DROP VIEW IF EXISTS temp.all_scores; DROP VIEW IF EXISTS temp.all_parameters; "
+                    "BEGIN IMMEDIATE TRANSACTION;", NULL, NULL, &errmsg) != SQLITE_OK) )
+  {
+   fprintf(stderr, "%s: upgrade_build_id_sequence(): could not start, '%s'\n",
+           ctx->error_prefix, errmsg);
+   sqlite3_free(errmsg);
+   failed = 2;
+  }
+
+  if( (failed == 0) &&
+      ((sqlite3_exec(ctx->db_ctx, ddl, NULL, NULL, &errmsg) != SQLITE_OK) ||
+       (sqlite3_exec(ctx->db_ctx, "INSERT INTO main.builds_upgrade SELECT * FROM main.builds; "
+                     "DROP TABLE main.builds; "
+                     "ALTER TABLE main.builds_upgrade RENAME TO builds; "
+                     "DELETE FROM main.sqlite_sequence WHERE name = 'builds';",
+                     NULL, NULL, &errmsg) != SQLITE_OK)) )
+   failed = 1;
+
+  for(i=0; (failed == 0) && (i<n_indexes); i++)
+  {
+   if(sqlite3_exec(ctx->db_ctx, index_sql[i], NULL, NULL, &errmsg) != SQLITE_OK)
+    failed = 1;
+  }
+
+  if(failed == 0)
+  {
+   if(exists)
+    sql = "INSERT INTO main.sqlite_sequence (name, seq) SELECT 'builds', IFNULL(MAX(id), 0) "
+          "FROM (SELECT MAX(build_id) AS id FROM main.builds "
+          "UNION ALL SELECT MAX(last_build_id) FROM main.archives);";
+   else
+    sql = "INSERT INTO main.sqlite_sequence (name, seq) "
+          "SELECT 'builds', IFNULL(MAX(build_id), 0) FROM main.builds;";
+
+   if(sqlite3_exec(ctx->db_ctx, sql, NULL, NULL, &errmsg) != SQLITE_OK)
+    failed = 1;
+  }
+
+  if(failed == 1)
+  {
+   fprintf(stderr, "%s: upgrade_build_id_sequence(): could not rebuild builds, '%s'\n",
+           ctx->error_prefix, errmsg);
+   sqlite3_free(errmsg);
+   sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+  } else if(failed == 0) {
+   if(sqlite3_exec(ctx->db_ctx, "COMMIT TRANSACTION;", NULL, NULL, &errmsg) != SQLITE_OK)
+   {
+    fprintf(stderr, "%s: upgrade_build_id_sequence(): sqlite3_exec(\"COMMIT TRANSACTION;\"): '%s'\n",
+            ctx->error_prefix, errmsg);
+    sqlite3_free(errmsg);
+    sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+    failed = 1;
+   }
+  }
+ }
+
+ if(ddl != NULL)
+  free(ddl);
+
+ if(n_indexes > 0)
+  free_string_array(index_sql, n_indexes);
+
+ return failed != 0;
+}
+
+/* makes schema.table look like main.table, adding whatever columns main has grown since */
+int prepare_archive_table(struct buildmatrix_context *ctx, const char *schema, const char *table)
+{
+ char **names, **types, **archive_names, **archive_types, sql[4096], *errmsg;
+ const char *ddl;
+ int n_columns, n_archive_columns, i, failed = 0;
+ struct sqlite3_stmt *statement = NULL;
+
+ if(table_columns(ctx, schema, table, &archive_names, &archive_types, &n_archive_columns))
+  return 1;
+
+ if(n_archive_columns == 0)
+ {
+  /* new archive file, borrow the table definition from the main database */
+  snprintf(sql, 4096, "SELECT sql FROM main.sqlite_master WHERE type = 'table' AND name = '%s';",
+           table);
+
+  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: prepare_archive_table(): sqlite3_prepare(%s) failed, '%s'\n",
+           ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+   return 1;
+  }
+
+  if( (sqlite3_step(statement) != SQLITE_ROW) ||
+      (sqlite3_column_type(statement, 0) != SQLITE_TEXT) ||
+      (strncmp((ddl = (const char *) sqlite3_column_text(statement, 0)), "CREATE TABLE ", 13) != 0) )
+  {
+   fprintf(stderr, "%s: prepare_archive_table(): no usable definition for %s\n",
+           ctx->error_prefix, table);
+   sqlite3_finalize(statement);
+   return 1;
+  }
+
+  if(strcmp(table, "builds") == 0)
+   snprintf(sql, 4096, "CREATE TABLE %s.%s;", schema, ddl + 13);
+  else
+   snprintf(sql, 4096, "CREATE TABLE %s.%s; CREATE INDEX %s.%s_build_id ON %s (build_id);",
+            schema, ddl + 13, schema, table, table);
+  sqlite3_finalize(statement);
+
+  if(sqlite3_exec(ctx->db_ctx, sql, NULL, NULL, &errmsg) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: prepare_archive_table(): could not create %s.%s, '%s'\n",
+           ctx->error_prefix, schema, table, errmsg);
+   sqlite3_free(errmsg);
+   return 1;
+  }
+
+  return 0;
+ }
+
+ if(table_columns(ctx, "main", table, &names, &types, &n_columns))
+ {
+  free_string_array(archive_names, n_archive_columns);
+  free_string_array(archive_types, n_archive_columns);
+  return 1;
+ }
+
+ for(i=0; i<n_columns; i++)
+ {
+  if(has_column(archive_names, n_archive_columns, names[i]))
+   continue;
+
+  snprintf(sql, 4096, "ALTER TABLE %s.%s ADD COLUMN %s %s;", schema, table, names[i], types[i]);
+
+  if(sqlite3_exec(ctx->db_ctx, sql, NULL, NULL, &errmsg) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: prepare_archive_table(): %s failed, '%s'\n",
+           ctx->error_prefix, sql, errmsg);
+   sqlite3_free(errmsg);
+   failed = 1;
+   break;
+  }
+ }
+
+ free_string_array(names, n_columns);
+ free_string_array(types, n_columns);
+ free_string_array(archive_names, n_archive_columns);
+ free_string_array(archive_types, n_archive_columns);
+ return failed;
+}
+
+int archive_period(struct buildmatrix_context *ctx, const char *period, const char *format,
+                   long long int cutoff, int *n_archived)
+{
+ char filename[256], *sql, *errmsg, **names, **types;
+ int i, j, n_columns, sql_length, collision = 0;
+ struct sqlite3_stmt *statement = NULL;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: archive_period(%s)\n", ctx->error_prefix, period);
+
+ *n_archived = 0;
+
+ snprintf(filename, 256, "buildmatrix-%s.sqlite3", period);
+
+ if(attach_archive_file(ctx, filename, "archive_target"))
+  return 1;
+
+ if((sql = malloc(ARCHIVE_SQL_SIZE)) == NULL)
+ {
+  fprintf(stderr, "%s: archive_period(): malloc(%d) failed\n",
+          ctx->error_prefix, ARCHIVE_SQL_SIZE);
+  sqlite3_exec(ctx->db_ctx, "DETACH DATABASE archive_target;", NULL, NULL, NULL);
+  return 1;
+ }
+
+ for(i=0; archive_tables[i] != NULL; i++)
+ {
+  if(prepare_archive_table(ctx, "archive_target", archive_tables[i]))
+  {
+   free(sql);
+   sqlite3_exec(ctx->db_ctx, "DETACH DATABASE archive_target;", NULL, NULL, NULL);
+   return 1;
+  }
+ }
+
+ /* adding to an archive readers already leave out would only hide more builds */
+ if( (archive_collision(ctx, "archive_target", &collision)) || (collision > 0) )
+ {
+  if(collision > 0)
+   fprintf(stderr, "%s: archive_period(): refusing to archive into %s, build %d is in both "
+           "it and the main database\n", ctx->error_prefix, filename, collision);
+  free(sql);
+  sqlite3_exec(ctx->db_ctx, "DETACH DATABASE archive_target;", NULL, NULL, NULL);
+  return 1;
+ }
+
+ if(sqlite3_exec(ctx->db_ctx, "BEGIN IMMEDIATE TRANSACTION; DELETE FROM build_set;",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: archive_period(): sqlite3_exec(\"BEGIN TRANSACTION;\"): '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  free(sql);
+  sqlite3_exec(ctx->db_ctx, "DETACH DATABASE archive_target;", NULL, NULL, NULL);
+  return 1;
+ }
+
+ snprintf(sql, ARCHIVE_SQL_SIZE, "INSERT INTO build_set SELECT build_id FROM main.builds "
+          "WHERE build_time < ? AND strftime('%s', build_time, 'unixepoch') = ?;", format);
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: archive_period(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  free(sql);
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION; DETACH DATABASE archive_target;",
+               NULL, NULL, NULL);
+  return 1;
+ }
+
+ if( (sqlite3_bind_int64(statement, 1, cutoff) != SQLITE_OK) ||
+     (sqlite3_bind_text(statement, 2, period, strlen(period), SQLITE_TRANSIENT) != SQLITE_OK) ||
+     (sqlite3_step(statement) != SQLITE_DONE) )
+ {
+  fprintf(stderr, "%s: archive_period(): could not select builds, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  free(sql);
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION; DETACH DATABASE archive_target;",
+               NULL, NULL, NULL);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+ *n_archived = sqlite3_changes(ctx->db_ctx);
+
+ /* test_history only covers builds that stay in the main database */
+ if(forget_test_history(ctx))
+ {
+  free(sql);
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION; DETACH DATABASE archive_target;",
+               NULL, NULL, NULL);
+  return 1;
+ }
+
+ /* explicit column lists, columns in an older archive file may be in a different order */
+ for(i=0; archive_tables[i] != NULL; i++)
+ {
+  if(table_columns(ctx, "main", archive_tables[i], &names, &types, &n_columns))
+  {
+   free(sql);
+   sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION; DETACH DATABASE archive_target;",
+                NULL, NULL, NULL);
+   return 1;
+  }
+
+  sql_length = snprintf(sql, ARCHIVE_SQL_SIZE, "INSERT INTO archive_target.%s (",
+                        archive_tables[i]);
+  for(j=0; j<n_columns; j++)
+   sql_length += snprintf(sql + sql_length, ARCHIVE_SQL_SIZE - sql_length, "%s%s",
+                          j == 0 ? "" : ", ", names[j]);
+  sql_length += snprintf(sql + sql_length, ARCHIVE_SQL_SIZE - sql_length, ") SELECT ");
+  for(j=0; j<n_columns; j++)
+   sql_length += snprintf(sql + sql_length, ARCHIVE_SQL_SIZE - sql_length, "%s%s",
+                          j == 0 ? "" : ", ", names[j]);
+  snprintf(sql + sql_length, ARCHIVE_SQL_SIZE - sql_length,
+           " FROM main.%s WHERE build_id IN (SELECT build_id FROM build_set); "
+           "DELETE FROM main.%s WHERE build_id IN (SELECT build_id FROM build_set);",
+           archive_tables[i], archive_tables[i]);
+
+  free_string_array(names, n_columns);
+  free_string_array(types, n_columns);
+
+  if(sqlite3_exec(ctx->db_ctx, sql, NULL, NULL, &errmsg) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: archive_period(): could not move %s, '%s'\n",
+           ctx->error_prefix, archive_tables[i], errmsg);
+   sqlite3_free(errmsg);
+   free(sql);
+   sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION; DETACH DATABASE archive_target;",
+                NULL, NULL, NULL);
+   return 1;
+  }
+ }
+
+ free(sql);
+
+ sql = "INSERT OR REPLACE INTO main.archives "
+       "(archive_id, period, filename, first_build_id, last_build_id, first_time, last_time) "
+       "SELECT (SELECT archive_id FROM main.archives WHERE period = ?1), ?1, ?2, "
+       "MIN(build_id), MAX(build_id), MIN(build_time), MAX(build_time) "
+       "FROM archive_target.builds;";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: archive_period(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION; DETACH DATABASE archive_target;",
+               NULL, NULL, NULL);
+  return 1;
+ }
+
+ if( (sqlite3_bind_text(statement, 1, period, strlen(period), SQLITE_TRANSIENT) != SQLITE_OK) ||
+     (sqlite3_bind_text(statement, 2, filename, strlen(filename), SQLITE_TRANSIENT) != SQLITE_OK) ||
+     (sqlite3_step(statement) != SQLITE_DONE) )
+ {
+  fprintf(stderr, "%s: archive_period(): could not update archives, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION; DETACH DATABASE archive_target;",
+               NULL, NULL, NULL);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+
+ /* the builds moved, so lists cached from the old layout are stale */
+ if(bump_change_counter(ctx, "builds"))
+ {
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION; DETACH DATABASE archive_target;",
+               NULL, NULL, NULL);
+  return 1;
+ }
+
+ if(sqlite3_exec(ctx->db_ctx, "COMMIT TRANSACTION;", NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: archive_period(): sqlite3_exec(\"COMMIT TRANSACTION;\"): '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION; DETACH DATABASE archive_target;",
+               NULL, NULL, NULL);
+  return 1;
+ }
+
+ if(sqlite3_exec(ctx->db_ctx, "DETACH DATABASE archive_target;", NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: archive_period(): could not detach %s, '%s'\n",
+          ctx->error_prefix, filename, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ if(ctx->verbose)
+  fprintf(stderr, "%s: moved %d builds to %s\n", ctx->error_prefix, *n_archived, filename);
+
+ return 0;
+}
+
+int archive(struct buildmatrix_context *ctx)
+{
+ char *value, *format = "%Y", *sql, *errmsg, **periods = NULL;
+ int age = 0, n_periods = 0, code, i, n_archived, total = 0;
+ long long int cutoff;
+ struct sqlite3_stmt *statement = NULL;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: archive()\n", ctx->error_prefix);
+
+ if(open_database(ctx))
+  return 1;
+
+ if((value = resolve_configuration_value(ctx, "archiveage")) != NULL)
+ {
+  sscanf(value, "%d", &age);
+  free(value);
+ }
+
+ if(age < 1)
+ {
+  if(ctx->quiet == 0)
+   fprintf(stderr, "%s: archiveage is not set to a number of days, nothing to do\n",
+           ctx->error_prefix);
+  close_database(ctx);
+  return 0;
+ }
+
+ if((value = resolve_configuration_value(ctx, "archiveperiod")) != NULL)
+ {
+  if(strcmp(value, "month") == 0)
+  {
+   format = "%Y-%m";
+  } else if(strcmp(value, "year") != 0) {
+   fprintf(stderr, "%s: archiveperiod should be \"year\" or \"month\", not \"%s\"\n",
+           ctx->error_prefix, value);
+   free(value);
+   close_database(ctx);
+   return 1;
+  }
+  free(value);
+ }
+
+ cutoff = (long long int) time(NULL) - age * 86400LL;
+
+ if(sqlite3_exec(ctx->db_ctx,
+                 "CREATE TABLE IF NOT EXISTS main.archives (archive_id INTEGER PRIMARY KEY, "
+                 "period TEXT, filename TEXT, first_build_id INTEGER, last_build_id INTEGER, "
+                 "first_time INTEGER, last_time INTEGER, UNIQUE (period)); "
+                 "CREATE TEMP TABLE IF NOT EXISTS build_set (build_id INTEGER PRIMARY KEY);",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: archive(): could not create archives table, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  close_database(ctx);
+  return 1;
+ }
+
+ if(format[2] == '-')
+  sql = "SELECT DISTINCT strftime('%Y-%m', build_time, 'unixepoch') FROM main.builds "
+        "WHERE build_time < ? ORDER BY 1;";
+ else
+  sql = "SELECT DISTINCT strftime('%Y', build_time, 'unixepoch') FROM main.builds "
+        "WHERE build_time < ? ORDER BY 1;";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: archive(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  close_database(ctx);
+  return 1;
+ }
+
+ if(sqlite3_bind_int64(statement, 1, cutoff) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: archive(): sqlite3_bind_int64() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  close_database(ctx);
+  return 1;
+ }
+
+ while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ {
+  if(sqlite3_column_type(statement, 0) != SQLITE_TEXT)
+   continue;
+
+  if(add_to_string_array(&periods, n_periods,
+                         (const char *) sqlite3_column_text(statement, 0), -1, 0) != 0)
+  {
+   sqlite3_finalize(statement);
+   close_database(ctx);
+   return 1;
+  }
+  n_periods++;
+ }
+
+ sqlite3_finalize(statement);
+
+ if(code != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: archive(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  if(n_periods > 0)
+   free_string_array(periods, n_periods);
+  close_database(ctx);
+  return 1;
+ }
+
+ for(i=0; i<n_periods; i++)
+ {
+  if(archive_period(ctx, periods[i], format, cutoff, &n_archived))
+  {
+   fprintf(stderr, "%s: archive(): stopped at %s after %d builds\n",
+           ctx->error_prefix, periods[i], total);
+   free_string_array(periods, n_periods);
+   close_database(ctx);
+   return 1;
+  }
+  total += n_archived;
+ }
+
+ if(n_periods > 0)
+  free_string_array(periods, n_periods);
+
+ /* same idea as prune, hand the freed pages back if the database allows it */
+ sqlite3_exec(ctx->db_ctx, "PRAGMA main.incremental_vacuum;", NULL, NULL, NULL);
+
+ if(ctx->quiet == 0)
+  printf("Archived %d builds into %d archive files.\n", total, n_periods);
+
+ close_database(ctx);
+ return 0;
+}
@@ -27,7 +27,7 @@ int start_server(struct buildmatrix_context *ctx)
  int server_input[2];
  int server_output[2];
  int n_bytes, i;
- char buffer[64];
+ char buffer[256], *codecs;
  char *remote_project_directory = NULL, *remote_bin_path = NULL;
 
  if(ctx->verbose > 1)
@@ -203,10 +203,11 @@ int start_server(struct buildmatrix_context *ctx)
  if(ctx->verbose)
   fprintf(stderr, "%s: initializing dialog with server\n", ctx->error_prefix);
 
- if(send_line(ctx, 24, "build matrix initialize\n"))
+ /* offer to take compressed artifacts as is, older servers ignore the suffix */
+ if(send_line(ctx, 29, "build matrix initialize|gzip\n"))
   return 1;
 
- if(receive_line(ctx, 64, &n_bytes, buffer))
+ if(receive_line(ctx, 256, &n_bytes, buffer))
   return 1;
 
  if(n_bytes == 0)
@@ -219,6 +220,14 @@ int start_server(struct buildmatrix_context *ctx)
 
  if( (n_bytes > 23) && (strncmp(buffer, "connection initialized|", 23) == 0) )
  {
+  ctx->peer_codecs = 0;
+  if((codecs = strchr(buffer + 23, '|')) != NULL)
+  {
+   *codecs = 0;
+   if(strcmp(codecs + 1, "gzip") == 0)
+    ctx->peer_codecs |= 1 << BLDMTRX_CODEC_GZIP;
+  }
+
   if((ctx->project_name = strdup(buffer + 23)) == NULL)
   {
    fprintf(stderr, "%s: strdup() failed, %s\n", ctx->error_prefix, strerror(errno));   
@@ -307,8 +316,14 @@ int submit(struct buildmatrix_context *ctx, int from_server_to_client)
  if(send_parameters(ctx))
   return 1;
 
- if(send_test_results(ctx, ctx->test_results))
-  return 1;
+ if( (ctx->stream_test_results) && (ctx->test_results_file != NULL) )
+ {
+  if(stream_test_results(ctx, ctx->test_results_file))
+   return 1;
+ } else {
+  if(send_test_results(ctx, ctx->test_results))
+   return 1;
+ }
 
  if(send_line(ctx, 7, "submit\n"))
   return 1;
@@ -682,53 +697,156 @@ int show_build(struct buildmatrix_context *ctx)
 
 int list_tests(struct buildmatrix_context *ctx)
 {
- int n_bytes;
- char buffer[32];
+ int n_bytes, start, field, i;
+ char buffer[4096], *fields[12];
+ struct test_history_data data;
 
  if(ctx->verbose > 1)
   fprintf(stderr, "%s: lists_tests()\n", ctx->error_prefix);
 
+ if(ctx->job_name != NULL)
+ {
+  if(send_job_name(ctx))
+  return 1;
+ }
+
+ if(ctx->branch_name != NULL)
+ {
+  if(send_branch_name(ctx))
+  return 1;
+ }
+
  if(send_user_name(ctx))
   return 1;
 
  if(send_line(ctx, 11, "list tests\n"))
   return 1;
 
- if(receive_line(ctx, 32, &n_bytes, buffer))
+ if(receive_line(ctx, 4096, &n_bytes, buffer))
   return 1;
 
- if(strncmp(buffer, "ok", 2) == 0)
+ if(strncmp(buffer, "ok", 2) != 0)
  {
-  if(ctx->verbose)
-   fprintf(stderr, "%s: entered into list jobs sub dialog mode\n",
-           ctx->error_prefix);
+  fprintf(stderr, "%s: unexpected response to \"list tests\", \"%s\"\n",
+          ctx->error_prefix, buffer);
+  return 1;
+ }
 
-  if(send_line(ctx, 5, "done\n"))
+ if(ctx->test_list_strategy.start(ctx, ctx->test_list_strategy.strategy_context, NULL))
+  return 1;
+
+ while(1)
+ {
+  if(receive_line(ctx, 4096, &n_bytes, buffer))
    return 1;
 
-  if(receive_line(ctx, 32, &n_bytes, buffer))
+  if( (n_bytes == 5) && (strncmp(buffer, "done", 4) == 0) )
+   break;
+    
+  if( (n_bytes > 6) && (strncmp(buffer, "failed", 6) == 0) )
+  {
+   fprintf(stderr, "%s: list_tests(): server failure\n", ctx->error_prefix);
    return 1;
+  }
 
-  if(strncmp(buffer, "ok", 2) == 0)
+  /* test id, suite, test, job, branch, passed, failed, incomplete, last result, flips,
+     last failure build id, last failure unique identifier */
+  start = 0;
+  field = 0;
+  for(i=0; (i<n_bytes) && (field < 12); i++)
   {
-   if(ctx->verbose)
-    fprintf(stderr, "%s: leaving list tests sub dialog mode\n", ctx->error_prefix);
-   return 0;
+   if(buffer[i] == '|')
+   {
+    buffer[i] = 0;
+    fields[field++] = buffer + start;
+    start = i + 1;
+   }
   }
 
-  fprintf(stderr, "%s: unexpected response to \"done\", \"%s\"\n", 
+  if(field != 12)
+  {
+   fprintf(stderr, "%s: wrong number of columns (%d instead of 12) in list tests results \"%s\"\n",
+           ctx->error_prefix, field, buffer);
+   return 1;
+  }
+
+  sscanf(fields[0], "%d", &data.test_id);
+  data.suite = fields[1];
+  data.test = fields[2];
+  data.job_name = fields[3];
+  data.branch = fields[4];
+  sscanf(fields[5], "%d", &data.passed);
+  sscanf(fields[6], "%d", &data.failed);
+  sscanf(fields[7], "%d", &data.incompleted);
+  sscanf(fields[8], "%d", &data.last_result);
+  sscanf(fields[9], "%d", &data.flips);
+  sscanf(fields[10], "%d", &data.last_failure_build_id);
+  data.last_failure = fields[11];
+  if(strcmp(data.last_failure, "NULL") == 0)
+   data.last_failure = NULL;
+
+  if(ctx->test_list_strategy.iterative(ctx, ctx->test_list_strategy.strategy_context, &data))
+   return 1;
+ }
+
+ return ctx->test_list_strategy.done(ctx, ctx->test_list_strategy.strategy_context, NULL);
+}
+
+int test_diff(struct buildmatrix_context *ctx)
+{
+ int n_bytes;
+ char buffer[4096];
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: test_diff()\n", ctx->error_prefix);
+
+ if(send_user_name(ctx))
+  return 1;
+
+ n_bytes = snprintf(buffer, 4096, "test diff %s %s\n", 
+                    ctx->unique_identifier, ctx->other_identifier);
+
+ if(send_line(ctx, n_bytes, buffer))
+  return 1;
+
+ if(receive_line(ctx, 4096, &n_bytes, buffer))
+  return 1;
+
+ if(strncmp(buffer, "ok", 2) != 0)
+ {
+  fprintf(stderr, "%s: unexpected response to \"test diff\", \"%s\"\n",
           ctx->error_prefix, buffer);
   return 1;
  }
 
- fprintf(stderr, "%s: unexpected response to \"list tests\", \"%s\"\n",
-         ctx->error_prefix, buffer);
- return 1;
+ if(ctx->list_ops_strategy.start(ctx, ctx->list_ops_strategy.strategy_context, 
+                                 "Test differences:"))
+  return 1;
+
+ while(1)
+ {
+  if(receive_line(ctx, 4096, &n_bytes, buffer))
+   return 1;
+
+  if( (n_bytes == 5) && (strncmp(buffer, "done", 4) == 0) )
+   break;
+    
+  if( (n_bytes > 6) && (strncmp(buffer, "failed", 6) == 0) )
+  {
+   fprintf(stderr, "%s: test_diff(): server failure\n", ctx->error_prefix);
+   return 1;
+  }
+
+  if(ctx->list_ops_strategy.iterative(ctx, ctx->list_ops_strategy.strategy_context, buffer))
+   return 1;
+ }
+
+ return ctx->list_ops_strategy.done(ctx, ctx->list_ops_strategy.strategy_context, NULL);
 }
 
 int list_builds(struct buildmatrix_context *ctx)
 {
- int n_bytes, i, field, total, start;
+ int n_bytes;
  char buffer[4096];
 
  struct list_builds_data data;
@@ -761,6 +879,12 @@ int list_builds(struct buildmatrix_context *ctx)
 
 //less than greater than build number
 
+ if(send_submitter_name(ctx))
+  return 1;
+
+ if(send_time_range(ctx))
+  return 1;
+
  if(send_line(ctx, 12, "list builds\n"))
   return 1;
 
@@ -803,149 +927,8 @@ int list_builds(struct buildmatrix_context *ctx)
    return 1;
   }
 
-  /* branch name, job name, build node, build number, user, build result, start time, end time, totals  */
-  start = 0;
-  field = 0;
-  for(i=0; i<n_bytes; i++)
-  {
-   if(buffer[i] == '|')
-   {
-    buffer[i] = 0;
-    switch(field)
-    {
-     case 0:
-          sscanf(buffer + start, "%d", &data.build_id);
-          start = i + 1;
-          field++;
-          break;
-
-     case 1:
-          data.branch = buffer + start;
-          start = i + 1;
-          field++;
-          break;
-
-     case 2:
-          data.job_name = buffer + start;
-          start = i + 1;
-          field++;
-          break;
-
-     case 3:
-          data.build_node = buffer + start;
-          start = i + 1;
-          field++;
-          break;
-
-     case 4:
-          data.unique_identifier = buffer + start;
-          start = i + 1;
-          field++;
-          break;
-
-     case 5:
-          data.user = buffer + start;
-          start = i + 1;
-          field++;
-          break;
-
-     case 6:
-          sscanf(buffer + start, "%d", &data.build_result);
-          start = i + 1;
-          field++;
-          break;
-
-     case 7:
-          sscanf(buffer + start, "%lld", &data.build_time);
-          start = i + 1;
-          field++;
-          break;
-
-     case 8:
-          sscanf(buffer + start, "%d", &total);
-          start = i + 1;
-          field++;
-          break;
-
-     case 9:
-          sscanf(buffer + start, "%d", &data.passed);
-          start = i + 1;
-          field++;
-          break;
-
-     case 10:
-          sscanf(buffer + start, "%d", &data.failed);
-          start = i + 1;
-          field++;
-          break;
-
-     case 11:
-          sscanf(buffer + start, "%d", &data.incompleted);
-          start = i + 1;
-          field++;
-          break;
-
-     case 12:
-          sscanf(buffer + start, "%d", &data.has_parameters);
-          start = i + 1;
-          field++;
-          break;
-
-     case 13:
-          sscanf(buffer + start, "%d", &data.has_tests);
-          start = i + 1;
-          field++;
-          break;
-
-     case 14:
-          data.report_name = buffer + start;
-          if(strcmp(data.report_name, "NULL") == 0)
-           data.report_name = NULL;
-          start = i + 1;
-          field++;
-          break;
-
-     case 15:
-          data.output_name = buffer + start;
-          if(strcmp(data.output_name, "NULL") == 0)
-           data.output_name = NULL;
-          start = i + 1;
-          field++;
-          break;
-
-     case 16:
-          data.checksum_name = buffer + start;
-          if(strcmp(data.checksum_name, "NULL") == 0)
-           data.checksum_name = NULL;
-          start = i + 1;
-          field++;
-          break;
-
-     case 17:
-          data.revision = buffer + start;
-          start = i + 1;
-          field++;
-          break;
-
-    }
-   }
-  }
-
-  if(field != 18)
-  {
-   if(ctx->verbose)
-    fprintf(stderr, "%s: wrong number of columns (%d instead of 18) in lists builds results (%d bytes) \"%s\"\n",
-            ctx->error_prefix, field, n_bytes, buffer);
-
-   send_line(ctx, 7, "failed\n");
-   return 1;
-  }
-
-  if(total != (data.passed + data.failed + data.incompleted) )
+  if(parse_list_builds_line(ctx, buffer, n_bytes, &data))
   {
-   if(ctx->verbose)
-    fprintf(stderr, "%s: test totals failed sanity check\n", ctx->error_prefix);
-
    send_line(ctx, 7, "failed\n");
    return 1;
   }
@@ -1014,4 +997,63 @@ int scratch(struct buildmatrix_context *ctx)
  return 1;
 }
 
+int scratch_matching(struct buildmatrix_context *ctx)
+{
+ int n_bytes, n_builds = -1;
+ char buffer[32];
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: scratch_matching()\n", ctx->error_prefix);
+
+ if(ctx->yes_no_prompt(ctx, "Scratch every build matching the given filters?") == 0)
+  return 1;
+
+ if(ctx->local)
+ {
+  if(service_scratch_matching(ctx, &n_builds))
+   return 1;
+
+  if(ctx->quiet == 0)
+   printf("Scratched %d builds.\n", n_builds);
+
+  return 0;
+ }
 
+ if(send_user_name(ctx))
+  return 1;
+
+ if(send_job_name(ctx))
+  return 1;
+
+ if(send_branch_name(ctx))
+  return 1;
+
+ if(send_build_host_name(ctx))
+  return 1;
+
+ if(send_submitter_name(ctx))
+  return 1;
+
+ if(send_time_range(ctx))
+  return 1;
+
+ if(send_line(ctx, 17, "scratch matching\n"))
+  return 1;
+
+ if(receive_line(ctx, 32, &n_bytes, buffer))
+  return 1;
+
+ if( (strncmp(buffer, "ok ", 3) == 0) &&
+     (sscanf(buffer + 3, "%d", &n_builds) == 1) )
+ {
+  if(ctx->quiet == 0)
+   printf("Scratched %d builds.\n", n_builds);
+
+  return 0;
+ }
+
+ fprintf(stderr, "%s: unexpected response to \"scratch matching\", \"%s\"\n",
+         ctx->error_prefix, buffer);
+
+ return 1;
+}
@@ -0,0 +1,529 @@
+/*
+    Copyright 2013 Stover Enterprises, LLC (An Alabama Limited Liability Corporation)
+    Written by C. Thomas Stover
+
+    This file is part of the program Build Matrix.
+    See http://buildmatrix.stoverenterprises.com for more information.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "prototypes.h"
+
+/* windowBits of 15 + 16 tells zlib to use the gzip wrapper, so artifacts on disk can be
+   read with zcat */
+#define GZIP_WINDOW_BITS 31
+
+const char *artifact_codec_name(int codec)
+{
+ switch(codec)
+ {
+  case BLDMTRX_CODEC_NONE:
+       return "none";
+
+  case BLDMTRX_CODEC_GZIP:
+       return "gzip";
+ }
+
+ return NULL;
+}
+
+/* what limbo_to_database() appends to a stored artifact's file name, so the dashboard's links
+   to it are served as what they are */
+const char *artifact_codec_suffix(int codec)
+{
+ if(codec == BLDMTRX_CODEC_GZIP)
+  return ".gz";
+
+ return "";
+}
+
+int artifact_codec_from_name(const char *name)
+{
+ if(name == NULL)
+  return BLDMTRX_CODEC_NONE;
+
+ if(strcmp(name, "none") == 0)
+  return BLDMTRX_CODEC_NONE;
+
+ if(strcmp(name, "gzip") == 0)
+  return BLDMTRX_CODEC_GZIP;
+
+ return -1;
+}
+
+int resolve_artifact_codec(struct buildmatrix_context *ctx)
+{
+ char *value;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: resolve_artifact_codec()\n", ctx->error_prefix);
+
+ ctx->artifact_codec = BLDMTRX_CODEC_NONE;
+
+ /* projects created before this option existed just keep storing files verbatim */
+ if((value = resolve_configuration_value(ctx, "artifactcompression")) == NULL)
+  return 0;
+
+ if((ctx->artifact_codec = artifact_codec_from_name(value)) == -1)
+ {
+  fprintf(stderr, "%s: resolve_artifact_codec(): invalid value for configuration "
+          "variable artifactcompression, \"%s\"\n", ctx->error_prefix, value);
+  ctx->artifact_codec = BLDMTRX_CODEC_NONE;
+  free(value);
+  return 1;
+ }
+
+ free(value);
+ return 0;
+}
+
+/* projects created before artifact compression get builds.artifact_codec and the
+   uncompressed size columns on first use. Their existing builds read back as
+   BLDMTRX_CODEC_NONE with unknown sizes. */
+int upgrade_artifact_columns(struct buildmatrix_context *ctx)
+{
+ char **names, **types, *errmsg, sql[128];
+ const char *columns[4] = { "artifact_codec", "report_size", "output_size", "checksum_size" };
+ int n_columns, missing[4], i;
+
+ if(table_columns(ctx, "main", "builds", &names, &types, &n_columns))
+  return 1;
+
+ for(i=0; i<4; i++)
+  missing[i] = has_column(names, n_columns, columns[i]) == 0;
+
+ if(n_columns > 0)
+ {
+  free_string_array(names, n_columns);
+  free_string_array(types, n_columns);
+ }
+
+ for(i=0; i<4; i++)
+ {
+  if(missing[i] == 0)
+   continue;
+
+  if(ctx->verbose)
+   fprintf(stderr, "%s: adding builds.%s\n", ctx->error_prefix, columns[i]);
+
+  snprintf(sql, 128, "ALTER TABLE main.builds ADD COLUMN %s INTEGER;", columns[i]);
+  if(sqlite3_exec(ctx->db_ctx, sql, NULL, NULL, &errmsg) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: upgrade_artifact_columns(): could not add builds.%s, '%s'\n",
+           ctx->error_prefix, columns[i], errmsg);
+   sqlite3_free(errmsg);
+   return 1;
+  }
+ }
+
+ return 0;
+}
+
+/* picks up builds.checksum_size, report_size and output_size from consecutive columns of a
+   row, starting at column. Unknown sizes are -1. */
+void read_artifact_sizes(struct buildmatrix_context *ctx, sqlite3_stmt *statement, int column)
+{
+ long long int *sizes[3];
+ int i;
+
+ sizes[0] = &(ctx->checksum_size);
+ sizes[1] = &(ctx->report_size);
+ sizes[2] = &(ctx->output_size);
+
+ for(i=0; i<3; i++)
+ {
+  *(sizes[i]) = -1;
+  if(sqlite3_column_type(statement, column + i) == SQLITE_INTEGER)
+   *(sizes[i]) = sqlite3_column_int64(statement, column + i);
+ }
+}
+
+/* size gets the number of bytes read from in_fd, which is what the file inflates back to */
+int gzip_fd_to_fd(struct buildmatrix_context *ctx, int in_fd, int out_fd, long long int *size)
+{
+ unsigned char in_buffer[16384], out_buffer[16384];
+ int bytes_in, bytes_out, c, flush, code;
+ z_stream stream;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: gzip_fd_to_fd()\n", ctx->error_prefix);
+
+ memset(&stream, 0, sizeof(z_stream));
+ *size = 0;
+
+ if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, GZIP_WINDOW_BITS,
+                 8, Z_DEFAULT_STRATEGY) != Z_OK)
+ {
+  fprintf(stderr, "%s: gzip_fd_to_fd(): deflateInit2() failed\n", ctx->error_prefix);
+  return 1;
+ }
+
+ do
+ {
+  if((bytes_in = read(in_fd, in_buffer, 16384)) < 0)
+  {
+   fprintf(stderr, "%s: gzip_fd_to_fd(): read() failed: %s\n",
+           ctx->error_prefix, strerror(errno));
+   deflateEnd(&stream);
+   return 1;
+  }
+
+  *size += bytes_in;
+  flush = bytes_in == 0 ? Z_FINISH : Z_NO_FLUSH;
+  stream.next_in = in_buffer;
+  stream.avail_in = bytes_in;
+
+  do
+  {
+   stream.next_out = out_buffer;
+   stream.avail_out = 16384;
+
+   if((code = deflate(&stream, flush)) == Z_STREAM_ERROR)
+   {
+    fprintf(stderr, "%s: gzip_fd_to_fd(): deflate() failed\n", ctx->error_prefix);
+    deflateEnd(&stream);
+    return 1;
+   }
+
+   bytes_out = 0;
+   while(bytes_out < (int) (16384 - stream.avail_out))
+   {
+    if((c = write(out_fd, out_buffer + bytes_out, 16384 - stream.avail_out - bytes_out)) < 1)
+    {
+     fprintf(stderr, "%s: gzip_fd_to_fd(): write() failed: %s\n",
+             ctx->error_prefix, strerror(errno));
+     deflateEnd(&stream);
+     return 1;
+    }
+    bytes_out += c;
+   }
+
+  } while(stream.avail_out == 0);
+
+ } while(flush != Z_FINISH);
+
+ deflateEnd(&stream);
+
+ if(code != Z_STREAM_END)
+ {
+  fprintf(stderr, "%s: gzip_fd_to_fd(): deflate() did not finish the stream\n",
+          ctx->error_prefix);
+  return 1;
+ }
+
+ return 0;
+}
+
+int gunzip_start(struct buildmatrix_context *ctx, z_stream *stream)
+{
+ memset(stream, 0, sizeof(z_stream));
+
+ if(inflateInit2(stream, GZIP_WINDOW_BITS) != Z_OK)
+ {
+  fprintf(stderr, "%s: gunzip_start(): inflateInit2() failed\n", ctx->error_prefix);
+  return 1;
+ }
+
+ return 0;
+}
+
+int gunzip_chunk(struct buildmatrix_context *ctx, z_stream *stream,
+                 char *data, int length, int out_fd)
+{
+ unsigned char out_buffer[16384];
+ int code, bytes_out, c;
+
+ stream->next_in = (unsigned char *) data;
+ stream->avail_in = length;
+
+ while(stream->avail_in > 0)
+ {
+  stream->next_out = out_buffer;
+  stream->avail_out = 16384;
+
+  code = inflate(stream, Z_NO_FLUSH);
+  if( (code != Z_OK) && (code != Z_STREAM_END) && (code != Z_BUF_ERROR) )
+  {
+   fprintf(stderr, "%s: gunzip_chunk(): inflate() failed, %d\n", ctx->error_prefix, code);
+   return 1;
+  }
+
+  bytes_out = 0;
+  while(bytes_out < (int) (16384 - stream->avail_out))
+  {
+   if((c = write(out_fd, out_buffer + bytes_out, 16384 - stream->avail_out - bytes_out)) < 1)
+   {
+    fprintf(stderr, "%s: gunzip_chunk(): write() failed: %s\n",
+            ctx->error_prefix, strerror(errno));
+    return 1;
+   }
+   bytes_out += c;
+  }
+
+  if(code == Z_STREAM_END)
+  {
+   if(stream->avail_in > 0)
+   {
+    fprintf(stderr, "%s: gunzip_chunk(): trailing garbage after compressed stream\n",
+            ctx->error_prefix);
+    return 1;
+   }
+   break;
+  }
+ }
+
+ return 0;
+}
+
+int gunzip_end(struct buildmatrix_context *ctx, z_stream *stream)
+{
+ int code;
+
+ /* once the gzip trailer has been consumed inflate() keeps answering Z_STREAM_END */
+ stream->next_in = NULL;
+ stream->avail_in = 0;
+ code = inflate(stream, Z_FINISH);
+ inflateEnd(stream);
+
+ if(code != Z_STREAM_END)
+ {
+  fprintf(stderr, "%s: gunzip_end(): compressed transfer ended early\n", ctx->error_prefix);
+  return 1;
+ }
+
+ return 0;
+}
+
+/* The gzip trailer only holds the uncompressed size mod 2^32, so for builds committed before
+   the sizes were recorded the file is inflated once just to count. fd is rewound afterwards. */
+int gunzip_size(struct buildmatrix_context *ctx, int fd, const char *path, long long int *size)
+{
+ unsigned char in_buffer[16384], out_buffer[16384];
+ int length, code = Z_OK;
+ z_stream stream;
+
+ *size = 0;
+
+ if(gunzip_start(ctx, &stream))
+  return 1;
+
+ while(code != Z_STREAM_END)
+ {
+  if((length = read(fd, in_buffer, 16384)) < 1)
+  {
+   fprintf(stderr, "%s: gunzip_size(): %s is truncated or not a gzip file\n",
+           ctx->error_prefix, path);
+   inflateEnd(&stream);
+   return 1;
+  }
+
+  stream.next_in = in_buffer;
+  stream.avail_in = length;
+
+  while( (stream.avail_in > 0) && (code != Z_STREAM_END) )
+  {
+   stream.next_out = out_buffer;
+   stream.avail_out = 16384;
+
+   code = inflate(&stream, Z_NO_FLUSH);
+   if( (code != Z_OK) && (code != Z_STREAM_END) )
+   {
+    fprintf(stderr, "%s: gunzip_size(): inflate() of %s failed, %d\n",
+            ctx->error_prefix, path, code);
+    inflateEnd(&stream);
+    return 1;
+   }
+
+   *size += 16384 - stream.avail_out;
+  }
+ }
+
+ inflateEnd(&stream);
+
+ if(lseek(fd, 0, SEEK_SET) != 0)
+ {
+  fprintf(stderr, "%s: gunzip_size(): lseek() failed: %s\n", ctx->error_prefix, strerror(errno));
+  return 1;
+ }
+
+ return 0;
+}
+
+/* Artifacts compressed at rest are sent one of two ways. If the peer asked for gzip during
+   connection initialization, the stored bytes go out as is and the sendfile line is tagged
+   with the codec. Otherwise the file is inflated on the fly so older peers see exactly
+   what was submitted. size is the uncompressed size add_build() recorded, or -1 when the
+   build predates that and gunzip_size() has to count it. */
+int send_compressed_db_file(struct buildmatrix_context *ctx, char *path, char *name,
+                            long long int size)
+{
+ unsigned char in_buffer[16384];
+ char buffer[4096];
+ int fd, n_bytes, length, passthrough, failed = 0, code = Z_OK;
+ long long int bytes_sent = 0;
+ struct stat stat_buffer;
+ z_stream stream;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: send_compressed_db_file(%s)\n", ctx->error_prefix, path);
+
+ passthrough = (ctx->peer_codecs & (1 << BLDMTRX_CODEC_GZIP)) != 0;
+
+ if((fd = open(path, O_RDONLY)) < 0)
+ {
+  fprintf(stderr, "%s: send_compressed_db_file(): open(%s) failed: %s\n",
+          ctx->error_prefix, path, strerror(errno));
+  return 1;
+ }
+
+ if(fstat(fd, &stat_buffer))
+ {
+  fprintf(stderr, "%s: send_compressed_db_file(): fstat() failed: %s\n",
+          ctx->error_prefix, strerror(errno));
+  close(fd);
+  return 1;
+ }
+
+ if(passthrough)
+ {
+  size = stat_buffer.st_size;
+  length = snprintf(buffer, 4096, "sendfile %lld %s gzip\n", size, name);
+ } else {
+  if( ( (size < 0) && (gunzip_size(ctx, fd, path, &size)) ) ||
+      (gunzip_start(ctx, &stream)) )
+  {
+   close(fd);
+   return 1;
+  }
+
+  length = snprintf(buffer, 4096, "sendfile %lld %s\n", size, name);
+ }
+
+ if(ctx->verbose)
+  fprintf(stderr, "%s: send_compressed_db_file(): trying to send file %s (%lld bytes%s)\n",
+          ctx->error_prefix, name, size, passthrough ? ", gzip" : "");
+
+ if(write(ctx->out, buffer, length) < 1)
+ {
+  fprintf(stderr, "%s: send_compressed_db_file(): write() failed: %s\n",
+          ctx->error_prefix, strerror(errno));
+  failed = 1;
+ }
+
+ while(failed == 0)
+ {
+  if((n_bytes = read(ctx->in, buffer, 64)) < 1)
+  {
+   fprintf(stderr, "%s: send_compressed_db_file(): read() failed: %s\n",
+           ctx->error_prefix, strerror(errno));
+   failed = 1;
+   break;
+  }
+  buffer[n_bytes] = 0;
+
+  if(strncmp(buffer, "failed", 6) == 0)
+  {
+   fprintf(stderr, "%s: peer bailing out of file transfer '%s'\n", ctx->error_prefix, buffer + 7);
+   failed = 1;
+   break;
+  }
+
+  if(strncmp(buffer, "ok", 2) != 0)
+  {
+   fprintf(stderr, "%s: unexpected response in file transfer, \"%s\"\n",
+           ctx->error_prefix, buffer);
+   failed = 1;
+   break;
+  }
+
+  if(bytes_sent == size)
+  {
+   if(ctx->verbose)
+    fprintf(stderr, "%s: transfer complete\n", ctx->error_prefix);
+   break;
+  }
+
+  if(passthrough)
+  {
+   if((n_bytes = read(fd, buffer, 4096)) < 1)
+   {
+    fprintf(stderr, "%s: send_compressed_db_file(): read() failed: %s\n",
+            ctx->error_prefix, strerror(errno));
+    failed = 1;
+    break;
+   }
+  } else {
+   stream.next_out = (unsigned char *) buffer;
+   stream.avail_out = size - bytes_sent > 4096 ? 4096 : size - bytes_sent;
+   n_bytes = stream.avail_out;
+
+   while( (stream.avail_out > 0) && (code != Z_STREAM_END) )
+   {
+    if(stream.avail_in == 0)
+    {
+     if((length = read(fd, in_buffer, 16384)) < 1)
+     {
+      fprintf(stderr, "%s: send_compressed_db_file(): %s is truncated\n",
+              ctx->error_prefix, path);
+      failed = 1;
+      break;
+     }
+     stream.next_in = in_buffer;
+     stream.avail_in = length;
+    }
+
+    code = inflate(&stream, Z_NO_FLUSH);
+    if( (code != Z_OK) && (code != Z_STREAM_END) )
+    {
+     fprintf(stderr, "%s: send_compressed_db_file(): inflate() failed, %d\n",
+             ctx->error_prefix, code);
+     failed = 1;
+     break;
+    }
+   }
+
+   if(failed)
+    break;
+
+   if((n_bytes -= stream.avail_out) == 0)
+   {
+    fprintf(stderr, "%s: send_compressed_db_file(): %s changed while it was being sent\n",
+            ctx->error_prefix, path);
+    failed = 1;
+    break;
+   }
+  }
+
+  if(ctx->verbose > 2)
+   fprintf(stderr, "%s: sending bytes %lld through %lld of file transfer\n",
+           ctx->error_prefix, bytes_sent, bytes_sent + n_bytes);
+
+  if((n_bytes = write(ctx->out, buffer, n_bytes)) < 1)
+  {
+   fprintf(stderr, "%s: send_compressed_db_file(): write() failed: %s\n",
+           ctx->error_prefix, strerror(errno));
+   failed = 1;
+   break;
+  }
+
+  bytes_sent += n_bytes;
+ }
+
+ if(passthrough == 0)
+  inflateEnd(&stream);
+ close(fd);
+
+ return failed;
+}
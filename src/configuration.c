@@ -22,3 +22,494 @@
 #include "prototypes.h"
 
 
+/* The configuration table is read whole into an immutable snapshot, sorted by parameter, and
+   lookups are a binary search of that. Triggers on the configuration table bump the
+   "configuration" row of change_counters, and the snapshot is only reloaded when that counter
+   has moved, or when this process saves a value. A reload doesn't free the snapshot it
+   replaces, so strings returned by configuration_string() stay valid for the life of the
+   process. */
+
+int create_change_counters(struct buildmatrix_context *ctx)
+{
+ char *errmsg;
+
+ if(sqlite3_exec(ctx->db_ctx, 
+                 "CREATE TABLE IF NOT EXISTS change_counters (name TEXT, counter INTEGER, "
+                                                             "UNIQUE (name)); "
+                 "INSERT OR IGNORE INTO change_counters (name, counter) "
+                 "VALUES ('configuration', 0); "
+                 "INSERT OR IGNORE INTO change_counters (name, counter) "
+                 "VALUES ('builds', 0); "
+                 "CREATE TRIGGER IF NOT EXISTS configuration_inserted AFTER INSERT ON configuration "
+                 "BEGIN UPDATE change_counters SET counter = counter + 1 "
+                 "WHERE name = 'configuration'; END; "
+                 "CREATE TRIGGER IF NOT EXISTS configuration_updated AFTER UPDATE ON configuration "
+                 "BEGIN UPDATE change_counters SET counter = counter + 1 "
+                 "WHERE name = 'configuration'; END; "
+                 "CREATE TRIGGER IF NOT EXISTS configuration_deleted AFTER DELETE ON configuration "
+                 "BEGIN UPDATE change_counters SET counter = counter + 1 "
+                 "WHERE name = 'configuration'; END;",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: could not create change counters, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ return 0;
+}
+
+/* counter is -1 when there is no such counter, which means "always changed" */
+int read_change_counter(struct buildmatrix_context *ctx, const char *name, long long int *counter)
+{
+ const char *sql;
+ int code;
+ struct sqlite3_stmt *statement = NULL;
+
+ *counter = -1;
+
+ sql = "SELECT counter FROM change_counters WHERE name = ?;";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  /* a project from before change_counters, add it if the database is writeable */
+  if(ctx->verbose)
+   fprintf(stderr, "%s: read_change_counter(): adding change_counters\n", ctx->error_prefix);
+
+  if(create_change_counters(ctx))
+   return 0;
+
+  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: read_change_counter(): sqlite3_prepare(%s) failed, '%s'\n",
+           ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+   return 1;
+  }
+ }
+
+ if(sqlite3_bind_text(statement, 1, name, strlen(name), SQLITE_TRANSIENT) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: read_change_counter(): sqlite3_bind_text() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ code = sqlite3_step(statement);
+
+ if(code == SQLITE_ROW)
+ {
+  *counter = sqlite3_column_int64(statement, 0);
+ } else if(code != SQLITE_DONE) {
+  fprintf(stderr, "%s: read_change_counter(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+/* for counters not kept by triggers, the caller's transaction covers the update */
+int bump_change_counter(struct buildmatrix_context *ctx, const char *name)
+{
+ const char *sql;
+ struct sqlite3_stmt *statement = NULL;
+
+ if(create_change_counters(ctx))
+  return 1;
+
+ sql = "INSERT OR IGNORE INTO change_counters (name, counter) VALUES (?1, 0); "
+       "UPDATE change_counters SET counter = counter + 1 WHERE name = ?1;";
+
+ while(*sql != 0)
+ {
+  if(sqlite3_prepare_v2(ctx->db_ctx, sql, -1, &statement, &sql) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: bump_change_counter(): sqlite3_prepare() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   return 1;
+  }
+
+  if( (sqlite3_bind_text(statement, 1, name, strlen(name), SQLITE_TRANSIENT) != SQLITE_OK) ||
+      (sqlite3_step(statement) != SQLITE_DONE) )
+  {
+   fprintf(stderr, "%s: bump_change_counter(): could not update %s, '%s'\n",
+           ctx->error_prefix, name, sqlite3_errmsg(ctx->db_ctx));
+   sqlite3_finalize(statement);
+   return 1;
+  }
+
+  sqlite3_finalize(statement);
+
+  while(*sql == ' ')
+   sql++;
+ }
+
+ return 0;
+}
+
+/* PRAGMA data_version moves when another connection commits to the open database. 0 when
+   the SQLite in use predates it (3.8.8), the caller should then take nothing as unchanged. */
+int read_data_version(struct buildmatrix_context *ctx, long long int *version)
+{
+ const char *sql;
+ int code;
+ struct sqlite3_stmt *statement = NULL;
+
+ *version = 0;
+
+ sql = "PRAGMA data_version;";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: read_data_version(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ code = sqlite3_step(statement);
+
+ if(code == SQLITE_ROW)
+ {
+  *version = sqlite3_column_int64(statement, 0);
+ } else if(code != SQLITE_DONE) {
+  fprintf(stderr, "%s: read_data_version(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+int load_configuration_snapshot(struct buildmatrix_context *ctx, long long int counter)
+{
+ const char *sql;
+ int code, i, n_values = 0, allocation_size, failed = 0;
+ struct sqlite3_stmt *statement = NULL;
+ struct arena strings = { NULL, 0, 0 }, offsets = { NULL, 0, 0 };
+ struct configuration_snapshot *snapshot;
+ size_t offset, *pair;
+ char *str_ptr;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: load_configuration_snapshot(%lld)\n", ctx->error_prefix, counter);
+
+ sql = "SELECT parameter, value FROM configuration ORDER BY parameter;";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: load_configuration_snapshot(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ {
+  if( (sqlite3_column_type(statement, 0) != SQLITE_TEXT) ||
+      (sqlite3_column_type(statement, 1) != SQLITE_TEXT) )
+   continue;
+
+  if( (arena_reserve(&offsets, sizeof(size_t) * 2, &offset)) ||
+      (arena_append_string(&strings, (const char *) sqlite3_column_text(statement, 0),
+                           (size_t *) (offsets.base + offset))) ||
+      (arena_append_string(&strings, (const char *) sqlite3_column_text(statement, 1),
+                           (size_t *) (offsets.base + offset) + 1)) )
+  {
+   fprintf(stderr, "%s: load_configuration_snapshot(): out of memory\n", ctx->error_prefix);
+   failed = 1;
+   break;
+  }
+  n_values++;
+ }
+
+ if( (failed == 0) && (code != SQLITE_DONE) )
+ {
+  fprintf(stderr, "%s: load_configuration_snapshot(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  failed = 1;
+ }
+
+ sqlite3_finalize(statement);
+
+ // structure|parameters array|values array|strings space
+ allocation_size = sizeof(struct configuration_snapshot)
+                 + (n_values * sizeof(char *) * 2)
+                 + strings.used;
+
+ if( (failed == 0) &&
+     ((snapshot = (struct configuration_snapshot *) malloc(allocation_size)) == NULL) )
+ {
+  fprintf(stderr, "%s: load_configuration_snapshot(): malloc(%d) failed: %s\n",
+          ctx->error_prefix, allocation_size, strerror(errno));
+  failed = 1;
+ }
+
+ if(failed)
+ {
+  arena_free(&strings);
+  arena_free(&offsets);
+  return 1;
+ }
+
+ snapshot->counter = counter;
+ snapshot->n_values = n_values;
+ snapshot->parameters = (char **) (((char *) snapshot) + sizeof(struct configuration_snapshot));
+ snapshot->values = &(snapshot->parameters[n_values]);
+ str_ptr = (char *) &(snapshot->values[n_values]);
+ if(strings.used > 0)
+  memcpy(str_ptr, strings.base, strings.used);
+
+ pair = (size_t *) offsets.base;
+ for(i=0; i<n_values; i++)
+ {
+  snapshot->parameters[i] = str_ptr + pair[i * 2];
+  snapshot->values[i] = str_ptr + pair[(i * 2) + 1];
+ }
+
+ arena_free(&strings);
+ arena_free(&offsets);
+
+ free(ctx->configuration);
+ ctx->configuration = snapshot;
+ return 0;
+}
+
+/* makes sure ctx->configuration reflects the configuration table */
+int refresh_configuration(struct buildmatrix_context *ctx)
+{
+ long long int counter, data_version = 0;
+
+ /* While the database stays open, nothing else has committed since the last check if
+    data_version hasn't moved. Writes to the configuration table on this connection go through
+    save_configurtation_value(), which reloads. close_database() forgets the version. */
+ if( (ctx->configuration != NULL) && (ctx->db_ctx != NULL) &&
+     (ctx->configuration_data_version != 0) )
+ {
+  if(read_data_version(ctx, &data_version))
+   return 1;
+
+  if(data_version == ctx->configuration_data_version)
+   return 0;
+ }
+
+ if(open_database(ctx))
+  return 1;
+
+ if( (data_version == 0) && (read_data_version(ctx, &data_version)) )
+ {
+  close_database(ctx);
+  return 1;
+ }
+
+ if(read_change_counter(ctx, "configuration", &counter))
+ {
+  close_database(ctx);
+  return 1;
+ }
+
+ /* without a counter to go by, the first snapshot is kept until this process changes a value */
+ if( (ctx->configuration == NULL) ||
+     ( (counter != -1) && (ctx->configuration->counter != counter) ) )
+ {
+  if(load_configuration_snapshot(ctx, counter))
+  {
+   close_database(ctx);
+   return 1;
+  }
+ }
+
+ ctx->configuration_data_version = data_version;
+ close_database(ctx);
+ return 0;
+}
+
+/* NULL when the parameter isn't set. Points into the snapshot, which the next configuration call
+   may replace and free, use resolve_configuration_value() to hold on to a value. */
+const char *configuration_string(struct buildmatrix_context *ctx, const char *parameter)
+{
+ int low, high, middle, order;
+
+ if(refresh_configuration(ctx))
+  return NULL;
+
+ low = 0;
+ high = ctx->configuration->n_values - 1;
+ while(low <= high)
+ {
+  middle = (low + high) / 2;
+
+  if((order = strcmp(ctx->configuration->parameters[middle], parameter)) == 0)
+   return ctx->configuration->values[middle];
+
+  if(order < 0)
+   low = middle + 1;
+  else
+   high = middle - 1;
+ }
+
+ return NULL;
+}
+
+/* yes/no, with default_value when the parameter isn't set */
+int configuration_boolean(struct buildmatrix_context *ctx, const char *parameter,
+                          int default_value, int *value)
+{
+ const char *string;
+
+ *value = default_value;
+
+ if((string = configuration_string(ctx, parameter)) == NULL)
+  return 0;
+
+ if(strcmp(string, "yes") == 0)
+ {
+  *value = 1;
+  return 0;
+ }
+
+ if(strcmp(string, "no") == 0)
+ {
+  *value = 0;
+  return 0;
+ }
+
+ fprintf(stderr, "%s: configuration variable %s should be \"yes\" or \"no\", not \"%s\"\n",
+         ctx->error_prefix, parameter, string);
+ return 1;
+}
+
+int configuration_int(struct buildmatrix_context *ctx, const char *parameter,
+                      int default_value, int *value)
+{
+ const char *string;
+ int n;
+
+ *value = default_value;
+
+ if((string = configuration_string(ctx, parameter)) == NULL)
+  return 0;
+
+ if( (sscanf(string, "%d%n", value, &n) == 1) && (string[n] == 0) )
+  return 0;
+
+ fprintf(stderr, "%s: configuration variable %s should be a number, not \"%s\"\n",
+         ctx->error_prefix, parameter, string);
+ *value = default_value;
+ return 1;
+}
+
+/* for callers that want their own copy */
+char *resolve_configuration_value(struct buildmatrix_context *ctx, char *key)
+{
+ const char *value;
+ char *copy;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: resolve_configuration_value(%s)\n", ctx->error_prefix, key);
+
+ if((value = configuration_string(ctx, key)) == NULL)
+  return NULL;
+
+ if((copy = strdup(value)) == NULL)
+  fprintf(stderr, "%s: resolve_configuration_value(): strdup() failed\n", ctx->error_prefix);
+
+ return copy;
+}
+
+/* with overwrite == 0 an existing value is left alone */
+int save_configurtation_value(struct buildmatrix_context *ctx, char *parameter,
+                              char *value, int overwrite)
+{
+ const char *sql;
+ long long int counter;
+ struct sqlite3_stmt *statement = NULL;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: save_configurtation_value(%s, %s, %d)\n", ctx->error_prefix,
+          parameter, value, overwrite);
+
+ if( (parameter == NULL) || (value == NULL) )
+ {
+  fprintf(stderr, "%s: save_configurtation_value(): need a parameter and a value\n",
+          ctx->error_prefix);
+  return 1;
+ }
+
+ if(open_database(ctx))
+  return 1;
+
+ if(overwrite)
+  sql = "INSERT OR REPLACE INTO configuration (parameter, value) VALUES (?, ?);";
+ else
+  sql = "INSERT OR IGNORE INTO configuration (parameter, value) VALUES (?, ?);";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: save_configurtation_value(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  close_database(ctx);
+  return 1;
+ }
+
+ if( (sqlite3_bind_text(statement, 1, parameter, strlen(parameter), SQLITE_TRANSIENT) != SQLITE_OK) ||
+     (sqlite3_bind_text(statement, 2, value, strlen(value), SQLITE_TRANSIENT) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: save_configurtation_value(): sqlite3_bind_text() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  close_database(ctx);
+  return 1;
+ }
+
+ if(sqlite3_step(statement) != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: save_configurtation_value(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  close_database(ctx);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+
+ if(read_change_counter(ctx, "configuration", &counter))
+ {
+  close_database(ctx);
+  return 1;
+ }
+
+ if(load_configuration_snapshot(ctx, counter))
+ {
+  close_database(ctx);
+  return 1;
+ }
+
+ close_database(ctx);
+ return 0;
+}
+
+int list_configurtation_values(struct buildmatrix_context *ctx)
+{
+ int i;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: list_configurtation_values()\n", ctx->error_prefix);
+
+ if(refresh_configuration(ctx))
+  return 1;
+
+ printf("Configuration Variables:\n");
+
+ for(i=0; i<ctx->configuration->n_values; i++)
+  printf("%d %s = \"%s\"\n", i + 1, ctx->configuration->parameters[i],
+         ctx->configuration->values[i]);
+
+ printf(" (%d) variables\n", i);
+
+ return 0;
+}
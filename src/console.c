@@ -248,6 +248,56 @@ int service_list_builds_strategy_console_done(const struct buildmatrix_context *
  return 0;
 }
 
+int service_list_tests_strategy_console_start(const struct buildmatrix_context *ctx, 
+                                              void * const strategy_context, const void *ptr)
+{
+ struct service_list_strategy_console_context *sc;
+ sc = (struct service_list_strategy_console_context *) strategy_context;
+
+ if(ctx->verbose > 2)
+  fprintf(stderr, "%s: service_list_tests_strategy_console_start()\n", ctx->error_prefix);
+
+ sc->count = 0;
+ if(ctx->quiet == 0)
+  printf("Test history (passed/failed/incomplete, flips):\n");
+
+ return 0;
+}
+
+int service_list_tests_strategy_console_iterative(const struct buildmatrix_context *ctx, 
+                                                  void * const strategy_context, const void *ptr)
+{
+ struct service_list_strategy_console_context *sc;
+ sc = (struct service_list_strategy_console_context *) strategy_context;
+ const struct test_history_data *data = (const struct test_history_data *) ptr;
+
+ if(ctx->verbose > 2)
+  fprintf(stderr, "%s: service_list_tests_strategy_console_iterative()\n", ctx->error_prefix);
+
+ printf("%s.%s %s %s: %d/%d/%d, %d flip(s), last failure %s\n",
+        data->suite, data->test, data->job_name, data->branch, 
+        data->passed, data->failed, data->incompleted, data->flips,
+        data->last_failure == NULL ? "none" : data->last_failure);
+
+ sc->count++;
+ return 0;
+}
+
+int service_list_tests_strategy_console_done(const struct buildmatrix_context *ctx, 
+                                             void * const strategy_context, const void *ptr)
+{
+ struct service_list_strategy_console_context *sc;
+ sc = (struct service_list_strategy_console_context *) strategy_context;
+
+ if(ctx->verbose > 2)
+  fprintf(stderr, "%s: service_list_tests_strategy_console_done()\n", ctx->error_prefix);
+
+ if(ctx->quiet == 0)
+  printf("(%d) entries returned\n", sc->count);
+
+ return 0;
+}
+
 int process_build_strategy_console(struct buildmatrix_context * const ctx)
 {
  char *scores_out_filename, *parameters_out_filename;
@@ -260,7 +310,8 @@ int process_build_strategy_console(struct buildmatrix_context * const ctx)
  {
   /* title */
   printf("\nDetails retrieved for Unique Identifier %s of Job: \"%s\" on Branch: \"%s\" at Revision: \"%s\".\n",
-         ctx->unique_identifier, ctx->job_name, ctx->branch_name, ctx->revision);
+         ctx->unique_identifier, ctx->job_name, ctx->branch_name,
+         ctx->revision == NULL ? "N/A" : ctx->revision);
 
   /* result */
   printf("\tBuild Result: %s\n", ctx->build_result ? "success" : "failure");
@@ -288,12 +339,13 @@ int process_build_strategy_console(struct buildmatrix_context * const ctx)
    if((scores_out_filename = ctx->test_results_file) == NULL)
     scores_out_filename = "./test-results.bmt";
 
-   if(export_test_results_bldmtrx_format(ctx, ctx->test_results, scores_out_filename))
+   if(export_test_results(ctx, ctx->test_results, scores_out_filename))
    {
     printf("\tTest Scores: export failure\n");
     code = 1;
    } else {
-    printf("\tTest Scores: written in Build Matrix format to %s\n", scores_out_filename);   
+    printf("\tTest Scores: written in Build Matrix %sformat to %s\n", 
+           ctx->binary_test_results ? "binary " : "", scores_out_filename);   
    }
   }
 
@@ -373,6 +425,20 @@ int setup_console(struct buildmatrix_context * const ctx)
  else
   ctx->build_list_strategy = s;
 
+ s.start = service_list_tests_strategy_console_start;
+ s.iterative = service_list_tests_strategy_console_iterative;
+ s.done = service_list_tests_strategy_console_done;
+ if((sc = (struct service_list_strategy_console_context *)
+          malloc(sizeof(struct service_list_strategy_console_context))) == NULL)
+  return 1;
+
+ s.strategy_context = sc;
+
+ if(ctx->local)
+  ctx->service_list_tests_strategy = s;
+ else
+  ctx->test_list_strategy = s;
+
  ctx->process_build_strategy = process_build_strategy_console;
 
  return 0;
@@ -68,7 +68,10 @@ int open_database(struct buildmatrix_context *ctx)
  if(filename[0] == 0)
   snprintf(filename, 2048, "%s/buildmatrix.sqlite3", effective); 
 
- if(sqlite3_open(filename, &(ctx->db_ctx)) != SQLITE_OK)
+ if(sqlite3_open_v2(filename, &(ctx->db_ctx), 
+                    ctx->db_read_only ? SQLITE_OPEN_READONLY : 
+                                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                    NULL) != SQLITE_OK)
  {
   fprintf(stderr, "%s: sqlite3_open('%s') failed, '%s'\n",
           ctx->error_prefix, filename, sqlite3_errmsg(ctx->db_ctx));
@@ -102,6 +105,9 @@ int close_database(struct buildmatrix_context *ctx)
          ctx->error_prefix, ctx->db_ref_count);
  }
 
+ close_query_cache_database(ctx);
+ ctx->configuration_data_version = 0;
+
  if(ctx->db_ctx != NULL)
  {
   sqlite3_close(ctx->db_ctx);
@@ -111,6 +117,47 @@ int close_database(struct buildmatrix_context *ctx)
  return 0;
 }
 
+/* Closes the connection however many references there are, for when the process is about to
+   fork(). resume_database() reopens it with the same count. Attached archives, temp tables and
+   views are gone afterwards. */
+int suspend_database(struct buildmatrix_context *ctx, int *n_references)
+{
+ *n_references = ctx->db_ref_count;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: suspend_database() - %d references\n", ctx->error_prefix, *n_references);
+
+ close_query_cache_database(ctx);
+ ctx->configuration_data_version = 0;
+
+ if(ctx->db_ctx == NULL)
+  return 0;
+
+ if(sqlite3_close(ctx->db_ctx) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: suspend_database(): sqlite3_close() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  *n_references = 0;
+  return 1;
+ }
+
+ ctx->db_ctx = NULL;
+ ctx->db_ref_count = 0;
+ return 0;
+}
+
+int resume_database(struct buildmatrix_context *ctx, int n_references)
+{
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: resume_database() - %d references\n", ctx->error_prefix, n_references);
+
+ if(open_database(ctx))
+  return 1;
+
+ ctx->db_ref_count = n_references;
+ return 0;
+}
+
 int new_database(struct buildmatrix_context *ctx)
 {
  char *errmsg = NULL;
@@ -122,6 +169,17 @@ int new_database(struct buildmatrix_context *ctx)
  if(open_database(ctx))
   return 1;
 
+ /* lets prune give pages back a little at a time instead of needing a full VACUUM */
+ if(sqlite3_exec(ctx->db_ctx, "PRAGMA auto_vacuum = INCREMENTAL;",
+    NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: could not set auto_vacuum, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  sqlite3_close(ctx->db_ctx);
+  return 1;
+ }
+
  if(sqlite3_exec(ctx->db_ctx, 
     "CREATE TABLE configuration (id INTEGER PRIMARY KEY, parameter TEXT, value TEXT, "
                                  "UNIQUE (parameter));",
@@ -134,6 +192,12 @@ int new_database(struct buildmatrix_context *ctx)
   return 1;
  }
 
+ if(create_change_counters(ctx))
+ {
+  sqlite3_close(ctx->db_ctx);
+  return 1;
+ }
+
  if(sqlite3_exec(ctx->db_ctx, 
     "CREATE TABLE servers (id INTEGER PRIMARY KEY, name TEXT, sshbin TEXT, bldmtrxpath TEXT, "
                           "project_directory TEXT, transport INTEGER, last_pulled_id INTEGER, "
@@ -172,14 +236,16 @@ int new_database(struct buildmatrix_context *ctx)
  }
 
  if(sqlite3_exec(ctx->db_ctx, 
-    "CREATE TABLE builds (build_id INTEGER PRIMARY KEY, "
+    "CREATE TABLE builds (build_id INTEGER PRIMARY KEY AUTOINCREMENT, "
                          "job TEXT, "
                          "user_id INTEGER REFERENCES users(user_id), "
                          "branch TEXT, unique_identifier TEXT, build_node TEXT, "
                          "build_time INTEGER, result INTEGER, passed_tests INTEGER, "
                          "failed_tests INTEGER, incomplete_tests INTEGER, report TEXT, "
                          "output TEXT, checksum TEXT, has_tests INTEGER, has_parameters INTEGER, "
-                         "revision TEXT, UNIQUE (unique_identifier));",
+                         "revision TEXT, artifact_codec INTEGER, parameter_set_id INTEGER, "
+                         "report_size INTEGER, output_size INTEGER, checksum_size INTEGER, "
+                         "UNIQUE (unique_identifier));",
     NULL, NULL, &errmsg) != SQLITE_OK)
  {
   fprintf(stderr, "%s: could not create builds table, '%s'\n",
@@ -189,6 +255,17 @@ int new_database(struct buildmatrix_context *ctx)
   return 1;
  }
 
+ if(sqlite3_exec(ctx->db_ctx, 
+                 "CREATE INDEX builds_job_branch ON builds (job, branch, build_id);",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: could not create builds_job_branch index, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  sqlite3_close(ctx->db_ctx);
+  return 1;
+ }
+
  if(sqlite3_exec(ctx->db_ctx, 
                  "CREATE TABLE parameters (id INTEGER PRIMARY KEY, "
                                           "build_id INTEGER REFERENCES builds(build_id), "
@@ -202,6 +279,23 @@ int new_database(struct buildmatrix_context *ctx)
   return 1;
  }
 
+ if(sqlite3_exec(ctx->db_ctx, 
+                 "CREATE INDEX parameters_build_id ON parameters (build_id);",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: could not create parameters_build_id index, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  sqlite3_close(ctx->db_ctx);
+  return 1;
+ }
+
+ if(create_parameter_set_tables(ctx))
+ {
+  sqlite3_close(ctx->db_ctx);
+  return 1;
+ }
+
  if(sqlite3_exec(ctx->db_ctx, 
                  "CREATE TABLE suites (suite_id INTEGER PRIMARY KEY, name TEXT, "
                                       "description TEXT, UNIQUE(name));",
@@ -232,6 +326,7 @@ int new_database(struct buildmatrix_context *ctx)
                                       "build_id INTEGER REFERENCES builds(build_id), "
                                       "test_id INTEGER REFERENCES tests(test_id), "
                                       "result INTEGER, data TEXT, "
+                                      "blob_id INTEGER REFERENCES blobs(blob_id), "
                                       "UNIQUE(build_id, test_id));",
                  NULL, NULL, &errmsg) != SQLITE_OK)
  {
@@ -242,6 +337,18 @@ int new_database(struct buildmatrix_context *ctx)
   return 1;
  }
 
+ if(create_test_history_table(ctx))
+ {
+  sqlite3_close(ctx->db_ctx);
+  return 1;
+ }
+
+ if(create_blobs_table(ctx))
+ {
+  sqlite3_close(ctx->db_ctx);
+  return 1;
+ }
+
  close_database(ctx);
  return 0;
 }
@@ -300,6 +407,19 @@ int lookup_build_id(struct buildmatrix_context *ctx)
   build_id = sqlite3_column_int(statement, 0);
  }
 
+ sqlite3_finalize(statement);
+ statement = NULL;
+
+ /* ATTACH can't run inside a transaction, and the writers that hold one only work on main */
+ if( (build_id < 1) && (code == SQLITE_DONE) && (sqlite3_get_autocommit(ctx->db_ctx)) )
+ {
+  if(find_archived_build(ctx, ctx->unique_identifier, &build_id))
+  {
+   close_database(ctx);
+   return 1;
+  }
+ }
+
  if(build_id < 1)
  {
   fprintf(stderr, "%s: lookup_build_id(): could not find build %s.\n",
@@ -310,7 +430,6 @@ int lookup_build_id(struct buildmatrix_context *ctx)
  }
 
  ctx->build_id = build_id;
- sqlite3_finalize(statement);
 
  close_database(ctx);
  return 0;
@@ -355,6 +474,10 @@ int ready_build_submission(struct buildmatrix_context *ctx)
  if(open_database(ctx))
   return 1;
 
+ /* older projects could hand an archived build's id out again */
+ if(upgrade_build_id_sequence(ctx))
+  return 1;
+
  if(sqlite3_exec(ctx->db_ctx, "BEGIN TRANSACTION;",
     NULL, NULL, &errmsg) != SQLITE_OK)
  {
@@ -430,7 +553,8 @@ int add_build(struct buildmatrix_context *ctx)
 {
  char *sql, *errmsg;
  struct sqlite3_stmt *statement = NULL;
- int code;
+ long long int sizes[3] = { -1, -1, -1 };
+ int code, i;
 
  if(ctx->verbose > 1)
   fprintf(stderr, 
@@ -445,9 +569,14 @@ int add_build(struct buildmatrix_context *ctx)
   return 1;
  }
 
+ /* decide how this build's files will be stored before they leave limbo */
+ if( (resolve_artifact_codec(ctx)) ||
+     (upgrade_artifact_columns(ctx)) )
+  return 1;
+
  sql = "UPDATE builds SET result=?, build_node=?, report=?, output=?, checksum=?, "
        "build_time=?, passed_tests=?, failed_tests=?, incomplete_tests=?, "
-       "has_tests=?, has_parameters=?, revision=? "
+       "has_tests=?, has_parameters=?, revision=?, artifact_codec=? "
        "WHERE build_id = ? AND job=? AND branch=? AND unique_identifier=?";
 
  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
@@ -457,7 +586,7 @@ int add_build(struct buildmatrix_context *ctx)
   return 1;
  }
 
- if(sqlite3_bind_int(statement, 13, ctx->build_id) != SQLITE_OK)
+ if(sqlite3_bind_int(statement, 14, ctx->build_id) != SQLITE_OK)
  {
   fprintf(stderr, "%s: add_build(): sqlite3_bind_int() failed, '%s'\n",
           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
@@ -466,7 +595,7 @@ int add_build(struct buildmatrix_context *ctx)
  }
 
  /* just the build id should be enough, but we are going over board */ 
- if(sqlite3_bind_text(statement, 14, ctx->job_name, strlen(ctx->job_name),
+ if(sqlite3_bind_text(statement, 15, ctx->job_name, strlen(ctx->job_name),
                       SQLITE_TRANSIENT) != SQLITE_OK)
  {
   fprintf(stderr, "%s: add_build(): sqlite3_bind_text() failed, '%s'\n",
@@ -475,7 +604,7 @@ int add_build(struct buildmatrix_context *ctx)
   return 1;
  }
 
- if(sqlite3_bind_text(statement, 15, ctx->branch_name, strlen(ctx->branch_name),
+ if(sqlite3_bind_text(statement, 16, ctx->branch_name, strlen(ctx->branch_name),
                       SQLITE_TRANSIENT) != SQLITE_OK)
  {
   fprintf(stderr, "%s: add_build(): sqlite3_bind_text() failed, '%s'\n",
@@ -484,7 +613,7 @@ int add_build(struct buildmatrix_context *ctx)
   return 1;
  }
 
- if(sqlite3_bind_text(statement, 16, ctx->unique_identifier, strlen(ctx->unique_identifier),
+ if(sqlite3_bind_text(statement, 17, ctx->unique_identifier, strlen(ctx->unique_identifier),
                       SQLITE_TRANSIENT) != SQLITE_OK)
  {
   fprintf(stderr, "%s: add_build(): sqlite3_bind_text() failed, '%s'\n",
@@ -614,7 +743,8 @@ int add_build(struct buildmatrix_context *ctx)
   return 1;
  }
 
- if(sqlite3_bind_int(statement, 10, (ctx->test_results != NULL) ) != SQLITE_OK)
+ if(sqlite3_bind_int(statement, 10, 
+                     (ctx->test_results != NULL) || (ctx->test_results_streamed) ) != SQLITE_OK)
  {
   fprintf(stderr, "%s: add_build(): sqlite3_bind_int() failed, '%s'\n",
           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
@@ -650,6 +780,14 @@ int add_build(struct buildmatrix_context *ctx)
   }
  }
 
+ if(sqlite3_bind_int(statement, 13, ctx->artifact_codec) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: add_build(): sqlite3_bind_int() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
  code = sqlite3_step(statement);
  if(code != SQLITE_DONE)
  {
@@ -665,26 +803,68 @@ int add_build(struct buildmatrix_context *ctx)
   sqlite3_finalize(statement);
   return 1;
  }
+ sqlite3_finalize(statement);
 
  /* move the files out of limbo */
  if(ctx->checksum != NULL)
  {
-  if(limbo_to_database(ctx, ctx->checksum))
+  if(limbo_to_database(ctx, ctx->checksum, &(sizes[0])))
    return 1;
  }
 
  if(ctx->build_report != NULL)
  {
-  if(limbo_to_database(ctx, ctx->build_report))
+  if(limbo_to_database(ctx, ctx->build_report, &(sizes[1])))
    return 1;
  }
 
  if(ctx->build_output != NULL)
  {
-  if(limbo_to_database(ctx, ctx->build_output))
+  if(limbo_to_database(ctx, ctx->build_output, &(sizes[2])))
    return 1;
  }
 
+ /* a compressed file's size on disk isn't what a download or the dashboard should show, so
+    the uncompressed sizes are kept with the build */
+ sql = "UPDATE builds SET checksum_size=?, report_size=?, output_size=? WHERE build_id = ?";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: add_build(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ for(i=0; i<3; i++)
+ {
+  code = sizes[i] < 0 ? sqlite3_bind_null(statement, i + 1) :
+                        sqlite3_bind_int64(statement, i + 1, sizes[i]);
+  if(code != SQLITE_OK)
+   break;
+ }
+
+ if( (code != SQLITE_OK) ||
+     (sqlite3_bind_int(statement, 4, ctx->build_id) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: add_build(): sqlite3_bind() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ if(sqlite3_step(statement) != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: add_build(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+ sqlite3_finalize(statement);
+
+ /* moves the generation of the query cache, see open_query_cache() */
+ if(bump_change_counter(ctx, "builds"))
+  return 1;
+
  if(sqlite3_exec(ctx->db_ctx, "COMMIT TRANSACTION;",
     NULL, NULL, &errmsg) != SQLITE_OK)
  {
@@ -702,7 +882,8 @@ int service_list_jobs(struct buildmatrix_context *ctx)
  char *sql;
  const unsigned char *job_name;
  struct sqlite3_stmt *statement = NULL;
- int code, count = 0;
+ struct query_cache cache;
+ int code, count = 0, hit;
 
  if(ctx->verbose > 1)
   fprintf(stderr, 
@@ -711,6 +892,16 @@ int service_list_jobs(struct buildmatrix_context *ctx)
  if(open_database(ctx))
   return 1;
 
+ if(open_query_cache(ctx, &cache, "jobs", QUERY_FILTER_BRANCH | QUERY_FILTER_HOST,
+                     &(ctx->service_simple_lists_strategy), 0, &hit))
+  return 1;
+
+ if(hit)
+ {
+  close_database(ctx);
+  return 0;
+ }
+
  if(ctx->branch_name == NULL)
  { 
   if(ctx->build_node == NULL)
@@ -801,9 +992,11 @@ int service_list_jobs(struct buildmatrix_context *ctx)
     fprintf(stderr, "%s: service_list_jobs(): strategy callback failed\n",
             ctx->error_prefix);
    sqlite3_finalize(statement);
+   arena_free(&(cache.rows));
    return 1;
   }
 
+  record_query_cache_row(&cache, (const char *) job_name, strlen((const char *) job_name));
   count++;
  }
 
@@ -812,11 +1005,14 @@ int service_list_jobs(struct buildmatrix_context *ctx)
   fprintf(stderr, "%s: service_list_jobs(): sqlite3_step() failed, '%s'\n",
           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
   sqlite3_finalize(statement);
+  arena_free(&(cache.rows));
   return 1;
  }
 
  sqlite3_finalize(statement);
 
+ store_query_cache(ctx, &cache);
+
  if(ctx->verbose)
   fprintf(stderr, 
           "%s: service_list_jobs(): sent %d job name(s) with build node = %s, and branch = %s\n",
@@ -840,7 +1036,8 @@ int service_list_branches(struct buildmatrix_context *ctx)
  char *sql;
  const unsigned char *name;
  struct sqlite3_stmt *statement = NULL;
- int code, count = 0;
+ struct query_cache cache;
+ int code, count = 0, hit;
 
  if(ctx->verbose > 1)
   fprintf(stderr, 
@@ -849,6 +1046,16 @@ int service_list_branches(struct buildmatrix_context *ctx)
  if(open_database(ctx))
   return 1;
 
+ if(open_query_cache(ctx, &cache, "branches", QUERY_FILTER_JOB | QUERY_FILTER_HOST,
+                     &(ctx->service_simple_lists_strategy), 0, &hit))
+  return 1;
+
+ if(hit)
+ {
+  close_database(ctx);
+  return 0;
+ }
+
  if(ctx->job_name == NULL)
  { 
   if(ctx->build_node == NULL)
@@ -939,9 +1146,11 @@ int service_list_branches(struct buildmatrix_context *ctx)
     fprintf(stderr, "%s: service_list_jobs(): strategy callback failed\n",
             ctx->error_prefix);
    sqlite3_finalize(statement);
+   arena_free(&(cache.rows));
    return 1;
   }
 
+  record_query_cache_row(&cache, (const char *) name, strlen((const char *) name));
   count++;
  }
 
@@ -950,11 +1159,14 @@ int service_list_branches(struct buildmatrix_context *ctx)
   fprintf(stderr, "%s: service_list_branches(): sqlite3_step() failed, '%s'\n",
           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
   sqlite3_finalize(statement);
+  arena_free(&(cache.rows));
   return 1;
  }
 
  sqlite3_finalize(statement);
 
+ store_query_cache(ctx, &cache);
+
  if(ctx->verbose)
   fprintf(stderr, 
           "%s: service_list_branches(): sent %d branch name(s) with job name = %s, and build host = %s\n",
@@ -978,7 +1190,8 @@ int service_list_hosts(struct buildmatrix_context *ctx)
  char *sql;
  const unsigned char *name;
  struct sqlite3_stmt *statement = NULL;
- int code, count = 0;
+ struct query_cache cache;
+ int code, count = 0, hit;
 
  if(ctx->verbose > 1)
   fprintf(stderr, 
@@ -987,6 +1200,16 @@ int service_list_hosts(struct buildmatrix_context *ctx)
  if(open_database(ctx))
   return 1;
 
+ if(open_query_cache(ctx, &cache, "hosts", QUERY_FILTER_BRANCH | QUERY_FILTER_JOB,
+                     &(ctx->service_simple_lists_strategy), 0, &hit))
+  return 1;
+
+ if(hit)
+ {
+  close_database(ctx);
+  return 0;
+ }
+
  if(ctx->branch_name == NULL)
  { 
   if(ctx->job_name == NULL)
@@ -1077,9 +1300,11 @@ int service_list_hosts(struct buildmatrix_context *ctx)
     fprintf(stderr, "%s: service_list_jobs(): strategy callback failed\n",
             ctx->error_prefix);
    sqlite3_finalize(statement);
+   arena_free(&(cache.rows));
    return 1;
   }
 
+  record_query_cache_row(&cache, (const char *) name, strlen((const char *) name));
   count++;
  }
 
@@ -1088,11 +1313,14 @@ int service_list_hosts(struct buildmatrix_context *ctx)
   fprintf(stderr, "%s: service_list_hosts(): sqlite3_step() failed, '%s'\n",
           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
   sqlite3_finalize(statement);
+  arena_free(&(cache.rows));
   return 1;
  }
 
  sqlite3_finalize(statement);
 
+ store_query_cache(ctx, &cache);
+
  if(ctx->verbose)
   fprintf(stderr, 
           "%s: service_list_hosts(): sent %d hosts name(s) with job name = %s, and branch = %s\n",
@@ -1254,7 +1482,7 @@ int service_list_parameters(struct buildmatrix_context *ctx)
  const char *sql;
  const unsigned char *parameter;
  struct sqlite3_stmt *statement = NULL;
- int code, count = 0;
+ int code, count = 0, shared;
 
  if(ctx->verbose > 1)
   fprintf(stderr, 
@@ -1263,7 +1491,15 @@ int service_list_parameters(struct buildmatrix_context *ctx)
  if(open_database(ctx))
   return 1;
 
- sql = "SELECT distinct parameters.variable FROM parameters JOIN builds ON parameters.build_id;"; 
+ if(parameter_set_tables_exist(ctx, &shared))
+  return 1;
+
+ if(shared)
+  sql = "SELECT parameters.variable FROM parameters JOIN builds ON parameters.build_id "
+        "UNION SELECT string FROM parameter_strings "
+        "WHERE string_id IN (SELECT variable_id FROM parameter_set_pairs);";
+ else
+  sql = "SELECT distinct parameters.variable FROM parameters JOIN builds ON parameters.build_id;"; 
 
  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
  {
@@ -1331,160 +1567,515 @@ int service_list_parameters(struct buildmatrix_context *ctx)
  return 0;
 }
 
-int service_list_builds(struct buildmatrix_context *ctx)
+/* the build filters shared by "builds" and "scratch", appends a WHERE clause (or nothing) */
+int build_filter_sql(struct buildmatrix_context *ctx, char *sql, int size)
 {
- char sql[1024];
- struct sqlite3_stmt *statement = NULL;
- int code, sql_length, col_number = 1, where = 0, count;
- struct list_builds_data data;
-
- if(ctx->verbose > 1)
-  fprintf(stderr, 
-          "%s: service_list_builds()\n", ctx->error_prefix);
-
- if(open_database(ctx))
-  return 1;
-
- sql_length = 0;
-
- /* branch name, job name, build node, unique_identifier, user, build result, build time, totals  */
-
- sql_length =
- snprintf(sql, 1024 - sql_length,  
-          "SELECT build_id, branch, job, build_node, unique_identifier, users.name, result, "
-          "build_time, passed_tests, failed_tests, incomplete_tests, report, output, checksum, "
-          "has_tests, has_parameters, revision FROM builds JOIN users on builds.user_id"); 
+ int sql_length = 0, where = 0;
 
  if( (ctx->branch_name != NULL) ||
      (ctx->job_name != NULL) ||
-     (ctx->build_node != NULL) )
+     (ctx->build_node != NULL) ||
+     (ctx->submitter != NULL) ||
+     (ctx->since_time != 0) ||
+     (ctx->until_time != 0) )
   where = 1;
 
- if(where)
-  sql_length += snprintf(sql + sql_length, 1024 - sql_length, " WHERE ");
+ if(where == 0)
+  return 0;
+
+ sql_length += snprintf(sql + sql_length, size - sql_length, " WHERE ");
 
  if(ctx->branch_name != NULL)
- {
-  sql_length += 
-  snprintf(sql + sql_length, 1024 - sql_length,
-           "branch = ? and ");
- }
+  sql_length += snprintf(sql + sql_length, size - sql_length, "branch = ? and ");
  
  if(ctx->job_name != NULL)
- {
-  sql_length += 
-  snprintf(sql + sql_length, 1024 - sql_length,
-           "job = ? and ");
- }
+  sql_length += snprintf(sql + sql_length, size - sql_length, "job = ? and ");
  
  if(ctx->build_node != NULL)
- {
-  sql_length += 
-  snprintf(sql + sql_length, 1024 - sql_length,
-           "build_node = ? and ");
- }
+  sql_length += snprintf(sql + sql_length, size - sql_length, "build_node = ? and ");
 
- if(where)
-  sql_length -= 4;
+ if(ctx->submitter != NULL)
+  sql_length += snprintf(sql + sql_length, size - sql_length,
+                         "builds.user_id IN (SELECT user_id FROM users WHERE name = ?) and ");
 
- sql_length += 
- snprintf(sql + sql_length, 1024 - sql_length, ";");
+ if(ctx->since_time != 0)
+  sql_length += snprintf(sql + sql_length, size - sql_length, "build_time >= ? and ");
 
- if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
- {
-  fprintf(stderr, "%s: service_list_builds(): sqlite3_prepare(%s) failed, '%s'\n",
-          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
-  return 1;
- }
+ if(ctx->until_time != 0)
+  sql_length += snprintf(sql + sql_length, size - sql_length, "build_time < ? and ");
 
- if(ctx->branch_name != NULL)
+ sql_length -= 4;
+ sql[sql_length] = 0;
+
+ return sql_length;
+}
+
+int bind_build_filter(struct buildmatrix_context *ctx, struct sqlite3_stmt *statement,
+                      int *col_number)
+{
+ int i;
+ char *text[4];
+
+ text[0] = ctx->branch_name;
+ text[1] = ctx->job_name;
+ text[2] = ctx->build_node;
+ text[3] = ctx->submitter;
+
+ for(i=0; i<4; i++)
  {
-  if(sqlite3_bind_text(statement, col_number, ctx->branch_name, strlen(ctx->branch_name),
+  if(text[i] == NULL)
+   continue;
+
+  if(sqlite3_bind_text(statement, *col_number, text[i], strlen(text[i]),
                        SQLITE_TRANSIENT) != SQLITE_OK)
   {
-   fprintf(stderr, "%s: service_list_builds(): sqlite3_bind_text() failed, '%s'\n",
+   fprintf(stderr, "%s: bind_build_filter(): sqlite3_bind_text() failed, '%s'\n",
            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-   sqlite3_finalize(statement);
    return 1;
   }
-  col_number++;
+  (*col_number)++;
  }
 
- if(ctx->job_name != NULL)
+ if(ctx->since_time != 0)
  {
-  if(sqlite3_bind_text(statement, col_number, ctx->job_name, strlen(ctx->job_name),
-                       SQLITE_TRANSIENT) != SQLITE_OK)
+  if(sqlite3_bind_int64(statement, (*col_number)++, ctx->since_time) != SQLITE_OK)
   {
-   fprintf(stderr, "%s: service_list_builds(): sqlite3_bind_text() failed, '%s'\n",
+   fprintf(stderr, "%s: bind_build_filter(): sqlite3_bind_int64() failed, '%s'\n",
            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-   sqlite3_finalize(statement);
    return 1;
   }
-  col_number++;
  }
 
- if(ctx->build_node != NULL)
+ if(ctx->until_time != 0)
  {
-  if(sqlite3_bind_text(statement, col_number, ctx->build_node, strlen(ctx->build_node),
-                       SQLITE_TRANSIENT) != SQLITE_OK)
+  if(sqlite3_bind_int64(statement, (*col_number)++, ctx->until_time) != SQLITE_OK)
   {
-   fprintf(stderr, "%s: service_list_builds(): sqlite3_bind_text() failed, '%s'\n",
+   fprintf(stderr, "%s: bind_build_filter(): sqlite3_bind_int64() failed, '%s'\n",
            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-   sqlite3_finalize(statement);
    return 1;
   }
-  col_number++;
  }
 
- if(ctx->service_list_builds_strategy.start(ctx, 
-                                            ctx->service_list_builds_strategy.strategy_context,
-                                            NULL))
+ return 0;
+}
+
+/* jobs, branches, hosts and builds are answered from the query_cache table when the "builds"
+   change counter hasn't moved since the same command last ran with the same filters. Every
+   path that adds, removes or moves a build, or changes a user, bumps that counter in its own
+   transaction, so a hit reads neither builds nor the archives. Rows are kept one per line,
+   builds in the form format_list_builds_line() gives them.
+
+   The table lives in its own file, QUERY_CACHE_FILENAME next to the project database, on its
+   own connection. Storing a miss is a write, and a listing must never hold the project
+   database's write lock where a submission would run into it. The file is a cache and safe
+   to delete. */
+
+/* leaves ctx->cache_db_ctx NULL when the file can't be had, lists then just aren't cached */
+int open_query_cache_database(struct buildmatrix_context *ctx)
+{
+ char filename[4096];
+
+ if(ctx->cache_db_ctx != NULL)
+  return 0;
+
+ snprintf(filename, 4096, "%s/%s", ctx->local_project_directory, QUERY_CACHE_FILENAME);
+
+ if(sqlite3_open_v2(filename, &(ctx->cache_db_ctx), 
+                    ctx->db_read_only ? SQLITE_OPEN_READONLY : 
+                                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                    NULL) != SQLITE_OK)
  {
-  if(ctx->verbose > 1)
-   fprintf(stderr, "%s: service_list_builds(): strategy callback failed\n",
-           ctx->error_prefix);
-  return 1;
+  if(ctx->verbose)
+   fprintf(stderr, "%s: open_query_cache_database(): sqlite3_open('%s') failed, '%s'\n",
+           ctx->error_prefix, filename, sqlite3_errmsg(ctx->cache_db_ctx));
+  close_query_cache_database(ctx);
+  return 0;
  }
 
- count = 0;
- while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ if( (ctx->db_read_only == 0) &&
+     (sqlite3_exec(ctx->cache_db_ctx, 
+                   "CREATE TABLE IF NOT EXISTS query_cache (command TEXT, filters TEXT, "
+                   "generation INTEGER, n_rows INTEGER, rows TEXT, UNIQUE (command, filters));",
+                   NULL, NULL, NULL) != SQLITE_OK) )
  {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: open_query_cache_database(): could not set up query_cache, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->cache_db_ctx));
+  close_query_cache_database(ctx);
+ }
 
-  if(sqlite3_column_type(statement, 0) != SQLITE_INTEGER)
-  {
-   fprintf(stderr, "%s: service_list_builds(): builds.build_id is not an integer\n",
-           ctx->error_prefix);
-   sqlite3_finalize(statement);
-    return 1;
-  }
-  data.build_id = sqlite3_column_int(statement, 0);
+ return 0;
+}
 
-  if(sqlite3_column_type(statement, 1) != SQLITE_TEXT)
-  {
-   fprintf(stderr, "%s: service_list_builds(): branch_name is not text\n",
-           ctx->error_prefix);
-   sqlite3_finalize(statement);
-   return 1;
-  }
-  data.branch = (const char *) sqlite3_column_text(statement, 1);
+void close_query_cache_database(struct buildmatrix_context *ctx)
+{
+ if(ctx->cache_db_ctx != NULL)
+  sqlite3_close(ctx->cache_db_ctx);
 
-  if(sqlite3_column_type(statement, 2) != SQLITE_TEXT)
-  {
-   fprintf(stderr, "%s: service_list_builds(): job_name is not text\n",
-           ctx->error_prefix);
-   sqlite3_finalize(statement);
-   return 1;
-  }
-  data.job_name = (const char *) sqlite3_column_text(statement, 2);
+ ctx->cache_db_ctx = NULL;
+}
 
-  if(sqlite3_column_type(statement, 3) != SQLITE_TEXT)
-  {
-   fprintf(stderr, "%s: service_list_builds(): build_node is not text\n",
-           ctx->error_prefix);
-   sqlite3_finalize(statement);
-   return 1;
-  }
-  data.build_node = (const char *) sqlite3_column_text(statement, 3);
+/* the filters a list honors, in a fixed order, so the same question always has the same key */
+int query_cache_filters(struct buildmatrix_context *ctx, int filters, char *string, int size)
+{
+ const char *names[4] = { "branch", "job", "host", "submitter" };
+ const int bits[4] = { QUERY_FILTER_BRANCH, QUERY_FILTER_JOB, QUERY_FILTER_HOST,
+                       QUERY_FILTER_SUBMITTER };
+ char *values[4];
+ int length = 0, i;
+
+ values[0] = ctx->branch_name;
+ values[1] = ctx->job_name;
+ values[2] = ctx->build_node;
+ values[3] = ctx->submitter;
+
+ string[0] = 0;
+
+ for(i=0; i<4; i++)
+ {
+  if( ((filters & bits[i]) == 0) || (values[i] == NULL) || (length >= size) )
+   continue;
+
+  length += snprintf(string + length, size - length, "%s=%s\n", names[i], values[i]);
+ }
+
+ if( (filters & QUERY_FILTER_TIME) && (length < size) )
+  length += snprintf(string + length, size - length, "since=%lld\nuntil=%lld\n",
+                     ctx->since_time, ctx->until_time);
+
+ if(length >= size)
+  return -1;
+
+ return length;
+}
+
+/* On a hit the cached rows go through strategy, parsed back into list_builds_data when builds
+   is set, and *hit is set. On a miss the caller runs the query, passing each row to
+   record_query_cache_row() and finishing with store_query_cache(). */
+int open_query_cache(struct buildmatrix_context *ctx, struct query_cache *cache,
+                     const char *command, int filters, struct iterative_strategy *strategy,
+                     int builds, int *hit)
+{
+ struct sqlite3_stmt *statement = NULL;
+ struct list_builds_data data;
+ const char *rows, *end, *line;
+ char buffer[4096];
+ int code, length, failed = 0;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: open_query_cache(%s)\n", ctx->error_prefix, command);
+
+ memset(cache, 0, sizeof(struct query_cache));
+ cache->command = command;
+ *hit = 0;
+
+ if(read_change_counter(ctx, "builds", &(cache->generation)))
+  return 1;
+
+ /* a project from before the "builds" counter starts it at 0 */
+ if( (cache->generation < 0) && (ctx->db_read_only == 0) )
+ {
+  if( (create_change_counters(ctx)) ||
+      (read_change_counter(ctx, "builds", &(cache->generation))) )
+   return 1;
+ }
+
+ if( (cache->generation < 0) ||
+     (query_cache_filters(ctx, filters, cache->filters, 1024) < 0) ||
+     (open_query_cache_database(ctx)) ||
+     (ctx->cache_db_ctx == NULL) )
+  return 0;
+
+ cache->enabled = 1;
+
+ /* without the table yet, or with another process in the middle of storing, it's a miss */
+ if(sqlite3_prepare_v2(ctx->cache_db_ctx, 
+                       "SELECT n_rows, rows FROM query_cache WHERE command = ? AND filters = ? "
+                       "AND generation = ?;", -1, &statement, NULL) != SQLITE_OK)
+  return 0;
+
+ if( (sqlite3_bind_text(statement, 1, command, strlen(command), SQLITE_TRANSIENT) != SQLITE_OK) ||
+     (sqlite3_bind_text(statement, 2, cache->filters, strlen(cache->filters),
+                        SQLITE_TRANSIENT) != SQLITE_OK) ||
+     (sqlite3_bind_int64(statement, 3, cache->generation) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: open_query_cache(): sqlite3_bind() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->cache_db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ if((code = sqlite3_step(statement)) != SQLITE_ROW)
+ {
+  if( (code != SQLITE_DONE) && (ctx->verbose) )
+   fprintf(stderr, "%s: open_query_cache(): sqlite3_step() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->cache_db_ctx));
+
+  sqlite3_finalize(statement);
+  return 0;
+ }
+
+ if( (sqlite3_column_type(statement, 0) != SQLITE_INTEGER) ||
+     (sqlite3_column_type(statement, 1) != SQLITE_TEXT) )
+ {
+  fprintf(stderr, "%s: open_query_cache(): query_cache row for %s has the wrong types\n",
+          ctx->error_prefix, command);
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ *hit = 1;
+
+ if(ctx->verbose)
+  fprintf(stderr, "%s: %s answered from the query cache, %d row(s)\n", ctx->error_prefix,
+          command, sqlite3_column_int(statement, 0));
+
+ rows = (const char *) sqlite3_column_text(statement, 1);
+ end = rows + sqlite3_column_bytes(statement, 1);
+
+ failed = strategy->start(ctx, strategy->strategy_context, NULL);
+
+ while( (failed == 0) && (rows < end) )
+ {
+  line = rows;
+  while( (rows < end) && (*rows != '\n') )
+   rows++;
+
+  length = rows - line;
+  rows++;
+
+  if(length >= 4096)
+  {
+   fprintf(stderr, "%s: open_query_cache(): query_cache row for %s too long\n",
+           ctx->error_prefix, command);
+   failed = 1;
+   break;
+  }
+
+  memcpy(buffer, line, length);
+  buffer[length] = 0;
+
+  if(builds)
+  {
+   if((failed = parse_list_builds_line(ctx, buffer, length, &data)) == 0)
+    failed = strategy->iterative(ctx, strategy->strategy_context, &data);
+  } else {
+   failed = strategy->iterative(ctx, strategy->strategy_context, buffer);
+  }
+ }
+
+ sqlite3_finalize(statement);
+
+ if(failed)
+ {
+  if(ctx->verbose > 1)
+   fprintf(stderr, "%s: open_query_cache(): strategy callback failed\n", ctx->error_prefix);
+  return 1;
+ }
+
+ return strategy->done(ctx, strategy->strategy_context, NULL);
+}
+
+/* a list longer than QUERY_CACHE_LIMIT is not kept, rather than held in memory */
+int record_query_cache_row(struct query_cache *cache, const char *row, int length)
+{
+ size_t offset;
+
+ if(cache->enabled == 0)
+  return 0;
+
+ if( (cache->rows.used + length + 1 > QUERY_CACHE_LIMIT) ||
+     (arena_reserve(&(cache->rows), length + 1, &offset)) )
+ {
+  cache->enabled = 0;
+  arena_free(&(cache->rows));
+  return 0;
+ }
+
+ memcpy(cache->rows.base + offset, row, length);
+ cache->rows.base[offset + length] = '\n';
+ cache->n_rows++;
+ return 0;
+}
+
+/* Failing to store only costs the next run a query, so it is not an error. Another process
+   storing at the same time isn't waited on either: the connection has no busy timeout, so
+   BEGIN IMMEDIATE fails right away and this list just isn't kept. */
+int store_query_cache(struct buildmatrix_context *ctx, struct query_cache *cache)
+{
+ struct sqlite3_stmt *statement = NULL;
+ int failed = 0;
+
+ if( (cache->enabled == 0) || (ctx->db_read_only) || (ctx->cache_db_ctx == NULL) )
+ {
+  arena_free(&(cache->rows));
+  cache->enabled = 0;
+  return 0;
+ }
+
+ if(sqlite3_exec(ctx->cache_db_ctx, "BEGIN IMMEDIATE TRANSACTION;", NULL, NULL, NULL) != SQLITE_OK)
+ {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: store_query_cache(): not storing %s, '%s'\n",
+           ctx->error_prefix, cache->command, sqlite3_errmsg(ctx->cache_db_ctx));
+  arena_free(&(cache->rows));
+  cache->enabled = 0;
+  return 0;
+ }
+
+ /* rows of older generations can never be hits again */
+ if( (sqlite3_prepare_v2(ctx->cache_db_ctx, "DELETE FROM query_cache WHERE generation <> ?;",
+                         -1, &statement, NULL) != SQLITE_OK) ||
+     (sqlite3_bind_int64(statement, 1, cache->generation) != SQLITE_OK) ||
+     (sqlite3_step(statement) != SQLITE_DONE) )
+  failed = 1;
+
+ sqlite3_finalize(statement);
+ statement = NULL;
+
+ if( (failed == 0) &&
+     ( (sqlite3_prepare_v2(ctx->cache_db_ctx, 
+                           "INSERT OR REPLACE INTO query_cache (command, filters, generation, "
+                           "n_rows, rows) VALUES (?, ?, ?, ?, ?);",
+                           -1, &statement, NULL) != SQLITE_OK) ||
+       (sqlite3_bind_text(statement, 1, cache->command, strlen(cache->command),
+                          SQLITE_TRANSIENT) != SQLITE_OK) ||
+       (sqlite3_bind_text(statement, 2, cache->filters, strlen(cache->filters),
+                          SQLITE_TRANSIENT) != SQLITE_OK) ||
+       (sqlite3_bind_int64(statement, 3, cache->generation) != SQLITE_OK) ||
+       (sqlite3_bind_int(statement, 4, cache->n_rows) != SQLITE_OK) ||
+       (sqlite3_bind_text(statement, 5, cache->rows.base == NULL ? "" : cache->rows.base,
+                          cache->rows.used, SQLITE_TRANSIENT) != SQLITE_OK) ||
+       (sqlite3_step(statement) != SQLITE_DONE) ) )
+  failed = 1;
+
+ if( (failed) && (ctx->verbose) )
+  fprintf(stderr, "%s: store_query_cache(): could not store %s, '%s'\n",
+          ctx->error_prefix, cache->command, sqlite3_errmsg(ctx->cache_db_ctx));
+
+ sqlite3_finalize(statement);
+
+ if(sqlite3_exec(ctx->cache_db_ctx, failed ? "ROLLBACK TRANSACTION;" : "COMMIT TRANSACTION;",
+                 NULL, NULL, NULL) != SQLITE_OK)
+ {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: store_query_cache(): could not commit, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->cache_db_ctx));
+  sqlite3_exec(ctx->cache_db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+ }
+
+ arena_free(&(cache->rows));
+ cache->enabled = 0;
+ return 0;
+}
+
+int service_list_builds(struct buildmatrix_context *ctx)
+{
+ char sql[1024], line[4096];
+ struct sqlite3_stmt *statement = NULL;
+ int code, sql_length, col_number = 1, count, hit, length;
+ struct list_builds_data data;
+ struct query_cache cache;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, 
+          "%s: service_list_builds()\n", ctx->error_prefix);
+
+ if(open_database(ctx))
+  return 1;
+
+ /* a hit is answered before the builds table or any archive is opened */
+ if(open_query_cache(ctx, &cache, "builds", QUERY_FILTER_ALL,
+                     &(ctx->service_list_builds_strategy), 1, &hit))
+  return 1;
+
+ if(hit)
+ {
+  close_database(ctx);
+  return 0;
+ }
+
+ if(attach_archives(ctx, ctx->since_time, ctx->until_time, 0, 0))
+  return 1;
+
+ sql_length = 0;
+
+ /* branch name, job name, build node, unique_identifier, user, build result, build time, totals  */
+
+ sql_length =
+ snprintf(sql, 1024 - sql_length,  
+          "SELECT build_id, branch, job, build_node, unique_identifier, users.name, result, "
+          "build_time, passed_tests, failed_tests, incomplete_tests, report, output, checksum, "
+          "has_tests, has_parameters, revision FROM all_builds AS builds JOIN users on builds.user_id"); 
+
+ sql_length += build_filter_sql(ctx, sql + sql_length, 1024 - sql_length);
+
+ /* main's rows come ahead of the archives' in all_builds, put them back in submission order */
+ sql_length += 
+ snprintf(sql + sql_length, 1024 - sql_length, " ORDER BY build_id;");
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: service_list_builds(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
+  return 1;
+ }
+
+ if(bind_build_filter(ctx, statement, &col_number))
+ {
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ if(ctx->service_list_builds_strategy.start(ctx, 
+                                            ctx->service_list_builds_strategy.strategy_context,
+                                            NULL))
+ {
+  if(ctx->verbose > 1)
+   fprintf(stderr, "%s: service_list_builds(): strategy callback failed\n",
+           ctx->error_prefix);
+  return 1;
+ }
+
+ count = 0;
+ while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ {
+
+  if(sqlite3_column_type(statement, 0) != SQLITE_INTEGER)
+  {
+   fprintf(stderr, "%s: service_list_builds(): builds.build_id is not an integer\n",
+           ctx->error_prefix);
+   sqlite3_finalize(statement);
+    return 1;
+  }
+  data.build_id = sqlite3_column_int(statement, 0);
+
+  if(sqlite3_column_type(statement, 1) != SQLITE_TEXT)
+  {
+   fprintf(stderr, "%s: service_list_builds(): branch_name is not text\n",
+           ctx->error_prefix);
+   sqlite3_finalize(statement);
+   return 1;
+  }
+  data.branch = (const char *) sqlite3_column_text(statement, 1);
+
+  if(sqlite3_column_type(statement, 2) != SQLITE_TEXT)
+  {
+   fprintf(stderr, "%s: service_list_builds(): job_name is not text\n",
+           ctx->error_prefix);
+   sqlite3_finalize(statement);
+   return 1;
+  }
+  data.job_name = (const char *) sqlite3_column_text(statement, 2);
+
+  if(sqlite3_column_type(statement, 3) != SQLITE_TEXT)
+  {
+   fprintf(stderr, "%s: service_list_builds(): build_node is not text\n",
+           ctx->error_prefix);
+   sqlite3_finalize(statement);
+   return 1;
+  }
+  data.build_node = (const char *) sqlite3_column_text(statement, 3);
 
   if(sqlite3_column_type(statement, 4) != SQLITE_TEXT)
   {
@@ -1631,8 +2222,15 @@ int service_list_builds(struct buildmatrix_context *ctx)
     fprintf(stderr, "%s: service_list_builds(): strategy callback failed\n",
             ctx->error_prefix);
    sqlite3_finalize(statement);
+   arena_free(&(cache.rows));
    return 1;
   }
+
+  length = format_list_builds_line(line, 4096, &data);
+  if( (length > 0) && (length < 4096) )
+   record_query_cache_row(&cache, line, length - 1);
+  else
+   cache.enabled = 0;
   count++;
  }
 
@@ -1642,6 +2240,7 @@ int service_list_builds(struct buildmatrix_context *ctx)
   if(ctx->verbose > 1)
    fprintf(stderr, "%s: service_list_builds(): strategy callback failed\n",
            ctx->error_prefix);
+  arena_free(&(cache.rows));
   return 1;
  }
 
@@ -1650,11 +2249,14 @@ int service_list_builds(struct buildmatrix_context *ctx)
   fprintf(stderr, "%s: service_list_builds(): sqlite3_step() failed, '%s'\n",
           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
   sqlite3_finalize(statement);
+  arena_free(&(cache.rows));
   return 1;
  }
 
  sqlite3_finalize(statement);
 
+ store_query_cache(ctx, &cache);
+
  if(ctx->verbose )
   fprintf(stderr, 
           "%s: service_list_builds(): sent %d records\n", ctx->error_prefix, count);
@@ -1682,8 +2284,9 @@ int service_get_build(struct buildmatrix_context *ctx)
 
  sql = "SELECT build_id, build_node, result, build_time, "
        "passed_tests, failed_tests, incomplete_tests, "
-       "report, output, checksum, job, branch, users.name, revision "
-       "FROM builds JOIN users on builds.user_id WHERE unique_identifier = ?";
+       "report, output, checksum, job, branch, users.name, revision, artifact_codec, "
+       "checksum_size, report_size, output_size "
+       "FROM all_builds AS builds JOIN users on builds.user_id WHERE build_id = ?";
 
  if(ctx->unique_identifier == NULL)
  {
@@ -1693,6 +2296,16 @@ int service_get_build(struct buildmatrix_context *ctx)
   return 1;
  }
 
+ /* an archived build is found the way pull_test_results() finds its scores, through the
+    all_builds view with just its archive attached */
+ if( (upgrade_artifact_columns(ctx)) ||
+     (lookup_build_id(ctx)) ||
+     (attach_archives(ctx, 0, 0, ctx->build_id, ctx->build_id)) )
+ {
+  close_database(ctx);
+  return 1;
+ }
+
  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
  {
   fprintf(stderr, "%s: service_get_build(): sqlite3_prepare(%s) failed, '%s'\n",
@@ -1700,10 +2313,9 @@ int service_get_build(struct buildmatrix_context *ctx)
   return 1;
  }
 
- if(sqlite3_bind_text(statement, 1, ctx->unique_identifier, strlen(ctx->unique_identifier),
-                      SQLITE_TRANSIENT) != SQLITE_OK)
+ if(sqlite3_bind_int(statement, 1, ctx->build_id) != SQLITE_OK)
  {
-  fprintf(stderr, "%s: service_get_build(): sqlite3_bind_text() failed, '%s'\n",
+  fprintf(stderr, "%s: service_get_build(): sqlite3_bind_int() failed, '%s'\n",
           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
   sqlite3_finalize(statement);
   return 1;
@@ -1856,6 +2468,11 @@ int service_get_build(struct buildmatrix_context *ctx)
   ctx->revision = strdup((const char *) sqlite3_column_text(statement, 13));
  }
 
+ ctx->artifact_codec = BLDMTRX_CODEC_NONE;
+ if(sqlite3_column_type(statement, 14) == SQLITE_INTEGER)
+  ctx->artifact_codec = sqlite3_column_int(statement, 14);
+ read_artifact_sizes(ctx, statement, 15);
+
  sqlite3_finalize(statement);
  close_database(ctx);
 
@@ -1864,7 +2481,7 @@ int service_get_build(struct buildmatrix_context *ctx)
 
 int service_scratch(struct buildmatrix_context *ctx)
 {
- char *sql, *errmsg;
+ char *sql, *errmsg, history_sql[256];
  struct sqlite3_stmt *statement = NULL;
  int code;
 
@@ -1893,6 +2510,24 @@ int service_scratch(struct buildmatrix_context *ctx)
  if(lookup_build_id(ctx))
   return 1;
 
+ /* forget_test_history() works from build_set, like the other ways builds leave */
+ snprintf(history_sql, 256, "CREATE TEMP TABLE IF NOT EXISTS build_set (build_id INTEGER PRIMARY KEY); "
+          "DELETE FROM build_set; INSERT INTO build_set VALUES (%d);", ctx->build_id);
+
+ if(sqlite3_exec(ctx->db_ctx, history_sql, NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: service_scratch(): could not fill build_set, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ if(forget_test_history(ctx))
+  return 1;
+
+ if(release_test_blobs(ctx))
+  return 1;
+
  sql = "SELECT report, output, checksum FROM builds WHERE build_id = ?";
 
  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
@@ -2042,6 +2677,12 @@ int service_scratch(struct buildmatrix_context *ctx)
 
  sqlite3_finalize(statement);
 
+ /* tells generate_report() that cached parts of the dashboard may name this build, and
+    open_query_cache() that cached lists do */
+ if( (bump_change_counter(ctx, "scratch")) ||
+     (bump_change_counter(ctx, "builds")) )
+  return 1;
+
  // no point in checking fail, since this doesn't jive with the transaction model anyway
  remove_db_file(ctx, ctx->build_report);
  remove_db_file(ctx, ctx->build_output);
@@ -2060,6 +2701,214 @@ int service_scratch(struct buildmatrix_context *ctx)
  return 0;
 }
 
+/* Deletes every build whose build_id is in the temp table build_set, along with its scores
+   and parameters. The caller owns the transaction. The artifact files are not touched, instead
+   their names are appended to identifiers / files so they can be removed after a commit. */
+int delete_build_set(struct buildmatrix_context *ctx, char ***identifiers, char ***files,
+                     int *n_files, int *n_builds)
+{
+ char *sql, *errmsg;
+ const char *identifier;
+ struct sqlite3_stmt *statement = NULL;
+ int code, i;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: delete_build_set()\n", ctx->error_prefix);
+
+ sql = "SELECT unique_identifier, report, output, checksum FROM builds "
+       "WHERE build_id IN (SELECT build_id FROM build_set);";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: delete_build_set(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
+  return 1;
+ }
+
+ while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ {
+  if(sqlite3_column_type(statement, 0) != SQLITE_TEXT)
+  {
+   fprintf(stderr, "%s: delete_build_set(): unique_identifier is not text\n",
+           ctx->error_prefix);
+   sqlite3_finalize(statement);
+   return 1;
+  }
+  identifier = (const char *) sqlite3_column_text(statement, 0);
+
+  for(i=1; i<4; i++)
+  {
+   if(sqlite3_column_type(statement, i) != SQLITE_TEXT)
+    continue;
+
+   if( (add_to_string_array(identifiers, *n_files, identifier, -1, 0) != 0) ||
+       (add_to_string_array(files, *n_files, 
+                            (const char *) sqlite3_column_text(statement, i), -1, 0) != 0) )
+   {
+    sqlite3_finalize(statement);
+    return 1;
+   }
+   (*n_files)++;
+  }
+ }
+
+ if(code != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: delete_build_set(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+
+ if(forget_test_history(ctx))
+  return 1;
+
+ if(release_test_blobs(ctx))
+  return 1;
+
+ if(sqlite3_exec(ctx->db_ctx,
+                 "DELETE FROM scores WHERE build_id IN (SELECT build_id FROM build_set);",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: delete_build_set(): could not delete scores, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ if(sqlite3_exec(ctx->db_ctx,
+                 "DELETE FROM parameters WHERE build_id IN (SELECT build_id FROM build_set);",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: delete_build_set(): could not delete parameters, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ if(sqlite3_exec(ctx->db_ctx,
+                 "DELETE FROM builds WHERE build_id IN (SELECT build_id FROM build_set);",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: delete_build_set(): could not delete builds, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ if(n_builds != NULL)
+  *n_builds = sqlite3_changes(ctx->db_ctx);
+
+ if( (bump_change_counter(ctx, "scratch")) ||
+     (bump_change_counter(ctx, "builds")) )
+  return 1;
+
+ return 0;
+}
+
+int service_scratch_matching(struct buildmatrix_context *ctx, int *n_builds)
+{
+ char sql[1024], *errmsg, **identifiers = NULL, **files = NULL;
+ struct sqlite3_stmt *statement = NULL;
+ int sql_length, col_number = 1, n_files = 0;
+
+ if(ctx->verbose)
+  fprintf(stderr, 
+          "%s: service_scratch_matching()\n", ctx->error_prefix);
+
+ *n_builds = 0;
+
+ sql_length = snprintf(sql, 1024, "INSERT INTO build_set SELECT build_id FROM builds");
+
+ if(build_filter_sql(ctx, sql + sql_length, 1024 - sql_length) == 0)
+ {
+  fprintf(stderr, "%s: service_scratch_matching(): refusing to scratch without a filter\n",
+          ctx->error_prefix);
+  return 1;
+ }
+
+ if(open_database(ctx))
+  return 1;
+
+ if(sqlite3_exec(ctx->db_ctx, "CREATE TEMP TABLE IF NOT EXISTS build_set "
+                 "(build_id INTEGER PRIMARY KEY); BEGIN IMMEDIATE TRANSACTION; "
+                 "DELETE FROM build_set;", NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: service_scratch_matching(): sqlite3_exec(\"BEGIN TRANSACTION;\"): '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+  close_database(ctx);
+  return 1;
+ }
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: service_scratch_matching(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+  close_database(ctx);
+  return 1;
+ }
+
+ if( (bind_build_filter(ctx, statement, &col_number)) ||
+     (sqlite3_step(statement) != SQLITE_DONE) )
+ {
+  fprintf(stderr, "%s: service_scratch_matching(): could not select builds, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+  close_database(ctx);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+
+ if(delete_build_set(ctx, &identifiers, &files, &n_files, n_builds))
+ {
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+  if(n_files > 0)
+  {
+   free_string_array(identifiers, n_files);
+   free_string_array(files, n_files);
+  }
+  close_database(ctx);
+  return 1;
+ }
+
+ if(sqlite3_exec(ctx->db_ctx, "COMMIT TRANSACTION;", NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: service_scratch_matching(): sqlite3_exec(\"COMMIT TRANSACTION;\"): '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+  if(n_files > 0)
+  {
+   free_string_array(identifiers, n_files);
+   free_string_array(files, n_files);
+  }
+  close_database(ctx);
+  return 1;
+ }
+
+ /* the rows are gone and the write lock is released, the files can go at their own pace */
+ if(n_files > 0)
+ {
+  remove_build_files_in_background(ctx, identifiers, files, n_files);
+  free_string_array(identifiers, n_files);
+  free_string_array(files, n_files);
+ }
+
+ if(ctx->verbose)
+  fprintf(stderr, "%s: service_scratch_matching(): scratched %d builds\n",
+          ctx->error_prefix, *n_builds);
+
+ close_database(ctx);
+ return 0;
+}
+
 int service_pull(struct buildmatrix_context *ctx)
 {
  char *sql;
@@ -2074,8 +2923,15 @@ int service_pull(struct buildmatrix_context *ctx)
 
  sql = "SELECT build_id, branch, job, unique_identifier, build_node, result, build_time, "
        "passed_tests, failed_tests, incomplete_tests, report, output, checksum, users.name, "
-       "revision, has_tests, has_parameters "
-       "FROM builds JOIN users on builds.user_id WHERE build_id > ? ORDER BY build_id LIMIT 1";
+       "revision, has_tests, has_parameters, artifact_codec, "
+       "checksum_size, report_size, output_size "
+       "FROM all_builds AS builds JOIN users on builds.user_id WHERE build_id > ? "
+       "ORDER BY build_id LIMIT 1";
+
+ /* ahead of the views, which take their column list from main.builds */
+ if( (upgrade_artifact_columns(ctx)) ||
+     (attach_archives(ctx, 0, 0, ctx->pull_build_id + 1, 0)) )
+  return 1;
 
  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
  {
@@ -2210,6 +3066,11 @@ int service_pull(struct buildmatrix_context *ctx)
   if(sqlite3_column_type(statement, 16) == SQLITE_INTEGER)
    has_parameters = sqlite3_column_int(statement, 16);
 
+  ctx->artifact_codec = BLDMTRX_CODEC_NONE;
+  if(sqlite3_column_type(statement, 17) == SQLITE_INTEGER)
+   ctx->artifact_codec = sqlite3_column_int(statement, 17);
+  read_artifact_sizes(ctx, statement, 18);
+
  } else {
   if(code == SQLITE_DONE)
   {
@@ -0,0 +1,447 @@
+/*
+    Copyright 2013 Stover Enterprises, LLC (An Alabama Limited Liability Corporation) 
+    Written by C. Thomas Stover
+
+    This file is part of the program Build Matrix.
+    See http://buildmatrix.stoverenterprises.com for more information.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "prototypes.h"
+
+/* Machine readable output for builds, tests and build, chosen with --format. Each row is
+   written to stdout as the strategy is handed it, so listings of any size stream through in
+   constant memory. NDJSON is one JSON object per line. TSV starts listings with a header line;
+   tab, newline, carriage return and backslash in fields are written as \t, \n, \r and \\, and
+   a missing value as \N. The rows of build are mixed, so there each row starts with its kind,
+   build, score or parameter, instead of a header.
+
+   A row is described by parallel arrays of field names, values and kinds: 's' is a string,
+   'n' a number already formatted, and 'b' a flag, "0" or "1". A NULL value is missing. */
+
+const char *export_result_names[4] = { "unknown", "passed", "failed", "incomplete" };
+
+int export_json_string(const char *string)
+{
+ size_t span;
+ unsigned char c;
+
+ if(string == NULL)
+ {
+  fputs("null", stdout);
+  return 0;
+ }
+
+ putchar('"');
+
+ while(*string != 0)
+ {
+  /* copy runs that need no escaping in one call */
+  span = 0;
+  while( ((c = (unsigned char) string[span]) != 0) &&
+         (c >= 0x20) && (c != '"') && (c != '\\') )
+   span++;
+
+  if(span > 0)
+  {
+   fwrite(string, 1, span, stdout);
+   string += span;
+   continue;
+  }
+
+  c = (unsigned char) *string++;
+  switch(c)
+  {
+   case '"':
+        fputs("\\\"", stdout);
+        break;
+
+   case '\\':
+        fputs("\\\\", stdout);
+        break;
+
+   case '\n':
+        fputs("\\n", stdout);
+        break;
+
+   case '\r':
+        fputs("\\r", stdout);
+        break;
+
+   case '\t':
+        fputs("\\t", stdout);
+        break;
+
+   default:
+        printf("\\u%04x", c);
+  }
+ }
+
+ putchar('"');
+ return 0;
+}
+
+int export_tsv_string(const char *string)
+{
+ size_t span;
+ char c;
+
+ if(string == NULL)
+ {
+  fputs("\\N", stdout);
+  return 0;
+ }
+
+ while(*string != 0)
+ {
+  span = strcspn(string, "\t\n\r\\");
+
+  if(span > 0)
+  {
+   fwrite(string, 1, span, stdout);
+   string += span;
+   continue;
+  }
+
+  c = *string++;
+  switch(c)
+  {
+   case '\t':
+        fputs("\\t", stdout);
+        break;
+
+   case '\n':
+        fputs("\\n", stdout);
+        break;
+
+   case '\r':
+        fputs("\\r", stdout);
+        break;
+
+   default:
+        fputs("\\\\", stdout);
+  }
+ }
+
+ return 0;
+}
+
+int export_header(const struct buildmatrix_context *ctx, int n_fields, const char **names)
+{
+ int i;
+
+ if(ctx->output_format != OUTPUT_FORMAT_TSV)
+  return 0;
+
+ for(i=0; i<n_fields; i++)
+ {
+  if(i > 0)
+   putchar('\t');
+  fputs(names[i], stdout);
+ }
+ putchar('\n');
+
+ return 0;
+}
+
+int export_row(const struct buildmatrix_context *ctx, int n_fields, const char **names,
+               const char *kinds, const char **values)
+{
+ int i;
+
+ if(ctx->output_format == OUTPUT_FORMAT_TSV)
+ {
+  for(i=0; i<n_fields; i++)
+  {
+   if(i > 0)
+    putchar('\t');
+
+   if( (kinds[i] == 's') || (values[i] == NULL) )
+    export_tsv_string(values[i]);
+   else
+    fputs(values[i], stdout);
+  }
+  putchar('\n');
+  return 0;
+ }
+
+ putchar('{');
+ for(i=0; i<n_fields; i++)
+ {
+  if(i > 0)
+   putchar(',');
+
+  printf("\"%s\":", names[i]);
+
+  if(values[i] == NULL)
+  {
+   fputs("null", stdout);
+   continue;
+  }
+
+  switch(kinds[i])
+  {
+   case 's':
+        export_json_string(values[i]);
+        break;
+
+   case 'b':
+        fputs(strcmp(values[i], "0") == 0 ? "false" : "true", stdout);
+        break;
+
+   default:
+        fputs(values[i], stdout);
+  }
+ }
+ fputs("}\n", stdout);
+
+ return 0;
+}
+
+int export_flush(const struct buildmatrix_context *ctx)
+{
+ if(fflush(stdout) != 0)
+ {
+  fprintf(stderr, "%s: could not write to standard output, %s\n",
+          ctx->error_prefix, strerror(errno));
+  return 1;
+ }
+
+ return 0;
+}
+
+const char *export_build_list_names[17] = 
+ { "build_id", "unique_identifier", "job", "branch", "revision", "result", "build_host",
+   "user", "build_time", "passed", "failed", "incomplete", "has_parameters", "has_tests",
+   "report", "output", "checksum" };
+
+int service_list_builds_strategy_export_start(const struct buildmatrix_context *ctx, 
+                                              void * const strategy_context, const void *ptr)
+{
+ if(ctx->verbose > 2)
+  fprintf(stderr, "%s: service_list_builds_strategy_export_start()\n", ctx->error_prefix);
+
+ return export_header(ctx, 17, export_build_list_names);
+}
+
+int service_list_builds_strategy_export_iterative(const struct buildmatrix_context *ctx, 
+                                                  void * const strategy_context, const void *ptr)
+{
+ const struct list_builds_data *data = (const struct list_builds_data *) ptr;
+ char numbers[5][32];
+ const char *values[17];
+
+ if(ctx->verbose > 2)
+  fprintf(stderr, "%s: service_list_builds_strategy_export_iterative()\n", ctx->error_prefix);
+
+ snprintf(numbers[0], 32, "%d", data->build_id);
+ snprintf(numbers[1], 32, "%lld", data->build_time);
+ snprintf(numbers[2], 32, "%d", data->passed);
+ snprintf(numbers[3], 32, "%d", data->failed);
+ snprintf(numbers[4], 32, "%d", data->incompleted);
+
+ values[0] = numbers[0];
+ values[1] = data->unique_identifier;
+ values[2] = data->job_name;
+ values[3] = data->branch;
+ /* service_list_builds() sends N/A for a build without a revision */
+ if( (data->revision != NULL) && (strcmp(data->revision, "N/A") == 0) )
+  values[4] = NULL;
+ else
+  values[4] = data->revision;
+ values[5] = data->build_result ? "success" : "failure";
+ values[6] = data->build_node;
+ values[7] = data->user;
+ values[8] = numbers[1];
+ values[9] = numbers[2];
+ values[10] = numbers[3];
+ values[11] = numbers[4];
+ values[12] = data->has_parameters ? "1" : "0";
+ values[13] = data->has_tests ? "1" : "0";
+ values[14] = data->report_name;
+ values[15] = data->output_name;
+ values[16] = data->checksum_name;
+
+ return export_row(ctx, 17, export_build_list_names, "nsssssssnnnnbbsss", values);
+}
+
+int service_list_builds_strategy_export_done(const struct buildmatrix_context *ctx, 
+                                             void * const strategy_context, const void *ptr)
+{
+ if(ctx->verbose > 2)
+  fprintf(stderr, "%s: service_list_builds_strategy_export_done()\n", ctx->error_prefix);
+
+ return export_flush(ctx);
+}
+
+const char *export_test_list_names[10] = 
+ { "suite", "test", "job", "branch", "passed", "failed", "incomplete", "last_result", "flips",
+   "last_failure" };
+
+int service_list_tests_strategy_export_start(const struct buildmatrix_context *ctx, 
+                                             void * const strategy_context, const void *ptr)
+{
+ if(ctx->verbose > 2)
+  fprintf(stderr, "%s: service_list_tests_strategy_export_start()\n", ctx->error_prefix);
+
+ return export_header(ctx, 10, export_test_list_names);
+}
+
+int service_list_tests_strategy_export_iterative(const struct buildmatrix_context *ctx, 
+                                                 void * const strategy_context, const void *ptr)
+{
+ const struct test_history_data *data = (const struct test_history_data *) ptr;
+ char numbers[4][32];
+ const char *values[10];
+
+ if(ctx->verbose > 2)
+  fprintf(stderr, "%s: service_list_tests_strategy_export_iterative()\n", ctx->error_prefix);
+
+ snprintf(numbers[0], 32, "%d", data->passed);
+ snprintf(numbers[1], 32, "%d", data->failed);
+ snprintf(numbers[2], 32, "%d", data->incompleted);
+ snprintf(numbers[3], 32, "%d", data->flips);
+
+ values[0] = data->suite;
+ values[1] = data->test;
+ values[2] = data->job_name;
+ values[3] = data->branch;
+ values[4] = numbers[0];
+ values[5] = numbers[1];
+ values[6] = numbers[2];
+ values[7] = export_result_names[(data->last_result > 0 && data->last_result < 4) ? 
+                                 data->last_result : 0];
+ values[8] = numbers[3];
+ values[9] = data->last_failure;
+
+ return export_row(ctx, 10, export_test_list_names, "ssssnnnsns", values);
+}
+
+int service_list_tests_strategy_export_done(const struct buildmatrix_context *ctx, 
+                                            void * const strategy_context, const void *ptr)
+{
+ if(ctx->verbose > 2)
+  fprintf(stderr, "%s: service_list_tests_strategy_export_done()\n", ctx->error_prefix);
+
+ return export_flush(ctx);
+}
+
+/* build, then the build's scores suite by suite, then its parameters */
+int process_build_strategy_export(struct buildmatrix_context * const ctx)
+{
+ const char *build_names[15] = 
+  { "record", "unique_identifier", "job", "branch", "revision", "result", "build_host",
+    "user", "build_time", "passed", "failed", "incomplete", "report", "output", "checksum" };
+ const char *score_names[5] = { "record", "suite", "test", "result", "data" };
+ const char *parameter_names[3] = { "record", "name", "value" };
+ const char *values[15];
+ char numbers[4][32];
+ struct suite *s;
+ struct test *t;
+ int x, y;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: process_build_strategy_export()\n", ctx->error_prefix);
+
+ snprintf(numbers[0], 32, "%lld", ctx->build_time);
+ snprintf(numbers[1], 32, "%d", ctx->test_totals[1]);
+ snprintf(numbers[2], 32, "%d", ctx->test_totals[2]);
+ snprintf(numbers[3], 32, "%d", ctx->test_totals[3]);
+
+ values[0] = "build";
+ values[1] = ctx->unique_identifier;
+ values[2] = ctx->job_name;
+ values[3] = ctx->branch_name;
+ values[4] = ctx->revision;
+ values[5] = ctx->build_result ? "success" : "failure";
+ values[6] = ctx->build_node;
+ values[7] = ctx->user;
+ values[8] = numbers[0];
+ values[9] = numbers[1];
+ values[10] = numbers[2];
+ values[11] = numbers[3];
+ values[12] = ctx->report_written ? ctx->report_out_filename : NULL;
+ values[13] = ctx->output_written ? ctx->output_out_filename : NULL;
+ values[14] = ctx->checksum_written ? ctx->checksum_out_filename : NULL;
+
+ if(ctx->test_totals[0] == 0)
+  values[9] = values[10] = values[11] = NULL;
+
+ export_row(ctx, 15, build_names, "ssssssssnnnnsss", values);
+
+ if(ctx->test_results != NULL)
+ {
+  values[0] = "score";
+  for(x=0; x<ctx->test_results->n_suites; x++)
+  {
+   s = &(ctx->test_results->suites[x]);
+   values[1] = s->name;
+
+   for(y=0; y<s->n_tests; y++)
+   {
+    t = &(s->tests[y]);
+    values[2] = t->name;
+    values[3] = export_result_names[(t->result > 0 && t->result < 4) ? t->result : 0];
+    values[4] = t->data;
+    export_row(ctx, 5, score_names, "sssss", values);
+   }
+  }
+ }
+
+ if(ctx->parameters != NULL)
+ {
+  values[0] = "parameter";
+  for(x=0; x<ctx->parameters->n_pairs; x++)
+  {
+   values[1] = ctx->parameters->keys[x];
+   values[2] = ctx->parameters->values[x];
+   export_row(ctx, 3, parameter_names, "sss", values);
+  }
+ }
+
+ return export_flush(ctx);
+}
+
+int setup_export(struct buildmatrix_context * const ctx)
+{
+ struct iterative_strategy s;
+
+ if(ctx->output_format == OUTPUT_FORMAT_CONSOLE)
+  return 0;
+
+ s.start = service_list_builds_strategy_export_start;
+ s.iterative = service_list_builds_strategy_export_iterative;
+ s.done = service_list_builds_strategy_export_done;
+ s.strategy_context = NULL;
+
+ if(ctx->local)
+  ctx->service_list_builds_strategy = s;
+ else
+  ctx->build_list_strategy = s;
+
+ s.start = service_list_tests_strategy_export_start;
+ s.iterative = service_list_tests_strategy_export_iterative;
+ s.done = service_list_tests_strategy_export_done;
+ s.strategy_context = NULL;
+
+ if(ctx->local)
+  ctx->service_list_tests_strategy = s;
+ else
+  ctx->test_list_strategy = s;
+
+ ctx->process_build_strategy = process_build_strategy_export;
+
+ return 0;
+}
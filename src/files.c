@@ -22,11 +22,14 @@
 #include "prototypes.h"
 #include <dirent.h>
 
+/* Reads all of a file, or a pipe, onto the heap. *filesize is the number of bytes read, and
+   two 0 bytes follow them. */
 char *read_disk_file(struct buildmatrix_context *ctx, char *filename, size_t *filesize)
 {
- int fd, n_bytes, length;
+ int fd, length;
+ ssize_t n_bytes;
  size_t bytes_read = 0, allocation_size;
- char *buffer;
+ char *buffer, *bigger;
  struct stat stat_buffer;
 
  if((length = strlen(filename)) > 4000)
@@ -50,7 +53,8 @@ char *read_disk_file(struct buildmatrix_context *ctx, char *filename, size_t *fi
   return NULL;
  }
 
- allocation_size = stat_buffer.st_size + 2;
+ /* st_size is only a first guess, pipes and special files report 0 or less than they have */
+ allocation_size = stat_buffer.st_size + 4096;
  if((buffer = malloc(allocation_size)) == NULL)
  {
   fprintf(stderr, "%s: malloc(%d) failed\n", ctx->error_prefix, (int) allocation_size);
@@ -58,11 +62,26 @@ char *read_disk_file(struct buildmatrix_context *ctx, char *filename, size_t *fi
   return NULL;
  }
 
- while(bytes_read < (allocation_size - 2))
+ while(1)
  {
+  if(allocation_size - bytes_read < 3)
+  {
+   allocation_size *= 2;
+   if((bigger = realloc(buffer, allocation_size)) == NULL)
+   {
+    fprintf(stderr, "%s: realloc(%d) failed\n", ctx->error_prefix, (int) allocation_size);
+    close(fd);
+    free(buffer);
+    return NULL;
+   }
+   buffer = bigger;
+  }
 
-  if((n_bytes = read(fd, buffer + bytes_read, allocation_size - bytes_read)) < 0)
+  if((n_bytes = read(fd, buffer + bytes_read, allocation_size - bytes_read - 2)) < 0)
   {
+   if(errno == EINTR)
+    continue;
+
    fprintf(stderr, "%s: read_disk_file(): read() failed: %s\n",
            ctx->error_prefix, strerror(errno));
    close(fd);
@@ -70,6 +89,9 @@ char *read_disk_file(struct buildmatrix_context *ctx, char *filename, size_t *fi
    return NULL;
   }
 
+  if(n_bytes == 0)
+   break;
+
   bytes_read += n_bytes;
  }
  buffer[bytes_read] = 0;
@@ -78,15 +100,82 @@ char *read_disk_file(struct buildmatrix_context *ctx, char *filename, size_t *fi
  close(fd);
 
  if(filesize != NULL)
-  *filesize = allocation_size;
+  *filesize = bytes_read;
  return buffer;
 }
 
-int remove_db_file(struct buildmatrix_context *ctx, const char *filename)
+/* Maps a regular file read only, for the parsers that walk a whole input file once. The
+   mapping is not terminated, callers must never look at or past byte *filesize. Anything
+   that can't be mapped, pipes, special files and empty files, goes through read_disk_file()
+   instead. *mapped says which, for release_disk_file(). */
+char *map_disk_file(struct buildmatrix_context *ctx, char *filename, size_t *filesize,
+                    int *mapped)
 {
- char *path, dir[3];
- int allocation_size;
+ int fd;
+ void *contents;
+ struct stat stat_buffer;
+
+ *mapped = 0;
+
+ if(strlen(filename) > 4000)
+ {
+  fprintf(stderr, "%s: filename \"%s\" too long\n", ctx->error_prefix, filename);
+  return NULL;
+ }
+
+ if((fd = open(filename, O_RDONLY)) < 0)
+ {
+  fprintf(stderr, "%s: map_disk_file(): open(%s) failed: %s\n", 
+          ctx->error_prefix, filename, strerror(errno));
+  return NULL;
+ }
 
+ if(fstat(fd, &stat_buffer))
+ {
+  fprintf(stderr, "%s: map_disk_file(): fstat() failed: %s\n",
+           ctx->error_prefix, strerror(errno));
+  close(fd);
+  return NULL;
+ }
+
+ if( (S_ISREG(stat_buffer.st_mode) == 0) || (stat_buffer.st_size == 0) )
+ {
+  close(fd);
+  return read_disk_file(ctx, filename, filesize);
+ }
+
+ if((contents = mmap(NULL, stat_buffer.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+ {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: map_disk_file(): mmap(%s) failed, reading it instead: %s\n",
+           ctx->error_prefix, filename, strerror(errno));
+  close(fd);
+  return read_disk_file(ctx, filename, filesize);
+ }
+
+ close(fd);
+
+ /* only a hint, so failing doesn't matter */
+ madvise(contents, stat_buffer.st_size, MADV_SEQUENTIAL);
+
+ *mapped = 1;
+ *filesize = stat_buffer.st_size;
+ return (char *) contents;
+}
+
+void release_disk_file(char *contents, size_t filesize, int mapped)
+{
+ if(contents == NULL)
+  return;
+
+ if(mapped)
+  munmap(contents, filesize);
+ else
+  free(contents);
+}
+
+int remove_db_file(struct buildmatrix_context *ctx, const char *filename)
+{
  if(ctx->verbose > 1)
   fprintf(stderr, "%s: remove_db_file(%s)\n", ctx->error_prefix, filename);
 
@@ -99,22 +188,36 @@ int remove_db_file(struct buildmatrix_context *ctx, const char *filename)
   return 1;
  }
 
+ return remove_build_file(ctx, ctx->unique_identifier, filename);
+}
+
+int remove_build_file(struct buildmatrix_context *ctx, const char *unique_identifier,
+                      const char *filename)
+{
+ char *path, dir[3];
+ int allocation_size;
+
  allocation_size = strlen(ctx->local_project_directory)
-                 + strlen(ctx->unique_identifier)
+                 + strlen(unique_identifier)
                  + strlen(filename)
-                 + 10;
+                 + 13;
 
  if((path = malloc(allocation_size)) == NULL)
  {
-  fprintf(stderr, "%s: remove_db_file(): malloc(%d) failed: %s\n",
+  fprintf(stderr, "%s: remove_build_file(): malloc(%d) failed: %s\n",
           ctx->error_prefix, allocation_size, strerror(errno));
   return 1;
  }
 
- snprintf(dir, 3, "%s", ctx->unique_identifier);
+ snprintf(dir, 3, "%s", unique_identifier);
 
  snprintf(path, allocation_size, "%s/%s/%s-%s", 
-          ctx->local_project_directory, dir, ctx->unique_identifier, filename);
+          ctx->local_project_directory, dir, unique_identifier, filename);
+
+ /* builds committed with artifactcompression=gzip keep the file under a .gz name */
+ if(access(path, F_OK) != 0)
+  snprintf(path, allocation_size, "%s/%s/%s-%s%s", ctx->local_project_directory, dir,
+           unique_identifier, filename, artifact_codec_suffix(BLDMTRX_CODEC_GZIP));
 
  if(remove_disk_file(ctx, path))
  {
@@ -126,6 +229,54 @@ int remove_db_file(struct buildmatrix_context *ctx, const char *filename)
  return 0;
 }
 
+int remove_build_files_in_background(struct buildmatrix_context *ctx, char **identifiers,
+                                     char **files, int n_files)
+{
+ pid_t child;
+ int i, fd;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: remove_build_files_in_background() %d files\n",
+          ctx->error_prefix, n_files);
+
+ /* Double fork so the grandchild is reparented and never becomes our zombie. It must also
+    let go of stdin / stdout / stderr, otherwise an ssh session would wait on it. */
+ if((child = fork()) == 0)
+ {
+  if(fork() != 0)
+   _exit(0);
+
+  if((fd = open("/dev/null", O_RDWR)) != -1)
+  {
+   dup2(fd, 0);
+   dup2(fd, 1);
+   dup2(fd, 2);
+   if(fd > 2)
+    close(fd);
+  }
+
+  for(i=0; i<n_files; i++)
+   remove_build_file(ctx, identifiers[i], files[i]);
+
+  _exit(0);
+ }
+
+ if(child == -1)
+ {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: fork() failed, %s, removing files in the foreground\n",
+           ctx->error_prefix, strerror(errno));
+
+  for(i=0; i<n_files; i++)
+   remove_build_file(ctx, identifiers[i], files[i]);
+
+  return 0;
+ }
+
+ waitpid(child, NULL, 0);
+ return 0;
+}
+
 int remove_disk_file(struct buildmatrix_context *ctx, const char *filename)
 {
  char path[4096];
@@ -231,10 +382,12 @@ int send_file_from_blob(struct buildmatrix_context *ctx, char *filename, char *b
  return 0;
 }
 
-int send_db_file(struct buildmatrix_context *ctx, char *filename)
+/* size is the uncompressed size recorded for the artifact, or -1 if it isn't known */
+int send_db_file(struct buildmatrix_context *ctx, char *filename, long long int size)
 {
- char *path, dir[3];
- int allocation_size;
+ char *path, *name, dir[3];
+ const char *suffix;
+ int allocation_size, failed;
 
  if(ctx->verbose > 1)
   fprintf(stderr, "%s: send_db_file()\n", ctx->error_prefix);
@@ -245,9 +398,12 @@ int send_db_file(struct buildmatrix_context *ctx, char *filename)
   return 1;
  }
 
+ suffix = artifact_codec_suffix(ctx->artifact_codec);
+
  allocation_size = strlen(ctx->local_project_directory)
                  + strlen(ctx->unique_identifier)
                  + strlen(filename)
+                 + strlen(suffix)
                  + 10;
 
  if((path = malloc(allocation_size)) == NULL)
@@ -259,17 +415,29 @@ int send_db_file(struct buildmatrix_context *ctx, char *filename)
 
  snprintf(dir, 3, "%s", ctx->unique_identifier);
 
- snprintf(path, allocation_size, "%s/%s/%s-%s", 
-          ctx->local_project_directory, dir, ctx->unique_identifier, filename);
+ snprintf(path, allocation_size, "%s/%s/%s-%s%s", 
+          ctx->local_project_directory, dir, ctx->unique_identifier, filename, suffix);
 
- if(send_disk_file(ctx, path, NULL))
+ if(ctx->artifact_codec == BLDMTRX_CODEC_GZIP)
  {
-  free(path);
-  return 1;
+  /* the peer gets the name the file was submitted under, without the .gz */
+  if((name = strdup(strrchr(path, '/') + 1)) == NULL)
+  {
+   fprintf(stderr, "%s: send_db_file(): strdup() failed: %s\n",
+           ctx->error_prefix, strerror(errno));
+   free(path);
+   return 1;
+  }
+  name[strlen(name) - strlen(suffix)] = 0;
+
+  failed = send_compressed_db_file(ctx, path, name, size);
+  free(name);
+ } else {
+  failed = send_disk_file(ctx, path, NULL);
  }
 
  free(path);
- return 0;
+ return failed;
 }
 
 
@@ -428,9 +596,10 @@ int send_disk_file(struct buildmatrix_context *ctx, char *filename, char *fileco
 int receive_disk_file(struct buildmatrix_context *ctx, char **filename_ptr, int limbo)
 {
  long long int filesize, bytes_read = 0;
- char buffer[4097], filename[4002];
- int n_bytes, fd, bytes_written, i, length;
+ char buffer[4097], filename[4002], codec_name[16];
+ int n_bytes, fd, bytes_written, i, length, codec;
  struct stat metadata;
+ z_stream stream;
 
  if(ctx->verbose)
   fprintf(stderr, "%s: receive_disk_file()\n", ctx->error_prefix);
@@ -463,7 +632,9 @@ int receive_disk_file(struct buildmatrix_context *ctx, char **filename_ptr, int
  else
   length = snprintf(filename, 4002, "./");
 
- sscanf(buffer + 9, "%lld %4000s", &filesize, filename + length);
+ buffer[n_bytes] = 0;
+ codec_name[0] = 0;
+ sscanf(buffer + 9, "%lld %4000s %15s", &filesize, filename + length, codec_name);
  if(ctx->verbose)
  {
   fprintf(stderr, 
@@ -471,6 +642,16 @@ int receive_disk_file(struct buildmatrix_context *ctx, char **filename_ptr, int
           ctx->error_prefix, filename, filesize, *filename_ptr);
  }
 
+ /* a codec is only tagged on if we asked for it during connection initialization */
+ if( ((codec = artifact_codec_from_name(codec_name[0] == 0 ? NULL : codec_name)) == -1) ||
+     ((codec != BLDMTRX_CODEC_NONE) && ((ctx->peer_codecs & (1 << codec)) == 0)) )
+ {
+  fprintf(stderr, "%s: receive_disk_file(): unexpected codec \"%s\"\n",
+          ctx->error_prefix, codec_name);
+  write(ctx->out, "failed\n", 7);
+  return 1;
+ }
+
  if(*filename_ptr != NULL)
  {
   if(limbo)
@@ -536,10 +717,22 @@ int receive_disk_file(struct buildmatrix_context *ctx, char **filename_ptr, int
   return 1;
  }
 
+ if(codec == BLDMTRX_CODEC_GZIP)
+ {
+  if(gunzip_start(ctx, &stream))
+  {
+   write(ctx->out, "failed\n", 7);
+   close(fd);
+   return 1;
+  }
+ }
+
  if((n_bytes = write(ctx->out, "ok\n", 3)) != 3)
  {
   fprintf(stderr, "%s: receive_disk_file(): write() failed: %s\n",
           ctx->error_prefix, strerror(errno));
+  if(codec == BLDMTRX_CODEC_GZIP)
+   inflateEnd(&stream);
   close(fd);
   if(filename_ptr)
    free(*filename_ptr);
@@ -552,6 +745,8 @@ int receive_disk_file(struct buildmatrix_context *ctx, char **filename_ptr, int
   {
    fprintf(stderr, "%s: receive_disk_file(): write() failed: %s\n",
            ctx->error_prefix, strerror(errno));
+   if(codec == BLDMTRX_CODEC_GZIP)
+    inflateEnd(&stream);
    close(fd);
    if(filename_ptr)
     free(*filename_ptr);
@@ -560,6 +755,21 @@ int receive_disk_file(struct buildmatrix_context *ctx, char **filename_ptr, int
 
   errno = 0;
   bytes_written = 0;
+
+  if(codec == BLDMTRX_CODEC_GZIP)
+  {
+   if(gunzip_chunk(ctx, &stream, buffer, n_bytes, fd))
+   {
+    write(ctx->out, "failed\n", 7);
+    inflateEnd(&stream);
+    close(fd);
+    if(filename_ptr)
+     free(*filename_ptr);
+    return 1;
+   }
+   bytes_written = n_bytes;
+  }
+
   while(bytes_written < n_bytes)
   {
    if((i = write(fd, buffer + bytes_written, n_bytes - bytes_written)) < 1)
@@ -594,6 +804,12 @@ int receive_disk_file(struct buildmatrix_context *ctx, char **filename_ptr, int
 
  close(fd);
 
+ if(codec == BLDMTRX_CODEC_GZIP)
+ {
+  if(gunzip_end(ctx, &stream))
+   return 1;
+ }
+
  if(limbo)
  {
   if(chdir(ctx->current_working_directory))
@@ -705,7 +921,8 @@ int receive_file_as_blob(struct buildmatrix_context *ctx, char **filename_ptr, c
  return 0;
 }
 
-int limbo_to_database(struct buildmatrix_context *ctx, char *filename)
+/* size gets the uncompressed length of the artifact */
+int limbo_to_database(struct buildmatrix_context *ctx, char *filename, long long int *size)
 {
  char buffer[4096], *from_path, *to_path, dir[3];
  int allocation_size, in_fd, out_fd, bytes_in, bytes_out, c;
@@ -746,7 +963,7 @@ int limbo_to_database(struct buildmatrix_context *ctx, char *filename)
 
  allocation_size = strlen(ctx->local_project_directory)
                  + strlen(filename) 
-                 + 27;
+                 + 30;
 
  if((to_path = malloc(allocation_size)) == NULL)
  {
@@ -761,8 +978,9 @@ int limbo_to_database(struct buildmatrix_context *ctx, char *filename)
  mkdir(to_path, S_IRWXU);
  errno = 0;
 
- snprintf(to_path, allocation_size, "%s/%s/%s-%s", 
-          ctx->local_project_directory, dir, ctx->unique_identifier, filename);
+ snprintf(to_path, allocation_size, "%s/%s/%s-%s%s", 
+          ctx->local_project_directory, dir, ctx->unique_identifier, filename,
+          artifact_codec_suffix(ctx->artifact_codec));
 
  if((in_fd = open(from_path, O_RDONLY)) < 0)
  {
@@ -785,21 +1003,36 @@ int limbo_to_database(struct buildmatrix_context *ctx, char *filename)
   return 1;
  }
 
- while((bytes_in = read(in_fd, buffer, 4096)) > 0)
+ if(ctx->artifact_codec == BLDMTRX_CODEC_GZIP)
  {
-  bytes_out = 0;
-  while(bytes_out < bytes_in)
+  if(gzip_fd_to_fd(ctx, in_fd, out_fd, size))
+  {
+   close(out_fd);
+   close(in_fd);
+   free(to_path);
+   free(from_path); 
+   return 1;
+  }
+ } else {
+  *size = 0;
+  while((bytes_in = read(in_fd, buffer, 4096)) > 0)
   {
-   if((c = write(out_fd, buffer, bytes_in)) < 1)
+   *size += bytes_in;
+   bytes_out = 0;
+   while(bytes_out < bytes_in)
    {
-    fprintf(stderr, "%s: limbo_to_database(): write() failed: %s\n", 
-            ctx->error_prefix, strerror(errno));
-    close(out_fd);
-    close(in_fd);
-    free(to_path);
-    free(from_path); 
+    if((c = write(out_fd, buffer + bytes_out, bytes_in - bytes_out)) < 1)
+    {
+     fprintf(stderr, "%s: limbo_to_database(): write() failed: %s\n", 
+             ctx->error_prefix, strerror(errno));
+     close(out_fd);
+     close(in_fd);
+     free(to_path);
+     free(from_path); 
+     return 1;
+    }
+    bytes_out += c;
    }
-   bytes_out += c;
   }
  }
 
@@ -47,6 +47,20 @@ int main(int argc, char **argv)
   return 0;
  }
 
+ if(ctx->mode == BLDMTRX_MODE_CONVERT)
+ {
+  if( (ctx->test_results == NULL) || (ctx->test_results_out_file == NULL) )
+  {
+   fprintf(stderr, "%s: convert needs --testresults and --testresultsout\n", 
+           ctx->error_prefix);
+   return 1;
+  }
+
+  return_code = export_test_results(ctx, ctx->test_results, ctx->test_results_out_file);
+  free(ctx);
+  return return_code;
+ }
+
  if( (ctx->mode != BLDMTRX_MODE_INIT) &&
      (ctx->mode != BLDMTRX_MODE_CONNECT) )
  {
@@ -57,6 +71,9 @@ int main(int argc, char **argv)
  if(setup_console(ctx))
   return 1;
 
+ if(setup_export(ctx))
+  return 1;
+
  if((ctx->current_working_directory = get_current_dir_name()) == NULL)
  {
   fprintf(stderr, "%s: getwd() failed, %s\n", ctx->error_prefix, strerror(errno));
@@ -299,7 +316,17 @@ int main(int argc, char **argv)
        break;
 
   case BLDMTRX_MODE_LIST_TESTS:
-       return_code = list_tests(ctx);
+       if(ctx->local == 0)
+        return_code = list_tests(ctx);
+       else
+        return_code = service_list_tests(ctx);
+       break;
+
+  case BLDMTRX_MODE_TEST_DIFF:
+       if(ctx->local == 0)
+        return_code = test_diff(ctx);
+       else
+        return_code = service_test_diff(ctx, ctx->unique_identifier, ctx->other_identifier);
        break;
 
 //list parameters
@@ -336,7 +363,9 @@ int main(int argc, char **argv)
        break;
 
   case BLDMTRX_MODE_SCRATCH:
-       if(ctx->local == 0)
+       if(ctx->unique_identifier == NULL)
+        return_code = scratch_matching(ctx);
+       else if(ctx->local == 0)
         return_code = scratch(ctx);
        else
         return_code = service_scratch(ctx);
@@ -354,6 +383,14 @@ int main(int argc, char **argv)
        return_code = generate_report(ctx);      
        break;
 
+  case BLDMTRX_MODE_PRUNE:
+       return_code = prune(ctx);
+       break;
+
+  case BLDMTRX_MODE_ARCHIVE:
+       return_code = archive(ctx);
+       break;
+
   default:
       fprintf(stderr, "%s: I don't know what to do.\n", ctx->error_prefix);
       return_code = 1;
@@ -365,6 +402,7 @@ int main(int argc, char **argv)
    stop_server(ctx);
  }
 
+ free(ctx->configuration);
  free(ctx);
  return return_code;
 }
@@ -395,6 +433,27 @@ int default_configuration(struct buildmatrix_context *ctx)
  if(save_configurtation_value(ctx, "newusergetdefault", "yes", 0))
   return 1;
 
+ if(save_configurtation_value(ctx, "artifactcompression", "none", 0))
+  return 1;
+
+ if(save_configurtation_value(ctx, "archiveage", "0", 0))
+  return 1;
+
+ if(save_configurtation_value(ctx, "archiveperiod", "year", 0))
+  return 1;
+
+ if(save_configurtation_value(ctx, "reportstreaming", "no", 0))
+  return 1;
+
+ if(save_configurtation_value(ctx, "reportpages", "no", 0))
+  return 1;
+
+ if(save_configurtation_value(ctx, "reportpagesize", "100", 0))
+  return 1;
+
+ if(save_configurtation_value(ctx, "reportworkers", "1", 0))
+  return 1;
+
  if(ctx->mode == BLDMTRX_MODE_INIT)
   if(save_configurtation_value(ctx, "projectname", ctx->project_name, 0))
    return 1;
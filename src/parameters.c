@@ -117,14 +117,14 @@ int parameters_from_file(struct buildmatrix_context *ctx, char *filename)
 {
  char *contents, *str_ptr;
  int line_length, mark, n_pairs = 0, string_space = 0,
-     pass = 1, x, key_length, value_length, line_number;
+     pass = 1, key_length, value_length, line_number, mapped;
  size_t filesize, i;
  struct parameters *p;
 
  if(filename == NULL)
   return 1;
 
- if((contents = read_disk_file(ctx, filename, &filesize)) == NULL)
+ if((contents = map_disk_file(ctx, filename, &filesize, &mapped)) == NULL)
   return 1;
 
  while(pass < 3)
@@ -133,51 +133,31 @@ int parameters_from_file(struct buildmatrix_context *ctx, char *filename)
   line_number = 1;
   while(i<filesize)
   {
-   line_length = 0;  
-   while(1)
+   /* a mapped file isn't terminated, so the search stops at filesize, and a line may be
+      512 bytes before its newline */
+   if((line_length = scan_for_byte(contents + i, 
+                                   (filesize - i > 513) ? 513 : filesize - i, '\n')) == -1)
    {
-    if(contents[i + line_length] == '\n')
-     break;
-
-    if(i + line_length == filesize)
-    {
+    if(filesize - i <= 512)
      fprintf(stderr, "%s: parameters_from_file(): %s line %d has no newline\n",
              ctx->error_prefix, filename, line_number);
-     free(contents);
-     return 1;
-    }
-
-    if(line_length > 511)
-    {
+    else
      fprintf(stderr, "%s: parameters_from_file(): %s line %d is too long\n",
              ctx->error_prefix, filename, line_number);
-     free(contents);
-     return 1;
-    }
-
-    line_length++;
+    release_disk_file(contents, filesize, mapped);
+    return 1;
    }
 
    if(line_length < 1)
     break;
 
-   x = i;
-   mark = -1;
-   while(x < i + line_length)
-   {
-    if(contents[x] == '|')
-    {
-     mark = x;
-     break;
-    }
-    x++;
-   }
+   if((mark = scan_for_byte(contents + i, line_length, '|')) != -1)
+    mark += i;
    if(mark < 0)
    {
-    contents[i + line_length] = 0;
-    fprintf(stderr, "%s: parameters_from_file(): %s line %d has no | character, \"%s\"\n",
-            ctx->error_prefix, filename, line_number, contents + i);
-    free(contents);
+    fprintf(stderr, "%s: parameters_from_file(): %s line %d has no | character, \"%.*s\"\n",
+            ctx->error_prefix, filename, line_number, line_length, contents + i);
+    release_disk_file(contents, filesize, mapped);
     return 1;
    }
 
@@ -186,7 +166,7 @@ int parameters_from_file(struct buildmatrix_context *ctx, char *filename)
    {
     fprintf(stderr, "%s: parameters_from_file(): %s line %d: key is wrong length\n",
             ctx->error_prefix, filename, line_number);
-    free(contents);
+    release_disk_file(contents, filesize, mapped);
     return 1;
    }
 
@@ -195,7 +175,7 @@ int parameters_from_file(struct buildmatrix_context *ctx, char *filename)
    {
     fprintf(stderr, "%s: parameters_from_file(): %s line %d: value is wrong length\n",
             ctx->error_prefix, filename, line_number);
-    free(contents);
+    release_disk_file(contents, filesize, mapped);
     return 1;
    }
 
@@ -210,7 +190,7 @@ int parameters_from_file(struct buildmatrix_context *ctx, char *filename)
     {
      fprintf(stderr, "%s: parameters_from_file(): failure. p->npairs =%d n_pairs %d\n",
              ctx->error_prefix, p->n_pairs , n_pairs);
-     free(contents);
+     release_disk_file(contents, filesize, mapped);
      return 1;
     }
 
@@ -218,7 +198,7 @@ int parameters_from_file(struct buildmatrix_context *ctx, char *filename)
     {
      fprintf(stderr, "%s: parameters_from_file(): string space problem\n",
              ctx->error_prefix);
-     free(contents);
+     release_disk_file(contents, filesize, mapped);
      return 1;
     }
     p->keys[p->n_pairs] = str_ptr;
@@ -231,7 +211,7 @@ int parameters_from_file(struct buildmatrix_context *ctx, char *filename)
     {
      fprintf(stderr, "%s: parameters_from_file(): string space problem\n",
              ctx->error_prefix);
-     free(contents);
+     release_disk_file(contents, filesize, mapped);
      return 1;
     }
     p->values[p->n_pairs] = str_ptr;
@@ -251,7 +231,7 @@ int parameters_from_file(struct buildmatrix_context *ctx, char *filename)
   {
    if((p = allocate_parameter_structure(ctx, n_pairs, string_space, &str_ptr)) == NULL)
    {
-    free(contents);
+    release_disk_file(contents, filesize, mapped);
     return 1;
    }
   }
@@ -261,7 +241,7 @@ int parameters_from_file(struct buildmatrix_context *ctx, char *filename)
  }
 
  ctx->parameters = p;
- free(contents);
+ release_disk_file(contents, filesize, mapped);
  return 0;
 }
 
@@ -358,7 +338,7 @@ int send_parameters(struct buildmatrix_context *ctx)
 int receive_parameters(struct buildmatrix_context *ctx)
 {
  int n_pairs, string_space, buffer_length, 
-     mark, key_length, value_length, x;
+     mark, key_length, value_length;
  char buffer[512], *str_ptr;
  struct parameters *p;
 
@@ -423,17 +403,7 @@ int receive_parameters(struct buildmatrix_context *ctx)
    break;
   }
 
-  x = 0;
-  mark = -1;
-  while(x < buffer_length)
-  {
-   if(buffer[x] == '|')
-   {
-    mark = x;
-    break;
-   }
-   x++;
-  }
+  mark = scan_for_byte(buffer, buffer_length, '|');
   if(mark < 0)
   {
    fprintf(stderr, "%s: receive_parameters(): line no | character, \"%s\"\n",
@@ -505,159 +475,735 @@ int receive_parameters(struct buildmatrix_context *ctx)
  return 0;
 }
 
-int load_parameters_from_db(struct buildmatrix_context *ctx)
+/* collected by offset while a query streams, fixed up into struct parameters at the end */
+struct loaded_set
 {
- const char *sql, *key, *value;
- char *str_ptr;
- int code;
+ int id, first_pair, n_pairs, string_space;
+};
+
+struct loaded_pair
+{
+ size_t key, value;
+};
+
+struct loaded_build
+{
+ int build_id, set;
+};
+
+int parameter_set_tables_exist(struct buildmatrix_context *ctx, int *exists)
+{
+ char *sql;
  struct sqlite3_stmt *statement = NULL;
- struct parameters *p;
- int n_pairs = 0, string_space = 0, pass = 1, key_length, value_length;
 
- if(ctx->verbose > 1)
-  fprintf(stderr, "%s: load_parameters_from_db()\n", ctx->error_prefix);
+ sql = "SELECT COUNT(*) FROM main.sqlite_master WHERE type = 'table' AND name = 'parameter_sets';";
 
- if(ctx->build_id < 1)
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
  {
-  fprintf(stderr, "%s: load_parameters_from_db(): need build id\n", ctx->error_prefix);
+  fprintf(stderr, "%s: parameter_set_tables_exist(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
   return 1;
  }
 
- if(open_database(ctx))
+ if(sqlite3_step(statement) != SQLITE_ROW)
+ {
+  fprintf(stderr, "%s: parameter_set_tables_exist(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
   return 1;
- 
- pass = 1;
- while(pass < 3)
+ }
+
+ *exists = sqlite3_column_int(statement, 0);
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+/* prepares a query whose ?1 and ?2 are the first and last build_id */
+int prepare_build_range_query(struct buildmatrix_context *ctx, const char *sql,
+                              int first_build_id, int last_build_id,
+                              struct sqlite3_stmt **statement)
+{
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, statement, NULL) != SQLITE_OK)
  {
-  sql = "SELECT variable, value FROM parameters WHERE build_id = ?;";
+  fprintf(stderr, "%s: load_parameter_sets(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
+  return 1;
+ }
 
-  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
-  {
-   fprintf(stderr, "%s: load_parameters_from_db(): sqlite3_prepare(%s) failed, '%s'\n",
-           ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
-   return 1;
-  }
+ if( (sqlite3_bind_int(*statement, 1, first_build_id) != SQLITE_OK) ||
+     (sqlite3_bind_int(*statement, 2, last_build_id) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: load_parameter_sets(): sqlite3_bind_int() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(*statement);
+  *statement = NULL;
+  return 1;
+ }
 
-  if(sqlite3_bind_int(statement, 1, ctx->build_id) != SQLITE_OK)
+ return 0;
+}
+
+/* Steps a query returning (id, variable, value) ordered by id, appending one loaded_set per id.
+   The statement is finalized either way. */
+int load_parameter_rows(struct buildmatrix_context *ctx, struct sqlite3_stmt *statement,
+                        struct arena *set_arena, struct arena *pair_arena,
+                        struct arena *string_arena, int *n_sets, int *n_pairs)
+{
+ int code, id, previous_id = 0, first_row = 1, failed = 0;
+ struct loaded_set *ls;
+ struct loaded_pair *lp;
+ size_t offset;
+
+ while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ {
+  if( (sqlite3_column_type(statement, 1) != SQLITE_TEXT) ||
+      (sqlite3_column_type(statement, 2) != SQLITE_TEXT) )
   {
-   fprintf(stderr, "%s: loaad_parameters_from_db(): sqlite3_bind_int() failed, '%s'\n",
-           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-   sqlite3_finalize(statement);
-   return 1;
+   fprintf(stderr, "%s: load_parameter_sets(): key or value is not text\n",
+           ctx->error_prefix);
+   failed = 1;
+   break;
   }
 
-  while((code = sqlite3_step(statement)) == SQLITE_ROW)
+  id = sqlite3_column_int(statement, 0);
+
+  if( (first_row) || (id != previous_id) )
   {
-   if(pass == 2)
+   if(arena_reserve(set_arena, sizeof(struct loaded_set), &offset))
    {
-    if(p->n_pairs + 1 > n_pairs)
-    {
-     fprintf(stderr, "%s: load_parameters_from_db(): failure\n", ctx->error_prefix);
-     free(p);
-     sqlite3_finalize(statement);
-     return 1;
-    }
+    failed = 2;
+    break;
    }
+   ls = (struct loaded_set *) (set_arena->base + offset);
+   ls->id = id;
+   ls->first_pair = *n_pairs;
+   ls->n_pairs = 0;
+   ls->string_space = 0;
+   (*n_sets)++;
+   previous_id = id;
+   first_row = 0;
+  }
 
-   if(sqlite3_column_type(statement, 0) != SQLITE_TEXT)
-   {
-    fprintf(stderr, "%s: load_parameters_from_db(): key is not text\n",
-            ctx->error_prefix);
-    sqlite3_finalize(statement);
-    return 1;
-   }
-   if(pass == 1)
-   {
-    string_space += sqlite3_column_bytes(statement, 0) + 1;
-   } else {
-    key = (const char *) sqlite3_column_text(statement, 0);
-    key_length = sqlite3_column_bytes(statement, 0);
+  if(arena_reserve(pair_arena, sizeof(struct loaded_pair), &offset))
+  {
+   failed = 2;
+   break;
+  }
+  lp = (struct loaded_pair *) (pair_arena->base + offset);
 
-    if(p->string_space + key_length + 1 > string_space)
-    {
-     fprintf(stderr, "%s: load_parameters_from_db(): string space problem\n", ctx->error_prefix);
-     free(p);
-     sqlite3_finalize(statement);
-     return 1;
-    }
+  if( (arena_append_string(string_arena, (const char *) sqlite3_column_text(statement, 1),
+                           &(lp->key))) ||
+      (arena_append_string(string_arena, (const char *) sqlite3_column_text(statement, 2),
+                           &(lp->value))) )
+  {
+   failed = 2;
+   break;
+  }
 
-    p->keys[p->n_pairs] = str_ptr;
-    memcpy(str_ptr, key, key_length);
-    p->keys[p->n_pairs][key_length] = 0;
-    p->string_space += key_length + 1;
-    str_ptr += key_length + 1;
-   }
+  ls = ((struct loaded_set *) set_arena->base) + (*n_sets - 1);
+  ls->string_space += sqlite3_column_bytes(statement, 1) + 1
+                    + sqlite3_column_bytes(statement, 2) + 1;
+  ls->n_pairs++;
+  (*n_pairs)++;
+ }
+
+ if(failed == 2)
+  fprintf(stderr, "%s: load_parameter_sets(): out of memory\n", ctx->error_prefix);
+
+ if( (failed == 0) && (code != SQLITE_DONE) )
+ {
+  fprintf(stderr, "%s: load_parameter_sets(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  failed = 1;
+ }
+
+ sqlite3_finalize(statement);
+ return failed ? 1 : 0;
+}
 
-   if(sqlite3_column_type(statement, 1) != SQLITE_TEXT)
+/* Loads the parameters of every build with a build_id in [first_build_id, last_build_id].
+   Builds from before parameter sets existed are read from the parameters table with one query
+   ordered by build_id. Everything else takes one query for the distinct sets in the range and
+   one for which build uses which, so a set shared by a thousand builds is only read once. */
+int load_parameter_sets(struct buildmatrix_context *ctx, int first_build_id, int last_build_id,
+                        struct parameter_sets **sets_ptr)
+{
+ const char *sql;
+ int code = SQLITE_DONE, n_sets = 0, n_legacy_sets, n_pairs = 0, n_shared_builds = 0, shared = 0,
+     i, j, k, low, high, middle, failed = 0;
+ struct sqlite3_stmt *statement = NULL;
+ struct arena set_arena = { NULL, 0, 0 }, pair_arena = { NULL, 0, 0 },
+              string_arena = { NULL, 0, 0 }, build_arena = { NULL, 0, 0 };
+ struct loaded_set *ls;
+ struct loaded_pair *lp;
+ struct loaded_build *lb;
+ struct parameter_sets *sets;
+ size_t offset;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: load_parameter_sets(%d, %d)\n", ctx->error_prefix,
+          first_build_id, last_build_id);
+
+ if(open_database(ctx))
+  return 1;
+
+ if( (attach_archives(ctx, 0, 0, first_build_id, last_build_id)) ||
+     (parameter_set_tables_exist(ctx, &shared)) )
+ {
+  close_database(ctx);
+  return 1;
+ }
+
+ sql = "SELECT build_id, variable, value FROM all_parameters "
+       "WHERE build_id BETWEEN ?1 AND ?2 ORDER BY build_id, id;";
+
+ if( (prepare_build_range_query(ctx, sql, first_build_id, last_build_id, &statement)) ||
+     (load_parameter_rows(ctx, statement, &set_arena, &pair_arena, &string_arena,
+                          &n_sets, &n_pairs)) )
+  failed = 1;
+
+ n_legacy_sets = n_sets;
+
+ if( (failed == 0) && (shared) )
+ {
+  sql = "SELECT pairs.set_id, variables.string, vals.string FROM parameter_set_pairs AS pairs "
+        "JOIN parameter_strings AS variables ON variables.string_id = pairs.variable_id "
+        "JOIN parameter_strings AS vals ON vals.string_id = pairs.value_id "
+        "WHERE pairs.set_id IN (SELECT parameter_set_id FROM all_builds "
+                               "WHERE build_id BETWEEN ?1 AND ?2) "
+        "ORDER BY pairs.set_id, pairs.position;";
+
+  if( (prepare_build_range_query(ctx, sql, first_build_id, last_build_id, &statement)) ||
+      (load_parameter_rows(ctx, statement, &set_arena, &pair_arena, &string_arena,
+                           &n_sets, &n_pairs)) )
+   failed = 1;
+ }
+
+ if( (failed == 0) && (shared) )
+ {
+  sql = "SELECT build_id, parameter_set_id FROM all_builds "
+        "WHERE build_id BETWEEN ?1 AND ?2 AND parameter_set_id IS NOT NULL ORDER BY build_id;";
+
+  if(prepare_build_range_query(ctx, sql, first_build_id, last_build_id, &statement))
+   failed = 1;
+
+  while( (failed == 0) && ((code = sqlite3_step(statement)) == SQLITE_ROW) )
+  {
+   if(arena_reserve(&build_arena, sizeof(struct loaded_build), &offset))
    {
-    fprintf(stderr, "%s: load_parameters_from_db(): value is not text\n",
-            ctx->error_prefix);
-    sqlite3_finalize(statement);
-    return 1;
+    fprintf(stderr, "%s: load_parameter_sets(): out of memory\n", ctx->error_prefix);
+    failed = 1;
+    break;
    }
-
-   if(pass == 1)
+   lb = (struct loaded_build *) (build_arena.base + offset);
+   lb->build_id = sqlite3_column_int(statement, 0);
+
+   /* the shared sets were loaded ordered by set_id, a set with no pairs is not among them */
+   lb->set = -1;
+   k = sqlite3_column_int(statement, 1);
+   ls = (struct loaded_set *) set_arena.base;
+   low = n_legacy_sets;
+   high = n_sets - 1;
+   while(low <= high)
    {
-    string_space += sqlite3_column_bytes(statement, 1) + 1;
-   } else {
-    value = (const char *) sqlite3_column_text(statement, 1);
-    value_length = sqlite3_column_bytes(statement, 1);
-
-    if(p->string_space + value_length + 1 > string_space)
+    middle = (low + high) / 2;
+    if(ls[middle].id == k)
     {
-     fprintf(stderr, "%s: load_parameters_from_db(): string space problem\n", ctx->error_prefix);
-     free(p);
-     sqlite3_finalize(statement);
-     return 1;
+     lb->set = middle;
+     break;
     }
-
-    p->values[p->n_pairs] = str_ptr;
-    memcpy(str_ptr, value, value_length);
-    p->values[p->n_pairs][value_length] = 0;
-    p->string_space += value_length + 1;
-    str_ptr += value_length + 1;
+    if(ls[middle].id < k)
+     low = middle + 1;
+    else
+     high = middle - 1;
    }
- 
-   if(pass == 1)
-    n_pairs++;
-   else 
-    p->n_pairs++;
+
+   n_shared_builds++;
   }
 
-  if(code != SQLITE_DONE)
+  if( (failed == 0) && (code != SQLITE_DONE) )
   {
-   fprintf(stderr, "%s: load_parameters_from_db(): sqlite3_step() failed, '%s'\n",
+   fprintf(stderr, "%s: load_parameter_sets(): sqlite3_step() failed, '%s'\n",
            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-   sqlite3_finalize(statement);
-   return 1;
+   failed = 1;
   }
 
-  sqlite3_finalize(statement);
+  if(statement != NULL)
+   sqlite3_finalize(statement);
+ }
 
-  if(pass == 1)
+ close_database(ctx);
+
+ if(failed == 0)
+ {
+  if((sets = (struct parameter_sets *) malloc(sizeof(struct parameter_sets))) == NULL)
   {
-   if((p = allocate_parameter_structure(ctx, n_pairs, string_space, &str_ptr)) == NULL)
+   failed = 1;
+  } else {
+   memset(sets, 0, sizeof(struct parameter_sets));
+   sets->n_sets = n_sets;
+   sets->n_builds = n_legacy_sets + n_shared_builds;
+
+   if( ( (n_sets > 0) &&
+         ( ((sets->sets = (struct parameters *) 
+                          malloc(sizeof(struct parameters) * n_sets)) == NULL) ||
+           ((sets->pointers = (char **) malloc(sizeof(char *) * n_pairs * 2)) == NULL) ) ) ||
+       ( (sets->n_builds > 0) &&
+         ( ((sets->build_ids = (int *) malloc(sizeof(int) * sets->n_builds)) == NULL) ||
+           ((sets->by_build = (struct parameters **)
+                              malloc(sizeof(struct parameters *) * sets->n_builds)) == NULL) ) ) )
    {
-    sqlite3_finalize(statement);
-    return 1;
+    free_parameter_sets(sets);
+    failed = 1;
    }
   }
 
-  pass++; 
+  if(failed)
+   fprintf(stderr, "%s: load_parameter_sets(): malloc() failed: %s\n",
+           ctx->error_prefix, strerror(errno));
  }
 
- close_database(ctx);
+ if(failed)
+ {
+  arena_free(&set_arena);
+  arena_free(&pair_arena);
+  arena_free(&string_arena);
+  arena_free(&build_arena);
+  return 1;
+ }
+
+ /* the string arena is finished growing, so it can be handed over as is */
+ sets->strings = string_arena.base;
+ ls = (struct loaded_set *) set_arena.base;
+ lp = (struct loaded_pair *) pair_arena.base;
+ lb = (struct loaded_build *) build_arena.base;
+
+ for(i=0; i<n_sets; i++)
+ {
+  sets->sets[i].n_pairs = ls[i].n_pairs;
+  sets->sets[i].string_space = ls[i].string_space;
+  sets->sets[i].keys = sets->pointers + ls[i].first_pair;
+  sets->sets[i].values = sets->pointers + n_pairs + ls[i].first_pair;
+
+  for(j=0; j<ls[i].n_pairs; j++)
+  {
+   sets->sets[i].keys[j] = sets->strings + lp[ls[i].first_pair + j].key;
+   sets->sets[i].values[j] = sets->strings + lp[ls[i].first_pair + j].value;
+  }
+ }
+
+ /* merge the builds with their own rows and the builds using a shared set, both by build_id */
+ i = 0;
+ j = 0;
+ for(k=0; k<sets->n_builds; k++)
+ {
+  if( (j == n_shared_builds) ||
+      ( (i < n_legacy_sets) && (ls[i].id < lb[j].build_id) ) )
+  {
+   sets->build_ids[k] = ls[i].id;
+   sets->by_build[k] = &(sets->sets[i]);
+   i++;
+  } else {
+   sets->build_ids[k] = lb[j].build_id;
+   sets->by_build[k] = lb[j].set == -1 ? &(sets->empty) : &(sets->sets[lb[j].set]);
+   j++;
+  }
+ }
+
+ arena_free(&set_arena);
+ arena_free(&pair_arena);
+ arena_free(&build_arena);
+
+ *sets_ptr = sets;
+ return 0;
+}
+
+/* never NULL, a build without parameters gets an empty set */
+struct parameters *parameter_set_for_build(struct parameter_sets *sets, int build_id)
+{
+ int low = 0, high = sets->n_builds - 1, middle;
+
+ while(low <= high)
+ {
+  middle = (low + high) / 2;
+
+  if(sets->build_ids[middle] == build_id)
+   return sets->by_build[middle];
+
+  if(sets->build_ids[middle] < build_id)
+   low = middle + 1;
+  else
+   high = middle - 1;
+ }
+
+ return &(sets->empty);
+}
+
+void free_parameter_sets(struct parameter_sets *sets)
+{
+ if(sets == NULL)
+  return;
+
+ if(sets->build_ids != NULL)
+  free(sets->build_ids);
+
+ if(sets->by_build != NULL)
+  free(sets->by_build);
+
+ if(sets->sets != NULL)
+  free(sets->sets);
+
+ if(sets->pointers != NULL)
+  free(sets->pointers);
+
+ if(sets->strings != NULL)
+  free(sets->strings);
+
+ free(sets);
+}
+
+int load_parameters_from_db(struct buildmatrix_context *ctx)
+{
+ char *str_ptr;
+ int i, length;
+ struct parameters *p, *source;
+ struct parameter_sets *sets;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: load_parameters_from_db()\n", ctx->error_prefix);
+
+ if(ctx->build_id < 1)
+ {
+  fprintf(stderr, "%s: load_parameters_from_db(): need build id\n", ctx->error_prefix);
+  return 1;
+ }
+
+ if(load_parameter_sets(ctx, ctx->build_id, ctx->build_id, &sets))
+  return 1;
+
+ /* ctx->parameters is released with a single free(), so copy into the usual layout */
+ source = parameter_set_for_build(sets, ctx->build_id);
+
+ if((p = allocate_parameter_structure(ctx, source->n_pairs, source->string_space,
+                                      &str_ptr)) == NULL)
+ {
+  free_parameter_sets(sets);
+  return 1;
+ }
+
+ for(i=0; i<source->n_pairs; i++)
+ {
+  length = strlen(source->keys[i]) + 1;
+  memcpy(str_ptr, source->keys[i], length);
+  p->keys[i] = str_ptr;
+  str_ptr += length;
+
+  length = strlen(source->values[i]) + 1;
+  memcpy(str_ptr, source->values[i], length);
+  p->values[i] = str_ptr;
+  str_ptr += length;
+ }
+ p->n_pairs = source->n_pairs;
+ p->string_space = source->string_space;
+
+ free_parameter_sets(sets);
 
  ctx->parameters = p;
 
  return 0;
 }
 
+int compare_parameter_pairs(const void *a, const void *b)
+{
+ const struct parameter_pair *x = a, *y = b;
+ int order;
+
+ if((order = strcmp(x->key, y->key)) != 0)
+  return order;
+
+ return strcmp(x->value, y->value);
+}
+
+/* Creates the tables that store each distinct parameter set once. Names and values are interned
+   in parameter_strings, a set is identified by the md5 of its canonical (sorted) form and
+   builds.parameter_set_id points at it. */
+int create_parameter_set_tables(struct buildmatrix_context *ctx)
+{
+ char *errmsg;
+
+ if(sqlite3_exec(ctx->db_ctx, 
+                 "CREATE TABLE parameter_strings (string_id INTEGER PRIMARY KEY, string TEXT, "
+                                                 "UNIQUE (string)); "
+                 "CREATE TABLE parameter_sets (set_id INTEGER PRIMARY KEY, digest TEXT, "
+                                              "n_pairs INTEGER, UNIQUE (digest)); "
+                 "CREATE TABLE parameter_set_pairs (set_id INTEGER REFERENCES parameter_sets(set_id), "
+                                                   "position INTEGER, "
+                                                   "variable_id INTEGER REFERENCES parameter_strings(string_id), "
+                                                   "value_id INTEGER REFERENCES parameter_strings(string_id), "
+                                                   "PRIMARY KEY (set_id, position));",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: could not create parameter set tables, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ return 0;
+}
+
+/* projects created before parameter sets get the tables, and the builds column, on first use */
+int upgrade_parameter_set_tables(struct buildmatrix_context *ctx)
+{
+ char **names, **types, *errmsg;
+ int exists, n_columns, has_set_column;
+
+ if(parameter_set_tables_exist(ctx, &exists))
+  return 1;
+
+ if(exists)
+  return 0;
+
+ if(ctx->verbose)
+  fprintf(stderr, "%s: adding parameter set tables\n", ctx->error_prefix);
+
+ if(table_columns(ctx, "main", "builds", &names, &types, &n_columns))
+  return 1;
+
+ has_set_column = has_column(names, n_columns, "parameter_set_id");
+
+ if(n_columns > 0)
+ {
+  free_string_array(names, n_columns);
+  free_string_array(types, n_columns);
+ }
+
+ if(has_set_column == 0)
+ {
+  if(sqlite3_exec(ctx->db_ctx, "ALTER TABLE builds ADD COLUMN parameter_set_id INTEGER;",
+                  NULL, NULL, &errmsg) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: upgrade_parameter_set_tables(): could not add builds.parameter_set_id, '%s'\n",
+           ctx->error_prefix, errmsg);
+   sqlite3_free(errmsg);
+   return 1;
+  }
+ }
+
+ return create_parameter_set_tables(ctx);
+}
+
+/* md5 of the sorted pairs written out the same way parameters_to_file() does, as hex */
+int parameter_set_digest(struct buildmatrix_context *ctx, struct parameter_pair *pairs,
+                         int n_pairs, char *digest)
+{
+ unsigned char md5[16];
+ char *canonical;
+ int i, length = 0, allocation_size = 1;
+
+ for(i=0; i<n_pairs; i++)
+  allocation_size += strlen(pairs[i].key) + strlen(pairs[i].value) + 2;
+
+ if((canonical = (char *) malloc(allocation_size)) == NULL)
+ {
+  fprintf(stderr, "%s: parameter_set_digest(): malloc(%d) failed: %s\n",
+          ctx->error_prefix, allocation_size, strerror(errno));
+  return 1;
+ }
+
+ for(i=0; i<n_pairs; i++)
+  length += snprintf(canonical + length, allocation_size - length, "%s|%s\n",
+                     pairs[i].key, pairs[i].value);
+
+ if(build_matrix_md5_wrapper(ctx, (unsigned char *) canonical, length, md5))
+ {
+  free(canonical);
+  return 1;
+ }
+
+ free(canonical);
+
+ for(i=0; i<16; i++)
+  snprintf(digest + (i * 2), 3, "%02x", md5[i]);
+
+ return 0;
+}
+
+/* set_id is left at 0 when no set has this digest yet */
+int find_parameter_set(struct buildmatrix_context *ctx, const char *digest, int *set_id)
+{
+ const char *sql;
+ int code;
+ struct sqlite3_stmt *statement = NULL;
+
+ *set_id = 0;
+
+ sql = "SELECT set_id FROM parameter_sets WHERE digest = ?;";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: find_parameter_set(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(sqlite3_bind_text(statement, 1, digest, strlen(digest), SQLITE_TRANSIENT) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: find_parameter_set(): sqlite3_bind_text() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ code = sqlite3_step(statement);
+
+ if(code == SQLITE_ROW)
+ {
+  *set_id = sqlite3_column_int(statement, 0);
+ } else if(code != SQLITE_DONE) {
+  fprintf(stderr, "%s: find_parameter_set(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+/* insert is "INSERT OR IGNORE INTO parameter_strings", lookup selects its string_id */
+int intern_parameter_string(struct buildmatrix_context *ctx, struct sqlite3_stmt *insert,
+                            struct sqlite3_stmt *lookup, const char *string, int *string_id)
+{
+ sqlite3_reset(insert);
+ sqlite3_reset(lookup);
+
+ if( (sqlite3_bind_text(insert, 1, string, strlen(string), SQLITE_TRANSIENT) != SQLITE_OK) ||
+     (sqlite3_bind_text(lookup, 1, string, strlen(string), SQLITE_TRANSIENT) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: intern_parameter_string(): sqlite3_bind_text() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(sqlite3_step(insert) != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: intern_parameter_string(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(sqlite3_step(lookup) != SQLITE_ROW)
+ {
+  fprintf(stderr, "%s: intern_parameter_string(): could not find '%s', '%s'\n",
+          ctx->error_prefix, string, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ *string_id = sqlite3_column_int(lookup, 0);
+ return 0;
+}
+
+int insert_parameter_set(struct buildmatrix_context *ctx, const char *digest,
+                         struct parameter_pair *pairs, int n_pairs, int *set_id)
+{
+ const char *sql;
+ int i, variable_id, value_id, failed = 0;
+ struct sqlite3_stmt *statement = NULL, *insert = NULL, *lookup = NULL, *pair = NULL;
+
+ sql = "INSERT INTO parameter_sets (digest, n_pairs) VALUES (?, ?);";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: insert_parameter_set(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if( (sqlite3_bind_text(statement, 1, digest, strlen(digest), SQLITE_TRANSIENT) != SQLITE_OK) ||
+     (sqlite3_bind_int(statement, 2, n_pairs) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: insert_parameter_set(): sqlite3_bind() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ if(sqlite3_step(statement) != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: insert_parameter_set(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+ *set_id = (int) sqlite3_last_insert_rowid(ctx->db_ctx);
+
+ if( (sqlite3_prepare_v2(ctx->db_ctx,
+                         "INSERT OR IGNORE INTO parameter_strings (string) VALUES (?);",
+                         -1, &insert, NULL) != SQLITE_OK) ||
+     (sqlite3_prepare_v2(ctx->db_ctx,
+                         "SELECT string_id FROM parameter_strings WHERE string = ?;",
+                         -1, &lookup, NULL) != SQLITE_OK) ||
+     (sqlite3_prepare_v2(ctx->db_ctx,
+                         "INSERT INTO parameter_set_pairs (set_id, position, variable_id, value_id) "
+                         "VALUES (?, ?, ?, ?);", -1, &pair, NULL) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: insert_parameter_set(): sqlite3_prepare() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  failed = 1;
+ }
+
+ for(i=0; (failed == 0) && (i<n_pairs); i++)
+ {
+  if( (intern_parameter_string(ctx, insert, lookup, pairs[i].key, &variable_id)) ||
+      (intern_parameter_string(ctx, insert, lookup, pairs[i].value, &value_id)) )
+  {
+   failed = 1;
+   break;
+  }
+
+  sqlite3_reset(pair);
+
+  if( (sqlite3_bind_int(pair, 1, *set_id) != SQLITE_OK) ||
+      (sqlite3_bind_int(pair, 2, i) != SQLITE_OK) ||
+      (sqlite3_bind_int(pair, 3, variable_id) != SQLITE_OK) ||
+      (sqlite3_bind_int(pair, 4, value_id) != SQLITE_OK) )
+  {
+   fprintf(stderr, "%s: insert_parameter_set(): sqlite3_bind_int() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   failed = 1;
+   break;
+  }
+
+  if(sqlite3_step(pair) != SQLITE_DONE)
+  {
+   fprintf(stderr, "%s: insert_parameter_set(): sqlite3_step() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   failed = 1;
+   break;
+  }
+ }
+
+ sqlite3_finalize(insert);
+ sqlite3_finalize(lookup);
+ sqlite3_finalize(pair);
+
+ return failed;
+}
+
+/* Stores ctx->parameters as a shared parameter set, adding it only when no earlier build had
+   exactly the same pairs, and points the build at it. Runs inside the submission transaction
+   when there is one, so it uses a savepoint of its own. */
 int save_parameters_to_db(struct buildmatrix_context *ctx)
 {
+ char digest[33], *errmsg;
  const char *sql;
- int code, x;
+ int i, set_id = 0, failed = 0;
  struct sqlite3_stmt *statement = NULL;
+ struct parameter_pair *pairs;
 
  if(ctx->verbose > 1)
   fprintf(stderr, "%s: save_parameters_to_db()\n", ctx->error_prefix);
@@ -676,63 +1222,104 @@ int save_parameters_to_db(struct buildmatrix_context *ctx)
   return 1;
  }
 
+ if((pairs = (struct parameter_pair *) 
+             malloc(sizeof(struct parameter_pair) * (ctx->parameters->n_pairs + 1))) == NULL)
+ {
+  fprintf(stderr, "%s: save_parameters_to_db(): malloc() failed: %s\n",
+          ctx->error_prefix, strerror(errno));
+  return 1;
+ }
+
+ for(i=0; i < ctx->parameters->n_pairs; i++)
+ {
+  pairs[i].key = ctx->parameters->keys[i];
+  pairs[i].value = ctx->parameters->values[i];
+ }
+
+ qsort(pairs, ctx->parameters->n_pairs, sizeof(struct parameter_pair), compare_parameter_pairs);
+
+ if(parameter_set_digest(ctx, pairs, ctx->parameters->n_pairs, digest))
+ {
+  free(pairs);
+  return 1;
+ }
+
  if(open_database(ctx))
+ {
+  free(pairs);
   return 1;
+ }
 
- for(x=0; x < ctx->parameters->n_pairs; x++)
+ if(sqlite3_exec(ctx->db_ctx, "SAVEPOINT save_parameters;", NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: save_parameters_to_db(): sqlite3_exec(\"SAVEPOINT\"): '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  free(pairs);
+  close_database(ctx);
+  return 1;
+ }
+
+ if( (upgrade_parameter_set_tables(ctx)) ||
+     (find_parameter_set(ctx, digest, &set_id)) )
+  failed = 1;
+
+ if( (failed == 0) && (set_id == 0) )
  {
-  sql = "INSERT INTO parameters (build_id, variable, value) VALUES (?, ?, ?);";
+  if(ctx->verbose)
+   fprintf(stderr, "%s: new parameter set %s\n", ctx->error_prefix, digest);
+
+  failed = insert_parameter_set(ctx, digest, pairs, ctx->parameters->n_pairs, &set_id);
+ }
+
+ free(pairs);
+
+ if(failed == 0)
+ {
+  sql = "UPDATE builds SET parameter_set_id = ? WHERE build_id = ?;";
 
   if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
   {
    fprintf(stderr, 
            "%s: save_parameters_to_db(): sqlite3_prepare(%s) failed, '%s'\n",
            ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
-   return 1;
-  }
-
-  if(sqlite3_bind_int(statement, 1, ctx->build_id) != SQLITE_OK)
-  {
-   fprintf(stderr, "%s: save_parameters_to_db(): sqlite3_bind_int() failed, '%s'\n",
-           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-   sqlite3_finalize(statement);
-   return 1;
-  }
-
-  if(sqlite3_bind_text(statement, 2, ctx->parameters->keys[x], strlen(ctx->parameters->keys[x]),
-                       SQLITE_TRANSIENT) != SQLITE_OK)
-  {
-   fprintf(stderr, "%s: save_parameters_to_db(): sqlite3_bind_text() failed, '%s'\n",
-           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-   sqlite3_finalize(statement);
-   return 1;
-  }
+   failed = 1;
+  } else {
 
-  if(sqlite3_bind_text(statement, 3, ctx->parameters->values[x], strlen(ctx->parameters->values[x]),
-                       SQLITE_TRANSIENT) != SQLITE_OK)
-  {
-   fprintf(stderr, "%s: save_parameters_to_db(): sqlite3_bind_text() failed, '%s'\n",
-           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-   sqlite3_finalize(statement);
-   return 1;
-  }
+   if( (sqlite3_bind_int(statement, 1, set_id) != SQLITE_OK) ||
+       (sqlite3_bind_int(statement, 2, ctx->build_id) != SQLITE_OK) )
+   {
+    fprintf(stderr, "%s: save_parameters_to_db(): sqlite3_bind_int() failed, '%s'\n",
+            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+    failed = 1;
+   } else if(sqlite3_step(statement) != SQLITE_DONE) {
+    fprintf(stderr, "%s: save_parameters_to_db(): sqlite3_step() failed, '%s'\n",
+            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+    failed = 1;
+   }
 
-  code = sqlite3_step(statement);
-  if(code != SQLITE_DONE)
-  {
-   fprintf(stderr, "%s: save_parameters_to_db(): sqlite3_step() failed, '%s'\n",
-           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
    sqlite3_finalize(statement);
-   return 1;
   }
+ }
 
+ if(failed)
+ {
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TO save_parameters; RELEASE save_parameters;",
+               NULL, NULL, NULL);
+  close_database(ctx);
+  return 1;
  }
 
- sqlite3_finalize(statement);
+ if(sqlite3_exec(ctx->db_ctx, "RELEASE save_parameters;", NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: save_parameters_to_db(): sqlite3_exec(\"RELEASE\"): '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  close_database(ctx);
+  return 1;
+ }
 
  close_database(ctx);
 
  return 0;
 }
-
-
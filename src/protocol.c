@@ -48,7 +48,7 @@ int send_line(const struct buildmatrix_context *ctx, int length, char *buffer)
 int receive_line(struct buildmatrix_context *ctx, int size, int *length, char *buffer)
 {
  int bytes_read, n_bytes, i;
- static char line_buffer[4096];
+ static char line_buffer[PROTOCOL_LINE_MAX];
  static int line_buffer_length = 0;
 
  if(ctx->connection_initialized == 0)
@@ -57,27 +57,27 @@ int receive_line(struct buildmatrix_context *ctx, int size, int *length, char *b
   return 1;
  }
 
- if(line_buffer_length > size)
+ if( (size > PROTOCOL_LINE_MAX) || (line_buffer_length > size) )
  {
   fprintf(stderr, "%s: receive_line() more in line buffer than value of size. fix this\n", 
           ctx->error_prefix);
   return 1;
  }
 
- for(i=0; i<line_buffer_length; i++)
+ if((i = scan_for_byte(line_buffer, line_buffer_length, '\n')) != -1)
  {
-  if(line_buffer[i] == '\n')
-  {
-   memcpy(buffer, line_buffer, i);
-   buffer[i] = 0;
-   memmove(line_buffer, line_buffer + i + 1, line_buffer_length - (i + 1));
-   line_buffer_length -= (i + 1);
-   *length = i + 1;
-   return 0;
-  }
+  memcpy(buffer, line_buffer, i);
+  buffer[i] = 0;
+  memmove(line_buffer, line_buffer + i + 1, line_buffer_length - (i + 1));
+  line_buffer_length -= (i + 1);
+  *length = i + 1;
+  return 0;
  }
 
- bytes_read = i;
+ /* a partial line left over from the last read is the start of this one */
+ memcpy(buffer, line_buffer, line_buffer_length);
+ bytes_read = line_buffer_length;
+ line_buffer_length = 0;
 
  while(1)
  {
@@ -97,16 +97,14 @@ int receive_line(struct buildmatrix_context *ctx, int size, int *length, char *b
    return 1;
   }
 
-  for(i=bytes_read; i < bytes_read + n_bytes; i++)
+  if((i = scan_for_byte(buffer + bytes_read, n_bytes, '\n')) != -1)
   {
-   if(buffer[i] == '\n')
-   {
-    line_buffer_length = n_bytes - (i + 1 - bytes_read);
-    memcpy(line_buffer, buffer + i + 1, line_buffer_length);
-    *length = i + 1;
-    buffer[i] = 0;
-    return 0;
-   }
+   i += bytes_read;
+   line_buffer_length = n_bytes - (i + 1 - bytes_read);
+   memcpy(line_buffer, buffer + i + 1, line_buffer_length);
+   *length = i + 1;
+   buffer[i] = 0;
+   return 0;
   }
 
   bytes_read += n_bytes;
@@ -204,7 +202,7 @@ int send_revision(struct buildmatrix_context *ctx)
  if(ctx->verbose > 1)
   fprintf(stderr, "%s: send_revision()\n", ctx->error_prefix);
 
- if(ctx->user == NULL)
+ if(ctx->revision == NULL)
   return 0;
 
  if(ctx->verbose)
@@ -364,6 +362,90 @@ int send_build_host_name(struct buildmatrix_context *ctx)
  return 1;
 }
 
+int send_submitter_name(struct buildmatrix_context *ctx)
+{
+ int n_bytes, length;
+ char buffer[4096];
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: send_submitter_name()\n", ctx->error_prefix);
+
+ if(ctx->submitter == NULL)
+  return 0;
+
+ if(ctx->verbose)
+  fprintf(stderr, "%s: sending submitter name\n", ctx->error_prefix);
+
+ length = snprintf(buffer, 4096, "submitter: %s\n", ctx->submitter);
+
+ if(send_line(ctx, length, buffer))
+  return 1;
+
+ if(receive_line(ctx, 4096, &n_bytes, buffer))
+  return 1;
+
+ buffer[n_bytes] = 0;
+ if(strncmp(buffer, "failed", 6) == 0)
+ {
+  fprintf(stderr, "%s: peer rejected submitter name, \"%s\"\n", ctx->error_prefix, buffer);
+  return 1;
+ }
+
+ if(strncmp(buffer, "ok", 2) == 0)
+ {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: submitter name sent.\n", ctx->error_prefix);
+
+  return 0;
+ }
+
+ fprintf(stderr, "%s: unexpected response to submitter, \"%s\"\n", 
+         ctx->error_prefix, buffer);
+ return 1;
+}
+
+int send_time_range(struct buildmatrix_context *ctx)
+{
+ int n_bytes, length;
+ char buffer[4096];
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: send_time_range()\n", ctx->error_prefix);
+
+ if( (ctx->since_time == 0) && (ctx->until_time == 0) )
+  return 0;
+
+ if(ctx->verbose)
+  fprintf(stderr, "%s: sending time range\n", ctx->error_prefix);
+
+ length = snprintf(buffer, 4096, "time range: %lld %lld\n", ctx->since_time, ctx->until_time);
+
+ if(send_line(ctx, length, buffer))
+  return 1;
+
+ if(receive_line(ctx, 4096, &n_bytes, buffer))
+  return 1;
+
+ buffer[n_bytes] = 0;
+ if(strncmp(buffer, "failed", 6) == 0)
+ {
+  fprintf(stderr, "%s: peer rejected time range, \"%s\"\n", ctx->error_prefix, buffer);
+  return 1;
+ }
+
+ if(strncmp(buffer, "ok", 2) == 0)
+ {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: time range sent.\n", ctx->error_prefix);
+
+  return 0;
+ }
+
+ fprintf(stderr, "%s: unexpected response to time range, \"%s\"\n", 
+         ctx->error_prefix, buffer);
+ return 1;
+}
+
 int send_unique_identifier(struct buildmatrix_context *ctx)
 {
  int n_bytes, length;
@@ -578,7 +660,7 @@ int send_checksum(struct buildmatrix_context *ctx, int from_db)
 
   if(from_db)
   {
-   if(send_db_file(ctx, ctx->checksum))
+   if(send_db_file(ctx, ctx->checksum, ctx->checksum_size))
    {
     fprintf(stderr, "%s: peer rejected checksum.\n", ctx->error_prefix);
     return 1;
@@ -633,7 +715,7 @@ int send_build_output(struct buildmatrix_context *ctx, int from_db)
 
   if(from_db)
   {
-   if(send_db_file(ctx, ctx->build_output))
+   if(send_db_file(ctx, ctx->build_output, ctx->output_size))
    {
     fprintf(stderr, "%s: peer rejected build output.\n", ctx->error_prefix);
     return 1;
@@ -688,7 +770,7 @@ int send_build_report(struct buildmatrix_context *ctx, int from_db)
 
   if(from_db)
   {
-   if(send_db_file(ctx, ctx->build_report))
+   if(send_db_file(ctx, ctx->build_report, ctx->report_size))
    {
     fprintf(stderr, "%s: peer rejected build report.\n", ctx->error_prefix);
     return 1;
@@ -750,8 +832,8 @@ int send_test_totals(struct buildmatrix_context *ctx)
 
 int service_input(struct buildmatrix_context *ctx)
 {
- int n_bytes, allocation_size, save_in_database, code;
- char buffer[4096];
+ int n_bytes, allocation_size, save_in_database, code, length, n_scratched;
+ char buffer[4096], from_identifier[256], to_identifier[256];
  struct test_results *test_results;
 
  if(ctx->verbose > 1)
@@ -787,7 +869,15 @@ int service_input(struct buildmatrix_context *ctx)
   if(ctx->verbose)
    fprintf(stderr, "%s: peer requesting connection initialization\n", ctx->error_prefix);
 
-  n_bytes = snprintf(buffer, 64, "connection initialized|%s\n", ctx->project_name);
+  /* newer peers list the artifact codecs they can take as is, older ones send nothing */
+  ctx->peer_codecs = 0;
+  if(strcmp(buffer + 23, "|gzip") == 0)
+   ctx->peer_codecs |= 1 << BLDMTRX_CODEC_GZIP;
+
+  if(ctx->peer_codecs == 0)
+   n_bytes = snprintf(buffer, 256, "connection initialized|%s\n", ctx->project_name);
+  else
+   n_bytes = snprintf(buffer, 256, "connection initialized|%s|gzip\n", ctx->project_name);
 
   if(send_line(ctx, n_bytes, buffer))
    return 1;
@@ -1305,6 +1395,60 @@ int service_input(struct buildmatrix_context *ctx)
   return 0;
  }
 
+ /* submitter, filter for builds submitted by another user */
+ if( (n_bytes > 12) &&
+     (strncmp(buffer, "submitter: ", 11) == 0) )
+ {
+  if(ctx->submitter != NULL)
+   free(ctx->submitter);
+
+  allocation_size = n_bytes - 11;
+  if((ctx->submitter = (char *) malloc(allocation_size)) == NULL)
+  {
+   fprintf(stderr, "%s: malloc(%d) failed\n",
+           ctx->error_prefix, allocation_size);
+   return 1;
+  }
+  memcpy(ctx->submitter, buffer + 11, allocation_size - 1);
+  ctx->submitter[allocation_size - 1] = 0;
+
+  if(ctx->verbose)
+   fprintf(stderr, "%s: peer sending submitter, \"%s\"\n", 
+           ctx->error_prefix, ctx->submitter);
+
+  if(check_string(ctx, ctx->submitter))
+  {
+   send_line(ctx, 7, "failed\n");
+   return 1;
+  }
+
+  if(send_line(ctx, 3, "ok\n"))
+   return 1;
+
+  return 0;
+ }
+
+ /* time range, 0 meaning open ended */
+ if( (n_bytes > 12) &&
+     (strncmp(buffer, "time range: ", 12) == 0) )
+ {
+  if(sscanf(buffer + 12, "%lld %lld", &(ctx->since_time), &(ctx->until_time)) != 2)
+  {
+   fprintf(stderr, "%s: malformed time range\n", ctx->error_prefix);
+   send_line(ctx, 7, "failed\n");
+   return 1;
+  }
+
+  if(ctx->verbose)
+   fprintf(stderr, "%s: peer sending time range, %lld - %lld\n", 
+           ctx->error_prefix, ctx->since_time, ctx->until_time);
+
+  if(send_line(ctx, 3, "ok\n"))
+   return 1;
+
+  return 0;
+ }
+
  /* build result */
  if( (n_bytes > 8) &&
      (strncmp(buffer, "result: ", 8) == 0) )
@@ -1325,6 +1469,22 @@ int service_input(struct buildmatrix_context *ctx)
   return 0;
  }
 
+ /* proceed to receive_test_results_stream() */
+ if( (n_bytes == 20) &&
+     (strncmp(buffer, "test results stream", 19) == 0) )
+ {
+  if(save_in_database == 0)
+  {
+   send_line(ctx, 7, "failed\n");
+   return 1;
+  }
+
+  if(receive_test_results_stream(ctx))
+   return 1;
+
+  return 0;
+ }
+
  /* proceed to receive_test_results() */
  if( (n_bytes > 14) &&
      (strncmp(buffer, "test results: ", 14) == 0) )
@@ -1561,13 +1721,50 @@ int service_input(struct buildmatrix_context *ctx)
  if( (n_bytes == 11) &&
      (strncmp(buffer, "list tests", 10) == 0) )
  {
+  if(open_database(ctx))
+  {
+   send_line(ctx, 7, "failed\n");
+   return 1;
+  }
+
   if(authorize_list(ctx))
   {
    send_line(ctx, 7, "failed\n");
    return 1;
   }
 
+  if(send_line(ctx, 3, "ok\n"))
+   return 1;
+
   if(service_list_tests(ctx))
+  {
+   send_line(ctx, 7, "failed\n");
+   close_database(ctx);
+   return 1;
+  }
+
+  return 0;
+ }
+
+ /* test diff */
+ if( (n_bytes > 10) &&
+     (strncmp(buffer, "test diff ", 10) == 0) )
+ {
+  if( (sscanf(buffer + 10, "%255s %255s", from_identifier, to_identifier) != 2) ||
+      (check_string(ctx, from_identifier)) || (check_string(ctx, to_identifier)) )
+  {
+   fprintf(stderr, "%s: malformed test diff request\n", ctx->error_prefix);
+   send_line(ctx, 7, "failed\n");
+   return 1;
+  }
+
+  if(open_database(ctx))
+  {
+   send_line(ctx, 7, "failed\n");
+   return 1;
+  }
+
+  if(authorize_get(ctx))
   {
    send_line(ctx, 7, "failed\n");
    return 1;
@@ -1576,6 +1773,14 @@ int service_input(struct buildmatrix_context *ctx)
   if(send_line(ctx, 3, "ok\n"))
    return 1;
 
+  if(service_test_diff(ctx, from_identifier, to_identifier))
+  {
+   send_line(ctx, 7, "failed\n");
+   close_database(ctx);
+   return 1;
+  }
+
+  close_database(ctx);
   return 0;
  }
 
@@ -1667,6 +1872,29 @@ int service_input(struct buildmatrix_context *ctx)
   return 0;
  }
 
+ /* scratch every build matching the filters */
+ if( (n_bytes == 17) &&
+      (strncmp(buffer, "scratch matching", 16) == 0) )
+ {
+  if(authorize_scratch(ctx))
+  {
+   send_line(ctx, 7, "failed\n");
+   return 1;
+  }
+
+  if(service_scratch_matching(ctx, &n_scratched))
+  {
+   send_line(ctx, 7, "failed\n");
+   return 1;
+  }
+
+  length = snprintf(buffer, 32, "ok %d\n", n_scratched);
+  if(send_line(ctx, length, buffer))
+   return 1;
+ 
+  return 0;
+ }
+
  /* scratch build */
  if( (n_bytes == 8) &&
       (strncmp(buffer, "scratch", 7) == 0) )
@@ -1751,6 +1979,176 @@ int service_list_builds_strategy_net_start(const struct buildmatrix_context *ctx
  return 0;
 }
 
+int format_list_builds_line(char *buffer, int size, const struct list_builds_data *data)
+{
+ return snprintf(buffer, size, 
+                 "%d|%s|%s|%s|%s|%s|%d|%lld|%d|%d|%d|%d|%d|%d|%s|%s|%s|%s|\n", 
+                 data->build_id, data->branch, data->job_name, data->build_node,
+                 data->unique_identifier, data->user, data->build_result, data->build_time,
+                 (data->passed + data->failed + data->incompleted), 
+                 data->passed, data->failed, data->incompleted, data->has_parameters,
+                 data->has_tests,
+                 data->report_name == NULL ? "NULL" : data->report_name,
+                 data->output_name == NULL ? "NULL" : data->output_name,
+                 data->checksum_name == NULL ? "NULL" : data->checksum_name,
+                 data->revision);
+}
+
+/* a row of list builds, as service_list_builds_strategy_net_iterative() sends it and the
+   query cache keeps it, back into data. The strings point into buffer. */
+int parse_list_builds_line(struct buildmatrix_context *ctx, char *buffer, int n_bytes,
+                           struct list_builds_data *data)
+{
+ int i, field, total, start;
+
+ /* branch name, job name, build node, build number, user, build result, start time, end time, totals  */
+ start = 0;
+ field = 0;
+ for(i=0; i<n_bytes; i++)
+ {
+  if(buffer[i] == '|')
+  {
+   buffer[i] = 0;
+   switch(field)
+   {
+    case 0:
+         sscanf(buffer + start, "%d", &data->build_id);
+         start = i + 1;
+         field++;
+         break;
+
+    case 1:
+         data->branch = buffer + start;
+         start = i + 1;
+         field++;
+         break;
+
+    case 2:
+         data->job_name = buffer + start;
+         start = i + 1;
+         field++;
+         break;
+
+    case 3:
+         data->build_node = buffer + start;
+         start = i + 1;
+         field++;
+         break;
+
+    case 4:
+         data->unique_identifier = buffer + start;
+         start = i + 1;
+         field++;
+         break;
+
+    case 5:
+         data->user = buffer + start;
+         start = i + 1;
+         field++;
+         break;
+
+    case 6:
+         sscanf(buffer + start, "%d", &data->build_result);
+         start = i + 1;
+         field++;
+         break;
+
+    case 7:
+         sscanf(buffer + start, "%lld", &data->build_time);
+         start = i + 1;
+         field++;
+         break;
+
+    case 8:
+         sscanf(buffer + start, "%d", &total);
+         start = i + 1;
+         field++;
+         break;
+
+    case 9:
+         sscanf(buffer + start, "%d", &data->passed);
+         start = i + 1;
+         field++;
+         break;
+
+    case 10:
+         sscanf(buffer + start, "%d", &data->failed);
+         start = i + 1;
+         field++;
+         break;
+
+    case 11:
+         sscanf(buffer + start, "%d", &data->incompleted);
+         start = i + 1;
+         field++;
+         break;
+
+    case 12:
+         sscanf(buffer + start, "%d", &data->has_parameters);
+         start = i + 1;
+         field++;
+         break;
+
+    case 13:
+         sscanf(buffer + start, "%d", &data->has_tests);
+         start = i + 1;
+         field++;
+         break;
+
+    case 14:
+         data->report_name = buffer + start;
+         if(strcmp(data->report_name, "NULL") == 0)
+          data->report_name = NULL;
+         start = i + 1;
+         field++;
+         break;
+
+    case 15:
+         data->output_name = buffer + start;
+         if(strcmp(data->output_name, "NULL") == 0)
+          data->output_name = NULL;
+         start = i + 1;
+         field++;
+         break;
+
+    case 16:
+         data->checksum_name = buffer + start;
+         if(strcmp(data->checksum_name, "NULL") == 0)
+          data->checksum_name = NULL;
+         start = i + 1;
+         field++;
+         break;
+
+    case 17:
+         data->revision = buffer + start;
+         start = i + 1;
+         field++;
+         break;
+
+   }
+  }
+ }
+
+ if(field != 18)
+ {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: wrong number of columns (%d instead of 18) in lists builds results (%d bytes) \"%s\"\n",
+           ctx->error_prefix, field, n_bytes, buffer);
+
+  return 1;
+ }
+
+ if(total != (data->passed + data->failed + data->incompleted) )
+ {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: test totals failed sanity check\n", ctx->error_prefix);
+
+  return 1;
+ }
+
+ return 0;
+}
+
 int service_list_builds_strategy_net_iterative(const struct buildmatrix_context *ctx,
                                                 void * const strategy_context, const void *ptr)
 {
@@ -1763,17 +2161,7 @@ int service_list_builds_strategy_net_iterative(const struct buildmatrix_context
           ctx->error_prefix);
 
 
- length = 
- snprintf(buffer, 4096, 
-          "%d|%s|%s|%s|%s|%s|%d|%lld|%d|%d|%d|%d|%d|%d|%s|%s|%s|%s|\n", 
-          data->build_id, data->branch, data->job_name, data->build_node, data->unique_identifier,
-          data->user, data->build_result, data->build_time,
-          (data->passed + data->failed + data->incompleted), 
-          data->passed, data->failed, data->incompleted, data->has_parameters, data->has_tests,
-          data->report_name == NULL ? "NULL" : data->report_name,
-          data->output_name == NULL ? "NULL" : data->output_name,
-          data->checksum_name == NULL ? "NULL" : data->checksum_name,
-          data->revision);
+ length = format_list_builds_line(buffer, 4096, data);
 
  if(send_line(ctx, length, buffer))
  {
@@ -1795,3 +2183,59 @@ int service_list_builds_strategy_net_done(const struct buildmatrix_context *ctx,
  return send_line(ctx, 5, "done\n");
 }
 
+int service_list_tests_strategy_net_start(const struct buildmatrix_context *ctx,
+                                          void * const strategy_context, const void *ptr)
+{
+ if(ctx->verbose > 2)
+  fprintf(stderr, "%s: service_list_tests_strategy_net_start()\n",
+          ctx->error_prefix);
+
+ return 0;
+}
+
+/* test_history rows go out by field, like builds, and the client formats them */
+int service_list_tests_strategy_net_iterative(const struct buildmatrix_context *ctx,
+                                              void * const strategy_context, const void *ptr)
+{
+ char buffer[4096];
+ int length;
+ const struct test_history_data *data = (const struct test_history_data *) ptr;
+
+ if(ctx->verbose > 2)
+  fprintf(stderr, "%s: service_list_tests_strategy_net_iterative()\n",
+          ctx->error_prefix);
+
+ length = 
+ snprintf(buffer, 4096, "%d|%s|%s|%s|%s|%d|%d|%d|%d|%d|%d|%s|\n",
+          data->test_id, data->suite, data->test, data->job_name, data->branch,
+          data->passed, data->failed, data->incompleted, data->last_result, data->flips,
+          data->last_failure_build_id,
+          data->last_failure == NULL ? "NULL" : data->last_failure);
+
+ if(length >= 4096)
+ {
+  fprintf(stderr, "%s: service_list_tests_strategy_net_iterative(): line for %s.%s too long\n",
+          ctx->error_prefix, data->suite, data->test);
+  return 1;
+ }
+
+ if(send_line(ctx, length, buffer))
+ {
+  fprintf(stderr, "%s: service_list_tests_strategy_net_iterative(): send_line() failed\n",
+          ctx->error_prefix);
+  return 1;
+ }
+
+ return 0;
+}
+
+int service_list_tests_strategy_net_done(const struct buildmatrix_context *ctx, 
+                                         void * const strategy_context, const void *ptr)
+{
+ if(ctx->verbose > 2)
+  fprintf(stderr, "%s: service_list_tests_strategy_net_done()\n",
+          ctx->error_prefix);
+
+ return send_line(ctx, 5, "done\n");
+}
+
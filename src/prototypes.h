@@ -22,6 +22,7 @@
 #ifndef _PROTOTYPES_H_
 #define _PROTOTYPES_H_
 #include <sqlite3.h>
+#include <zlib.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,10 +31,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdint.h>
 
 #define BLDMTRX_MODE_PARSE        01
+#define BLDMTRX_MODE_CONVERT      02
 #define BLDMTRX_MODE_SERVE        10
 #define BLDMTRX_MODE_INIT         11
 #define BLDMTRX_MODE_ADD_USER     15
@@ -46,6 +50,8 @@
 #define BLDMTRX_MODE_LIST_ALIASES 22
 #define BLDMTRX_MODE_LIST_VARIABLES 23
 #define BLDMTRX_MODE_GEN_REPORT   30
+#define BLDMTRX_MODE_PRUNE        31
+#define BLDMTRX_MODE_ARCHIVE      32
 
 #define BLDMTRX_MODE_RECONFIGURE    99
 #define BLDMTRX_MODE_CONNECT        100
@@ -60,12 +66,22 @@
 #define BLDMTRX_MODE_LIST_BUILDS    107
 #define BLDMTRX_MODE_SHOW_BUILD     108
 #define BLDMTRX_MODE_LIST_TESTS     109
+#define BLDMTRX_MODE_TEST_DIFF      110
 
 #define BLDMTRX_ACCESS_BIT_SUBMIT  1
 #define BLDMTRX_ACCESS_BIT_GET     2
 #define BLDMTRX_ACCESS_BIT_LIST    4
 #define BLDMTRX_ACCESS_BIT_SCRATCH 8
 
+/* how build artifacts are stored at rest, recorded in builds.artifact_codec */
+#define BLDMTRX_CODEC_NONE 0
+#define BLDMTRX_CODEC_GZIP 1
+
+/* how builds, tests and build write to stdout, see export.c */
+#define OUTPUT_FORMAT_CONSOLE 0
+#define OUTPUT_FORMAT_NDJSON  1
+#define OUTPUT_FORMAT_TSV     2
+
 struct test
 {
  int result;
@@ -87,6 +103,118 @@ struct test_results
  int allocation_size, n_tests, string_space;
 };
 
+/* test results are accumulated by offset while reading, then laid out as one block for the
+   caller by assemble_test_results() */
+struct pulled_suite
+{
+ size_t name;
+ int first_test, n_tests;
+};
+
+struct pulled_test
+{
+ int result, has_data;
+ size_t name, data;
+};
+
+/* Binary test results file: a header, n_suites suite records, n_tests test records, then
+   string_space bytes of terminated strings the records refer to by offset. Everything is a
+   32 bit word in the byte order of the machine that wrote it, which byte_order shows. */
+#define BMT_MAGIC "BMTB"
+#define BMT_VERSION 1
+#define BMT_BYTE_ORDER 0x01020304
+#define BMT_NO_DATA 0xffffffff
+
+struct bmt_header
+{
+ char magic[4];
+ uint32_t byte_order, version, n_suites, n_tests, string_space;
+};
+
+struct bmt_suite
+{
+ uint32_t name, first_test, n_tests;
+};
+
+struct bmt_test
+{
+ uint32_t name, data, result;
+};
+
+/* one line of a test results file, see parse_test_results_line() */
+struct test_results_line
+{
+ int kind, result, has_data;
+ const char *name, *data;
+ int name_length, data_length;
+};
+
+/* A test's data may be up to TEST_DATA_LIMIT bytes. Anything longer than TEST_DATA_INLINE is
+   kept once per distinct value in the blobs table instead of in scores.data, so the scores rows
+   that result-only queries walk stay narrow, see file_test_blob(). PROTOCOL_LINE_MAX fits a
+   "test|" line with the longest name and data. */
+#define TEST_DATA_LIMIT 16384
+#define TEST_DATA_INLINE 256
+#define PROTOCOL_LINE_MAX (TEST_DATA_LIMIT + 2048)
+
+/* where test results files come from, see test_results_format() */
+#define TEST_RESULTS_FORMAT_TEXT  0
+#define TEST_RESULTS_FORMAT_JUNIT 1
+#define TEST_RESULTS_FORMAT_TAP   2
+
+#define IMPORT_XML  1
+#define IMPORT_NAME 2
+
+#define JUNIT_MAX_DEPTH 16
+
+/* walks a test results file a suite or test at a time, see read_test_results_record() */
+struct test_results_reader
+{
+ int format;
+ const char *filename, *contents;
+ size_t filesize, index, record;
+ int line_number;
+
+ /* JUnit XML and TAP put each test together here before handing it out */
+ int have_suite, pending, in_testcase, depth, result, has_data;
+ int suite_length, candidate_length, test_length, data_length;
+ const char *suite_names[JUNIT_MAX_DEPTH];
+ int suite_name_lengths[JUNIT_MAX_DEPTH];
+ char suite[513], candidate[513], test[257], data[TEST_DATA_LIMIT + 1];
+};
+
+/* statements for filing scores as they arrive, see open_test_results_filer() */
+struct test_results_filer
+{
+ struct sqlite3_stmt *suite_lookup, *suite_insert, *test_lookup, *test_insert, *score_insert,
+                     *blob_lookup, *blob_reference, *blob_insert;
+ int suite_id, n_scores;
+};
+
+/* growable buffer addressed by offset, so growing it never invalidates anything */
+struct arena
+{
+ char *base;
+ size_t used, size;
+};
+
+/* an immutable copy of the configuration table sorted by parameter, see configuration.c */
+struct configuration_snapshot
+{
+ long long int counter;
+ int n_values;
+ char **parameters;
+ char **values;
+};
+
+/* open addressing string -> id map, see strings.c */
+struct string_index
+{
+ const char **keys;
+ int *ids;
+ int n_slots, n_entries;
+};
+
 struct parameters
 {
  char **keys;
@@ -94,6 +222,23 @@ struct parameters
  int n_pairs, string_space;
 };
 
+struct parameter_pair
+{
+ const char *key, *value;
+};
+
+/* parameters of many builds, by_build[i] belongs to build_ids[i], sorted by build_id. Builds
+   submitted with the same parameters point at the same entry of sets. */
+struct parameter_sets
+{
+ int n_sets, n_builds;
+ int *build_ids;
+ struct parameters *sets, **by_build;
+ struct parameters empty;
+ char **pointers;
+ char *strings;
+};
+
 struct buildmatrix_context;
 
 struct iterative_strategy
@@ -125,6 +270,68 @@ struct list_builds_data
  int has_tests; 
 };
 
+/* one row of test_history, see testresults.c */
+struct test_history_data
+{
+ int test_id;
+ const char *suite;
+ const char *test;
+ const char *job_name;
+ const char *branch;
+ int passed;
+ int failed;
+ int incompleted;
+ int last_result;
+ int flips;
+ int last_failure_build_id;
+ const char *last_failure;
+};
+
+/* a test whose score differs between two builds, see read_test_diff() */
+#define TEST_DIFF_FAILING    0
+#define TEST_DIFF_PASSING    1
+#define TEST_DIFF_INCOMPLETE 2
+#define TEST_DIFF_ADDED      3
+#define TEST_DIFF_REMOVED    4
+
+struct test_diff_data
+{
+ int test_id;
+ const char *suite;
+ const char *test;
+ int change;
+ int old_result;
+ int new_result;
+};
+
+struct test_history_update
+{
+ struct sqlite3_stmt *insert, *update;
+};
+
+/* results of jobs, branches, hosts and builds kept in the query_cache table of
+   QUERY_CACHE_FILENAME, see database.c. The filters a list honors make up its key along with
+   the command. */
+#define QUERY_CACHE_FILENAME "query_cache.sqlite3"
+#define QUERY_FILTER_BRANCH    1
+#define QUERY_FILTER_JOB       2
+#define QUERY_FILTER_HOST      4
+#define QUERY_FILTER_SUBMITTER 8
+#define QUERY_FILTER_TIME      16
+#define QUERY_FILTER_ALL       31
+
+/* a miss on a longer list streams through without being kept */
+#define QUERY_CACHE_LIMIT (4 * 1024 * 1024)
+
+struct query_cache
+{
+ int enabled, n_rows;
+ long long int generation;
+ const char *command;
+ char filters[1024];
+ struct arena rows;
+};
+
 struct buildmatrix_context
 {
  /* general */
@@ -133,6 +340,7 @@ struct buildmatrix_context
  int force;
  int non_interactive;
  int mode, local;
+ int output_format;
  int (*yes_no_prompt) (struct buildmatrix_context *, char *);
  char *current_working_directory;
 
@@ -142,6 +350,7 @@ struct buildmatrix_context
  char *revision;
  int build_result;
  char *unique_identifier;
+ char *other_identifier;
  int test_totals[4];
  char *build_report;
  char *build_output;
@@ -151,14 +360,22 @@ struct buildmatrix_context
  char *build_node;
  char *project_name;
  struct test_results *test_results;
+ int stream_test_results;
+ int binary_test_results;
+ char *test_results_out_file;
+ int test_results_streamed;
  struct parameters *parameters;
  int n_parameters;
  long long int build_time;
  char *user;
+ char *submitter;
+ long long int since_time;
+ long long int until_time;
  char *email_address;
  int sub_dialog_mode;
  struct iterative_strategy list_ops_strategy;
  struct iterative_strategy build_list_strategy;
+ struct iterative_strategy test_list_strategy;
  int (*process_build_strategy) (struct buildmatrix_context * const);
 
  /* db related */
@@ -167,15 +384,30 @@ struct buildmatrix_context
  int posix_uid;
  int user_id;
  char *alias;
+ int identity_cached;
+ int identity_user_id;
+ int identity_mode_bitmask;
+ int identity_posix_uid;
+ char *identity_key;
+ char *identity_name;
  int grow_test_tables;
+ int artifact_codec;
+ long long int checksum_size;
+ long long int report_size;
+ long long int output_size;
  int build_id;
  int pull_build_id;
  int db_ref_count;
+ int db_read_only;
  sqlite3 *db_ctx;
+ sqlite3 *cache_db_ctx;
+ struct configuration_snapshot *configuration;
+ long long int configuration_data_version;
  char *local_project_directory;
  char *limbo_directory;
  struct iterative_strategy service_simple_lists_strategy;
  struct iterative_strategy service_list_builds_strategy;
+ struct iterative_strategy service_list_tests_strategy;
 
  /* fork & ssh related */
  char *server_argument_vector[64];
@@ -190,6 +422,7 @@ struct buildmatrix_context
 
  /* network & io */
  int connection_initialized;
+ int peer_codecs;
  int in;
  int out;
  char *error_prefix;
@@ -212,6 +445,8 @@ int send_build_result(struct buildmatrix_context *ctx);
 int send_branch_name(struct buildmatrix_context *ctx);
 int send_revision(struct buildmatrix_context *ctx);
 int send_build_host_name(struct buildmatrix_context *ctx);
+int send_submitter_name(struct buildmatrix_context *ctx);
+int send_time_range(struct buildmatrix_context *ctx);
 int send_unique_identifier(struct buildmatrix_context *ctx);
 int send_user_name(struct buildmatrix_context *ctx);
 int send_job_name(struct buildmatrix_context *ctx);
@@ -232,6 +467,9 @@ int service_list_strategy_net_iterative(const struct buildmatrix_context *ctx,
 int service_list_strategy_net_done(const struct buildmatrix_context *ctx,
                                    void * const strategy_context, const void *ptr);
 
+int format_list_builds_line(char *buffer, int size, const struct list_builds_data *data);
+int parse_list_builds_line(struct buildmatrix_context *ctx, char *buffer, int n_bytes,
+                           struct list_builds_data *data);
 int service_list_builds_strategy_net_start(const struct buildmatrix_context *ctx,
                                            void * const strategy_context, const void *ptr);
 int service_list_builds_strategy_net_iterative(const struct buildmatrix_context *ctx,
@@ -239,6 +477,13 @@ int service_list_builds_strategy_net_iterative(const struct buildmatrix_context
 int service_list_builds_strategy_net_done(const struct buildmatrix_context *ctx,
                                           void * const strategy_context, const void *ptr);
 
+int service_list_tests_strategy_net_start(const struct buildmatrix_context *ctx,
+                                          void * const strategy_context, const void *ptr);
+int service_list_tests_strategy_net_iterative(const struct buildmatrix_context *ctx,
+                                              void * const strategy_context, const void *ptr);
+int service_list_tests_strategy_net_done(const struct buildmatrix_context *ctx,
+                                         void * const strategy_context, const void *ptr);
+
 /* setup.c */
 struct buildmatrix_context *setup(int argc, char **argv);
 void help(void);
@@ -246,17 +491,40 @@ int clean_state(struct buildmatrix_context *ctx);
 
 /* files.c */
 char *read_disk_file(struct buildmatrix_context *ctx, char *filename, size_t *filesize);
+char *map_disk_file(struct buildmatrix_context *ctx, char *filename, size_t *filesize,
+                    int *mapped);
+void release_disk_file(char *contents, size_t filesize, int mapped);
 int remove_disk_file(struct buildmatrix_context *ctx, const char *filename);
 int remove_db_file(struct buildmatrix_context *ctx, const char *filename);
+int remove_build_file(struct buildmatrix_context *ctx, const char *unique_identifier,
+                      const char *filename);
+int remove_build_files_in_background(struct buildmatrix_context *ctx, char **identifiers,
+                                     char **files, int n_files);
 int send_disk_file(struct buildmatrix_context *ctx, char *filename, char *filecontents);
-int send_db_file(struct buildmatrix_context *ctx, char *filename);
+int send_db_file(struct buildmatrix_context *ctx, char *filename, long long int size);
 int send_file_from_blob(struct buildmatrix_context *ctx, char *filename, char *blob, int size);
 int receive_disk_file(struct buildmatrix_context *ctx, char **filename_ptr, int limbo);
 int receive_file_as_blob(struct buildmatrix_context *ctx, char **filename_ptr, char **filecontents);
-int limbo_to_database(struct buildmatrix_context *ctx, char *filename);
+int limbo_to_database(struct buildmatrix_context *ctx, char *filename, long long int *size);
 int limbo_cleanup(struct buildmatrix_context *ctx);
 unsigned long long int file_size(struct buildmatrix_context *ctx, const char *filename);
 
+/* compression.c */
+const char *artifact_codec_name(int codec);
+const char *artifact_codec_suffix(int codec);
+int artifact_codec_from_name(const char *name);
+int resolve_artifact_codec(struct buildmatrix_context *ctx);
+int upgrade_artifact_columns(struct buildmatrix_context *ctx);
+void read_artifact_sizes(struct buildmatrix_context *ctx, sqlite3_stmt *statement, int column);
+int gzip_fd_to_fd(struct buildmatrix_context *ctx, int in_fd, int out_fd, long long int *size);
+int gunzip_start(struct buildmatrix_context *ctx, z_stream *stream);
+int gunzip_chunk(struct buildmatrix_context *ctx, z_stream *stream,
+                 char *data, int length, int out_fd);
+int gunzip_end(struct buildmatrix_context *ctx, z_stream *stream);
+int gunzip_size(struct buildmatrix_context *ctx, int fd, const char *path, long long int *size);
+int send_compressed_db_file(struct buildmatrix_context *ctx, char *path, char *name,
+                            long long int size);
+
 /* client.c */
 int start_server(struct buildmatrix_context *ctx);
 int stop_server(struct buildmatrix_context *ctx);
@@ -266,29 +534,54 @@ int list_jobs(struct buildmatrix_context *ctx);
 int available_jobs(struct buildmatrix_context *ctx);
 int submit(struct buildmatrix_context *ctx, int from_server_to_client);
 int scratch(struct buildmatrix_context *ctx);
+int scratch_matching(struct buildmatrix_context *ctx);
 int list_builds(struct buildmatrix_context *ctx);
 int list_tests(struct buildmatrix_context *ctx);
+int test_diff(struct buildmatrix_context *ctx);
 int show_build(struct buildmatrix_context *ctx);
 int pull(struct buildmatrix_context *ctx);
 
 /* server.c */
 int serve(struct buildmatrix_context *ctx);
 int service_list_tests(struct buildmatrix_context *ctx);
+int service_test_diff_strategy_start(const struct buildmatrix_context *ctx,
+                                     void * const strategy_context, const void *ptr);
+int service_test_diff_strategy_iterative(const struct buildmatrix_context *ctx,
+                                         void * const strategy_context, const void *ptr);
+int service_test_diff_strategy_done(const struct buildmatrix_context *ctx,
+                                    void * const strategy_context, const void *ptr);
+int service_test_diff(struct buildmatrix_context *ctx, const char *from_identifier,
+                      const char *to_identifier);
 int rollback_submit(struct buildmatrix_context *ctx);
 int service_submit(struct buildmatrix_context * const ctx);
 int generate_unique_identifier(struct buildmatrix_context *ctx);
 
 /* strings.c */
 int check_string(struct buildmatrix_context *ctx, char *string);
+int scan_for_byte(const char *buffer, int length, char c);
+size_t scan_line(const char *buffer, size_t length);
+long scan_for_string(const char *buffer, size_t length, const char *needle, size_t needle_length);
+int scan_for_invalid(const char *string);
 int add_to_string_array(char ***array, int array_size, 
                         const char *string, int string_length,
                         int prevent_duplicates);
 int free_string_array(char **array, int n_elements);
 int file_size_to_string(unsigned long long int file_size, char *string, int size);
+int string_to_time(struct buildmatrix_context *ctx, const char *string, long long int *value);
+int arena_reserve(struct arena *a, size_t length, size_t *offset);
+int arena_append_string(struct arena *a, const char *string, size_t *offset);
+void arena_free(struct arena *a);
+unsigned int hash_string(const char *string);
+int string_index_create(struct string_index *index, int expected);
+int string_index_lookup(const struct string_index *index, const char *key);
+int string_index_insert(struct string_index *index, const char *key, int id);
+void string_index_free(struct string_index *index);
 
 /* database.c */
 int open_database(struct buildmatrix_context *ctx);
 int close_database(struct buildmatrix_context *ctx);
+int suspend_database(struct buildmatrix_context *ctx, int *n_references);
+int resume_database(struct buildmatrix_context *ctx, int n_references);
 int new_database(struct buildmatrix_context *ctx);
 int ready_build_submission(struct buildmatrix_context *ctx);
 int add_build(struct buildmatrix_context *ctx);
@@ -301,8 +594,14 @@ int service_list_builds(struct buildmatrix_context *ctx);
 int service_list_users(struct buildmatrix_context *ctx);
 int service_list_parameters(struct buildmatrix_context *ctx);
 int service_scratch(struct buildmatrix_context *ctx);
+int service_scratch_matching(struct buildmatrix_context *ctx, int *n_builds);
+int build_filter_sql(struct buildmatrix_context *ctx, char *sql, int size);
+int bind_build_filter(struct buildmatrix_context *ctx, struct sqlite3_stmt *statement,
+                      int *col_number);
 int service_get_build(struct buildmatrix_context *ctx);
 int service_pull(struct buildmatrix_context *ctx);
+int delete_build_set(struct buildmatrix_context *ctx, char ***identifiers, char ***files,
+                     int *n_files, int *n_builds);
 
 /* connections.c */
 int save_connection_details(struct buildmatrix_context *ctx);
@@ -314,11 +613,79 @@ int update_pull_build_id(struct buildmatrix_context *ctx);
 /* testresults.c */
 int load_test_results(struct buildmatrix_context *ctx, char *filename,
                       struct test_results **results);
+int parse_test_results_line(struct buildmatrix_context *ctx, const char *filename,
+                            int line_number, const char *line, int line_length,
+                            const char *suite_name, struct test_results_line *parsed);
+int stream_test_results(struct buildmatrix_context *ctx, char *filename);
+int receive_test_results_stream(struct buildmatrix_context *ctx);
+int assemble_test_results(struct buildmatrix_context *ctx, struct pulled_suite *ps, int n_suites,
+                          struct pulled_test *pt, int n_tests, const char *strings,
+                          size_t string_space, struct test_results **results);
 int print_suite_array(struct buildmatrix_context *ctx, struct test_results *results);
 int export_test_results_bldmtrx_format(struct buildmatrix_context *ctx, 
                                        struct test_results *results, char *filename);
+int export_test_results_binary_format(struct buildmatrix_context *ctx, 
+                                      struct test_results *results, char *filename);
+int export_test_results(struct buildmatrix_context *ctx, 
+                        struct test_results *results, char *filename);
+int is_binary_test_results(const char *contents, size_t filesize);
+int check_binary_test_results(struct buildmatrix_context *ctx, const char *filename,
+                              const char *contents, size_t filesize);
+int load_binary_test_results(struct buildmatrix_context *ctx, const char *filename,
+                             const char *contents, size_t filesize,
+                             struct test_results **results);
+int open_test_results_filer(struct buildmatrix_context *ctx, struct test_results_filer *filer);
+void close_test_results_filer(struct test_results_filer *filer);
+int file_test_suite(struct buildmatrix_context *ctx, struct test_results_filer *filer,
+                    const char *name);
+int file_test_score(struct buildmatrix_context *ctx, struct test_results_filer *filer,
+                    const char *name, int result, const char *data);
+int file_test_blob(struct buildmatrix_context *ctx, struct test_results_filer *filer,
+                   const char *data, int *blob_id);
+int fold_build_test_history(struct buildmatrix_context *ctx);
 int file_test_results(struct buildmatrix_context *ctx, struct test_results *results);
 int pull_test_results(struct buildmatrix_context *ctx, struct test_results **results);
+int test_history_table_exists(struct buildmatrix_context *ctx, int *exists);
+int create_test_history_table(struct buildmatrix_context *ctx);
+int open_test_history_update(struct buildmatrix_context *ctx, struct test_history_update *update);
+void close_test_history_update(struct test_history_update *update);
+int apply_test_history_update(struct buildmatrix_context *ctx, struct test_history_update *update,
+                              int test_id, const char *job, const char *branch,
+                              int build_id, int result);
+int fold_test_history(struct buildmatrix_context *ctx, const char *sql, int *n_scores);
+int upgrade_test_history_table(struct buildmatrix_context *ctx);
+int forget_test_history(struct buildmatrix_context *ctx);
+int read_test_history(struct buildmatrix_context *ctx, struct iterative_strategy *strategy);
+int blobs_table_exists(struct buildmatrix_context *ctx, int *exists);
+int create_blobs_table(struct buildmatrix_context *ctx);
+int upgrade_blobs_table(struct buildmatrix_context *ctx);
+int release_test_blobs(struct buildmatrix_context *ctx);
+int open_query_cache_database(struct buildmatrix_context *ctx);
+void close_query_cache_database(struct buildmatrix_context *ctx);
+int query_cache_filters(struct buildmatrix_context *ctx, int filters, char *string, int size);
+int open_query_cache(struct buildmatrix_context *ctx, struct query_cache *cache,
+                     const char *command, int filters, struct iterative_strategy *strategy,
+                     int builds, int *hit);
+int record_query_cache_row(struct query_cache *cache, const char *row, int length);
+int store_query_cache(struct buildmatrix_context *ctx, struct query_cache *cache);
+int read_test_diff(struct buildmatrix_context *ctx, const char *from_identifier,
+                   const char *to_identifier, struct iterative_strategy *strategy);
+
+/* testformats.c */
+int test_results_format(const char *contents, size_t filesize);
+void open_test_results_reader(struct test_results_reader *reader, const char *filename,
+                              const char *contents, size_t filesize);
+int test_results_reader_line(const struct test_results_reader *reader);
+int read_test_results_record(struct buildmatrix_context *ctx, struct test_results_reader *reader,
+                             const char *suite_name, struct test_results_line *parsed);
+int import_string(char *out, int size, const char *in, int length, int flags);
+int find_xml_attribute(const char *tag, int tag_length, const char *attribute,
+                       const char **value, int *value_length);
+int next_imported_record(struct test_results_reader *reader, struct test_results_line *parsed);
+int read_junit_record(struct buildmatrix_context *ctx, struct test_results_reader *reader,
+                      struct test_results_line *parsed);
+int read_tap_record(struct buildmatrix_context *ctx, struct test_results_reader *reader,
+                    struct test_results_line *parsed);
 
 /* parameters.c */
 int parameters_from_environ(struct buildmatrix_context *ctx);
@@ -327,21 +694,49 @@ int parameters_to_file(struct buildmatrix_context *ctx, char *filename);
 int parameters_from_file(struct buildmatrix_context *ctx, char *filename);
 int send_parameters(struct buildmatrix_context *ctx);
 int receive_parameters(struct buildmatrix_context *ctx);
+int parameter_set_tables_exist(struct buildmatrix_context *ctx, int *exists);
+int prepare_build_range_query(struct buildmatrix_context *ctx, const char *sql,
+                              int first_build_id, int last_build_id,
+                              struct sqlite3_stmt **statement);
+int load_parameter_rows(struct buildmatrix_context *ctx, struct sqlite3_stmt *statement,
+                        struct arena *set_arena, struct arena *pair_arena,
+                        struct arena *string_arena, int *n_sets, int *n_pairs);
+int load_parameter_sets(struct buildmatrix_context *ctx, int first_build_id, int last_build_id,
+                        struct parameter_sets **sets_ptr);
+struct parameters *parameter_set_for_build(struct parameter_sets *sets, int build_id);
+void free_parameter_sets(struct parameter_sets *sets);
 int load_parameters_from_db(struct buildmatrix_context *ctx);
+int compare_parameter_pairs(const void *a, const void *b);
+int create_parameter_set_tables(struct buildmatrix_context *ctx);
+int upgrade_parameter_set_tables(struct buildmatrix_context *ctx);
+int parameter_set_digest(struct buildmatrix_context *ctx, struct parameter_pair *pairs,
+                         int n_pairs, char *digest);
+int find_parameter_set(struct buildmatrix_context *ctx, const char *digest, int *set_id);
+int intern_parameter_string(struct buildmatrix_context *ctx, struct sqlite3_stmt *insert,
+                            struct sqlite3_stmt *lookup, const char *string, int *string_id);
+int insert_parameter_set(struct buildmatrix_context *ctx, const char *digest,
+                         struct parameter_pair *pairs, int n_pairs, int *set_id);
 int save_parameters_to_db(struct buildmatrix_context *ctx);
 
 /* console */
 int setup_console(struct buildmatrix_context * const ctx);
 
+/* export */
+int setup_export(struct buildmatrix_context * const ctx);
+
 /* portability.c */
 int build_matrix_md5_wrapper(const struct buildmatrix_context *ctx,
                              const unsigned char *input, unsigned int length,
                              unsigned char *output);
 
 /* users.c */
+void invalidate_identity_cache(struct buildmatrix_context *ctx);
+int identity_cache_matches(struct buildmatrix_context *ctx);
+int load_identity(struct buildmatrix_context *ctx);
 int resolve_user_id(struct buildmatrix_context *ctx);
 int add_user(struct buildmatrix_context *ctx);
 int advanced_security_check(struct buildmatrix_context *ctx);
+int check_posix_uid(struct buildmatrix_context *ctx, int uid);
 int authorize_submit(struct buildmatrix_context *ctx);
 int authorize_scratch(struct buildmatrix_context *ctx);
 int authorize_list(struct buildmatrix_context *ctx);
@@ -356,11 +751,49 @@ int remove_alias(struct buildmatrix_context *ctx);
 int list_aliases(struct buildmatrix_context *ctx);
 
 /* configuration.c */
+int create_change_counters(struct buildmatrix_context *ctx);
+int read_change_counter(struct buildmatrix_context *ctx, const char *name, long long int *counter);
+int bump_change_counter(struct buildmatrix_context *ctx, const char *name);
+int read_data_version(struct buildmatrix_context *ctx, long long int *version);
+int load_configuration_snapshot(struct buildmatrix_context *ctx, long long int counter);
+int refresh_configuration(struct buildmatrix_context *ctx);
+const char *configuration_string(struct buildmatrix_context *ctx, const char *parameter);
+int configuration_boolean(struct buildmatrix_context *ctx, const char *parameter,
+                          int default_value, int *value);
+int configuration_int(struct buildmatrix_context *ctx, const char *parameter,
+                      int default_value, int *value);
 char *resolve_configuration_value(struct buildmatrix_context *ctx, char *key);
 int save_configurtation_value(struct buildmatrix_context *ctx, char *parameter,
                               char *value, int overwrite);
 int list_configurtation_values(struct buildmatrix_context *ctx);
 
+/* archive.c */
+int table_columns(struct buildmatrix_context *ctx, const char *schema, const char *table,
+                  char ***names, char ***types, int *n_columns);
+int has_column(char **names, int n_columns, const char *name);
+int archive_select_list(struct buildmatrix_context *ctx, const char *schema, const char *table,
+                        char *sql, int size);
+int create_archive_views(struct buildmatrix_context *ctx);
+int archives_table_exists(struct buildmatrix_context *ctx, int *exists);
+int archive_views_exist(struct buildmatrix_context *ctx, int *exists);
+int attach_archive_file(struct buildmatrix_context *ctx, const char *filename, const char *schema);
+int archive_collision(struct buildmatrix_context *ctx, const char *schema, int *build_id);
+int archive_slots(struct buildmatrix_context *ctx, int *n_slots);
+int detach_archives_outside(struct buildmatrix_context *ctx, long long int since_time,
+                            long long int until_time, int first_build_id, int last_build_id);
+int attach_archives(struct buildmatrix_context *ctx, long long int since_time,
+                    long long int until_time, int first_build_id, int last_build_id);
+int find_archived_build(struct buildmatrix_context *ctx, const char *unique_identifier,
+                        int *build_id);
+int upgrade_build_id_sequence(struct buildmatrix_context *ctx);
+int prepare_archive_table(struct buildmatrix_context *ctx, const char *schema, const char *table);
+int archive_period(struct buildmatrix_context *ctx, const char *period, const char *format,
+                   long long int cutoff, int *n_archived);
+int archive(struct buildmatrix_context *ctx);
+
+/* retention.c */
+int prune(struct buildmatrix_context *ctx);
+
 /* report.c */
 int generate_report(struct buildmatrix_context *ctx);
 struct list_builds_data *copy_list_build_data(const struct buildmatrix_context *const ctx,
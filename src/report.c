@@ -21,11 +21,19 @@
 
 #include "prototypes.h"
 
-struct parameter_grid_row
+/* the parameters table pivoted, one row per name and one column per build. cells holds
+   n_rows * n_columns offsets into pool, where each distinct value is stored once, or -1
+   where the build doesn't have that parameter */
+struct parameter_grid
 {
- char **values;
+ int n_rows, n_columns;
+ int *cells;
+ struct arena pool;
 };
 
+struct report_page_writer;
+struct parameter_stream;
+
 struct report_details
 {
  struct buildmatrix_context *ctx;
@@ -33,10 +41,16 @@ struct report_details
  time_t generation_time;
  time_t lastest_build;
  int n_branches, n_jobs, n_users, n_hosts, n_builds, n_tests, n_parameters;
+ int first_build_id, last_build_id, streaming, pages;
+ struct report_page_writer *page_writer;
+ struct parameter_stream *parameter_stream;
  char **users_list, **jobs_list, **branches_list, **hosts_list, **tests_list, **parameters_list;
  struct list_builds_data **builds;
+ struct test_history_data **test_history;
+ int n_test_history;
  struct parameters **parameters;
- struct parameter_grid_row **parameter_rows;
+ struct parameter_sets *parameter_sets;
+ struct parameter_grid parameter_grid;
 };
 
 struct service_list_strategy_report_context
@@ -123,60 +137,1778 @@ int service_list_builds_strategy_report_done(const struct buildmatrix_context *c
 }
 
 int render_relative_db_file_path(const char *unique_identifier, const char *filename,
-                                 char *string, int size)
+                                 const char *suffix, char *string, int size)
 {
  char dir[3];
 
  snprintf(dir, 3, "%s", unique_identifier);
 
- return snprintf(string, size, "./%s/%s-%s", dir, unique_identifier, filename);
+ return snprintf(string, size, "./%s/%s-%s%s", dir, unique_identifier, filename, suffix);
 }
 
-int render_report(struct report_details *report)
+/* Each build's row in the builds table and its entry in appendix Z never change once the
+   build is in, so they are kept in the report_fragments table (a cache, safe to delete) and
+   reused by later runs. The parameters section is one fragment for the whole report, keyed by
+   the newest build_id, the number of builds and the "scratch" change counter, since any new
+   or removed build changes its columns. Everything else is cheap and rendered every time. */
+
+struct report_cache
 {
- FILE *output;
- char time_string[128], fs_string[32], path_string[1024];
+ int enabled, section_cacheable, n_reused, n_rendered;
+ long long int scratch_generation;
+ int last_build_id;
+ struct sqlite3_stmt *lookup, *store;
+ FILE *spool;
+};
+
+typedef int (*report_fragment_renderer) (struct report_details *report,
+                                         const struct list_builds_data *build, FILE *output);
+
+int create_report_fragments_table(struct buildmatrix_context *ctx)
+{
+ char *errmsg;
+
+ if(sqlite3_exec(ctx->db_ctx, 
+                 "CREATE TABLE IF NOT EXISTS report_fragments (name TEXT, build_id INTEGER, "
+                 "unique_identifier TEXT, last_build_id INTEGER, n_builds INTEGER, "
+                 "scratch_generation INTEGER, html TEXT, UNIQUE (name, build_id));",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: could not create report_fragments, '%s'\n", ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ return 0;
+}
+
+int open_report_cache(struct report_details *report, struct report_cache *cache)
+{
+ struct buildmatrix_context *ctx = report->ctx;
+ char *errmsg, filter[1024];
+
+ memset(cache, 0, sizeof(struct report_cache));
+ cache->last_build_id = report->last_build_id;
+
+ if(read_change_counter(ctx, "scratch", &(cache->scratch_generation)))
+  return 1;
+
+ /* a filtered report has a different set of builds than the cached sections were made for,
+    and a streamed report doesn't hold a whole section in memory */
+ cache->section_cacheable = (build_filter_sql(ctx, filter, 1024) == 0) && (report->streaming == 0);
+
+ /* report workers have read only connections, render_report_pages() made the table for them */
+ if( (ctx->db_read_only == 0) && (create_report_fragments_table(ctx)) )
+  return 1;
+
+ if(sqlite3_exec(ctx->db_ctx, "BEGIN TRANSACTION;", NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: open_report_cache(): sqlite3_exec(\"BEGIN TRANSACTION;\"): '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ if( (sqlite3_prepare_v2(ctx->db_ctx,
+                         "SELECT html FROM report_fragments WHERE name = ? AND build_id = ? AND "
+                         "unique_identifier IS ? AND last_build_id = ? AND n_builds = ? AND "
+                         "scratch_generation = ?;", -1, &(cache->lookup), NULL) != SQLITE_OK) ||
+     (sqlite3_prepare_v2(ctx->db_ctx,
+                         "INSERT OR REPLACE INTO report_fragments (name, build_id, "
+                         "unique_identifier, last_build_id, n_builds, scratch_generation, html) "
+                         "VALUES (?, ?, ?, ?, ?, ?, ?);", -1, &(cache->store), NULL) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: open_report_cache(): sqlite3_prepare() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(cache->lookup);
+  cache->lookup = NULL;
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+  return 1;
+ }
+
+ cache->enabled = 1;
+ return 0;
+}
+
+int close_report_cache(struct report_details *report, struct report_cache *cache)
+{
+ struct buildmatrix_context *ctx = report->ctx;
+ char *errmsg;
+
+ if(cache->enabled == 0)
+  return 0;
+
+ sqlite3_finalize(cache->lookup);
+ sqlite3_finalize(cache->store);
+ cache->enabled = 0;
+
+ /* fragments of builds that are gone, all_builds only covers every archive when unfiltered */
+ if( (cache->section_cacheable) && (cache->spool == NULL) )
+ {
+  if(sqlite3_exec(ctx->db_ctx, "DELETE FROM report_fragments WHERE build_id > 0 AND "
+                  "build_id NOT IN (SELECT build_id FROM all_builds);",
+                  NULL, NULL, &errmsg) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: close_report_cache(): could not remove old fragments, '%s'\n",
+           ctx->error_prefix, errmsg);
+   sqlite3_free(errmsg);
+  }
+ }
+
+ if(sqlite3_exec(ctx->db_ctx, "COMMIT TRANSACTION;", NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: close_report_cache(): sqlite3_exec(\"COMMIT TRANSACTION;\"): '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+  return 1;
+ }
+
+ if( (ctx->verbose) && (cache->spool == NULL) )
+  fprintf(stderr, "%s: report fragments reused %d, rendered %d\n", ctx->error_prefix,
+          cache->n_reused, cache->n_rendered);
+
+ return 0;
+}
+
+int store_report_fragment(struct report_details *report, struct report_cache *cache,
+                          const char *name, int build_id, const char *identifier,
+                          int last_build_id, int n_builds, long long int scratch_generation,
+                          const char *html, size_t html_length)
+{
+ struct buildmatrix_context *ctx = report->ctx;
+
+ sqlite3_reset(cache->store);
+ if( (sqlite3_bind_text(cache->store, 1, name, -1, SQLITE_STATIC) != SQLITE_OK) ||
+     (sqlite3_bind_int(cache->store, 2, build_id) != SQLITE_OK) ||
+     ( (identifier == NULL) ? (sqlite3_bind_null(cache->store, 3) != SQLITE_OK) :
+       (sqlite3_bind_text(cache->store, 3, identifier, -1, SQLITE_STATIC) != SQLITE_OK) ) ||
+     (sqlite3_bind_int(cache->store, 4, last_build_id) != SQLITE_OK) ||
+     (sqlite3_bind_int(cache->store, 5, n_builds) != SQLITE_OK) ||
+     (sqlite3_bind_int64(cache->store, 6, scratch_generation) != SQLITE_OK) ||
+     (sqlite3_bind_text(cache->store, 7, html, html_length, SQLITE_TRANSIENT) != SQLITE_OK) ||
+     (sqlite3_step(cache->store) != SQLITE_DONE) )
+ {
+  fprintf(stderr, "%s: store_report_fragment(): could not store %s fragment, '%s'\n",
+          ctx->error_prefix, name, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ return 0;
+}
+
+/* Writes fragment name of build (or of the whole report when build is NULL) to output, from
+   the cache when it has a current copy, otherwise from render() and then into the cache. */
+int emit_report_fragment(struct report_details *report, struct report_cache *cache,
+                         const char *name, const struct list_builds_data *build,
+                         report_fragment_renderer render, FILE *output)
+{
+ struct buildmatrix_context *ctx = report->ctx;
+ const char *identifier = NULL;
+ char *html = NULL;
+ size_t html_length = 0;
+ int build_id = 0, last_build_id = 0, n_builds = 0, code, failed;
+ long long int scratch_generation = 0;
+ FILE *memory;
+
+ if( (cache->enabled == 0) || ( (build == NULL) && (cache->section_cacheable == 0) ) )
+  return render(report, build, output);
+
+ if(build == NULL)
+ {
+  last_build_id = cache->last_build_id;
+  n_builds = report->n_builds;
+  scratch_generation = cache->scratch_generation;
+ } else {
+  build_id = build->build_id;
+  identifier = build->unique_identifier;
+ }
+
+ sqlite3_reset(cache->lookup);
+ if( (sqlite3_bind_text(cache->lookup, 1, name, -1, SQLITE_STATIC) != SQLITE_OK) ||
+     (sqlite3_bind_int(cache->lookup, 2, build_id) != SQLITE_OK) ||
+     ( (identifier == NULL) ? (sqlite3_bind_null(cache->lookup, 3) != SQLITE_OK) :
+       (sqlite3_bind_text(cache->lookup, 3, identifier, -1, SQLITE_STATIC) != SQLITE_OK) ) ||
+     (sqlite3_bind_int(cache->lookup, 4, last_build_id) != SQLITE_OK) ||
+     (sqlite3_bind_int(cache->lookup, 5, n_builds) != SQLITE_OK) ||
+     (sqlite3_bind_int64(cache->lookup, 6, scratch_generation) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: emit_report_fragment(): sqlite3_bind() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if((code = sqlite3_step(cache->lookup)) == SQLITE_ROW)
+ {
+  if(sqlite3_column_type(cache->lookup, 0) == SQLITE_TEXT)
+  {
+   fwrite(sqlite3_column_text(cache->lookup, 0), 1, sqlite3_column_bytes(cache->lookup, 0), output);
+   cache->n_reused++;
+   return 0;
+  }
+ } else if(code != SQLITE_DONE) {
+  fprintf(stderr, "%s: emit_report_fragment(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if((memory = open_memstream(&html, &html_length)) == NULL)
+ {
+  fprintf(stderr, "%s: emit_report_fragment(): open_memstream() failed: %s\n",
+          ctx->error_prefix, strerror(errno));
+  return 1;
+ }
+
+ if(render(report, build, memory))
+ {
+  fclose(memory);
+  free(html);
+  return 1;
+ }
+ fclose(memory);
+
+ fwrite(html, 1, html_length, output);
+ cache->n_rendered++;
+
+ /* a report worker's connection is read only, the parent stores what it renders */
+ if(cache->spool != NULL)
+ {
+  if(identifier != NULL)
+  {
+   fprintf(cache->spool, "F %s %d %d %d\n", name, build_id, (int) strlen(identifier),
+           (int) html_length);
+   fwrite(identifier, 1, strlen(identifier), cache->spool);
+   fwrite(html, 1, html_length, cache->spool);
+  }
+  free(html);
+  return 0;
+ }
+
+ failed = store_report_fragment(report, cache, name, build_id, identifier, last_build_id,
+                                n_builds, scratch_generation, html, html_length);
+ free(html);
+ return failed;
+}
+
+
+int render_builds_table_heading(FILE *output)
+{
+ fprintf(output,
+         "    <tr>\n"
+         "     <td align=center><b>Indentifier</b></td>\n"
+         "     <td align=center><b>Branch</b></td>\n"
+         "     <td align=center><b>Job</b></td>\n"
+         "     <td align=center><b>Node</b></td>\n"
+         "     <td align=center><b>Revision</b></td>\n"
+         "     <td align=center><b>User</b></td>\n"
+         "     <td align=center><b>Result</b></td>\n"
+         "     <td align=center><b>Submit Time</b></td>\n"
+         "     <td align=center><b>P</b></td>\n"
+         "     <td align=center><b>F</b></td>\n"
+         "     <td align=center><b>I</b></td>\n"
+         "     <td align=center><b>Parameters</b></td>\n"
+         "     <td align=center><b>Tests</b></td>\n"
+         "     <td align=center><b>Report</b></td>\n"
+         "     <td align=center><b>Output</b></td>\n"
+         "     <td align=center><b>Signiture</b></td>\n"
+         "    </tr>\n");
+
+ return 0;
+}
+
+int render_build_row(struct report_details *report, const struct list_builds_data *build,
+                     FILE *output)
+{
+ char time_string[128];
  struct tm tm;
  time_t ti;
- int i, j;
  const char *s;
 
- if(chdir(report->ctx->local_project_directory))
+ fprintf(output, "    <tr>\n");
+
+ if( (s = build->unique_identifier) == NULL)
+  fprintf(output, "     <td></td>\n");
+ else
+  fprintf(output, "     <td><a href=\"#%s\">%s</a></td>\n", s, s);
+
+ if((s = build->branch) == NULL)
+  fprintf(output, "     <td></td>\n");
+ else
+  fprintf(output, "     <td>%s</td>\n", s);
+
+ if((s = build->job_name) == NULL)
+  fprintf(output, "     <td></td>\n");
+ else
+  fprintf(output, "     <td>%s</td>\n", s);
+
+ if((s = build->build_node) == NULL)
+  fprintf(output, "     <td></td>\n");
+ else
+  fprintf(output, "     <td>%s</td>\n", s);
+
+ if((s = build->revision) == NULL)
+  fprintf(output, "     <td></td>\n");
+ else
+  fprintf(output, "     <td>%s</td>\n", s);
+
+ if((s = build->user) == NULL)
+  fprintf(output, "     <td></td>\n");
+ else
+  fprintf(output, "     <td>%s</td>\n", s);
+
+ switch(build->build_result)
  {
-  fprintf(stderr, "chdir(%s) failed: %s\n", report->ctx->local_project_directory, strerror(errno));
+  case 0:
+       fprintf(output, "     <td bgcolor=red>failed</td>\n");
+       break;
+
+  case 1:
+       fprintf(output, "     <td bgcolor=green>passed</td>\n");
+       break;
+
+
+  default:
+       fprintf(output, "     <td></td>\n");
+ }
+
+ ti = build->build_time;
+ localtime_r(&ti, &tm);
+ strftime(time_string, 128, "%c", &tm);
+ fprintf(output, "     <td>%s</td>\n", time_string);
+
+ fprintf(output, "     <td>%d</td>\n", build->passed);
+ fprintf(output, "     <td>%d</td>\n", build->failed);
+ fprintf(output, "     <td>%d</td>\n", build->incompleted);
+
+ fprintf(output, "     <td>%s</td>\n", build->has_parameters ? "yes" : "no");
+ fprintf(output, "     <td>%s</td>\n", build->has_tests ? "yes" : "no");
+ fprintf(output, "     <td>%s</td>\n", (build->report_name != NULL) ? "yes" : "no");
+ fprintf(output, "     <td>%s</td>\n", (build->output_name != NULL) ? "yes" : "no");
+ fprintf(output, "     <td>%s</td>\n", (build->checksum_name != NULL) ? "yes" : "no");
+
+ fprintf(output, "    </tr>\n");
+ return 0;
+}
+
+/* build is ignored, this is the whole section */
+int render_parameters_section(struct report_details *report, const struct list_builds_data *build,
+                              FILE *output)
+{
+ int i, j, cell;
+ const char *s;
+
+ fprintf(output, 
+         "  <h2><a name=\"parameters\">Parameters</h2>\n");
+
+ fprintf(output, 
+         "   <table border=1>\n"
+         "    <tr>\n"
+         "     <td>Parameters</td>\n");
+
+ for(j=0; j<report->n_builds; j++)
+ {
+  if(report->parameters[j]->n_pairs > 0)
+  {
+   s = report->builds[j]->unique_identifier;
+   fprintf(output, "     <td><a href=\"#%s\">%s</a></td>\n", s, s);
+  }
+ }
+ fprintf(output, "    </tr>\n");
+        
+ for(i=0; i<report->n_parameters; i++)
+ {
+  fprintf(output, "    <tr>\n");
+  fprintf(output, "     <td>%s</td>\n", report->parameters_list[i]); 
+  for(j=0; j<report->n_builds; j++)
+  {
+   if(report->parameters[j]->n_pairs > 0)
+   {
+    cell = report->parameter_grid.cells[(i * report->parameter_grid.n_columns) + j];
+    if(cell == -1)
+     fprintf(output, "     <td>n/a</td>\n");    
+    else
+     fprintf(output, "     <td>%s</td>\n", report->parameter_grid.pool.base + cell); 
+   }
+  }
+  fprintf(output, "    </tr>\n");
+ }
+ fprintf(output,
+         "   </table>\n");
+
+ return 0;
+}
+
+/* How a build's files were stored and their uncompressed sizes (-1 when not recorded). The
+   rows handed to the renderers come from service_list_builds() and may be from the query
+   cache, which doesn't carry these, so appendix Z asks per build. Its fragments are cached,
+   so this runs once per build. */
+int lookup_artifact_details(struct report_details *report, int build_id, int *codec,
+                            long long int *sizes)
+{
+ struct buildmatrix_context *ctx = report->ctx;
+ struct sqlite3_stmt *statement = NULL;
+ char *sql;
+ int code, i;
+
+ *codec = BLDMTRX_CODEC_NONE;
+ for(i=0; i<3; i++)
+  sizes[i] = -1;
+
+ sql = "SELECT artifact_codec, report_size, output_size, checksum_size "
+       "FROM all_builds WHERE build_id = ?";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: lookup_artifact_details(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
   return 1;
  }
 
- if((output = fopen("./dashboard.html", "w")) == NULL)
+ if(sqlite3_bind_int(statement, 1, build_id) != SQLITE_OK)
  {
-  fprintf(stderr, "%s\n", strerror(errno));
+  fprintf(stderr, "%s: lookup_artifact_details(): sqlite3_bind_int() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
   return 1;
  }
 
- localtime_r(&(report->generation_time), &tm);
- strftime(time_string, 128, "%c", &tm);
+ if((code = sqlite3_step(statement)) == SQLITE_ROW)
+ {
+  if(sqlite3_column_type(statement, 0) == SQLITE_INTEGER)
+   *codec = sqlite3_column_int(statement, 0);
 
- fprintf(output, 
-         "<html>\n"
-         " <!-- This file was dynamically generated by Build Configuration Adjust\n"
-         "      This is the fallback/default report output format, and is formated in \n"
-         "      plain, old fashion html for wide compatibility. --!>\n"
-         " <head>\n"
-         "  <meta charset=\"utf-8\">\n"
-         "  <title>%s - Build Matrix Dashboard Report</title>\n"
-         " </head>\n"
-         " <body>\n", report->project_name);
+  for(i=0; i<3; i++)
+  {
+   if(sqlite3_column_type(statement, i + 1) == SQLITE_INTEGER)
+    sizes[i] = sqlite3_column_int64(statement, i + 1);
+  }
+ } else if(code != SQLITE_DONE) {
+  fprintf(stderr, "%s: lookup_artifact_details(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+/* Compressed artifacts are linked under their .gz name, so they are served as gzip data
+   rather than as garbled text, and shown at the size they were submitted at. */
+int render_artifact_link(struct report_details *report, const struct list_builds_data *build,
+                         const char *label, const char *name, int codec, long long int size,
+                         FILE *output)
+{
+ char fs_string[32], path_string[1024];
+
+ render_relative_db_file_path(build->unique_identifier, name, artifact_codec_suffix(codec),
+                              path_string, 1024);
+
+ if(size < 0)
+  size = file_size(report->ctx, path_string);
+
+ file_size_to_string(size, fs_string, 32);
+ fprintf(output, " <p>%s (%s) <a href=\"%s\">%s</a></p>\n", label, fs_string, path_string, name);
+ return 0;
+}
+
+int render_build_details(struct report_details *report, const struct list_builds_data *build,
+                         FILE *output)
+{
+ long long int sizes[3];
+ const char *s;
+ int codec;
+
+ s = build->unique_identifier;
+
+ fprintf(output, " <h3><a name=\"%s\">Details of Build %s</a></h3>\n", s, s);
+
+ if(lookup_artifact_details(report, build->build_id, &codec, sizes))
+  return 1;
+
+ if((s = build->report_name) != NULL)
+  render_artifact_link(report, build, "The build report", s, codec, sizes[0], output);
+
+ if((s = build->output_name) != NULL)
+  render_artifact_link(report, build, "The build output", s, codec, sizes[1], output);
+
+ if((s = build->checksum_name) != NULL)
+  render_artifact_link(report, build, "The checksum / signature", s, codec, sizes[2], output);
+
+ fprintf(output, "<hr>\n");
+ return 0;
+}
+
+/* The streaming mode (configuration variable reportstreaming) doesn't keep the builds. Each
+   part of the report that walks them runs service_list_builds() again and renders a build at a
+   time from the cursor. Only the short lists stay in memory, and for the parameters section
+   its cells, see struct parameter_stream. */
+
+struct report_stream_context
+{
+ struct report_details *report;
+ struct report_cache *cache;
+ const char *fragment;
+ report_fragment_renderer render;
+ FILE *output;
+};
+
+int service_list_builds_strategy_stream_start(const struct buildmatrix_context *ctx, 
+                                               void * const strategy_context, const void *ptr)
+{
+ return 0;
+}
+
+int service_list_builds_strategy_stream_iterative(const struct buildmatrix_context *ctx, 
+                                                   void * const strategy_context, const void *ptr)
+{
+ struct report_stream_context *sc;
+ sc = (struct report_stream_context *) strategy_context;
+ const struct list_builds_data *build = (const struct list_builds_data *) ptr;
+
+ if(sc->cache == NULL)
+  return sc->render(sc->report, build, sc->output);
+
+ return emit_report_fragment(sc->report, sc->cache, sc->fragment, build, sc->render, sc->output);
+}
+
+int service_list_builds_strategy_stream_done(const struct buildmatrix_context *ctx, 
+                                              void * const strategy_context, const void *ptr)
+{
+ return 0;
+}
+
+/* render() each build of the report in turn, through the cache when cache isn't NULL */
+int stream_report_builds(struct report_details *report, struct report_cache *cache,
+                         const char *fragment, report_fragment_renderer render, FILE *output)
+{
+ struct report_stream_context sc;
+ struct iterative_strategy s;
+
+ sc.report = report;
+ sc.cache = cache;
+ sc.fragment = fragment;
+ sc.render = render;
+ sc.output = output;
+
+ s.start = service_list_builds_strategy_stream_start;
+ s.iterative = service_list_builds_strategy_stream_iterative;
+ s.done = service_list_builds_strategy_stream_done;
+ s.strategy_context = &sc;
+ report->ctx->service_list_builds_strategy = s;
+
+ return service_list_builds(report->ctx);
+}
+
+/* output is ignored, this only counts */
+int count_report_build(struct report_details *report, const struct list_builds_data *build,
+                       FILE *output)
+{
+ report->n_builds++;
+
+ if( (report->first_build_id == 0) || (build->build_id < report->first_build_id) )
+  report->first_build_id = build->build_id;
+
+ if(build->build_id > report->last_build_id)
+  report->last_build_id = build->build_id;
+
+ return 0;
+}
+
+/* The streamed parameters section reads the builds once. Each build's set is loaded on its own
+   and let go, its cells kept as a column of offsets into values, where each distinct value is
+   stored once as in struct parameter_grid. The table is written out row by row at the end. */
+struct parameter_stream
+{
+ int n_rows, n_columns, columns_size, n_values;
+ int *cells, *headings;
+ struct string_index names, index;
+ struct arena values, identifiers;
+};
+
+/* the index keys point into values, so they are put back in when it moves */
+int intern_parameter_value(struct parameter_stream *ps, const char *value, int *offset_ptr)
+{
+ char *old_base;
+ size_t offset, i;
+ int failed = 0;
+
+ if((*offset_ptr = string_index_lookup(&(ps->index), value)) != -1)
+  return 0;
+
+ old_base = ps->values.base;
+ if(arena_append_string(&(ps->values), value, &offset))
+  return 1;
+
+ *offset_ptr = (int) offset;
+ ps->n_values++;
+
+ if( (old_base == NULL) || (old_base == ps->values.base) )
+  return string_index_insert(&(ps->index), ps->values.base + offset, (int) offset);
+
+ string_index_free(&(ps->index));
+ if(string_index_create(&(ps->index), ps->n_values))
+  return 1;
+
+ for(i=0; (failed == 0) && (i<ps->values.used); i += strlen(ps->values.base + i) + 1)
+  failed = string_index_insert(&(ps->index), ps->values.base + i, (int) i);
+
+ return failed;
+}
+
+/* output is ignored, this adds a column for the build if it has parameters */
+int collect_parameter_column(struct report_details *report, const struct list_builds_data *build,
+                             FILE *output)
+{
+ struct parameter_stream *ps = report->parameter_stream;
+ struct parameter_sets *sets;
+ struct parameters *p;
+ size_t offset;
+ int i, row, value, allocation_size, *cells, failed = 0;
+
+ if(build->has_parameters == 0)
+  return 0;
+
+ if(load_parameter_sets(report->ctx, build->build_id, build->build_id, &sets))
+ {
+  fprintf(stderr, "%s: load_parameter_sets() failed\n", report->ctx->error_prefix);
+  return 1;
+ }
+
+ p = parameter_set_for_build(sets, build->build_id);
+
+ if( (p->n_pairs > 0) && (ps->n_columns == ps->columns_size) )
+ {
+  ps->columns_size = (ps->columns_size == 0) ? 64 : ps->columns_size * 2;
+
+  allocation_size = sizeof(int) * ps->n_rows * ps->columns_size;
+  if((cells = (int *) realloc(ps->cells, allocation_size)) != NULL)
+   ps->cells = cells;
+
+  allocation_size = sizeof(int) * ps->columns_size;
+  if( (cells == NULL) ||
+      ((cells = (int *) realloc(ps->headings, allocation_size)) == NULL) )
+   failed = 1;
+  else
+   ps->headings = cells;
+ }
+
+ if( (failed == 0) && (p->n_pairs > 0) &&
+     (arena_append_string(&(ps->identifiers), build->unique_identifier, &offset)) )
+  failed = 1;
+
+ if( (failed == 0) && (p->n_pairs > 0) )
+ {
+  ps->headings[ps->n_columns] = (int) offset;
+
+  cells = ps->cells + (ps->n_columns * ps->n_rows);
+  for(row=0; row<ps->n_rows; row++)
+   cells[row] = -1;
+
+  /* same as the grid, the last pair wins when a build has a name more than once */
+  for(i=0; (failed == 0) && (i<p->n_pairs); i++)
+  {
+   if((row = string_index_lookup(&(ps->names), p->keys[i])) == -1)
+    continue;
+
+   if(intern_parameter_value(ps, p->values[i], &value))
+    failed = 1;
+   cells[row] = value;
+  }
+
+  ps->n_columns++;
+ }
+
+ free_parameter_sets(sets);
+
+ if(failed)
+  fprintf(stderr, "%s: collect_parameter_column(): out of memory\n", report->ctx->error_prefix);
+
+ return failed;
+}
+
+/* build is ignored, this is the whole section */
+int render_parameters_section_streaming(struct report_details *report,
+                                        const struct list_builds_data *build, FILE *output)
+{
+ struct parameter_stream ps;
+ const char *s;
+ int i, j, cell, failed = 0;
+
+ memset(&ps, 0, sizeof(struct parameter_stream));
+ ps.n_rows = report->n_parameters;
+
+ if( (string_index_create(&(ps.names), ps.n_rows)) ||
+     (string_index_create(&(ps.index), 64)) )
+ {
+  fprintf(stderr, "%s: render_parameters_section_streaming(): out of memory\n",
+          report->ctx->error_prefix);
+  string_index_free(&(ps.names));
+  return 1;
+ }
+
+ for(i=0; (failed == 0) && (i<ps.n_rows); i++)
+  failed = string_index_insert(&(ps.names), report->parameters_list[i], i);
+
+ if(failed)
+  fprintf(stderr, "%s: render_parameters_section_streaming(): out of memory\n",
+          report->ctx->error_prefix);
+
+ if( (failed == 0) && (ps.n_rows > 0) )
+ {
+  report->parameter_stream = &ps;
+  failed = stream_report_builds(report, NULL, NULL, collect_parameter_column, output);
+  report->parameter_stream = NULL;
+ }
+
+ if(failed == 0)
+ {
+  fprintf(output, 
+          "  <h2><a name=\"parameters\">Parameters</h2>\n");
+
+  fprintf(output, 
+          "   <table border=1>\n"
+          "    <tr>\n"
+          "     <td>Parameters</td>\n");
+
+  for(j=0; j<ps.n_columns; j++)
+  {
+   s = ps.identifiers.base + ps.headings[j];
+   fprintf(output, "     <td><a href=\"#%s\">%s</a></td>\n", s, s);
+  }
+  fprintf(output, "    </tr>\n");
+
+  for(i=0; i<ps.n_rows; i++)
+  {
+   fprintf(output, "    <tr>\n");
+   fprintf(output, "     <td>%s</td>\n", report->parameters_list[i]); 
+   for(j=0; j<ps.n_columns; j++)
+   {
+    cell = ps.cells[(j * ps.n_rows) + i];
+    if(cell == -1)
+     fprintf(output, "     <td>n/a</td>\n");    
+    else
+     fprintf(output, "     <td>%s</td>\n", ps.values.base + cell); 
+   }
+   fprintf(output, "    </tr>\n");
+  }
+  fprintf(output,
+          "   </table>\n");
+ }
+
+ if(ps.cells != NULL)
+  free(ps.cells);
+ if(ps.headings != NULL)
+  free(ps.headings);
+ string_index_free(&(ps.names));
+ string_index_free(&(ps.index));
+ arena_free(&(ps.values));
+ arena_free(&(ps.identifiers));
+ return failed;
+}
+
+/* the top of dashboard.html, down to the rule under the title */
+int render_report_heading(struct report_details *report, FILE *output)
+{
+ char time_string[128];
+ struct tm tm;
+
+ localtime_r(&(report->generation_time), &tm);
+ strftime(time_string, 128, "%c", &tm);
+
+ fprintf(output, 
+         "<html>\n"
+         " <!-- This file was dynamically generated by Build Configuration Adjust\n"
+         "      This is the fallback/default report output format, and is formated in \n"
+         "      plain, old fashion html for wide compatibility. --!>\n"
+         " <head>\n"
+         "  <meta charset=\"utf-8\">\n"
+         "  <title>%s - Build Matrix Dashboard Report</title>\n"
+         " </head>\n"
+         " <body>\n", report->project_name);
+
+ fprintf(output, 
+         "  <table width=100%%><tr><td>\n"
+         "   <h1>%s</h1>\n"
+         "   <h2>Build Matrix Dashboard Report</h2>\n", report->project_name);
+
+ fprintf(output,
+         "  </td><td>\n"
+         "   <h3 align=right>Report Generated on <i>%s</i></h3>\n"
+         "  </td></tr></table>\n"
+         "  <hr>\n", time_string);
+
+ return 0;
+}
+
+/* The Tests section is read straight out of test_history (see testresults.c), one row per
+   test, job and branch, so it costs the number of tests rather than builds times tests. */
+struct test_history_data *copy_test_history_data(const struct buildmatrix_context *const ctx,
+                                                 const struct test_history_data * const source)
+{
+ struct test_history_data *copy;
+ int allocation_size, suite_length, test_length, job_length, branch_length, failure_length = 0;
+ char *str_ptr;
+
+ allocation_size = sizeof(struct test_history_data);
+ allocation_size += (suite_length = strlen(source->suite) + 1);
+ allocation_size += (test_length = strlen(source->test) + 1);
+ allocation_size += (job_length = strlen(source->job_name) + 1);
+ allocation_size += (branch_length = strlen(source->branch) + 1);
+
+ if(source->last_failure != NULL)
+  allocation_size += (failure_length = strlen(source->last_failure) + 1);
+
+ if((copy = (struct test_history_data *) malloc(allocation_size)) == NULL)
+ {
+  fprintf(stderr, "%s: copy_test_history_data(): malloc(%d) failed: %s\n", 
+          ctx->error_prefix, allocation_size, strerror(errno));
+  return NULL;
+ }
+
+ memcpy(copy, source, sizeof(struct test_history_data));
+
+ str_ptr = ((char *) copy) + sizeof(struct test_history_data);
+
+ copy->suite = memcpy(str_ptr, source->suite, suite_length);
+ str_ptr += suite_length;
+
+ copy->test = memcpy(str_ptr, source->test, test_length);
+ str_ptr += test_length;
+
+ copy->job_name = memcpy(str_ptr, source->job_name, job_length);
+ str_ptr += job_length;
+
+ copy->branch = memcpy(str_ptr, source->branch, branch_length);
+ str_ptr += branch_length;
+
+ if(source->last_failure != NULL)
+  copy->last_failure = memcpy(str_ptr, source->last_failure, failure_length);
+
+ return copy;
+}
+
+struct test_history_strategy_report_context
+{
+ struct report_details *report;
+ int size;
+};
+
+int test_history_strategy_report_start(const struct buildmatrix_context *ctx, 
+                                       void * const strategy_context, const void *ptr)
+{
+ return 0;
+}
+
+/* rows arrive sorted by suite and test, so the list of distinct tests only needs the last */
+int test_history_strategy_report_iterative(const struct buildmatrix_context *ctx, 
+                                           void * const strategy_context, const void *ptr)
+{
+ struct test_history_strategy_report_context *sc;
+ sc = (struct test_history_strategy_report_context *) strategy_context;
+ struct report_details *report = sc->report;
+ const struct test_history_data *data = (const struct test_history_data *) ptr;
+ struct test_history_data *copy, **array;
+ char name[1024];
+ int allocation_size;
+
+ if((copy = copy_test_history_data(ctx, data)) == NULL)
+  return 1;
+
+ if(report->n_test_history + 1 >= sc->size)
+ {
+  sc->size = (sc->size == 0) ? 10 : sc->size * 2;
+  allocation_size = sizeof(struct test_history_data *) * sc->size;
+
+  if((array = (struct test_history_data **) 
+              realloc(report->test_history, allocation_size)) == NULL)
+  {
+   fprintf(stderr, "%s: test_history_strategy_report_iterative(): realloc(%d) failed: %s\n", 
+           ctx->error_prefix, allocation_size, strerror(errno));
+   free(copy);
+   return 1;
+  }
+  report->test_history = array;
+ }
+
+ report->test_history[report->n_test_history++] = copy;
+
+ snprintf(name, 1024, "%s.%s", data->suite, data->test);
+
+ if( (report->n_tests > 0) && (strcmp(report->tests_list[report->n_tests - 1], name) == 0) )
+  return 0;
+
+ if(add_to_string_array(&(report->tests_list), report->n_tests, name, strlen(name), 0))
+  return 1;
+
+ report->n_tests++;
+ return 0;
+}
+
+int test_history_strategy_report_done(const struct buildmatrix_context *ctx, 
+                                      void * const strategy_context, const void *ptr)
+{
+ return 0;
+}
+
+int render_tests_section(struct report_details *report, FILE *output)
+{
+ struct test_history_data *row;
+ int i;
+
+ fprintf(output, 
+         "  <h2><a name=\"tests\">Tests</h2>\n");
+
+ if(report->n_test_history == 0)
+ {
+  fprintf(output, "   <p>none</p>\n");
+  return 0;
+ }
+
+ fprintf(output,
+         "   <table border=1>\n"
+         "    <tr>\n"
+         "     <td align=center><b>Test</b></td>\n"
+         "     <td align=center><b>Job</b></td>\n"
+         "     <td align=center><b>Branch</b></td>\n"
+         "     <td align=center><b>Last Result</b></td>\n"
+         "     <td align=center><b>Passed</b></td>\n"
+         "     <td align=center><b>Failed</b></td>\n"
+         "     <td align=center><b>Incomplete</b></td>\n"
+         "     <td align=center><b>Pass Rate</b></td>\n"
+         "     <td align=center><b>Flips</b></td>\n"
+         "     <td align=center><b>Last Failure</b></td>\n"
+         "    </tr>\n");
+
+ for(i=0; i<report->n_test_history; i++)
+ {
+  row = report->test_history[i];
+
+  fprintf(output, 
+          "    <tr>\n"
+          "     <td>%s.%s</td>\n"
+          "     <td>%s</td>\n"
+          "     <td>%s</td>\n", row->suite, row->test, row->job_name, row->branch);
+
+  switch(row->last_result)
+  {
+   case 1:
+        fprintf(output, "     <td bgcolor=green>passed</td>\n");
+        break;
+
+   case 2:
+        fprintf(output, "     <td bgcolor=red>failed</td>\n");
+        break;
+
+   case 3:
+        fprintf(output, "     <td>incomplete</td>\n");
+        break;
+
+   default:
+        fprintf(output, "     <td></td>\n");
+  }
+
+  fprintf(output, "     <td>%d</td>\n", row->passed);
+  fprintf(output, "     <td>%d</td>\n", row->failed);
+  fprintf(output, "     <td>%d</td>\n", row->incompleted);
+
+  if(row->passed + row->failed > 0)
+   fprintf(output, "     <td>%d%%</td>\n", (row->passed * 100) / (row->passed + row->failed));
+  else
+   fprintf(output, "     <td>n/a</td>\n");
+
+  fprintf(output, "     <td>%d</td>\n", row->flips);
+
+  if(row->last_failure == NULL)
+   fprintf(output, "     <td></td>\n");
+  else
+   fprintf(output, "     <td>%s</td>\n", row->last_failure);
+
+  fprintf(output, "    </tr>\n");
+ }
+
+ fprintf(output,
+         "   </table>\n");
+
+ return 0;
+}
+
+/* The paged layout (configuration variable reportpages) makes dashboard.html an index, a job
+   by branch table of the latest build, and puts the builds themselves on pages of
+   reportpagesize builds, one series of pages per job and one per job and branch. Pages fill in
+   submission order, so a new build only changes the last page of its series, and a page is
+   only written when its contents differ from the file already there. */
+
+struct report_page_cell
+{
+ int page, build_result;
+ char *unique_identifier;
+};
+
+struct report_page_writer
+{
+ const char *job, *branch;
+ int page, n_on_page, page_size, n_written, n_unchanged, failed;
+ int latest_result;
+ char *latest_identifier, *rows_html, *details_html;
+ size_t rows_length, details_length;
+ FILE *rows, *details;
+ struct report_cache *cache;
+ struct string_index *branch_index;
+ char *branches_seen;
+};
+
+/* bytes other than letters, digits and '-' become _xx, so '.' can separate the parts */
+int render_page_name_part(const char *part, char *string, int size)
+{
+ int length = 0;
+
+ while( (*part != 0) && (length < size - 4) )
+ {
+  if( ((*part >= 'a') && (*part <= 'z')) || ((*part >= 'A') && (*part <= 'Z')) ||
+      ((*part >= '0') && (*part <= '9')) || (*part == '-') )
+   string[length++] = *part;
+  else
+   length += snprintf(string + length, size - length, "_%02x", (unsigned char) *part);
+  part++;
+ }
+ string[length] = 0;
+
+ return length;
+}
+
+int render_page_name(const char *job, const char *branch, int page, char *string, int size)
+{
+ char job_part[512], branch_part[512];
+
+ render_page_name_part(job, job_part, 512);
+
+ if(branch == NULL)
+  return snprintf(string, size, "dashboard.%s.%d.html", job_part, page);
+
+ render_page_name_part(branch, branch_part, 512);
+ return snprintf(string, size, "dashboard.%s.%s.%d.html", job_part, branch_part, page);
+}
+
+/* leaves the file alone when it already holds exactly html */
+int write_report_page(struct report_details *report, const char *filename,
+                      const char *html, size_t length, int *written)
+{
+ struct stat metadata;
+ FILE *file;
+ char *existing;
+ int same = 0;
+
+ *written = 0;
+
+ if( (stat(filename, &metadata) == 0) && (S_ISREG(metadata.st_mode)) &&
+     (metadata.st_size == (off_t) length) )
+ {
+  if((existing = (char *) malloc(length + 1)) == NULL)
+  {
+   fprintf(stderr, "%s: write_report_page(): malloc(%d) failed: %s\n", 
+           report->ctx->error_prefix, (int) length + 1, strerror(errno));
+   return 1;
+  }
+
+  if((file = fopen(filename, "r")) != NULL)
+  {
+   same = (fread(existing, 1, length, file) == length) && (memcmp(existing, html, length) == 0);
+   fclose(file);
+  }
+  free(existing);
+ }
+
+ if(same)
+  return 0;
+
+ if((file = fopen(filename, "w")) == NULL)
+ {
+  fprintf(stderr, "%s: write_report_page(): fopen(%s) failed: %s\n", 
+          report->ctx->error_prefix, filename, strerror(errno));
+  return 1;
+ }
+
+ if(fwrite(html, 1, length, file) != length)
+ {
+  fprintf(stderr, "%s: write_report_page(): fwrite(%s) failed: %s\n", 
+          report->ctx->error_prefix, filename, strerror(errno));
+  fclose(file);
+  return 1;
+ }
+
+ fclose(file);
+ *written = 1;
+ return 0;
+}
+
+int render_page_navigation(struct report_page_writer *writer, int has_next, FILE *output)
+{
+ char filename[1280];
+
+ fprintf(output, "  <p><a href=\"dashboard.html\">Index</a>");
+
+ if(writer->page > 1)
+ {
+  render_page_name(writer->job, writer->branch, writer->page - 1, filename, 1280);
+  fprintf(output, " | <a href=\"%s\">Previous</a>", filename);
+ }
+
+ if(has_next)
+ {
+  render_page_name(writer->job, writer->branch, writer->page + 1, filename, 1280);
+  fprintf(output, " | <a href=\"%s\">Next</a>", filename);
+ }
+
+ fprintf(output, "</p>\n");
+ return 0;
+}
+
+int finish_report_page(struct report_details *report, struct report_page_writer *writer,
+                       int has_next)
+{
+ char filename[1280], *html = NULL;
+ size_t html_length = 0;
+ FILE *page;
+ int written;
+
+ fclose(writer->rows);
+ fclose(writer->details);
+ writer->rows = NULL;
+ writer->details = NULL;
+
+ if((page = open_memstream(&html, &html_length)) == NULL)
+ {
+  fprintf(stderr, "%s: finish_report_page(): open_memstream() failed: %s\n",
+          report->ctx->error_prefix, strerror(errno));
+  return 1;
+ }
+
+ fprintf(page,
+         "<html>\n"
+         " <head>\n"
+         "  <meta charset=\"utf-8\">\n"
+         "  <title>%s - Build Matrix Dashboard Report</title>\n"
+         " </head>\n"
+         " <body>\n"
+         "  <h1>%s</h1>\n", report->project_name, report->project_name);
+
+ if(writer->branch == NULL)
+  fprintf(page, "  <h2>Job %s, page %d</h2>\n", writer->job, writer->page);
+ else
+  fprintf(page, "  <h2>Job %s on branch %s, page %d</h2>\n",
+          writer->job, writer->branch, writer->page);
+
+ render_page_navigation(writer, has_next, page);
+
+ fprintf(page,
+         "  <hr>\n"
+         "   <table border=1>\n");
+ render_builds_table_heading(page);
+ fwrite(writer->rows_html, 1, writer->rows_length, page);
+ render_builds_table_heading(page);
+ fprintf(page,
+         "   </table>\n"
+         "  <hr>\n");
+
+ fwrite(writer->details_html, 1, writer->details_length, page);
+ render_page_navigation(writer, has_next, page);
+
+ fprintf(page,
+         " </body>\n"
+         "</html>\n");
+ fclose(page);
+
+ free(writer->rows_html);
+ free(writer->details_html);
+ writer->rows_html = NULL;
+ writer->details_html = NULL;
+
+ render_page_name(writer->job, writer->branch, writer->page, filename, 1280);
+ if(write_report_page(report, filename, html, html_length, &written))
+ {
+  free(html);
+  return 1;
+ }
+ free(html);
+
+ if(written)
+  writer->n_written++;
+ else
+  writer->n_unchanged++;
+
+ return 0;
+}
+
+/* output is ignored, the build goes on the writer's current page */
+int add_build_to_page(struct report_details *report, const struct list_builds_data *build,
+                      FILE *output)
+{
+ struct report_page_writer *writer = report->page_writer;
+ int branch;
+
+ if(writer->n_on_page == writer->page_size)
+ {
+  if(finish_report_page(report, writer, 1))
+   return 1;
+
+  writer->page++;
+  writer->n_on_page = 0;
+ }
+
+ if(writer->n_on_page == 0)
+ {
+  writer->rows = open_memstream(&(writer->rows_html), &(writer->rows_length));
+  writer->details = open_memstream(&(writer->details_html), &(writer->details_length));
+
+  if( (writer->rows == NULL) || (writer->details == NULL) )
+  {
+   fprintf(stderr, "%s: add_build_to_page(): open_memstream() failed: %s\n",
+           report->ctx->error_prefix, strerror(errno));
+   return 1;
+  }
+ }
+
+ if( (emit_report_fragment(report, writer->cache, "build_row", build, render_build_row,
+                           writer->rows)) ||
+     (emit_report_fragment(report, writer->cache, "build_details", build, render_build_details,
+                           writer->details)) )
+  return 1;
+
+ writer->n_on_page++;
+
+ if(writer->latest_identifier != NULL)
+  free(writer->latest_identifier);
+
+ if((writer->latest_identifier = strdup(build->unique_identifier)) == NULL)
+ {
+  fprintf(stderr, "%s: add_build_to_page(): strdup() failed: %s\n",
+          report->ctx->error_prefix, strerror(errno));
+  return 1;
+ }
+ writer->latest_result = build->build_result;
+
+ if(writer->branches_seen != NULL)
+ {
+  if((branch = string_index_lookup(writer->branch_index, build->branch)) != -1)
+   writer->branches_seen[branch] = 1;
+ }
+
+ return 0;
+}
+
+/* Writes every page of one job, or of one job and branch, and removes the pages past the end
+   left from when the series was longer. */
+int render_page_series(struct report_details *report, struct report_page_writer *writer,
+                       const char *job, const char *branch)
+{
+ struct buildmatrix_context *ctx = report->ctx;
+ char *saved_job = ctx->job_name, *saved_branch = ctx->branch_name, filename[1280];
+ int page, failed;
+
+ writer->job = job;
+ writer->branch = branch;
+ writer->page = 1;
+ writer->n_on_page = 0;
+ writer->rows_html = NULL;
+ writer->details_html = NULL;
+ if(writer->latest_identifier != NULL)
+  free(writer->latest_identifier);
+ writer->latest_identifier = NULL;
+
+ /* the page's builds are just the report's builds filtered further */
+ ctx->job_name = (char *) job;
+ if(branch != NULL)
+  ctx->branch_name = (char *) branch;
+
+ report->page_writer = writer;
+ failed = stream_report_builds(report, NULL, NULL, add_build_to_page, NULL);
+
+ ctx->job_name = saved_job;
+ ctx->branch_name = saved_branch;
+
+ if( (failed == 0) && (writer->n_on_page > 0) )
+  failed = finish_report_page(report, writer, 0);
+
+ if(writer->rows != NULL)
+  fclose(writer->rows);
+ if(writer->details != NULL)
+  fclose(writer->details);
+ writer->rows = NULL;
+ writer->details = NULL;
+
+ if(writer->rows_html != NULL)
+  free(writer->rows_html);
+ if(writer->details_html != NULL)
+  free(writer->details_html);
+
+ if(failed)
+  return 1;
+
+ for(page = writer->n_on_page > 0 ? writer->page + 1 : 1; ; page++)
+ {
+  render_page_name(job, branch, page, filename, 1280);
+  if(unlink(filename))
+   break;
+ }
+
+ return 0;
+}
+
+/* both series of job i: its own pages and the pages of each branch it was built on */
+int render_job_pages(struct report_details *report, struct report_page_writer *writer, int i,
+                     int *job_pages, struct report_page_cell *cells)
+{
+ struct report_page_cell *cell;
+ int j;
+
+ if( (report->ctx->job_name != NULL) && (strcmp(report->ctx->job_name, report->jobs_list[i]) != 0) )
+  return 0;
+
+ memset(writer->branches_seen, 0, report->n_branches + 1);
+ if(render_page_series(report, writer, report->jobs_list[i], NULL))
+  return 1;
+ job_pages[i] = writer->n_on_page > 0 ? writer->page : 0;
+
+ for(j=0; j<report->n_branches; j++)
+ {
+  if(writer->branches_seen[j] == 0)
+   continue;
+
+  if(render_page_series(report, writer, report->jobs_list[i], report->branches_list[j]))
+   return 1;
+
+  cell = cells + (i * report->n_branches) + j;
+  cell->page = writer->page;
+  cell->build_result = writer->latest_result;
+  cell->unique_identifier = writer->latest_identifier;
+  writer->latest_identifier = NULL;
+ }
+
+ return 0;
+}
+
+/* Runs in a child of render_report_pages(), with its own read only connection. Worker k of
+   n_workers does jobs k, k + n_workers, ... and writes what the parent needs to spool: the last
+   page of each job (J), the latest build of each job and branch (C), the fragments it rendered
+   (F, see emit_report_fragment()) and its counts (N). */
+int report_worker(struct report_details *report, struct report_page_writer *writer, int k,
+                  int n_workers, int *job_pages, struct report_page_cell *cells, FILE *spool)
+{
+ struct buildmatrix_context *ctx = report->ctx;
+ struct report_cache cache;
+ struct report_page_cell *cell;
+ int i, j, failed = 0;
+
+ /* the parent closed its connection before fork(), see suspend_database() */
+ ctx->db_read_only = 1;
+
+ if( (open_database(ctx)) ||
+     (attach_archives(ctx, ctx->since_time, ctx->until_time, 0, 0)) )
+  return 1;
+
+ if(open_report_cache(report, &cache))
+  cache.enabled = 0;
+ cache.spool = spool;
+ writer->cache = &cache;
+
+ for(i=k; (failed == 0) && (i<report->n_jobs); i += n_workers)
+ {
+  if((failed = render_job_pages(report, writer, i, job_pages, cells)))
+   break;
+
+  fprintf(spool, "J %d %d\n", i, job_pages[i]);
+
+  for(j=0; j<report->n_branches; j++)
+  {
+   cell = cells + (i * report->n_branches) + j;
+   if(cell->unique_identifier == NULL)
+    continue;
+
+   fprintf(spool, "C %d %d %d %d %d\n", i, j, cell->page, cell->build_result,
+           (int) strlen(cell->unique_identifier));
+   fwrite(cell->unique_identifier, 1, strlen(cell->unique_identifier), spool);
+  }
+ }
+
+ if(close_report_cache(report, &cache))
+  failed = 1;
+
+ fprintf(spool, "N %d %d %d %d\n", writer->n_written, writer->n_unchanged,
+         cache.n_reused, cache.n_rendered);
+
+ if(fflush(spool))
+  failed = 1;
+
+ return failed;
+}
+
+/* reads a worker's spool back in, the fragments go to the parent's cache */
+int merge_report_worker(struct report_details *report, struct report_page_writer *writer,
+                        struct report_cache *cache, FILE *spool,
+                        int *job_pages, struct report_page_cell *cells)
+{
+ struct report_page_cell *cell;
+ char type, name[32], *identifier, *html;
+ int i, j, page, result, length, html_length, build_id, a, b, c, d, failed = 0;
+
+ rewind(spool);
+
+ while( (failed == 0) && (fscanf(spool, " %c", &type) == 1) )
+ {
+  switch(type)
+  {
+   case 'J':
+        if( (fscanf(spool, "%d %d", &i, &page) != 2) || (fgetc(spool) != '\n') ||
+            (i < 0) || (i >= report->n_jobs) )
+        {
+         failed = 1;
+         break;
+        }
+        job_pages[i] = page;
+        break;
+
+   case 'C':
+        if( (fscanf(spool, "%d %d %d %d %d", &i, &j, &page, &result, &length) != 5) ||
+            (fgetc(spool) != '\n') || (i < 0) || (i >= report->n_jobs) || (j < 0) ||
+            (j >= report->n_branches) || (length < 0) ||
+            ((identifier = (char *) malloc(length + 1)) == NULL) )
+        {
+         failed = 1;
+         break;
+        }
+
+        if(fread(identifier, 1, length, spool) != (size_t) length)
+        {
+         free(identifier);
+         failed = 1;
+         break;
+        }
+        identifier[length] = 0;
+
+        cell = cells + (i * report->n_branches) + j;
+        cell->page = page;
+        cell->build_result = result;
+        cell->unique_identifier = identifier;
+        break;
+
+   case 'F':
+        if( (fscanf(spool, "%31s %d %d %d", name, &build_id, &length, &html_length) != 4) ||
+            (fgetc(spool) != '\n') || (length < 0) || (html_length < 0) ||
+            ((identifier = (char *) malloc(length + html_length + 2)) == NULL) )
+        {
+         failed = 1;
+         break;
+        }
+
+        /* the identifier and the html share one buffer */
+        html = identifier + length + 1;
+        if( (fread(identifier, 1, length, spool) != (size_t) length) ||
+            (fread(html, 1, html_length, spool) != (size_t) html_length) )
+        {
+         free(identifier);
+         failed = 1;
+         break;
+        }
+        identifier[length] = 0;
+
+        if(cache->enabled)
+         failed = store_report_fragment(report, cache, name, build_id, identifier, 0, 0, 0,
+                                        html, html_length);
+        free(identifier);
+        break;
+
+   case 'N':
+        if(fscanf(spool, "%d %d %d %d", &a, &b, &c, &d) != 4)
+        {
+         failed = 1;
+         break;
+        }
+        writer->n_written += a;
+        writer->n_unchanged += b;
+        cache->n_reused += c;
+        cache->n_rendered += d;
+        break;
+
+   default:
+        failed = 1;
+  }
+ }
+
+ if(failed)
+  fprintf(stderr, "%s: merge_report_worker(): could not read a report worker's results\n",
+          report->ctx->error_prefix);
+
+ return failed;
+}
+
+int render_page_index(struct report_details *report, int *job_pages,
+                      struct report_page_cell *cells)
+{
+ struct report_page_cell *cell;
+ char filename[1280];
+ int i, j;
+ FILE *output;
+
+ if((output = fopen("./dashboard.html", "w")) == NULL)
+ {
+  fprintf(stderr, "%s\n", strerror(errno));
+  return 1;
+ }
+
+ render_report_heading(report, output);
+
+ fprintf(output, 
+         "  <h2>Latest Builds</h2>\n"
+         "   <table border=1>\n"
+         "    <tr>\n"
+         "     <td></td>\n");
+
+ for(j=0; j<report->n_branches; j++)
+  fprintf(output, "     <td align=center><b>%s</b></td>\n", report->branches_list[j]);
+ fprintf(output, "    </tr>\n");
+
+ for(i=0; i<report->n_jobs; i++)
+ {
+  if(job_pages[i] == 0)
+   continue;
+
+  render_page_name(report->jobs_list[i], NULL, job_pages[i], filename, 1280);
+  fprintf(output, 
+          "    <tr>\n"
+          "     <td><a href=\"%s\">%s</a></td>\n", filename, report->jobs_list[i]);
+
+  for(j=0; j<report->n_branches; j++)
+  {
+   cell = cells + (i * report->n_branches) + j;
+
+   if(cell->unique_identifier == NULL)
+   {
+    fprintf(output, "     <td></td>\n");
+    continue;
+   }
+
+   render_page_name(report->jobs_list[i], report->branches_list[j], cell->page, filename, 1280);
+   fprintf(output, "     <td%s><a href=\"%s#%s\">%s</a></td>\n", 
+           cell->build_result == 0 ? " bgcolor=red" : 
+           cell->build_result == 1 ? " bgcolor=green" : "",
+           filename, cell->unique_identifier, cell->unique_identifier);
+  }
+  fprintf(output, "    </tr>\n");
+ }
+
+ fprintf(output,
+         "   </table>\n");
+
+ render_tests_section(report, output);
+
+ fprintf(output,
+         " </body>\n"
+         "</html>\n");
+ fclose(output);
+
+ return 0;
+}
+
+/* With reportworkers above 1 the jobs are shared out to that many forked workers. Each writes
+   its own page files, and the index is put together from their spools in job order, so the
+   output doesn't depend on which worker finished first. */
+int render_report_pages(struct report_details *report)
+{
+ struct buildmatrix_context *ctx = report->ctx;
+ struct report_cache cache;
+ struct report_page_writer writer;
+ struct report_page_cell *cells = NULL;
+ struct string_index branch_index;
+ int *job_pages = NULL, n_workers, i, k, status, n_references = 0, failed = 0;
+ pid_t *workers = NULL;
+ FILE **spools = NULL;
+
+ if(chdir(ctx->local_project_directory))
+ {
+  fprintf(stderr, "chdir(%s) failed: %s\n", ctx->local_project_directory, strerror(errno));
+  return 1;
+ }
+
+ memset(&writer, 0, sizeof(struct report_page_writer));
+ if( (configuration_int(ctx, "reportpagesize", 100, &(writer.page_size))) ||
+     (configuration_int(ctx, "reportworkers", 1, &n_workers)) )
+  return 1;
+
+ if(writer.page_size < 1)
+  writer.page_size = 100;
+
+ if(n_workers > report->n_jobs)
+  n_workers = report->n_jobs;
+
+ if( ((cells = (struct report_page_cell *) 
+               calloc(report->n_jobs * report->n_branches + 1, 
+                      sizeof(struct report_page_cell))) == NULL) ||
+     ((job_pages = (int *) calloc(report->n_jobs + 1, sizeof(int))) == NULL) ||
+     ((workers = (pid_t *) calloc(n_workers + 1, sizeof(pid_t))) == NULL) ||
+     ((spools = (FILE **) calloc(n_workers + 1, sizeof(FILE *))) == NULL) ||
+     ((writer.branches_seen = (char *) malloc(report->n_branches + 1)) == NULL) )
+ {
+  fprintf(stderr, "%s: render_report_pages(): out of memory\n", ctx->error_prefix);
+  if(cells != NULL)
+   free(cells);
+  if(job_pages != NULL)
+   free(job_pages);
+  if(workers != NULL)
+   free(workers);
+  if(spools != NULL)
+   free(spools);
+  return 1;
+ }
+
+ if(string_index_create(&branch_index, report->n_branches))
+ {
+  fprintf(stderr, "%s: render_report_pages(): out of memory\n", ctx->error_prefix);
+  free(cells);
+  free(job_pages);
+  free(workers);
+  free(spools);
+  free(writer.branches_seen);
+  return 1;
+ }
+
+ for(i=0; (failed == 0) && (i<report->n_branches); i++)
+  failed = string_index_insert(&branch_index, report->branches_list[i], i);
+ writer.branch_index = &branch_index;
+
+ memset(&cache, 0, sizeof(struct report_cache));
+ writer.cache = &cache;
+
+ if(n_workers < 2)
+ {
+  /* archives can't be attached once the cache's transaction is open, and without the cache
+     every fragment is simply rendered */
+  if(attach_archives(ctx, ctx->since_time, ctx->until_time, 0, 0))
+   failed = 1;
+
+  if( (failed) || (open_report_cache(report, &cache)) )
+   cache.enabled = 0;
+
+  for(i=0; (failed == 0) && (i<report->n_jobs); i++)
+   failed = render_job_pages(report, &writer, i, job_pages, cells);
+ } else {
+  /* An sqlite connection must not be carried across fork(), the children would inherit its
+     locks. The parent lets go of the database until the workers are done, and takes the
+     cache's transaction only then, to store what they rendered. */
+  if( (create_report_fragments_table(ctx)) ||
+      (suspend_database(ctx, &n_references)) )
+   failed = 1;
+
+  /* nothing buffered may be written twice */
+  fflush(stdout);
+  fflush(stderr);
+
+  for(k=0; (failed == 0) && (k<n_workers); k++)
+  {
+   if((spools[k] = tmpfile()) == NULL)
+   {
+    fprintf(stderr, "%s: render_report_pages(): tmpfile() failed, %s\n",
+            ctx->error_prefix, strerror(errno));
+    failed = 1;
+    break;
+   }
+
+   if((workers[k] = fork()) == 0)
+    _exit(report_worker(report, &writer, k, n_workers, job_pages, cells, spools[k]));
+
+   if(workers[k] == -1)
+   {
+    fprintf(stderr, "%s: render_report_pages(): fork() failed, %s\n",
+            ctx->error_prefix, strerror(errno));
+    workers[k] = 0;
+    failed = 1;
+   }
+  }
+
+  for(k=0; k<n_workers; k++)
+  {
+   if(workers[k] == 0)
+    continue;
+
+   if( (waitpid(workers[k], &status, 0) == -1) || (WIFEXITED(status) == 0) ||
+       (WEXITSTATUS(status) != 0) )
+   {
+    fprintf(stderr, "%s: render_report_pages(): report worker %d failed\n",
+            ctx->error_prefix, k);
+    failed = 1;
+   }
+  }
+
+  if( (n_references > 0) && (resume_database(ctx, n_references)) )
+   failed = 1;
+
+  if( (failed == 0) &&
+      ( (attach_archives(ctx, ctx->since_time, ctx->until_time, 0, 0)) ||
+        (open_report_cache(report, &cache)) ) )
+   cache.enabled = 0;
+
+  for(k=0; k<n_workers; k++)
+  {
+   if(spools[k] == NULL)
+    continue;
+
+   if(failed == 0)
+    failed = merge_report_worker(report, &writer, &cache, spools[k], job_pages, cells);
+
+   fclose(spools[k]);
+  }
+ }
+
+ if(close_report_cache(report, &cache))
+  failed = 1;
+
+ if(failed == 0)
+  failed = render_page_index(report, job_pages, cells);
+
+ if(ctx->verbose)
+  fprintf(stderr, "%s: report pages written %d, unchanged %d\n", ctx->error_prefix,
+          writer.n_written, writer.n_unchanged);
+
+ for(i=0; i < report->n_jobs * report->n_branches; i++)
+ {
+  if(cells[i].unique_identifier != NULL)
+   free(cells[i].unique_identifier);
+ }
+ if(writer.latest_identifier != NULL)
+  free(writer.latest_identifier);
+ free(cells);
+ free(job_pages);
+ free(workers);
+ free(spools);
+ free(writer.branches_seen);
+ string_index_free(&branch_index);
+
+ return failed;
+}
+
+int render_report(struct report_details *report)
+{
+ FILE *output;
+ struct report_cache cache;
+ int i, failed = 0;
+
+ if(chdir(report->ctx->local_project_directory))
+ {
+  fprintf(stderr, "chdir(%s) failed: %s\n", report->ctx->local_project_directory, strerror(errno));
+  return 1;
+ }
+
+ if((output = fopen("./dashboard.html", "w")) == NULL)
+ {
+  fprintf(stderr, "%s\n", strerror(errno));
+  return 1;
+ }
 
- fprintf(output, 
-         "  <table width=100%%><tr><td>\n"
-         "   <h1>%s</h1>\n"
-         "   <h2>Build Matrix Dashboard Report</h2>\n", report->project_name);
+ /* without the cache every fragment is simply rendered */
+ if(open_report_cache(report, &cache))
+  cache.enabled = 0;
 
- fprintf(output,
-         "  </td><td>\n"
-         "   <h3 align=right>Report Generated on <i>%s</i></h3>\n"
-         "  </td></tr></table>\n"
-         "  <hr>\n", time_string);
+ render_report_heading(report, output);
  
  fprintf(output,
          " <table width=100%%><tr><td>\n"
@@ -224,156 +1956,28 @@ int render_report(struct report_details *report)
          "  <h2><a name=\"builds\">Builds</h2>\n");
 
  fprintf(output,
-         "   <table border=1>\n"
-         "    <tr>\n"
-         "     <td align=center><b>Indentifier</b></td>\n"
-         "     <td align=center><b>Branch</b></td>\n"
-         "     <td align=center><b>Job</b></td>\n"
-         "     <td align=center><b>Node</b></td>\n"
-         "     <td align=center><b>Revision</b></td>\n"
-         "     <td align=center><b>User</b></td>\n"
-         "     <td align=center><b>Result</b></td>\n"
-         "     <td align=center><b>Submit Time</b></td>\n"
-         "     <td align=center><b>P</b></td>\n"
-         "     <td align=center><b>F</b></td>\n"
-         "     <td align=center><b>I</b></td>\n"
-         "     <td align=center><b>Parameters</b></td>\n"
-         "     <td align=center><b>Tests</b></td>\n"
-         "     <td align=center><b>Report</b></td>\n"
-         "     <td align=center><b>Output</b></td>\n"
-         "     <td align=center><b>Signiture</b></td>\n"
-         "    </tr>\n");
-
- for(i=0; i<report->n_builds; i++)
- {
-  fprintf(output, "    <tr>\n");
-
-  if( (s = report->builds[i]->unique_identifier) == NULL)
-   fprintf(output, "     <td></td>\n");
-  else
-   fprintf(output, "     <td><a href=\"#%s\">%s</a></td>\n", s, s);
-
-  if((s = report->builds[i]->branch) == NULL)
-   fprintf(output, "     <td></td>\n");
-  else
-   fprintf(output, "     <td>%s</td>\n", s);
-
-  if((s = report->builds[i]->job_name) == NULL)
-   fprintf(output, "     <td></td>\n");
-  else
-   fprintf(output, "     <td>%s</td>\n", s);
-
-  if((s = report->builds[i]->build_node) == NULL)
-   fprintf(output, "     <td></td>\n");
-  else
-   fprintf(output, "     <td>%s</td>\n", s);
-
-  if((s = report->builds[i]->revision) == NULL)
-   fprintf(output, "     <td></td>\n");
-  else
-   fprintf(output, "     <td>%s</td>\n", s);
-
-  if((s = report->builds[i]->user) == NULL)
-   fprintf(output, "     <td></td>\n");
-  else
-   fprintf(output, "     <td>%s</td>\n", s);
-
-  switch(report->builds[i]->build_result)
-  {
-   case 0:
-        fprintf(output, "     <td bgcolor=red>failed</td>\n");
-        break;
-
-   case 1:
-        fprintf(output, "     <td bgcolor=green>passed</td>\n");
-        break;
+         "   <table border=1>\n");
 
+ render_builds_table_heading(output);
 
-   default:
-        fprintf(output, "     <td></td>\n");
-  }
-
-  ti = report->builds[i]->build_time;
-  localtime_r(&ti, &tm);
-  strftime(time_string, 128, "%c", &tm);
-  fprintf(output, "     <td>%s</td>\n", time_string);
+ if(report->streaming)
+  failed = stream_report_builds(report, &cache, "build_row", render_build_row, output);
 
-  fprintf(output, "     <td>%d</td>\n", report->builds[i]->passed);
-  fprintf(output, "     <td>%d</td>\n", report->builds[i]->failed);
-  fprintf(output, "     <td>%d</td>\n", report->builds[i]->incompleted);
+ for(i=0; (failed == 0) && (report->streaming == 0) && (i<report->n_builds); i++)
+  failed = emit_report_fragment(report, &cache, "build_row", report->builds[i], render_build_row,
+                                output);
 
-  fprintf(output, "     <td>%s</td>\n", report->builds[i]->has_parameters ? "yes" : "no");
-  fprintf(output, "     <td>%s</td>\n", report->builds[i]->has_tests ? "yes" : "no");
-  fprintf(output, "     <td>%s</td>\n", (report->builds[i]->report_name != NULL) ? "yes" : "no");
-  fprintf(output, "     <td>%s</td>\n", (report->builds[i]->output_name != NULL) ? "yes" : "no");
-  fprintf(output, "     <td>%s</td>\n", (report->builds[i]->checksum_name != NULL) ? "yes" : "no");
-
-  fprintf(output, "    </tr>\n");
- }
+ render_builds_table_heading(output);
 
  fprintf(output,
-         "    <tr>\n"
-         "     <td align=center><b>Indentifier</b></td>\n"
-         "     <td align=center><b>Branch</b></td>\n"
-         "     <td align=center><b>Job</b></td>\n"
-         "     <td align=center><b>Node</b></td>\n"
-         "     <td align=center><b>Revision</b></td>\n"
-         "     <td align=center><b>User</b></td>\n"
-         "     <td align=center><b>Result</b></td>\n"
-         "     <td align=center><b>Submit Time</b></td>\n"
-         "     <td align=center><b>P</b></td>\n"
-         "     <td align=center><b>F</b></td>\n"
-         "     <td align=center><b>I</b></td>\n"
-         "     <td align=center><b>Parameters</b></td>\n"
-         "     <td align=center><b>Tests</b></td>\n"
-         "     <td align=center><b>Report</b></td>\n"
-         "     <td align=center><b>Output</b></td>\n"
-         "     <td align=center><b>Signiture</b></td>\n"
-         "    </tr>\n"
          "   </table>\n");
 
- if(report->n_parameters > 0)
- {
-  fprintf(output, 
-          "  <h2><a name=\"parameters\">Parameters</h2>\n");
-
-  fprintf(output, 
-          "   <table border=1>\n"
-          "    <tr>\n"
-          "     <td>Parameters</td>\n");
-
-  for(j=0; j<report->n_builds; j++)
-  {
-   if(report->parameters[j]->n_pairs > 0)
-   {
-    s = report->builds[j]->unique_identifier;
-    fprintf(output, "     <td><a href=\"#%s\">%s</a></td>\n", s, s);
-   }
-  }
-  fprintf(output, "    </tr>\n");
-         
-  for(i=0; i<report->n_parameters; i++)
-  {
-   fprintf(output, "    <tr>\n");
-   fprintf(output, "     <td>%s</td>\n", report->parameters_list[i]); 
-   for(j=0; j<report->n_builds; j++)
-   {
-    if(report->parameters[j]->n_pairs > 0)
-    {
-     if(report->parameter_rows[i]->values[j] == NULL)
-      fprintf(output, "     <td>n/a</td>\n");    
-     else
-      fprintf(output, "     <td>%s</td>\n", report->parameter_rows[i]->values[j]); 
-    }
-   }
-   fprintf(output, "    </tr>\n");
-  }
-  fprintf(output,
-          "   </table>\n");
- }
+ if( (failed == 0) && (report->n_parameters > 0) )
+  failed = emit_report_fragment(report, &cache, "parameters", NULL,
+                                report->streaming ? render_parameters_section_streaming :
+                                                    render_parameters_section, output);
 
- fprintf(output, 
-         "  <h2><a name=\"tests\">Tests</h2>\n");
+ render_tests_section(report, output);
 
  fprintf(output, 
          "  <h2><a name=\"appendix_B\">Appendix B: <i>List of Branches</i></a></h2>\n");
@@ -434,44 +2038,104 @@ int render_report(struct report_details *report)
  fprintf(output, 
          "  <h2><a name=\"appendix_Z\">Appendix Z: <i>Build Details</i></a></h2\n");
 
- for(i=0; i<report->n_builds; i++)
+ if( (failed == 0) && (report->streaming) )
+  failed = stream_report_builds(report, &cache, "build_details", render_build_details, output);
+
+ for(i=0; (failed == 0) && (report->streaming == 0) && (i<report->n_builds); i++)
+  failed = emit_report_fragment(report, &cache, "build_details", report->builds[i],
+                                render_build_details, output);
+
+ if(close_report_cache(report, &cache))
+  failed = 1;
+
+ fclose(output);
+
+ return failed;
+}
+
+/* One pass over each build's pairs, with the parameter names and the values seen so far
+   looked up by hash instead of compared against every name for every build. */
+int build_parameter_grid(struct report_details *report)
+{
+ struct parameter_grid *grid = &(report->parameter_grid);
+ struct string_index names, values;
+ struct parameters *p;
+ int i, j, row, value, allocation_size, failed = 0;
+ size_t offset;
+
+ grid->n_rows = report->n_parameters;
+ grid->n_columns = report->n_builds;
+
+ if(grid->n_rows == 0)
+  return 0;
+
+ allocation_size = sizeof(int) * grid->n_rows * grid->n_columns;
+ if((grid->cells = (int *) malloc(allocation_size + 1)) == NULL)
  {
-  s = report->builds[i]->unique_identifier;
+  fprintf(stderr, "%s: build_parameter_grid(): malloc(%d) failed: %s\n", 
+          report->ctx->error_prefix, allocation_size, strerror(errno));
+  return 1;
+ }
+
+ for(i=0; i < grid->n_rows * grid->n_columns; i++)
+  grid->cells[i] = -1;
 
-  fprintf(output, " <h3><a name=\"%s\">Details of Build %s</a></h3>\n", s, s);
+ if(string_index_create(&names, grid->n_rows))
+ {
+  fprintf(stderr, "%s: build_parameter_grid(): out of memory\n", report->ctx->error_prefix);
+  return 1;
+ }
 
+ if(string_index_create(&values, 64))
+ {
+  fprintf(stderr, "%s: build_parameter_grid(): out of memory\n", report->ctx->error_prefix);
+  string_index_free(&names);
+  return 1;
+ }
 
-  if((s = report->builds[i]->report_name) != NULL)
-  {
-   render_relative_db_file_path(report->builds[i]->unique_identifier, s, path_string, 1024);
-   file_size_to_string(file_size(report->ctx, path_string), fs_string, 32);
-   fprintf(output, " <p>The build report (%s) <a href=\"%s\">%s</a></p>\n",
-           fs_string, path_string, s);
-  }
+ for(i=0; (failed == 0) && (i<grid->n_rows); i++)
+  failed = string_index_insert(&names, report->parameters_list[i], i);
 
-  if((s = report->builds[i]->output_name) != NULL)
-  {
-   render_relative_db_file_path(report->builds[i]->unique_identifier, s, path_string, 1024);
-   file_size_to_string(file_size(report->ctx, path_string), fs_string, 32);
-   fprintf(output, " <p>The build output (%s) <a href=\"%s\">%s</a></p>\n",
-           fs_string, path_string, s);
-  }
+ /* the index keys are the values in report->parameter_sets, pool keeps its own copy */
+ for(j=0; (failed == 0) && (j<grid->n_columns); j++)
+ {
+  p = report->parameters[j];
 
-  if((s = report->builds[i]->checksum_name) != NULL)
+  for(i=0; i<p->n_pairs; i++)
   {
-   render_relative_db_file_path(report->builds[i]->unique_identifier, s, path_string, 1024);
-   file_size_to_string(file_size(report->ctx, path_string), fs_string, 32);
-   fprintf(output, " <p>The checksum / signature (%s) <a href=\"%s\">%s</a></p>\n",
-           fs_string, path_string, s);
-  }
+   if((row = string_index_lookup(&names, p->keys[i])) == -1)
+    continue;
+
+   if((value = string_index_lookup(&values, p->values[i])) == -1)
+   {
+    if( (arena_append_string(&(grid->pool), p->values[i], &offset)) ||
+        (string_index_insert(&values, p->values[i], (int) offset)) )
+    {
+     failed = 1;
+     break;
+    }
+    value = (int) offset;
+   }
 
-  fprintf(output, "<hr>\n");
+   grid->cells[(row * grid->n_columns) + j] = value;
+  }
  }
 
+ if(failed)
+  fprintf(stderr, "%s: build_parameter_grid(): out of memory\n", report->ctx->error_prefix);
 
- fclose(output);
+ string_index_free(&names);
+ string_index_free(&values);
+ return failed;
+}
 
- return 0;
+void free_parameter_grid(struct parameter_grid *grid)
+{
+ if(grid->cells != NULL)
+  free(grid->cells);
+
+ grid->cells = NULL;
+ arena_free(&(grid->pool));
 }
 
 void free_report(struct report_details *report)
@@ -499,6 +2163,16 @@ void free_report(struct report_details *report)
  if(report->parameters_list != NULL)
   free_string_array(report->parameters_list, report->n_parameters);
 
+ if(report->tests_list != NULL)
+  free_string_array(report->tests_list, report->n_tests);
+
+ if(report->test_history != NULL)
+ {
+  for(i=0; i<report->n_test_history; i++)
+   free(report->test_history[i]);
+  free(report->test_history);
+ }
+
  if(report->builds != NULL)
  {
   for(i=0; i<report->n_builds; i++)
@@ -509,28 +2183,59 @@ void free_report(struct report_details *report)
   free(report->builds);
  }
 
+ /* entries point into parameter_sets */
  if(report->parameters != NULL)
- {
-  for(i=0; i<report->n_builds; i++)
-  {
-   if(report->parameters[i] != NULL)
-    free(report->parameters[i]);
-  }
   free(report->parameters);
- }
+
+ if(report->parameter_sets != NULL)
+  free_parameter_sets(report->parameter_sets);
+
+ free_parameter_grid(&(report->parameter_grid));
 
  free(report);
 }
 
+/* the rest of generate_report(), for both the streamed and the in memory report */
+int generate_report_finish(struct buildmatrix_context *ctx, struct report_details *report)
+{
+ struct test_history_strategy_report_context sc;
+ struct iterative_strategy s;
+
+ sc.report = report;
+ sc.size = 0;
+ s.start = test_history_strategy_report_start;
+ s.iterative = test_history_strategy_report_iterative;
+ s.done = test_history_strategy_report_done;
+ s.strategy_context = &sc;
+
+ if(read_test_history(ctx, &s))
+ {
+  fprintf(stderr, "%s: read_test_history() failed\n", ctx->error_prefix);
+  free_report(report);
+  close_database(ctx);
+  return 1;
+ }
+
+ if(report->pages ? render_report_pages(report) : render_report(report))
+ {
+  fprintf(stderr, "%s: render_report() failed\n", ctx->error_prefix);
+  free_report(report);
+  close_database(ctx);
+  return 1;
+ }
+
+ free_report(report);
+ close_database(ctx);
+ return 0;
+}
+
 int generate_report(struct buildmatrix_context *ctx)
 {
  struct report_details *report;
  struct service_list_strategy_report_context *sc;
  struct service_list_builds_strategy_report_context *scb;
  struct iterative_strategy s;
- struct parameter_grid_row *pr;
- char **value_ptr;
- int i, allocation_size, j, x;
+ int i, allocation_size;
 
  if((report = (struct report_details *) malloc(sizeof(struct report_details))) == NULL)
  {
@@ -540,10 +2245,31 @@ int generate_report(struct buildmatrix_context *ctx)
 
  time(&(report->generation_time));
  report->ctx = ctx;
+ report->builds = NULL;
+ report->n_builds = 0;
+ report->tests_list = NULL;
+ report->n_tests = 0;
+ report->test_history = NULL;
+ report->n_test_history = 0;
+ report->parameters = NULL;
+ report->parameter_sets = NULL;
+ report->parameter_stream = NULL;
+ report->first_build_id = 0;
+ report->last_build_id = 0;
+ memset(&(report->parameter_grid), 0, sizeof(struct parameter_grid));
 
  if(open_database(ctx))
   return 1;
 
+ /* appendix Z reads the artifact sizes through the all_builds view, which takes its column
+    list from main.builds */
+ if(upgrade_artifact_columns(ctx))
+ {
+  free_report(report);
+  close_database(ctx);
+  return 1;
+ }
+
  if((report->project_name = resolve_configuration_value(ctx, "projectname")) == NULL)
  {
   fprintf(stderr, "%s: Can't figure out my project name.\n", ctx->error_prefix);
@@ -607,6 +2333,37 @@ int generate_report(struct buildmatrix_context *ctx)
  report->parameters_list = sc->array;
  report->n_parameters = sc->array_size;
 
+ if(configuration_boolean(ctx, "reportstreaming", 0, &(report->streaming)))
+ {
+  free_report(report);
+  close_database(ctx);
+  return 1;
+ }
+
+ if(configuration_boolean(ctx, "reportpages", 0, &(report->pages)))
+ {
+  free_report(report);
+  close_database(ctx);
+  return 1;
+ }
+
+ /* the pages are written straight from the cursor, like a streamed report */
+ if(report->pages)
+  return generate_report_finish(ctx, report);
+
+ if(report->streaming)
+ {
+  /* the parameter sets are read a build at a time, see struct parameter_stream */
+  if(stream_report_builds(report, NULL, NULL, count_report_build, NULL))
+  {
+   free_report(report);
+   close_database(ctx);
+   return 1;
+  }
+
+  return generate_report_finish(ctx, report);
+ }
+
  s.start = service_list_builds_strategy_report_start;
  s.iterative = service_list_builds_strategy_report_iterative;
  s.done = service_list_builds_strategy_report_done;
@@ -635,77 +2392,40 @@ int generate_report(struct buildmatrix_context *ctx)
   return 1;
  } 
 
+ /* one query for the parameters of every build in the report */
  for(i=0; i<report->n_builds; i++)
  {
-  ctx->build_id = report->builds[i]->build_id;
-  if(load_parameters_from_db(ctx))
-  {
-   fprintf(stderr, "%s: load_parameters() failed\n", ctx->error_prefix);
-   free_report(report);
-   close_database(ctx);
-   return 1;
-  }
-  report->parameters[i] = ctx->parameters;
+  if( (report->first_build_id == 0) || (report->builds[i]->build_id < report->first_build_id) )
+   report->first_build_id = report->builds[i]->build_id;
+
+  if(report->builds[i]->build_id > report->last_build_id)
+   report->last_build_id = report->builds[i]->build_id;
  }
 
- if(report->n_parameters == 0)
+ if(load_parameter_sets(ctx, report->first_build_id, report->last_build_id,
+                        &(report->parameter_sets)))
  {
-  report->parameter_rows = NULL;
- } else {
-  allocation_size = report->n_parameters * sizeof(struct parameter_row *);
-  if((report->parameter_rows = (struct parameter_grid_row **) malloc(allocation_size)) == NULL)
-  {
-   fprintf(stderr, "%s: malloc(%d) failed: %s\n", 
-           ctx->error_prefix, allocation_size, strerror(errno));
-   free_report(report);
-   close_database(ctx);
-   return 1;
-  }
-
-  allocation_size = sizeof(struct parameter_grid_row) 
-                  + (sizeof(char *) * report->n_builds);
-
-  for(i=0; i<report->n_parameters; i++)
-  {
-   if((pr = (struct parameter_grid_row *) malloc(allocation_size)) == NULL)
-   {
-    fprintf(stderr, "%s: malloc(%d) failed: %s\n", 
-            ctx->error_prefix, allocation_size, strerror(errno));
-    free_report(report);
-    close_database(ctx);
-    return 1;
-   }
-   pr->values = (char **) ((char *) pr + sizeof(struct parameter_grid_row));
-   report->parameter_rows[i] = pr;
-
-   for(j=0; j < report->n_builds; j++)
-   {
-    value_ptr = &(pr->values[j]);
-    *value_ptr = NULL;
-    for(x=0; x<report->parameters[j]->n_pairs; x++)
-    {
-     if(strcmp(report->parameters_list[i], report->parameters[j]->keys[x]) == 0)
-      *value_ptr = report->parameters[j]->values[x];
-    }
-   }
-  }
+  fprintf(stderr, "%s: load_parameter_sets() failed\n", ctx->error_prefix);
+  free_report(report);
+  close_database(ctx);
+  return 1;
  }
 
- report->n_tests = 0;
+ for(i=0; i<report->n_builds; i++)
+  report->parameters[i] = parameter_set_for_build(report->parameter_sets,
+                                                  report->builds[i]->build_id);
 
- if(render_report(report))
+ if(build_parameter_grid(report))
  {
-  fprintf(stderr, "%s: render_report() failed\n", ctx->error_prefix);
   free_report(report);
   close_database(ctx);
   return 1;
  }
 
- free_report(report);
- close_database(ctx);
- return 0;
+ return generate_report_finish(ctx, report);
 }
 
+
 int append_list_build_data_array(const struct buildmatrix_context *ctx,
                                  const struct list_builds_data *source, 
                                  struct list_builds_data *** const array_ptr,
@@ -0,0 +1,537 @@
+/*
+    Copyright 2013 Stover Enterprises, LLC (An Alabama Limited Liability Corporation)
+    Written by C. Thomas Stover
+
+    This file is part of the program Build Matrix.
+    See http://buildmatrix.stoverenterprises.com for more information.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "prototypes.h"
+
+/* Retention rules live in the configuration table as parameters named "retention.<name>".
+   Each value is one rule saying which builds to keep:
+
+    keeplast N [job=x] [branch=y] [result=success|failure]
+     - the newest N builds of each job / branch pair that match the filters
+
+    keepdays N [job=x] [branch=y] [result=success|failure]
+     - builds that match the filters and are no older than N days
+
+   The filters give a rule its scope. A build is pruned when it is in the scope of at least
+   one rule and no rule keeps it, so rules only ever add protection. With "keeplast 10" and
+   "keepdays 90 result=failure", failures are kept for 90 days even once they fall out of
+   the newest 10. Builds outside the scope of every rule are left alone. */
+
+#define PRUNE_BATCH_SIZE   1000
+#define PRUNE_VACUUM_PAGES 4096
+#define RETENTION_TOKEN_SIZE 256
+
+struct retention_rule
+{
+ int keep_last;
+ int keep_days;
+ int result;
+ char job[RETENTION_TOKEN_SIZE];
+ char branch[RETENTION_TOKEN_SIZE];
+};
+
+int parse_retention_rule(struct buildmatrix_context *ctx, const char *name, const char *value,
+                         struct retention_rule *rule)
+{
+ char token[RETENTION_TOKEN_SIZE];
+ int offset = 0, length, n;
+
+ memset(rule, 0, sizeof(struct retention_rule));
+ rule->keep_last = -1;
+ rule->keep_days = -1;
+ rule->result = -1;
+
+ if(sscanf(value, "keeplast %d%n", &(rule->keep_last), &offset) == 1)
+ {
+  if(rule->keep_last < 0)
+  {
+   fprintf(stderr, "%s: retention rule %s: keeplast must not be negative\n",
+           ctx->error_prefix, name);
+   return 1;
+  }
+ } else if(sscanf(value, "keepdays %d%n", &(rule->keep_days), &offset) == 1) {
+  if(rule->keep_days < 0)
+  {
+   fprintf(stderr, "%s: retention rule %s: keepdays must not be negative\n",
+           ctx->error_prefix, name);
+   return 1;
+  }
+ } else {
+  fprintf(stderr, "%s: retention rule %s: expected \"keeplast N\" or \"keepdays N\", "
+          "not \"%s\"\n", ctx->error_prefix, name, value);
+  return 1;
+ }
+
+ while(sscanf(value + offset, " %255s%n", token, &n) == 1)
+ {
+  offset += n;
+  length = strlen(token);
+
+  /* sscanf() stopped at the width, not at the end of the token */
+  if( (value[offset] != 0) && (strchr(" \t\r\n", value[offset]) == NULL) )
+  {
+   fprintf(stderr, "%s: retention rule %s: \"%s...\" is longer than %d characters\n",
+           ctx->error_prefix, name, token, RETENTION_TOKEN_SIZE - 1);
+   return 1;
+  }
+
+  if( (length > 4) && (strncmp(token, "job=", 4) == 0) )
+  {
+   snprintf(rule->job, RETENTION_TOKEN_SIZE, "%s", token + 4);
+   continue;
+  }
+
+  if( (length > 7) && (strncmp(token, "branch=", 7) == 0) )
+  {
+   snprintf(rule->branch, RETENTION_TOKEN_SIZE, "%s", token + 7);
+   continue;
+  }
+
+  if(strcmp(token, "result=success") == 0)
+  {
+   rule->result = 1;
+   continue;
+  }
+
+  if(strcmp(token, "result=failure") == 0)
+  {
+   rule->result = 0;
+   continue;
+  }
+
+  fprintf(stderr, "%s: retention rule %s: don't understand \"%s\"\n",
+          ctx->error_prefix, name, token);
+  return 1;
+ }
+
+ return 0;
+}
+
+/* the WHERE clause for the builds in a rule's scope, parameters bound by bind_retention_scope() */
+int retention_scope_sql(struct retention_rule *rule, char *sql, int size)
+{
+ int sql_length;
+
+ sql_length = snprintf(sql, size, "1 = 1");
+
+ if(rule->job[0] != 0)
+  sql_length += snprintf(sql + sql_length, size - sql_length, " AND job = ?");
+
+ if(rule->branch[0] != 0)
+  sql_length += snprintf(sql + sql_length, size - sql_length, " AND branch = ?");
+
+ if(rule->result != -1)
+  sql_length += snprintf(sql + sql_length, size - sql_length, " AND result = ?");
+
+ return sql_length;
+}
+
+int bind_retention_scope(struct buildmatrix_context *ctx, struct sqlite3_stmt *statement,
+                         struct retention_rule *rule, int *column)
+{
+ if( ( (rule->job[0] != 0) &&
+       (sqlite3_bind_text(statement, (*column)++, rule->job, strlen(rule->job),
+                          SQLITE_TRANSIENT) != SQLITE_OK) ) ||
+     ( (rule->branch[0] != 0) &&
+       (sqlite3_bind_text(statement, (*column)++, rule->branch, strlen(rule->branch),
+                          SQLITE_TRANSIENT) != SQLITE_OK) ) ||
+     ( (rule->result != -1) &&
+       (sqlite3_bind_int(statement, (*column)++, rule->result) != SQLITE_OK) ) )
+ {
+  fprintf(stderr, "%s: bind_retention_scope(): sqlite3_bind() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ return 0;
+}
+
+/* adds the builds in the rule's scope to prune_candidates, and the ones it keeps to
+   retention_kept */
+int select_retention_rule(struct buildmatrix_context *ctx, const char *name,
+                          struct retention_rule *rule)
+{
+ char scope[256], sql[1024];
+ int column, pass, n_scope = 0, n_kept = 0, window_functions;
+ struct sqlite3_stmt *statement = NULL;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: select_retention_rule(%s)\n", ctx->error_prefix, name);
+
+ window_functions = sqlite3_libversion_number() >= 3025000;
+
+ retention_scope_sql(rule, scope, 256);
+
+ for(pass=0; pass<2; pass++)
+ {
+  if(pass == 0)
+  {
+   snprintf(sql, 1024, "INSERT OR IGNORE INTO prune_candidates "
+                       "SELECT build_id FROM main.builds WHERE %s;", scope);
+  } else if( (rule->keep_last > -1) && (window_functions) ) {
+   /* one pass over the builds_job_branch index instead of counting newer builds per row */
+   snprintf(sql, 1024, "INSERT OR IGNORE INTO retention_kept SELECT build_id FROM "
+                       "(SELECT build_id, ROW_NUMBER() OVER (PARTITION BY job, branch "
+                                                           "ORDER BY build_id DESC) AS newest "
+                       "FROM main.builds WHERE %s) WHERE newest <= ?;", scope);
+  } else if(rule->keep_last > -1) {
+   /* window functions came with SQLite 3.25, so count the newer builds in scope instead. The
+      scope's columns inside the subquery are newer's, its parameters are bound twice. */
+   snprintf(sql, 1024, "INSERT OR IGNORE INTO retention_kept "
+                       "SELECT build_id FROM main.builds AS kept WHERE %s AND "
+                       "(SELECT COUNT(*) FROM main.builds AS newer "
+                        "WHERE newer.job = kept.job AND newer.branch = kept.branch "
+                        "AND newer.build_id > kept.build_id AND %s) < ?;", scope, scope);
+  } else {
+   snprintf(sql, 1024, "INSERT OR IGNORE INTO retention_kept "
+                       "SELECT build_id FROM main.builds WHERE %s AND build_time >= ?;", scope);
+  }
+
+  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: select_retention_rule(): sqlite3_prepare(%s) failed, '%s'\n",
+           ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+   return 1;
+  }
+
+  column = 1;
+  if( (bind_retention_scope(ctx, statement, rule, &column)) ||
+      ( (pass == 1) && (rule->keep_last > -1) && (window_functions == 0) &&
+        (bind_retention_scope(ctx, statement, rule, &column)) ) )
+  {
+   sqlite3_finalize(statement);
+   return 1;
+  }
+
+  if(pass == 1)
+  {
+   if( ( (rule->keep_last > -1) &&
+         (sqlite3_bind_int(statement, column, rule->keep_last) != SQLITE_OK) ) ||
+       ( (rule->keep_last == -1) &&
+         (sqlite3_bind_int64(statement, column,
+                             (long long int) time(NULL) - rule->keep_days * 86400LL) != SQLITE_OK) ) )
+   {
+    fprintf(stderr, "%s: select_retention_rule(): sqlite3_bind() failed, '%s'\n",
+            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+    sqlite3_finalize(statement);
+    return 1;
+   }
+  }
+
+  if(sqlite3_step(statement) != SQLITE_DONE)
+  {
+   fprintf(stderr, "%s: select_retention_rule(): sqlite3_step() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   sqlite3_finalize(statement);
+   return 1;
+  }
+
+  if(pass == 0)
+   n_scope = sqlite3_changes(ctx->db_ctx);
+  else
+   n_kept = sqlite3_changes(ctx->db_ctx);
+
+  sqlite3_finalize(statement);
+  statement = NULL;
+ }
+
+ if(ctx->verbose)
+  fprintf(stderr, "%s: retention rule %s brings %d more builds into scope and keeps %d\n",
+          ctx->error_prefix, name, n_scope, n_kept);
+
+ return 0;
+}
+
+int count_prune_candidates(struct buildmatrix_context *ctx, int *count)
+{
+ char *sql;
+ struct sqlite3_stmt *statement = NULL;
+
+ sql = "SELECT COUNT(*) FROM prune_candidates;";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: count_prune_candidates(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(sqlite3_step(statement) != SQLITE_ROW)
+ {
+  fprintf(stderr, "%s: count_prune_candidates(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ *count = sqlite3_column_int(statement, 0);
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+int load_retention_rules(struct buildmatrix_context *ctx, int *n_rules)
+{
+ char *sql, *errmsg;
+ const char *name, *value;
+ int code;
+ struct sqlite3_stmt *statement = NULL;
+ struct retention_rule rule;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: load_retention_rules()\n", ctx->error_prefix);
+
+ *n_rules = 0;
+
+ sql = "SELECT parameter, value FROM configuration "
+       "WHERE parameter LIKE 'retention.%' ORDER BY parameter;";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: load_retention_rules(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ {
+  if( (sqlite3_column_type(statement, 0) != SQLITE_TEXT) ||
+      (sqlite3_column_type(statement, 1) != SQLITE_TEXT) )
+  {
+   fprintf(stderr, "%s: load_retention_rules(): configuration values are not text\n",
+           ctx->error_prefix);
+   sqlite3_finalize(statement);
+   return 1;
+  }
+
+  name = (const char *) sqlite3_column_text(statement, 0);
+  value = (const char *) sqlite3_column_text(statement, 1);
+
+  if(parse_retention_rule(ctx, name, value, &rule))
+  {
+   sqlite3_finalize(statement);
+   return 1;
+  }
+
+  if(select_retention_rule(ctx, name, &rule))
+  {
+   sqlite3_finalize(statement);
+   return 1;
+  }
+
+  (*n_rules)++;
+ }
+
+ if(code != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: load_retention_rules(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ sqlite3_finalize(statement);
+
+ /* whatever any rule keeps stays, whichever other rules it is in the scope of */
+ if(sqlite3_exec(ctx->db_ctx, "DELETE FROM prune_candidates "
+                 "WHERE build_id IN (SELECT build_id FROM retention_kept);",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: load_retention_rules(): could not drop kept builds, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ return 0;
+}
+
+/* one batch of at most PRUNE_BATCH_SIZE builds per write transaction, artifact files are
+   removed only once that transaction has committed */
+int prune_batch(struct buildmatrix_context *ctx, int *n_pruned)
+{
+ char *errmsg, **identifiers = NULL, **files = NULL, buffer[128];
+ int i, n_files = 0, n_builds = 0;
+
+ *n_pruned = 0;
+
+ if(sqlite3_exec(ctx->db_ctx, "BEGIN IMMEDIATE TRANSACTION;", NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: prune_batch(): sqlite3_exec(\"BEGIN TRANSACTION;\"): '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ snprintf(buffer, 128, "DELETE FROM build_set; INSERT INTO build_set "
+          "SELECT build_id FROM prune_candidates ORDER BY build_id LIMIT %d;", PRUNE_BATCH_SIZE);
+
+ if(sqlite3_exec(ctx->db_ctx, buffer, NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: prune_batch(): could not fill build_set, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+  return 1;
+ }
+
+ if(delete_build_set(ctx, &identifiers, &files, &n_files, &n_builds))
+ {
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+  if(identifiers != NULL)
+   free_string_array(identifiers, n_files);
+  if(files != NULL)
+   free_string_array(files, n_files);
+  return 1;
+ }
+
+ if( (sqlite3_exec(ctx->db_ctx, "DELETE FROM prune_candidates "
+                   "WHERE build_id IN (SELECT build_id FROM build_set);",
+                   NULL, NULL, &errmsg) != SQLITE_OK) ||
+     (sqlite3_exec(ctx->db_ctx, "COMMIT TRANSACTION;", NULL, NULL, &errmsg) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: prune_batch(): could not commit, '%s'\n", ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+  free_string_array(identifiers, n_files);
+  free_string_array(files, n_files);
+  return 1;
+ }
+
+ // a file that is already gone is not worth stopping for
+ for(i=0; i<n_files; i++)
+  remove_build_file(ctx, identifiers[i], files[i]);
+
+ if(n_files > 0)
+ {
+  free_string_array(identifiers, n_files);
+  free_string_array(files, n_files);
+ }
+
+ /* hand some of the free pages back, this takes the write lock on its own */
+ snprintf(buffer, 128, "PRAGMA incremental_vacuum(%d);", PRUNE_VACUUM_PAGES);
+ if(sqlite3_exec(ctx->db_ctx, buffer, NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: prune_batch(): incremental vacuum failed, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ *n_pruned = n_builds;
+ return 0;
+}
+
+int prune(struct buildmatrix_context *ctx)
+{
+ char *errmsg, string[256];
+ int n_rules, n_candidates, n_pruned, total = 0;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: prune()\n", ctx->error_prefix);
+
+ if(open_database(ctx))
+  return 1;
+
+ if(sqlite3_exec(ctx->db_ctx,
+                 "CREATE TEMP TABLE prune_candidates (build_id INTEGER PRIMARY KEY); "
+                 "CREATE TEMP TABLE retention_kept (build_id INTEGER PRIMARY KEY); "
+                 "CREATE TEMP TABLE build_set (build_id INTEGER PRIMARY KEY);",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: prune(): could not create temporary tables, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  close_database(ctx);
+  return 1;
+ }
+
+ /* projects created before retention rules don't have the index keeplast walks */
+ if(sqlite3_exec(ctx->db_ctx,
+                 "CREATE INDEX IF NOT EXISTS main.builds_job_branch ON builds (job, branch, build_id);",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: prune(): could not create builds_job_branch index, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  close_database(ctx);
+  return 1;
+ }
+
+ if(load_retention_rules(ctx, &n_rules))
+ {
+  close_database(ctx);
+  return 1;
+ }
+
+ if(n_rules == 0)
+ {
+  if(ctx->quiet == 0)
+   fprintf(stderr, "%s: no retention.* rules in the configuration, nothing to do\n",
+           ctx->error_prefix);
+  close_database(ctx);
+  return 0;
+ }
+
+ if(count_prune_candidates(ctx, &n_candidates))
+ {
+  close_database(ctx);
+  return 1;
+ }
+
+ if(n_candidates == 0)
+ {
+  if(ctx->quiet == 0)
+   printf("No builds fall outside of the retention rules.\n");
+  close_database(ctx);
+  return 0;
+ }
+
+ snprintf(string, 256, "%d builds fall outside of the %d retention rules. Delete them?",
+          n_candidates, n_rules);
+ if(ctx->yes_no_prompt(ctx, string) == 0)
+ {
+  close_database(ctx);
+  return 1;
+ }
+
+ do
+ {
+  if(prune_batch(ctx, &n_pruned))
+  {
+   fprintf(stderr, "%s: prune(): stopped after %d builds\n", ctx->error_prefix, total);
+   close_database(ctx);
+   return 1;
+  }
+
+  total += n_pruned;
+
+  if(ctx->verbose)
+   fprintf(stderr, "%s: pruned %d of %d builds\n", ctx->error_prefix, total, n_candidates);
+
+ } while(n_pruned > 0);
+
+ if(ctx->quiet == 0)
+  printf("Pruned %d builds.\n", total);
+
+ close_database(ctx);
+ return 0;
+}
@@ -23,23 +23,17 @@
 
 int serve(struct buildmatrix_context *ctx)
 {
- char *tmp;
+ const char *tmp;
 
  if(ctx->verbose > 1)
   fprintf(stderr, "%s: serve()\n", ctx->error_prefix);
 
- if((tmp = resolve_configuration_value(ctx, "writeable")) == NULL)
+ if((tmp = configuration_string(ctx, "writeable")) == NULL)
  {
   fprintf(stderr, "%s: Can't figure out if I can write to myself.\n", ctx->error_prefix);
   return 1;
  }
 
- if((ctx->project_name = resolve_configuration_value(ctx, "projectname")) == NULL)
- {
-  fprintf(stderr, "%s: Can't figure out my project name.\n", ctx->error_prefix);
-  return 1;
- }
- 
  if(strcmp(tmp, "yes") == 0)
  {
   ctx->write_master = 1;
@@ -47,7 +41,12 @@ int serve(struct buildmatrix_context *ctx)
   if(ctx->verbose)
    fprintf(stderr, "%s: I don't seem to be able to write to my self.\n", ctx->error_prefix);
  }
- free(tmp);
+
+ if((ctx->project_name = resolve_configuration_value(ctx, "projectname")) == NULL)
+ {
+  fprintf(stderr, "%s: Can't figure out my project name.\n", ctx->error_prefix);
+  return 1;
+ }
 
  ctx->service_simple_lists_strategy.start = service_list_strategy_net_start;
  ctx->service_simple_lists_strategy.iterative = service_list_strategy_net_iterative;
@@ -59,6 +58,11 @@ int serve(struct buildmatrix_context *ctx)
  ctx->service_list_builds_strategy.done = service_list_builds_strategy_net_done;
  ctx->service_list_builds_strategy.strategy_context = NULL;
 
+ ctx->service_list_tests_strategy.start = service_list_tests_strategy_net_start;
+ ctx->service_list_tests_strategy.iterative = service_list_tests_strategy_net_iterative;
+ ctx->service_list_tests_strategy.done = service_list_tests_strategy_net_done;
+ ctx->service_list_tests_strategy.strategy_context = NULL;
+
  ctx->process_build_strategy = service_submit;
 
  ctx->yes_no_prompt = NULL;
@@ -74,7 +78,118 @@ int serve(struct buildmatrix_context *ctx)
 
 int service_list_tests(struct buildmatrix_context *ctx)
 {
- return 1;
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: service_list_tests()\n", ctx->error_prefix);
+
+ if(open_database(ctx))
+  return 1;
+
+ if(read_test_history(ctx, &(ctx->service_list_tests_strategy)))
+ {
+  if(ctx->verbose > 1)
+   fprintf(stderr, "%s: service_list_tests(): read_test_history() failed\n",
+           ctx->error_prefix);
+  return 1;
+ }
+
+ close_database(ctx);
+
+ return 0;
+}
+
+/* changed scores go out as lines through service_simple_lists_strategy, with the totals last */
+int service_test_diff_strategy_start(const struct buildmatrix_context *ctx,
+                                     void * const strategy_context, const void *ptr)
+{
+ return ctx->service_simple_lists_strategy.start(ctx, 
+                                                 ctx->service_simple_lists_strategy.strategy_context,
+                                                 "Test differences:");
+}
+
+int service_test_diff_strategy_iterative(const struct buildmatrix_context *ctx,
+                                         void * const strategy_context, const void *ptr)
+{
+ char buffer[4096];
+ const char *results[4] = { "unknown", "passed", "failed", "incomplete" };
+ const struct test_diff_data *data = (const struct test_diff_data *) ptr;
+ int old_result, new_result;
+
+ old_result = (data->old_result > 0 && data->old_result < 4) ? data->old_result : 0;
+ new_result = (data->new_result > 0 && data->new_result < 4) ? data->new_result : 0;
+
+ switch(data->change)
+ {
+  case TEST_DIFF_ADDED:
+       snprintf(buffer, 4096, "added %s.%s (%s)", 
+                data->suite, data->test, results[new_result]);
+       break;
+
+  case TEST_DIFF_REMOVED:
+       snprintf(buffer, 4096, "removed %s.%s (was %s)", 
+                data->suite, data->test, results[old_result]);
+       break;
+
+  default:
+       snprintf(buffer, 4096, "newly %s %s.%s (was %s)",
+                data->change == TEST_DIFF_PASSING ? "passing" :
+                data->change == TEST_DIFF_FAILING ? "failing" : "incomplete",
+                data->suite, data->test, results[old_result]);
+ }
+
+ return ctx->service_simple_lists_strategy.iterative(ctx, 
+                                                     ctx->service_simple_lists_strategy.strategy_context,
+                                                     buffer);
+}
+
+int service_test_diff_strategy_done(const struct buildmatrix_context *ctx,
+                                    void * const strategy_context, const void *ptr)
+{
+ char buffer[256];
+ const int *totals = (const int *) ptr;
+
+ snprintf(buffer, 256, 
+          "%d newly failing, %d newly passing, %d newly incomplete, %d added, %d removed",
+          totals[TEST_DIFF_FAILING], totals[TEST_DIFF_PASSING], totals[TEST_DIFF_INCOMPLETE],
+          totals[TEST_DIFF_ADDED], totals[TEST_DIFF_REMOVED]);
+
+ if(ctx->service_simple_lists_strategy.iterative(ctx, 
+                                                 ctx->service_simple_lists_strategy.strategy_context,
+                                                 buffer))
+  return 1;
+
+ return ctx->service_simple_lists_strategy.done(ctx, 
+                                                ctx->service_simple_lists_strategy.strategy_context,
+                                                NULL);
+}
+
+int service_test_diff(struct buildmatrix_context *ctx, const char *from_identifier,
+                      const char *to_identifier)
+{
+ struct iterative_strategy s;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: service_test_diff()\n", ctx->error_prefix);
+
+ if(open_database(ctx))
+  return 1;
+
+ s.start = service_test_diff_strategy_start;
+ s.iterative = service_test_diff_strategy_iterative;
+ s.done = service_test_diff_strategy_done;
+ s.strategy_context = NULL;
+
+ if(read_test_diff(ctx, from_identifier, to_identifier, &s))
+ {
+  if(ctx->verbose > 1)
+   fprintf(stderr, "%s: service_test_diff(): read_test_diff() failed\n",
+           ctx->error_prefix);
+  close_database(ctx);
+  return 1;
+ }
+
+ close_database(ctx);
+
+ return 0;
 }
 
 int rollback_submit(struct buildmatrix_context *ctx)
@@ -166,7 +281,7 @@ int generate_unique_identifier(struct buildmatrix_context *ctx)
  time(&now);
 
  length = snprintf(temp, 256, "%s%s%s%d%d%s", ctx->job_name, ctx->branch_name, h,
-                   (int) now, rand(), ctx->revision);
+                   (int) now, rand(), ctx->revision == NULL ? "" : ctx->revision);
 
  if(build_matrix_md5_wrapper(ctx, (unsigned char *) temp, length, digest))
   return 1;
@@ -43,9 +43,12 @@ void help(void)
          "  --branch branchname\n"
          "  --revision string\n"
          "  --job jobname\n"
-         "  --identifier unique_identifier\n"
+         "  --identifier unique_identifier (a second one is the newer build for testdiff)\n"
          "  --id build_id\n"
          "  --buildhost host\n"
+         "  --submitter name (builds submitted by user)\n"
+         "  --since time (YYYY-MM-DD or unix time)\n"
+         "  --until time (YYYY-MM-DD or unix time)\n"
          "  --testpasses n\n"
          "  --testfailures n\n"
          "  --testincompletes n\n"
@@ -54,7 +57,9 @@ void help(void)
          "  --success\n"
          "  --failure\n"
          "  --checksum filename (in/out file for build output checksum / signature)\n"
-         "  --testresults filename (in/out file for test scores)\n"
+         "  --testresults filename (in/out file for test scores: text, binary, JUnit XML or TAP)\n"
+         "  --testresultsout filename (out file for test scores converted by convert)\n"
+         "  --binarytestresults (write test scores in the binary form)\n"
          "  --parameters filename (in/out file for parameters)\n"
          "\n  [network related]\n"
          "  --local\n"
@@ -68,6 +73,8 @@ void help(void)
          "\n  [modify behavior of mode(s)]\n"
          "  --default\n"
          "  --dontgrowtesttables\n"
+         "  --streamtestresults (submit sends --testresults as it is parsed)\n"
+         "  --format ndjson|tsv (builds, tests and build write rows to stdout)\n"
          " and mode is either:\n"
          "  init (create a project)\n"
          "  submit (submit a build for a job)\n"
@@ -76,10 +83,13 @@ void help(void)
          "  hosts (lists build hosts\\nodes)\n"
          "  builds (lists builds)\n"
          "  build (get build details)\n"
-         "  tests (lists tests)\n"
-         "  scratch (erase a build)\n"
+         "  tests (lists pass/fail history per test, job and branch, by --job and --branch)\n"
+         "  testdiff (tests that changed between the builds of the first and second --identifier)\n"
+         "  scratch (erase a build, or every build matching --job, --branch, --buildhost,\n"
+         "           --submitter, --since and --until)\n"
          "  pull (retrieve build report, build output, or test scores)\n"
          "  parse (verify input file are correctly formated and exit)\n"
+         "  convert (write --testresults, text, binary, JUnit XML or TAP, to --testresultsout)\n"
          "  createuser\n"
          "  deleteuser\n"
          "  moduser\n"
@@ -93,6 +103,8 @@ void help(void)
          "  aliases\n"
          "  variables\n"
          "  report\n"
+         "  prune\n"
+         "  archive\n"
          "\n");
 }
 
@@ -239,6 +251,24 @@ struct buildmatrix_context *setup(int argc, char **argv)
    handled = 1;
   }
 
+  if(strcmp(argv[current_arg], "--testresultsout") == 0)
+  {
+   if(current_arg + 1 == argc)
+   {
+    fprintf(stderr, "--testresultsout requires an argument\n");
+    return NULL;
+   }
+   ctx->test_results_out_file = argv[++current_arg];
+
+   handled = 1;
+  }
+
+  if(strcmp(argv[current_arg], "--binarytestresults") == 0)
+  {
+   ctx->binary_test_results = 1;
+   handled = 1;
+  }
+
   if(strcmp(argv[current_arg], "--job") == 0)
   {
    if(current_arg + 1 == argc)
@@ -290,6 +320,43 @@ struct buildmatrix_context *setup(int argc, char **argv)
    handled = 1;
   }
 
+  if(strcmp(argv[current_arg], "--submitter") == 0)
+  {
+   if(current_arg + 1 == argc)
+   {
+    fprintf(stderr, "--submitter requires an argument\n");
+    return NULL;
+   }
+   ctx->submitter = strdup(argv[++current_arg]); //compatibility with free() logic
+   if(check_string(ctx, ctx->submitter))
+    return NULL;
+   handled = 1;
+  }
+
+  if(strcmp(argv[current_arg], "--since") == 0)
+  {
+   if(current_arg + 1 == argc)
+   {
+    fprintf(stderr, "--since requires a time\n");
+    return NULL;
+   }
+   if(string_to_time(ctx, argv[++current_arg], &(ctx->since_time)))
+    return NULL;
+   handled = 1;
+  }
+
+  if(strcmp(argv[current_arg], "--until") == 0)
+  {
+   if(current_arg + 1 == argc)
+   {
+    fprintf(stderr, "--until requires a time\n");
+    return NULL;
+   }
+   if(string_to_time(ctx, argv[++current_arg], &(ctx->until_time)))
+    return NULL;
+   handled = 1;
+  }
+
   if(strcmp(argv[current_arg], "--alias") == 0)
   {
    if(current_arg + 1 == argc)
@@ -386,9 +453,16 @@ struct buildmatrix_context *setup(int argc, char **argv)
     fprintf(stderr, "--identifier requires a string\n");
     return NULL;
    }
-   ctx->unique_identifier = strdup(argv[++current_arg]); //compatibility with free() logic
-   if(check_string(ctx, ctx->unique_identifier))
-    return NULL;
+   if(ctx->unique_identifier == NULL)
+   {
+    ctx->unique_identifier = strdup(argv[++current_arg]); //compatibility with free() logic
+    if(check_string(ctx, ctx->unique_identifier))
+     return NULL;
+   } else {
+    ctx->other_identifier = strdup(argv[++current_arg]);
+    if(check_string(ctx, ctx->other_identifier))
+     return NULL;
+   }
    handled = 1;
   }
 
@@ -551,6 +625,33 @@ struct buildmatrix_context *setup(int argc, char **argv)
    handled = 1;
   }
 
+  if(strcmp(argv[current_arg], "--streamtestresults") == 0)
+  {
+   ctx->stream_test_results = 1;
+   handled = 1;
+  }
+
+  if(strcmp(argv[current_arg], "--format") == 0)
+  {
+   if(current_arg + 1 == argc)
+   {
+    fprintf(stderr, "--format requires an argument\n");
+    return NULL;
+   }
+   current_arg++;
+
+   if(strcmp(argv[current_arg], "ndjson") == 0)
+   {
+    ctx->output_format = OUTPUT_FORMAT_NDJSON;
+   } else if(strcmp(argv[current_arg], "tsv") == 0) {
+    ctx->output_format = OUTPUT_FORMAT_TSV;
+   } else {
+    fprintf(stderr, "--format should be \"ndjson\" or \"tsv\", not \"%s\"\n", argv[current_arg]);
+    return NULL;
+   }
+   handled = 1;
+  }
+
   if(strcmp(argv[current_arg], "--bldmtrxpath") == 0)
   {
    if(current_arg + 1 == argc)
@@ -590,6 +691,12 @@ struct buildmatrix_context *setup(int argc, char **argv)
       handled = 1;
      }
 
+     if(strcmp(argv[current_arg], "testdiff") == 0)
+     {
+      ctx->mode = BLDMTRX_MODE_TEST_DIFF;
+      handled = 1;
+     }
+
      if(strcmp(argv[current_arg], "builds") == 0)
      {
       ctx->mode = BLDMTRX_MODE_LIST_BUILDS;
@@ -638,6 +745,12 @@ struct buildmatrix_context *setup(int argc, char **argv)
       handled = 1;
      }
 
+     if(strcmp(argv[current_arg], "convert") == 0)
+     {
+      ctx->mode = BLDMTRX_MODE_CONVERT;
+      handled = 1;
+     }
+
      if(strcmp(argv[current_arg], "serve") == 0)
      {
       ctx->error_prefix = "build matrix server";
@@ -720,6 +833,18 @@ struct buildmatrix_context *setup(int argc, char **argv)
       handled = 1;
      }
 
+     if(strcmp(argv[current_arg], "prune") == 0)
+     {
+      ctx->mode = BLDMTRX_MODE_PRUNE;
+      handled = 1;
+     }
+
+     if(strcmp(argv[current_arg], "archive") == 0)
+     {
+      ctx->mode = BLDMTRX_MODE_ARCHIVE;
+      handled = 1;
+     }
+
      if(handled == 0)
      {
       fprintf(stderr, "%s: unknown mode, '%s'\n", ctx->error_prefix, argv[current_arg]);
@@ -749,11 +874,24 @@ struct buildmatrix_context *setup(int argc, char **argv)
   }
  }
 
+ if(ctx->mode == BLDMTRX_MODE_TEST_DIFF)
+ {
+  if(ctx->other_identifier == NULL)
+  {
+   fprintf(stderr, "%s: must specify two unique identifers for a test diff operation\n",
+           ctx->error_prefix);
+   return NULL;
+  }
+ }
+
  if(ctx->mode == BLDMTRX_MODE_SCRATCH)
  {
-  if(ctx->unique_identifier == NULL)
+  if( (ctx->unique_identifier == NULL) &&
+      (ctx->job_name == NULL) && (ctx->branch_name == NULL) &&
+      (ctx->build_node == NULL) && (ctx->submitter == NULL) &&
+      (ctx->since_time == 0) && (ctx->until_time == 0) )
   {  
-   fprintf(stderr, "%s: must specify a unique identifer for a get scratch operation\n",
+   fprintf(stderr, "%s: must specify a unique identifer or a filter for a scratch operation\n",
            ctx->error_prefix);
    return NULL;
   }
@@ -776,7 +914,9 @@ struct buildmatrix_context *setup(int argc, char **argv)
   }
  }
 
- if(ctx->test_results_file != NULL)
+ /* a streamed submit parses the file while sending it, see stream_test_results() */
+ if( (ctx->test_results_file != NULL) &&
+     ((ctx->stream_test_results == 0) || (ctx->mode != BLDMTRX_MODE_SUBMIT)) )
  {
   if(load_test_results(ctx, ctx->test_results_file, &(ctx->test_results)))
   {
@@ -856,6 +996,12 @@ int clean_state(struct buildmatrix_context *ctx)
   ctx->build_node = NULL;
  }
 
+ if(ctx->submitter != NULL)
+ {
+  free(ctx->submitter);
+  ctx->submitter = NULL;
+ }
+
  if(ctx->unique_identifier != NULL)
  {
   free(ctx->unique_identifier);
@@ -897,9 +1043,16 @@ int clean_state(struct buildmatrix_context *ctx)
   free(ctx->test_results);
   ctx->test_results = NULL;
  }
+ ctx->test_results_streamed = 0;
 
  ctx->build_id = -1;
  ctx->user_id = -1;
+ ctx->since_time = 0;
+ ctx->until_time = 0;
+ ctx->artifact_codec = BLDMTRX_CODEC_NONE;
+ ctx->checksum_size = -1;
+ ctx->report_size = -1;
+ ctx->output_size = -1;
  return 0;
 }
 
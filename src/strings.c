@@ -23,31 +23,90 @@
 
 int check_string(struct buildmatrix_context *ctx, char *string)
 {
- int x = 0;
+ int x;
 
  if(string == NULL)
   return 0;
 
- while(string[x] != 0)
+ if((x = scan_for_invalid(string)) == -1)
+  return 0;
+
+ if(string[x] == '|')
  {
-  if(string[x] == '|')
-  {
-   fprintf(stderr, "%s: input string \"%s\" can not include \"|\" characters.\n", 
-           ctx->error_prefix, string);
-   return 1;
-  }
+  fprintf(stderr, "%s: input string \"%s\" can not include \"|\" characters.\n", 
+          ctx->error_prefix, string);
+  return 1;
+ }
 
-  if(string[x] == ' ')
-  {
-   fprintf(stderr, "%s: input string \"%s\" can not include spaces.\n", 
-           ctx->error_prefix, string);
-   return 1;
-  }
+ fprintf(stderr, "%s: input string \"%s\" can not include spaces.\n", 
+         ctx->error_prefix, string);
+ return 1;
+}
+
+/* The parsers find their delimiters through these rather than stepping a byte at a time.
+   memchr() and strcspn() are vectorized in the C library, which picks SSE2 or AVX2 versions
+   for the running CPU itself. */
+
+/* offset of the first c in the length bytes at buffer, or -1 */
+int scan_for_byte(const char *buffer, int length, char c)
+{
+ const char *found;
+
+ if(length < 1)
+  return -1;
 
-  x++;
+ if((found = memchr(buffer, c, length)) == NULL)
+  return -1;
+
+ return found - buffer;
+}
+
+/* length of the line at buffer, up to the first newline or 0 byte, or length if neither */
+size_t scan_line(const char *buffer, size_t length)
+{
+ const char *found;
+
+ if((found = memchr(buffer, '\n', length)) != NULL)
+  length = found - buffer;
+
+ if((found = memchr(buffer, 0, length)) != NULL)
+  length = found - buffer;
+
+ return length;
+}
+
+/* offset of the first copy of the needle_length bytes at needle in the length bytes at
+   buffer, or -1 */
+long scan_for_string(const char *buffer, size_t length, const char *needle, size_t needle_length)
+{
+ const char *found, *end;
+
+ if( (needle_length == 0) || (length < needle_length) )
+  return -1;
+
+ end = buffer + length - needle_length + 1;
+ found = buffer;
+ while((found = memchr(found, needle[0], end - found)) != NULL)
+ {
+  if(memcmp(found, needle, needle_length) == 0)
+   return found - buffer;
+  found++;
  }
 
- return 0;
+ return -1;
+}
+
+/* offset of the first '|' or space in a terminated string, or -1, see check_string() */
+int scan_for_invalid(const char *string)
+{
+ size_t x;
+
+ x = strcspn(string, "| ");
+
+ if(string[x] == 0)
+  return -1;
+
+ return x;
 }
 
 int add_to_string_array(char ***array, int array_size, 
@@ -139,3 +198,192 @@ int file_size_to_string(unsigned long long int file_size, char *string, int size
 }
 
 
+
+int string_to_time(struct buildmatrix_context *ctx, const char *string, long long int *value)
+{
+ struct tm t;
+ int n = 0;
+
+ /* either seconds since the epoch, or a YYYY-MM-DD date in local time */
+ memset(&t, 0, sizeof(struct tm));
+ if( (sscanf(string, "%d-%d-%d%n", &(t.tm_year), &(t.tm_mon), &(t.tm_mday), &n) == 3) &&
+     (string[n] == 0) )
+ {
+  t.tm_year -= 1900;
+  t.tm_mon -= 1;
+  t.tm_isdst = -1;
+  *value = (long long int) mktime(&t);
+  if(*value == -1)
+  {
+   fprintf(stderr, "%s: \"%s\" is not a valid date\n", ctx->error_prefix, string);
+   return 1;
+  }
+  return 0;
+ }
+
+ if( (sscanf(string, "%lld%n", value, &n) == 1) && (string[n] == 0) )
+  return 0;
+
+ fprintf(stderr, "%s: \"%s\" is neither a YYYY-MM-DD date nor a unix time\n",
+         ctx->error_prefix, string);
+ return 1;
+}
+
+int arena_reserve(struct arena *a, size_t length, size_t *offset)
+{
+ size_t new_size;
+ char *new_base;
+
+ if(a->used + length > a->size)
+ {
+  new_size = (a->size == 0) ? 4096 : a->size;
+  while(new_size < a->used + length)
+   new_size *= 2;
+
+  if((new_base = realloc(a->base, new_size)) == NULL)
+   return 1;
+
+  a->base = new_base;
+  a->size = new_size;
+ }
+
+ *offset = a->used;
+ a->used += length;
+ return 0;
+}
+
+int arena_append_string(struct arena *a, const char *string, size_t *offset)
+{
+ size_t length = strlen(string) + 1;
+
+ if(arena_reserve(a, length, offset))
+  return 1;
+
+ memcpy(a->base + *offset, string, length);
+ return 0;
+}
+
+void arena_free(struct arena *a)
+{
+ if(a->base != NULL)
+  free(a->base);
+
+ a->base = NULL;
+ a->size = 0;
+ a->used = 0;
+}
+
+/* FNV-1a */
+unsigned int hash_string(const char *string)
+{
+ unsigned int hash = 2166136261u;
+
+ while(*string != 0)
+ {
+  hash ^= (unsigned char) *string++;
+  hash *= 16777619u;
+ }
+
+ return hash;
+}
+
+/* the index doesn't copy keys, they have to outlive it */
+int string_index_create(struct string_index *index, int expected)
+{
+ int i;
+
+ index->n_slots = 16;
+ while(index->n_slots < expected * 2)
+  index->n_slots *= 2;
+
+ index->n_entries = 0;
+ index->ids = NULL;
+
+ if( ((index->keys = (const char **) malloc(sizeof(char *) * index->n_slots)) == NULL) ||
+     ((index->ids = (int *) malloc(sizeof(int) * index->n_slots)) == NULL) )
+ {
+  if(index->keys != NULL)
+   free(index->keys);
+  index->keys = NULL;
+  index->ids = NULL;
+  return 1;
+ }
+
+ for(i=0; i<index->n_slots; i++)
+  index->keys[i] = NULL;
+
+ return 0;
+}
+
+/* -1 if key is not in the index */
+int string_index_lookup(const struct string_index *index, const char *key)
+{
+ unsigned int slot;
+
+ slot = hash_string(key) & (index->n_slots - 1);
+
+ while(index->keys[slot] != NULL)
+ {
+  if(strcmp(index->keys[slot], key) == 0)
+   return index->ids[slot];
+
+  slot = (slot + 1) & (index->n_slots - 1);
+ }
+
+ return -1;
+}
+
+int string_index_insert(struct string_index *index, const char *key, int id)
+{
+ struct string_index bigger;
+ unsigned int slot;
+ int i;
+
+ /* keep it at most half full */
+ if((index->n_entries + 1) * 2 > index->n_slots)
+ {
+  if(string_index_create(&bigger, index->n_slots))
+   return 1;
+
+  for(i=0; i<index->n_slots; i++)
+  {
+   if(index->keys[i] != NULL)
+    string_index_insert(&bigger, index->keys[i], index->ids[i]);
+  }
+
+  string_index_free(index);
+  *index = bigger;
+ }
+
+ slot = hash_string(key) & (index->n_slots - 1);
+
+ while(index->keys[slot] != NULL)
+ {
+  if(strcmp(index->keys[slot], key) == 0)
+  {
+   index->ids[slot] = id;
+   return 0;
+  }
+
+  slot = (slot + 1) & (index->n_slots - 1);
+ }
+
+ index->keys[slot] = key;
+ index->ids[slot] = id;
+ index->n_entries++;
+ return 0;
+}
+
+void string_index_free(struct string_index *index)
+{
+ if(index->keys != NULL)
+  free(index->keys);
+
+ if(index->ids != NULL)
+  free(index->ids);
+
+ index->keys = NULL;
+ index->ids = NULL;
+ index->n_slots = 0;
+ index->n_entries = 0;
+}
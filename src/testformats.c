@@ -0,0 +1,702 @@
+/*
+    Copyright 2013 Stover Enterprises, LLC (An Alabama Limited Liability Corporation)
+    Written by C. Thomas Stover
+
+    This file is part of the program Build Matrix.
+    See http://buildmatrix.stoverenterprises.com for more information.
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "prototypes.h"
+#include <ctype.h>
+#include <strings.h>
+
+/* Test results files are read one suite or test at a time through a test_results_reader, so
+   load_test_results() and stream_test_results() take JUnit XML and TAP as well as the text
+   format. Neither of those is ever built up in memory: the XML is scanned tag to tag, and
+   everything outside the few elements that matter is skipped with memchr().
+   Names from other tools may have spaces or '|' in them, these become '_'. */
+
+/* which kind of test results file this is, the binary form is checked for separately */
+int test_results_format(const char *contents, size_t filesize)
+{
+ size_t i = 0;
+
+ /* UTF-8 byte order mark */
+ if( (filesize >= 3) && (memcmp(contents, "\xef\xbb\xbf", 3) == 0) )
+  i = 3;
+
+ while( (i < filesize) &&
+        ((contents[i] == ' ') || (contents[i] == '\t') ||
+         (contents[i] == '\r') || (contents[i] == '\n')) )
+  i++;
+
+ if( (i < filesize) && (contents[i] == '<') )
+  return TEST_RESULTS_FORMAT_JUNIT;
+
+ if( ((filesize - i >= 12) && (strncmp(contents + i, "TAP version ", 12) == 0)) ||
+     ((filesize - i >= 3) && (strncmp(contents + i, "1..", 3) == 0)) ||
+     ((filesize - i >= 2) && (strncmp(contents + i, "ok", 2) == 0)) ||
+     ((filesize - i >= 6) && (strncmp(contents + i, "not ok", 6) == 0)) )
+  return TEST_RESULTS_FORMAT_TAP;
+
+ return TEST_RESULTS_FORMAT_TEXT;
+}
+
+void open_test_results_reader(struct test_results_reader *reader, const char *filename,
+                              const char *contents, size_t filesize)
+{
+ memset(reader, 0, sizeof(struct test_results_reader));
+ reader->filename = filename;
+ reader->contents = contents;
+ reader->filesize = filesize;
+ reader->format = test_results_format(contents, filesize);
+}
+
+/* line number of the record last returned, for messages. Only the text and TAP readers go
+   line by line, so for JUnit XML the lines are counted here, when something went wrong. */
+int test_results_reader_line(const struct test_results_reader *reader)
+{
+ const char *p, *end;
+ int line_number = 1;
+
+ if(reader->format != TEST_RESULTS_FORMAT_JUNIT)
+  return reader->line_number;
+
+ p = reader->contents;
+ end = reader->contents + reader->record;
+ while( (p < end) && ((p = memchr(p, '\n', end - p)) != NULL) )
+ {
+  line_number++;
+  p++;
+ }
+
+ return line_number;
+}
+
+/* Hands back the next suite or test. parsed->kind is 1 for a suite, 2 for a test, and 0 once
+   the results are over. Names and data point into the file or into the reader, and only
+   last until the next call. */
+int read_test_results_record(struct buildmatrix_context *ctx, struct test_results_reader *reader,
+                             const char *suite_name, struct test_results_line *parsed)
+{
+ int line_length;
+
+ if(reader->format == TEST_RESULTS_FORMAT_JUNIT)
+  return read_junit_record(ctx, reader, parsed);
+
+ if(reader->format == TEST_RESULTS_FORMAT_TAP)
+  return read_tap_record(ctx, reader, parsed);
+
+ parsed->kind = 0;
+
+ if(reader->index >= reader->filesize)
+  return 0;
+
+ reader->record = reader->index;
+ reader->line_number++;
+
+ line_length = scan_line(reader->contents + reader->index, reader->filesize - reader->index);
+ reader->index += line_length + 1;
+
+ return parse_test_results_line(ctx, reader->filename, reader->line_number,
+                                reader->contents + reader->record, line_length,
+                                suite_name, parsed);
+}
+
+/* Copies an imported name or data string to out, which holds size bytes, terminated. With
+   IMPORT_XML entities are decoded, and with IMPORT_NAME spaces and '|' become '_'. Control
+   characters never get through, they would break a line of the text format. Returns the
+   length, or -1 if it didn't all fit; out then has as much as did. */
+int import_string(char *out, int size, const char *in, int length, int flags)
+{
+ int i, j = 0, end, code, digits, hex;
+ char c;
+
+ for(i=0; i<length; i++)
+ {
+  if(j == size - 1)
+  {
+   out[j] = 0;
+   return -1;
+  }
+
+  c = in[i];
+
+  if( (flags & IMPORT_XML) && (c == '&') &&
+      ((end = scan_for_byte(in + i, (length - i < 12) ? length - i : 12, ';')) != -1) )
+  {
+   code = -1;
+
+   if( (end == 3) && (strncmp(in + i, "&lt;", 4) == 0) )
+    code = '<';
+   else if( (end == 3) && (strncmp(in + i, "&gt;", 4) == 0) )
+    code = '>';
+   else if( (end == 4) && (strncmp(in + i, "&amp;", 5) == 0) )
+    code = '&';
+   else if( (end == 5) && (strncmp(in + i, "&quot;", 6) == 0) )
+    code = '"';
+   else if( (end == 5) && (strncmp(in + i, "&apos;", 6) == 0) )
+    code = '\'';
+   else if( (end > 2) && (in[i + 1] == '#') ) {
+    /* &#nnn; or &#xhh; */
+    hex = ( (in[i + 2] == 'x') || (in[i + 2] == 'X') );
+    code = (end > 2 + hex) ? 0 : -1;
+    for(digits = i + 2 + hex; (code != -1) && (digits < i + end); digits++)
+    {
+     c = tolower((unsigned char) in[digits]);
+     if(isdigit((unsigned char) c))
+      code = (code * (hex ? 16 : 10)) + (c - '0');
+     else if( (hex) && (c >= 'a') && (c <= 'f') )
+      code = (code * 16) + (c - 'a' + 10);
+     else
+      code = -1;
+
+     if(code > 0x10ffff)
+      code = -1;
+    }
+    c = in[i];
+   }
+
+   if(code > 0x7f)
+   {
+    /* UTF-8, never longer than the reference it came from */
+    if(j + 4 >= size)
+    {
+     out[j] = 0;
+     return -1;
+    }
+
+    if(code < 0x800)
+    {
+     out[j++] = 0xc0 | (code >> 6);
+    } else if(code < 0x10000) {
+     out[j++] = 0xe0 | (code >> 12);
+     out[j++] = 0x80 | ((code >> 6) & 0x3f);
+    } else {
+     out[j++] = 0xf0 | (code >> 18);
+     out[j++] = 0x80 | ((code >> 12) & 0x3f);
+     out[j++] = 0x80 | ((code >> 6) & 0x3f);
+    }
+    out[j++] = 0x80 | (code & 0x3f);
+    i += end;
+    continue;
+   }
+
+   if(code != -1)
+   {
+    c = (char) code;
+    i += end;
+   }
+  }
+
+  if( ((unsigned char) c < 0x20) || (c == 0x7f) )
+   c = ' ';
+
+  if( (flags & IMPORT_NAME) && ((c == ' ') || (c == '|')) )
+   c = '_';
+
+  out[j++] = c;
+ }
+
+ out[j] = 0;
+ return j;
+}
+
+/* The value of attribute in the tag_length bytes of an XML tag, which start with the element
+   name. Returns 1 if the tag doesn't have it. */
+int find_xml_attribute(const char *tag, int tag_length, const char *attribute,
+                       const char **value, int *value_length)
+{
+ int i = 0, name, name_length, end, attribute_length;
+ char quote;
+
+ attribute_length = strlen(attribute);
+
+ while( (i < tag_length) && (isspace((unsigned char) tag[i]) == 0) )
+  i++;
+
+ while(i < tag_length)
+ {
+  while( (i < tag_length) && (isspace((unsigned char) tag[i])) )
+   i++;
+
+  name = i;
+  while( (i < tag_length) && (tag[i] != '=') && (tag[i] != '/') &&
+         (isspace((unsigned char) tag[i]) == 0) )
+   i++;
+  name_length = i - name;
+
+  while( (i < tag_length) && (isspace((unsigned char) tag[i])) )
+   i++;
+
+  if( (i >= tag_length) || (tag[i] != '=') )
+  {
+   if(name_length == 0)
+    i++;
+   continue;
+  }
+
+  i++;
+  while( (i < tag_length) && (isspace((unsigned char) tag[i])) )
+   i++;
+
+  if( (i >= tag_length) || ((tag[i] != '"') && (tag[i] != '\'')) )
+   return 1;
+
+  quote = tag[i++];
+  if((end = scan_for_byte(tag + i, tag_length - i, quote)) == -1)
+   return 1;
+
+  if( (name_length == attribute_length) && (strncmp(tag + name, attribute, name_length) == 0) )
+  {
+   *value = tag + i;
+   *value_length = end;
+   return 0;
+  }
+
+  i += end + 1;
+ }
+
+ return 1;
+}
+
+/* Hands out the test that has been put together in the reader. If its suite, the candidate,
+   isn't the one tests are going to, that suite comes out first, and the test on the next
+   call. */
+int next_imported_record(struct test_results_reader *reader, struct test_results_line *parsed)
+{
+ if( (reader->have_suite == 0) || (reader->suite_length != reader->candidate_length) ||
+     (memcmp(reader->suite, reader->candidate, reader->candidate_length) != 0) )
+ {
+  memcpy(reader->suite, reader->candidate, reader->candidate_length + 1);
+  reader->suite_length = reader->candidate_length;
+  reader->have_suite = 1;
+  reader->pending = 1;
+
+  parsed->kind = 1;
+  parsed->name = reader->suite;
+  parsed->name_length = reader->suite_length;
+  return 0;
+ }
+
+ reader->pending = 0;
+ parsed->kind = 2;
+ parsed->name = reader->test;
+ parsed->name_length = reader->test_length;
+ parsed->result = reader->result;
+ parsed->has_data = reader->has_data;
+ parsed->data = reader->data;
+ parsed->data_length = reader->data_length;
+ return 0;
+}
+
+/* JUnit XML. A test's suite is the classname of its testcase, or failing that the name of the
+   innermost testsuite around it. A testcase passed unless it has a failure or error in it, and
+   one with only skipped in it is incomplete; the message of that element is the test's data. */
+int read_junit_record(struct buildmatrix_context *ctx, struct test_results_reader *reader,
+                      struct test_results_line *parsed)
+{
+ const char *p, *end, *tag, *found, *value;
+ size_t remaining;
+ long x;
+ int tag_length, element_length, closing, self_closing, value_length, length;
+ char quote, *suite;
+
+ tag = NULL;
+ tag_length = 0;
+ closing = 0;
+ self_closing = 0;
+
+ parsed->kind = 0;
+
+ if(reader->pending)
+  return next_imported_record(reader, parsed);
+
+ while(reader->index < reader->filesize)
+ {
+  remaining = reader->filesize - reader->index;
+  if((p = memchr(reader->contents + reader->index, '<', remaining)) == NULL)
+   break;
+
+  reader->record = p - reader->contents;
+  remaining = reader->filesize - reader->record;
+
+  /* comments, CDATA, the declaration and the like, none of which can hold a test */
+  end = NULL;
+  if( (remaining >= 4) && (strncmp(p, "<!--", 4) == 0) )
+  {
+   if((x = scan_for_string(p + 4, remaining - 4, "-->", 3)) != -1)
+    end = p + 4 + x + 3;
+  } else if( (remaining >= 9) && (strncmp(p, "<![CDATA[", 9) == 0) ) {
+   if((x = scan_for_string(p + 9, remaining - 9, "]]>", 3)) != -1)
+    end = p + 9 + x + 3;
+  } else if( (remaining >= 2) && (strncmp(p, "<?", 2) == 0) ) {
+   if((x = scan_for_string(p + 2, remaining - 2, "?>", 2)) != -1)
+    end = p + 2 + x + 2;
+  } else if( (remaining >= 2) && (strncmp(p, "<!", 2) == 0) ) {
+   if((found = memchr(p + 2, '>', remaining - 2)) != NULL)
+    end = found + 1;
+  } else {
+   /* an element tag, where a '>' inside a quoted attribute value doesn't end it */
+   quote = 0;
+   for(found = p + 1; found < reader->contents + reader->filesize; found++)
+   {
+    if(quote)
+    {
+     if(*found == quote)
+      quote = 0;
+    } else if( (*found == '"') || (*found == '\'') ) {
+     quote = *found;
+    } else if(*found == '>') {
+     break;
+    }
+   }
+
+   if(found < reader->contents + reader->filesize)
+   {
+    closing = (p[1] == '/');
+    tag = p + 1 + closing;
+    tag_length = found - tag;
+    self_closing = ( (closing == 0) && (tag_length > 0) && (tag[tag_length - 1] == '/') );
+    if(self_closing)
+     tag_length--;
+    end = found + 1;
+   }
+  }
+
+  if(end == NULL)
+  {
+   fprintf(stderr, "%s: file %s, line %d: XML markup is not closed\n",
+           ctx->error_prefix, reader->filename, test_results_reader_line(reader));
+   return 1;
+  }
+
+  reader->index = end - reader->contents;
+
+  if(tag == NULL)
+   continue;
+
+  element_length = 0;
+  while( (element_length < tag_length) && (tag[element_length] != '/') &&
+         (isspace((unsigned char) tag[element_length]) == 0) )
+   element_length++;
+
+  if( (element_length == 9) && (strncmp(tag, "testsuite", 9) == 0) )
+  {
+   if(closing)
+   {
+    if(reader->depth > 0)
+     reader->depth--;
+    continue;
+   }
+
+   if(self_closing)
+    continue;
+
+   if(reader->depth == JUNIT_MAX_DEPTH)
+   {
+    fprintf(stderr, "%s: file %s, line %d: testsuite elements are nested more than %d deep\n",
+            ctx->error_prefix, reader->filename, test_results_reader_line(reader),
+            JUNIT_MAX_DEPTH);
+    return 1;
+   }
+
+   if(find_xml_attribute(tag, tag_length, "name", &value, &value_length))
+   {
+    value = NULL;
+    value_length = 0;
+   }
+   reader->suite_names[reader->depth] = value;
+   reader->suite_name_lengths[reader->depth] = value_length;
+   reader->depth++;
+   continue;
+  }
+
+  if( (element_length == 8) && (strncmp(tag, "testcase", 8) == 0) )
+  {
+   if(closing)
+   {
+    if(reader->in_testcase == 0)
+     continue;
+
+    reader->in_testcase = 0;
+    return next_imported_record(reader, parsed);
+   }
+
+   if(reader->in_testcase)
+   {
+    fprintf(stderr, "%s: file %s, line %d: testcase inside a testcase\n",
+            ctx->error_prefix, reader->filename, test_results_reader_line(reader));
+    return 1;
+   }
+
+   if(find_xml_attribute(tag, tag_length, "name", &value, &value_length))
+   {
+    fprintf(stderr, "%s: file %s, line %d: testcase has no name\n",
+            ctx->error_prefix, reader->filename, test_results_reader_line(reader));
+    return 1;
+   }
+
+   length = import_string(reader->test, 257, value, value_length, IMPORT_XML | IMPORT_NAME);
+   if(length == -1)
+   {
+    fprintf(stderr, "%s: file %s, line %d: test name length is limited to 256 bytes\n",
+            ctx->error_prefix, reader->filename, test_results_reader_line(reader));
+    return 1;
+   }
+   reader->test_length = length;
+
+   if( (find_xml_attribute(tag, tag_length, "classname", &value, &value_length)) ||
+       (value_length == 0) )
+   {
+    value = NULL;
+    if(reader->depth > 0)
+    {
+     value = reader->suite_names[reader->depth - 1];
+     value_length = reader->suite_name_lengths[reader->depth - 1];
+    }
+   }
+
+   suite = reader->candidate;
+   if( (value == NULL) || (value_length == 0) )
+    length = import_string(suite, 513, "testsuite", 9, 0);
+   else
+    length = import_string(suite, 513, value, value_length, IMPORT_XML | IMPORT_NAME);
+
+   if(length == -1)
+   {
+    fprintf(stderr, "%s: file %s, line %d: suite name length is limited to 512 bytes\n",
+            ctx->error_prefix, reader->filename, test_results_reader_line(reader));
+    return 1;
+   }
+   reader->candidate_length = length;
+
+   if( (reader->test_length == 0) || (reader->candidate_length == 0) )
+   {
+    fprintf(stderr, "%s: file %s, line %d: testcase with an empty name\n",
+            ctx->error_prefix, reader->filename, test_results_reader_line(reader));
+    return 1;
+   }
+
+   reader->result = 1;
+   reader->has_data = 0;
+   reader->data_length = 0;
+
+   if(self_closing)
+    return next_imported_record(reader, parsed);
+
+   reader->in_testcase = 1;
+   continue;
+  }
+
+  if( (closing) || (reader->in_testcase == 0) )
+   continue;
+
+  if( ((element_length == 7) && (strncmp(tag, "failure", 7) == 0)) ||
+      ((element_length == 5) && (strncmp(tag, "error", 5) == 0)) )
+  {
+   reader->result = 2;
+  } else if( (element_length == 7) && (strncmp(tag, "skipped", 7) == 0) ) {
+   if(reader->result != 1)
+    continue;
+   reader->result = 3;
+  } else {
+   continue;
+  }
+
+  if( (find_xml_attribute(tag, tag_length, "message", &value, &value_length) == 0) ||
+      (find_xml_attribute(tag, tag_length, "type", &value, &value_length) == 0) )
+  {
+   /* data is only informational, so a long message is cut off rather than refused */
+   if((length = import_string(reader->data, TEST_DATA_LIMIT + 1, value, value_length, IMPORT_XML)) == -1)
+    length = TEST_DATA_LIMIT;
+   reader->data_length = length;
+   reader->has_data = 1;
+  } else {
+   reader->data_length = 0;
+   reader->has_data = 0;
+  }
+ }
+
+ if(reader->in_testcase)
+ {
+  fprintf(stderr, "%s: file %s, line %d: file ends inside a testcase\n",
+          ctx->error_prefix, reader->filename, test_results_reader_line(reader));
+  return 1;
+ }
+
+ return 0;
+}
+
+/* TAP. It has no suites, so the tests all go in one named after the file. A test's name is
+   its description, or its number when it has none. "# SKIP" and "# TODO" tests are
+   incomplete, with the reason as data. Indented lines, subtests and YAML blocks, are passed
+   over, as are plans, comments and anything else that isn't a test line. */
+int read_tap_record(struct buildmatrix_context *ctx, struct test_results_reader *reader,
+                    struct test_results_line *parsed)
+{
+ const char *line, *name, *base;
+ int line_length, i, ok, number, number_length, description, description_end, hash,
+     reason, length;
+
+ parsed->kind = 0;
+
+ if(reader->pending)
+  return next_imported_record(reader, parsed);
+
+ while(reader->index < reader->filesize)
+ {
+  reader->record = reader->index;
+  reader->line_number++;
+  line = reader->contents + reader->index;
+  line_length = scan_line(line, reader->filesize - reader->index);
+  reader->index += line_length + 1;
+
+  if( (line_length > 0) && (line[line_length - 1] == '\r') )
+   line_length--;
+
+  if( (line_length >= 9) && (strncmp(line, "Bail out!", 9) == 0) )
+  {
+   fprintf(stderr, "%s: file %s, line %d: the test run bailed out, \"%.*s\"\n",
+           ctx->error_prefix, reader->filename, reader->line_number, line_length, line);
+   return 1;
+  }
+
+  if( (line_length >= 6) && (strncmp(line, "not ok", 6) == 0) )
+  {
+   ok = 0;
+   i = 6;
+  } else if( (line_length >= 2) && (strncmp(line, "ok", 2) == 0) ) {
+   ok = 1;
+   i = 2;
+  } else {
+   continue;
+  }
+
+  if( (i < line_length) && (line[i] != ' ') && (line[i] != '\t') && (line[i] != '#') )
+   continue;
+
+  while( (i < line_length) && ((line[i] == ' ') || (line[i] == '\t')) )
+   i++;
+
+  number = i;
+  while( (i < line_length) && (isdigit((unsigned char) line[i])) )
+   i++;
+  number_length = i - number;
+
+  while( (i < line_length) && ((line[i] == ' ') || (line[i] == '\t')) )
+   i++;
+
+  if( (i < line_length) && (line[i] == '-') )
+  {
+   i++;
+   while( (i < line_length) && ((line[i] == ' ') || (line[i] == '\t')) )
+    i++;
+  }
+
+  /* the directive starts at the first '#' that isn't escaped */
+  description = i;
+  hash = -1;
+  while( (i < line_length) && ((hash = scan_for_byte(line + i, line_length - i, '#')) != -1) )
+  {
+   hash += i;
+   if( (hash == 0) || (line[hash - 1] != '\\') )
+    break;
+   i = hash + 1;
+   hash = -1;
+  }
+
+  description_end = (hash == -1) ? line_length : hash;
+  while( (description_end > description) &&
+         ((line[description_end - 1] == ' ') || (line[description_end - 1] == '\t')) )
+   description_end--;
+
+  reader->result = ok ? 1 : 2;
+  reader->has_data = 0;
+  reader->data_length = 0;
+
+  if(hash != -1)
+  {
+   reason = hash + 1;
+   while( (reason < line_length) && ((line[reason] == ' ') || (line[reason] == '\t')) )
+    reason++;
+
+   if( (line_length - reason >= 4) &&
+       ((strncasecmp(line + reason, "skip", 4) == 0) ||
+        (strncasecmp(line + reason, "todo", 4) == 0)) )
+   {
+    reader->result = 3;
+
+    while( (reason < line_length) && (isalpha((unsigned char) line[reason])) )
+     reason++;
+    while( (reason < line_length) && ((line[reason] == ' ') || (line[reason] == '\t')) )
+     reason++;
+
+    if(reason < line_length)
+    {
+     if((length = import_string(reader->data, TEST_DATA_LIMIT + 1, line + reason,
+                                line_length - reason, 0)) == -1)
+      length = TEST_DATA_LIMIT;
+     reader->data_length = length;
+     reader->has_data = 1;
+    }
+   }
+  }
+
+  if(description_end > description)
+  {
+   name = line + description;
+   length = description_end - description;
+  } else if(number_length > 0) {
+   name = line + number;
+   length = number_length;
+  } else {
+   fprintf(stderr, "%s: file %s, line %d: test has neither a number nor a description\n",
+           ctx->error_prefix, reader->filename, reader->line_number);
+   return 1;
+  }
+
+  if((length = import_string(reader->test, 257, name, length, IMPORT_NAME)) == -1)
+  {
+   fprintf(stderr, "%s: file %s, line %d: test name length is limited to 256 bytes\n",
+           ctx->error_prefix, reader->filename, reader->line_number);
+   return 1;
+  }
+  reader->test_length = length;
+
+  if(reader->have_suite == 0)
+  {
+   /* the file name, less any directory and extension */
+   if((base = strrchr(reader->filename, '/')) == NULL)
+    base = reader->filename;
+   else
+    base++;
+
+   if( ((name = strrchr(base, '.')) == NULL) || (name == base) )
+    name = base + strlen(base);
+
+   if(name == base)
+    length = import_string(reader->candidate, 513, "tap", 3, 0);
+   else if((length = import_string(reader->candidate, 513, base, name - base, IMPORT_NAME)) == -1)
+    length = 512;
+   reader->candidate_length = length;
+  }
+
+  return next_imported_record(reader, parsed);
+ }
+
+ return 0;
+}
@@ -21,320 +21,376 @@
 
 #include "prototypes.h"
 
+/* One pass over the file. Suites and tests are accumulated like pull_test_results() does, and
+   duplicates are found with hashes of the names instead of rescanning every name seen so far.
+   Every stored name or data string is shorter than the line or tag it came from, so a string
+   space of the file's size never moves, and the indexes can point straight into it. The file
+   is normally mapped rather than read, see map_disk_file(), and may also be JUnit XML or TAP,
+   see read_test_results_record(). */
 int load_test_results(struct buildmatrix_context *ctx, char *filename,
                       struct test_results **results)
 {
- char *file_ctxtents, *suite_name;
- struct test_results *r;
- struct test *t;
- struct suite *s, *suites;
- int n_suites = 0, n_tests = 0, line_length, line_number, handled, code, pass = 1;
- size_t allocation_size = 0, filesize, index;
- char temp[1024];
- int test_names_array_size = 0, mark, markB, result, x;
- char **suite_names_array = NULL, **test_names_array = NULL;
- void *base_ptr = NULL, *tests_base_ptr, *strings_base_ptr; 
+ char *file_ctxtents, *strings, *suite_name = NULL;
+ struct pulled_suite *ps = NULL;
+ struct pulled_test *pt;
+ struct arena suite_arena = { NULL, 0, 0 }, test_arena = { NULL, 0, 0 };
+ struct string_index suite_index, test_index;
+ struct test_results_line parsed;
+ struct test_results_reader reader;
+ size_t filesize, string_space = 0, offset;
+ int n_suites = 0, n_tests = 0, mapped, failed = 0;
 
  if(ctx->verbose > 1)
   fprintf(stderr, "%s: load_test_results()\n", ctx->error_prefix);
  
- if((file_ctxtents = read_disk_file(ctx, filename, &filesize)) == NULL)
+ if((file_ctxtents = map_disk_file(ctx, filename, &filesize, &mapped)) == NULL)
  {
   return 1;
  }
 
- while(pass < 3)
+ if(is_binary_test_results(file_ctxtents, filesize))
  {
-  index = 0;
-  if(pass == 2)
-  {
-   free_string_array(suite_names_array, n_suites);
-   free_string_array(test_names_array, test_names_array_size);
-   suite_names_array = NULL;
-   test_names_array = NULL;
+  failed = load_binary_test_results(ctx, filename, file_ctxtents, filesize, results);
+  release_disk_file(file_ctxtents, filesize, mapped);
+  return failed;
+ }
 
-   allocation_size += sizeof(struct test_results);
+ /* room for the one suite a TAP file's name gives it */
+ if((strings = (char *) malloc(filesize + 1 + 513)) == NULL)
+ {
+  fprintf(stderr, "%s: malloc(%d) failed\n", ctx->error_prefix, (int) filesize + 1 + 513);
+  release_disk_file(file_ctxtents, filesize, mapped);
+  return 1;
+ }
 
-   if((base_ptr = malloc(allocation_size)) == NULL)
-   {
-    fprintf(stderr, "%s: malloc() failed\n", ctx->error_prefix);
-    free(file_ctxtents);
-    return 1;    
-   }
+ if(string_index_create(&suite_index, 16))
+ {
+  fprintf(stderr, "%s: load_test_results(): out of memory\n", ctx->error_prefix);
+  free(strings);
+  release_disk_file(file_ctxtents, filesize, mapped);
+  return 1;
+ }
 
-   r = (struct test_results *) base_ptr;
-   base_ptr += sizeof(struct test_results);
-   r->allocation_size = allocation_size;
-   r->n_suites = n_suites;
-   r->n_tests = test_names_array_size;
+ if(string_index_create(&test_index, 64))
+ {
+  fprintf(stderr, "%s: load_test_results(): out of memory\n", ctx->error_prefix);
+  string_index_free(&suite_index);
+  free(strings);
+  release_disk_file(file_ctxtents, filesize, mapped);
+  return 1;
+ }
 
-   suites = (struct suite *) base_ptr;
-   tests_base_ptr = base_ptr + (sizeof(struct suite) * n_suites);
-   strings_base_ptr = tests_base_ptr + (sizeof(struct test) * test_names_array_size);
-   n_suites = 0;
-   n_tests = 0;
+ open_test_results_reader(&reader, filename, file_ctxtents, filesize);
 
-   r->suites = suites;
-   r->string_space = (base_ptr + allocation_size) - strings_base_ptr;
+ while(failed == 0)
+ {
+  if(read_test_results_record(ctx, &reader, suite_name, &parsed))
+  {
+   failed = 1;
+   break;
   }
 
-  line_number = 0;
-  while(index < filesize)
+  if(parsed.kind == 0)
+   break;
+
+  memcpy(strings + string_space, parsed.name, parsed.name_length);
+  strings[string_space + parsed.name_length] = 0;
+
+  if(parsed.kind == 1)
   {
-   line_length = 0;
-   line_number++;
-   while(1)
+   if(string_index_lookup(&suite_index, strings + string_space) != -1)
    {
-    if(index + line_length == filesize)
-    {
-     line_length--;
-     break;
-    }
-
-    if(file_ctxtents[index + line_length] == '\n')
-     break;
-  
-    line_length++;
+    fprintf(stderr, 
+            "%s: file %s, line %d: suite \"%s\" has already been listed.\n", 
+            ctx->error_prefix, filename, test_results_reader_line(&reader), 
+            strings + string_space);
+    failed = 1;
+    break;
    }
 
-   if(line_length < 9)
+   if(arena_reserve(&suite_arena, sizeof(struct pulled_suite), &offset))
    {
+    failed = 2;
     break;
    }
+   ps = (struct pulled_suite *) suite_arena.base;
+   ps[n_suites].name = string_space;
+   ps[n_suites].first_test = n_tests;
+   ps[n_suites].n_tests = 0;
 
-   handled = 0;
+   suite_name = strings + string_space;
+   string_space += parsed.name_length + 1;
 
-   if(strncmp(file_ctxtents + index, "suite: ", 7) == 0)
+   if(string_index_insert(&suite_index, suite_name, n_suites))
    {
-    memcpy(temp, file_ctxtents + index + 7, line_length - 7);
-    temp[line_length - 7] = 0;
+    failed = 2;
+    break;
+   }
 
-    if(pass == 1)
-    {
-     if(check_string(ctx, temp))
-     {
-      fprintf(stderr, 
-              "%s: file %s, line %d: string validation error\n", 
-             ctx->error_prefix, filename, line_number);
-      free(file_ctxtents);
-      return 1;
-     }
+   n_suites++;
 
-     if((code = add_to_string_array(&suite_names_array, n_suites, 
-                                    temp, line_length - 7, 1)) == -1)
-     {
-      fprintf(stderr, "%s: add_to_string_array() failed\n", 
-             ctx->error_prefix);
-      free(file_ctxtents);
-      return 1;
-     }
+  } else {
 
-     if(code == 0)
-     {
-      suite_name = suite_names_array[n_suites++];
-      allocation_size += sizeof(struct suite);
-      allocation_size += line_length - 6;
-     } else {
-      fprintf(stderr, 
-              "%s: file %s, line %d: suite \"%s\" has already been listed.\n", 
-              ctx->error_prefix, filename, line_number, temp);
-      free(file_ctxtents);
-      return 1;
-     }
-    } else {
-     x=0;
-     s = NULL;
+   /* suites can't repeat, so a test name only collides with one from the current suite */
+   if(string_index_lookup(&test_index, strings + string_space) == n_suites - 1)
+   {
+    fprintf(stderr, 
+            "%s: file %s, line %d: results for test %s.%s were already given\n", 
+           ctx->error_prefix, filename, test_results_reader_line(&reader), 
+           suite_name, strings + string_space);
+    failed = 1;
+    break;
+   }
 
-     while(x<n_suites)
-     {
-      if(strcmp(temp, suites[x].name) == 0)
-       s = &(suites[x]);
-      x++;
-     }
-     if(s == NULL)
-     {
-      s = &(suites[n_suites++]);
-      s->name = (char *) strings_base_ptr;
-      strings_base_ptr += line_length - 6;
-      snprintf(s->name, line_length - 6, "%s", temp);
-      s->n_tests = 0;
-      s->tests = (struct test *) tests_base_ptr;
-     }
+   if(string_index_insert(&test_index, strings + string_space, n_suites - 1))
+   {
+    failed = 2;
+    break;
+   }
 
-    }
-    handled = 1;
+   if(arena_reserve(&test_arena, sizeof(struct pulled_test), &offset))
+   {
+    failed = 2;
+    break;
    }
+   pt = (struct pulled_test *) (test_arena.base + offset);
+   pt->result = parsed.result;
+   pt->name = string_space;
+   string_space += parsed.name_length + 1;
 
-   if(strncmp(file_ctxtents + index, "test: ", 6) == 0)
+   pt->has_data = parsed.has_data;
+   if(pt->has_data)
    {
-    /* test: testname: result[: data] */
-    mark = -1;
-    markB = -1;
-    x = 6;
-    while(x < line_length)
-    {
-     if(file_ctxtents[index + x] == ':')
-     {
-      if(mark == -1)
-      {
-       mark = x;
-      } else {
-       markB = x;
-       break;
-      }
-     }
-     x++;
-    }
-    if(mark == -1)
-    {
-     file_ctxtents[index + line_length] = 0;
-     fprintf(stderr, 
-             "%s: file %s, line %d: expected ':' after test name, \"%s\"\n", 
-            ctx->error_prefix, filename, line_number, file_ctxtents + index);
-     if(base_ptr != NULL)
-      free(base_ptr);
-     free(file_ctxtents);
-     return 1;
-    }
+    pt->data = string_space;
+    memcpy(strings + string_space, parsed.data, parsed.data_length);
+    strings[string_space + parsed.data_length] = 0;
+    string_space += parsed.data_length + 1;
+   }
 
-    if(markB == -1)
-     markB = line_length;
+   ps[n_suites - 1].n_tests++;
+   n_tests++;
+  }
+ }
 
-    if(pass == 1)
-    {
-     x = snprintf(temp, 1024, "%s.", suite_name);
-     memcpy(temp + x, file_ctxtents + index + 6, mark - 6);
-     temp[x + mark - 6] = 0;
+ if(failed == 2)
+  fprintf(stderr, "%s: load_test_results(): out of memory\n", ctx->error_prefix);
 
-     if(check_string(ctx, temp))
-     {
-      fprintf(stderr, 
-              "%s: file %s, line %d: string validation error\n", 
-             ctx->error_prefix, filename, line_number);
-      if(base_ptr != NULL)
-       free(base_ptr);
-      free(file_ctxtents);
-      return 1;
-     }
+ string_index_free(&suite_index);
+ string_index_free(&test_index);
+ release_disk_file(file_ctxtents, filesize, mapped);
 
-     if((code = add_to_string_array(&test_names_array, test_names_array_size, 
-                                    temp, x + mark - 6, 1)) == -1)
-     {
-      fprintf(stderr, "%s: add_to_string_array() failed\n", 
-             ctx->error_prefix);
-      if(base_ptr != NULL)
-       free(base_ptr);
-      free(file_ctxtents);
-       return 1;
-     }
+ if(failed == 0)
+  failed = assemble_test_results(ctx, ps, n_suites, (struct pulled_test *) test_arena.base,
+                                 n_tests, strings, string_space, results);
 
-     if(code == 1)
-     {
-      fprintf(stderr, 
-              "%s: file %s, line %d: results for test %s were already given\n", 
-             ctx->error_prefix, filename, line_number, temp);
-      return 1;
-     }
+ arena_free(&suite_arena);
+ arena_free(&test_arena);
+ free(strings);
 
-     allocation_size += (mark - 6) + 1;
-     allocation_size += line_length - markB;
-     allocation_size += sizeof(struct test);
-     test_names_array_size++;
-    } 
+ if(failed)
+  return 1;
 
-    result = -1;
+ return 0;
+}
 
-    if(strncmp(file_ctxtents + index + mark + 2, "passed", 6) == 0)
-    {
-     result = 1;
-    }
-   
-    if(strncmp(file_ctxtents + index + mark + 2, "failed", 6) == 0)
-    {
-     result = 2;
-    }
+/* Checks one line of a test results file. Names and data are left pointing into the line, since
+   a mapped file isn't terminated, and suite_name is the suite tests are currently going to,
+   or NULL before the first one. parsed->kind is 0 at the line that ends the results. */
+int parse_test_results_line(struct buildmatrix_context *ctx, const char *filename,
+                            int line_number, const char *line, int line_length,
+                            const char *suite_name, struct test_results_line *parsed)
+{
+ char temp[1024];
+ int mark, markB, x;
 
-    if(strncmp(file_ctxtents + index + mark + 2, "incomplete", 10) == 0)
-    {
-     result = 3;
-    }
+ parsed->kind = 0;
 
-    if(result == -1)
-    {
-     file_ctxtents[index + line_length] = 0;
-     fprintf(stderr, 
-             "%s: file %s, line %d: results for test %s not understood, \"%s\"\n", 
-             ctx->error_prefix, filename, line_number, temp, file_ctxtents + index + mark + 2);
+ if(line_length < 9)
+  return 0;
 
-     free(file_ctxtents);
-     return 1;
-    }
+ if(strncmp(line, "suite: ", 7) == 0)
+ {
+  if( (line_length - 7) > 512)
+  {
+   fprintf(stderr, 
+           "%s: file %s, line %d: suite name length is limited to 512 bytes\n", 
+           ctx->error_prefix, filename, line_number);
+   return 1;
+  }
 
-    if( (mark - 6) > 256)
-    {
-     fprintf(stderr, 
-             "%s: file %s, line %d: test name length is limited to 256 bytes\n", 
-             ctx->error_prefix, filename, line_number);
+  memcpy(temp, line + 7, line_length - 7);
+  temp[line_length - 7] = 0;
 
-     free(file_ctxtents);
-     return 1;
-    }
+  if(check_string(ctx, temp))
+  {
+   fprintf(stderr, 
+           "%s: file %s, line %d: string validation error\n", 
+          ctx->error_prefix, filename, line_number);
+   return 1;
+  }
 
-    if( (line_length - markB) > 1024)
-    {
-     fprintf(stderr, 
-             "%s: file %s, line %d: test data is limited to 1024 bytes\n", 
-             ctx->error_prefix, filename, line_number);
+  parsed->kind = 1;
+  parsed->name = line + 7;
+  parsed->name_length = line_length - 7;
+  return 0;
+ }
 
-     free(file_ctxtents);
-     return 1;
-    }
+ if(strncmp(line, "test: ", 6) != 0)
+ {
+  fprintf(stderr, 
+          "%s: file %s, line %d: expecting line to start with \"suite: \", or \"test: \", "
+          "instead of, \"%.9s\"\n", 
+         ctx->error_prefix, filename, line_number, line);
+  return 1;
+ }
 
-    if(pass == 2)
-    {
-     t = &(s->tests[s->n_tests++]);
+ /* test: testname: result[: data] */
+ markB = -1;
+ if((mark = scan_for_byte(line + 6, line_length - 6, ':')) != -1)
+ {
+  mark += 6;
+  if((markB = scan_for_byte(line + mark + 1, line_length - mark - 1, ':')) != -1)
+   markB += mark + 1;
+ }
+ if(mark == -1)
+ {
+  fprintf(stderr, 
+          "%s: file %s, line %d: expected ':' after test name, \"%.*s\"\n", 
+         ctx->error_prefix, filename, line_number, line_length, line);
+  return 1;
+ }
 
-     t->name = (char *) strings_base_ptr;
-     strings_base_ptr += mark + 1 - 6;
-     memcpy(t->name, file_ctxtents + index + 6, mark - 6);
-     t->name[mark - 6] = 0;
-     t->result = result;
+ if(markB == -1)
+  markB = line_length;
 
-     if((line_length - markB) == 0)
-     {
-      t->data = NULL;
-     } else {
-      t->data = (char *) strings_base_ptr;
-      strings_base_ptr += line_length - markB - 1;
-      memcpy(t->data, file_ctxtents + index + markB + 2, line_length - markB);
-      t->data[line_length - markB - 2] = 0;
-     }
-    }
+ if(suite_name == NULL)
+ {
+  fprintf(stderr, 
+          "%s: file %s, line %d: test \"%.*s\" comes before any suite\n", 
+          ctx->error_prefix, filename, line_number, mark - 6, line + 6);
+  return 1;
+ }
 
-    handled = 1;
-   }
+ snprintf(temp, 1024, "%s.%.*s", suite_name, mark - 6, line + 6);
 
-   if(handled == 0)
-   {
-    file_ctxtents[index + 9] = 0;
-    fprintf(stderr, 
-            "%s: file %s, line %d: expecting line to start with \"suite: \", or \"test: \", "
-            "instead of, \"%s\"\n", 
-           ctx->error_prefix, filename, line_number, file_ctxtents + index);
-     if(base_ptr != NULL)
-      free(base_ptr);
-    free(file_ctxtents);
-    return 1;
-   }
+ if(check_string(ctx, temp))
+ {
+  fprintf(stderr, 
+          "%s: file %s, line %d: string validation error\n", 
+         ctx->error_prefix, filename, line_number);
+  return 1;
+ }
+
+ parsed->result = -1;
+ x = line_length - mark - 2;
+
+ if( (x >= 6) && (strncmp(line + mark + 2, "passed", 6) == 0) )
+ {
+  parsed->result = 1;
+ }
   
-   index += line_length + 1;
-  }
+ if( (x >= 6) && (strncmp(line + mark + 2, "failed", 6) == 0) )
+ {
+  parsed->result = 2;
+ }
 
-  pass++;
+ if( (x >= 10) && (strncmp(line + mark + 2, "incomplete", 10) == 0) )
+ {
+  parsed->result = 3;
  }
 
- *results = r;
+ if(parsed->result == -1)
+ {
+  fprintf(stderr, 
+          "%s: file %s, line %d: results for test %s not understood, \"%.*s\"\n", 
+          ctx->error_prefix, filename, line_number, temp, (x > 0) ? x : 0, line + mark + 2);
+  return 1;
+ }
+
+ if( (mark - 6) > 256)
+ {
+  fprintf(stderr, 
+          "%s: file %s, line %d: test name length is limited to 256 bytes\n", 
+          ctx->error_prefix, filename, line_number);
+  return 1;
+ }
+
+ if( (line_length - markB) > TEST_DATA_LIMIT)
+ {
+  fprintf(stderr, 
+          "%s: file %s, line %d: test data is limited to %d bytes\n", 
+          ctx->error_prefix, filename, line_number, TEST_DATA_LIMIT);
+  return 1;
+ }
+
+ parsed->kind = 2;
+ parsed->name = line + 6;
+ parsed->name_length = mark - 6;
+
+ /* data follows the second ": " */
+ parsed->has_data = ((line_length - markB) != 0);
+ parsed->data = line + markB + 2;
+ if((parsed->data_length = line_length - markB - 2) < 0)
+  parsed->data_length = 0;
+
+ return 0;
+}
+
+/* lays the accumulated suites and tests out as the one block struct test_results callers
+   release with a single free(), the same layout receive_test_results() builds */
+int assemble_test_results(struct buildmatrix_context *ctx, struct pulled_suite *ps, int n_suites,
+                          struct pulled_test *pt, int n_tests, const char *strings,
+                          size_t string_space, struct test_results **results)
+{
+ struct test_results *r;
+ struct suite *suites;
+ struct test *tests;
+ size_t allocation_size;
+ char *strings_base_ptr;
+ int i, j;
+
+ allocation_size = sizeof(struct test_results);
+ allocation_size += sizeof(struct suite) * n_suites;
+ allocation_size += sizeof(struct test) * n_tests;
+ allocation_size += string_space;
+
+ if((r = malloc(allocation_size)) == NULL)
+ {
+  fprintf(stderr, "%s: malloc(%d) failed: %s\n",
+          ctx->error_prefix, (int) allocation_size, strerror(errno));
+  return 1;    
+ }
+
+ suites = (struct suite *) (((char *) r) + sizeof(struct test_results));
+ tests = (struct test *) (((char *) suites) + (sizeof(struct suite) * n_suites));
+ strings_base_ptr = ((char *) tests) + (sizeof(struct test) * n_tests);
+ if(string_space > 0)
+  memcpy(strings_base_ptr, strings, string_space);
+
+ r->allocation_size = allocation_size;
+ r->n_suites = n_suites;
+ r->n_tests = n_tests;
+ r->string_space = string_space;
+ r->suites = suites;
+
+ for(i=0; i<n_suites; i++)
+ {
+  suites[i].name = strings_base_ptr + ps[i].name;
+  suites[i].n_tests = ps[i].n_tests;
+  suites[i].tests = &(tests[ps[i].first_test]);
+
+  for(j=ps[i].first_test; j<ps[i].first_test + ps[i].n_tests; j++)
+  {
+   tests[j].result = pt[j].result;
+   tests[j].name = strings_base_ptr + pt[j].name;
+   if(pt[j].has_data)
+    tests[j].data = strings_base_ptr + pt[j].data;
+   else
+    tests[j].data = NULL;
+  }
+ }
 
+ *results = r;
  return 0;
 }
 
@@ -372,7 +428,7 @@ int print_suite_array(struct buildmatrix_context *ctx, struct test_results *resu
 int send_test_results(struct buildmatrix_context *ctx, struct test_results *results)
 {
  int n_bytes, buffer_length, suite_i, test_i;
- char buffer[2048];
+ char buffer[PROTOCOL_LINE_MAX];
 
  if(ctx->verbose > 1)
   fprintf(stderr, "%s: send_test_results()\n", ctx->error_prefix);
@@ -444,7 +500,7 @@ int send_test_results(struct buildmatrix_context *ctx, struct test_results *resu
   for(test_i = 0; test_i < results->suites[suite_i].n_tests; test_i++)
   {
    buffer_length = 
-   snprintf(buffer, 2048, "test|%s|%d|%s\n", 
+   snprintf(buffer, PROTOCOL_LINE_MAX, "test|%s|%d|%s\n", 
             results->suites[suite_i].tests[test_i].name,
             results->suites[suite_i].tests[test_i].result,
             (results->suites[suite_i].tests[test_i].data == NULL) ? "" :
@@ -489,9 +545,9 @@ int send_test_results(struct buildmatrix_context *ctx, struct test_results *resu
 int receive_test_results(struct buildmatrix_context *ctx, struct test_results **results)
 {
  int allocation_size, n_suites, n_tests, string_space, buffer_length, 
-     suite_i, test_i, handled, i, marks[3], n_marks;
+     suite_i, test_i, handled, i, x, marks[3], n_marks;
  struct test_results *r;
- char buffer[2048], temp[8];
+ char buffer[PROTOCOL_LINE_MAX + 1], temp[8];
  struct suite *s;
  struct test *t;
  void *base_ptr, *tests_base_ptr, *strings_base_ptr;
@@ -569,7 +625,7 @@ int receive_test_results(struct buildmatrix_context *ctx, struct test_results **
 
  while(1)
  {
-  if(receive_line(ctx, 512, &buffer_length, buffer))
+  if(receive_line(ctx, PROTOCOL_LINE_MAX, &buffer_length, buffer))
   {
    free(r);
    return 1;
@@ -665,28 +721,26 @@ int receive_test_results(struct buildmatrix_context *ctx, struct test_results **
    t = &(s->tests[test_i++]);
    tests_base_ptr += sizeof(struct test);
    s->n_tests++;
+   r->n_tests++;
 
    n_marks = 0;
    i = 4;
-   while(i < buffer_length)
+   while((x = scan_for_byte(buffer + i, buffer_length - i, '|')) != -1)
    {
-    if(buffer[i] == '|')
+    if(n_marks == 3)
     {
-     if(n_marks == 3)
-     {
-      buffer_length = snprintf(buffer, 2048, "failed\n");
+     buffer_length = snprintf(buffer, 2048, "failed\n");
  
-      if(ctx->verbose)
-       fprintf(stderr, "%s: bad format of test line\n", ctx->error_prefix);
-
-      send_line(ctx, buffer_length, buffer);
-      free(r);
-      return 1;
-     }
+     if(ctx->verbose)
+      fprintf(stderr, "%s: bad format of test line\n", ctx->error_prefix);
 
-     marks[n_marks++] = i;
+     send_line(ctx, buffer_length, buffer);
+     free(r);
+     return 1;
     }
-    i++;
+
+    marks[n_marks++] = i + x;
+    i += x + 1;
    }
 
    if(n_marks != 3)
@@ -775,7 +829,7 @@ int receive_test_results(struct buildmatrix_context *ctx, struct test_results **
    }
 
    i = buffer_length - (marks[2] + 2);
-   if(i > 1024)
+   if(i > TEST_DATA_LIMIT)
    {
     buffer_length = snprintf(buffer, 2048, "failed\n");
  
@@ -834,756 +888,2284 @@ int receive_test_results(struct buildmatrix_context *ctx, struct test_results **
  return 0;
 }
 
-int export_test_results_bldmtrx_format(struct buildmatrix_context *ctx, 
-                                       struct test_results *results, char *filename)
+/* lines are gathered into writes of about 8 KiB */
+#define STREAM_BUFFER_SIZE (8192 + PROTOCOL_LINE_MAX)
+
+/* Sends the file's suites and tests as they are parsed, without building a struct test_results
+   first or waiting for a reply to each line. Lines are batched into whole writes, and the peer
+   files them as they arrive and answers once after "done". Memory does not grow with the file,
+   apart from the suite names kept to catch a repeated suite; a repeated test is caught by the
+   peer. A file that goes bad part way through is abandoned with "failed". A binary file is
+   sent from its records the same way. */
+int stream_test_results(struct buildmatrix_context *ctx, char *filename)
 {
- FILE *output;
- int x, y;
- struct test *t;
- struct suite *s;
+ char *file_ctxtents, *suite_name = NULL, **suite_names = NULL, 
+      buffer[STREAM_BUFFER_SIZE], reply[32], temp[513], *strings;
+ struct string_index suite_index;
+ struct test_results_line parsed;
+ struct test_results_reader reader;
+ struct bmt_header *header;
+ struct bmt_suite *bs;
+ struct bmt_test *bt;
+ uint32_t i, j;
+ size_t filesize;
+ int mapped, n_bytes, buffer_length = 0, n_suites = 0, binary = 0, 
+     length, failed = 0;
 
  if(ctx->verbose > 1)
-  fprintf(stderr, "%s: export_test_results_bldmtrx_format()\n", ctx->error_prefix);
+  fprintf(stderr, "%s: stream_test_results()\n", ctx->error_prefix);
 
- if(results == NULL)
+ if((file_ctxtents = map_disk_file(ctx, filename, &filesize, &mapped)) == NULL)
   return 1;
- 
- if((output = fopen(filename, "w")) == NULL)
+
+ if(string_index_create(&suite_index, 16))
  {
-  fprintf(stderr, "%s: fopen(%s, \"w\") failed: %s\n", 
-          ctx->error_prefix, filename, strerror(errno));
+  fprintf(stderr, "%s: stream_test_results(): out of memory\n", ctx->error_prefix);
+  release_disk_file(file_ctxtents, filesize, mapped);
   return 1;
- } 
+ }
 
+ if(ctx->verbose)
+  fprintf(stderr, "%s: streaming test results\n", ctx->error_prefix);
 
- for(x=0; x<results->n_suites; x++)
+ if(send_line(ctx, 20, "test results stream\n"))
+  failed = 1;
+
+ if(failed == 0)
  {
-  s = &(results->suites[x]);
+  if(receive_line(ctx, 32, &n_bytes, reply))
+  {
+   failed = 1;
+  } else if(strncmp(reply, "ok", 2) != 0) {
+   fprintf(stderr, "%s: peer rejected test results stream, \"%s\"\n",
+           ctx->error_prefix, reply);
+   failed = 1;
+  }
+ }
 
-  fprintf(output, "suite: %s\n", s->name);
+ /* a binary file is walked record by record instead, it was checked as a whole up front */
+ if( (failed == 0) && (is_binary_test_results(file_ctxtents, filesize)) )
+ {
+  if(check_binary_test_results(ctx, filename, file_ctxtents, filesize))
+  {
+   failed = 2;
+  } else {
+   header = (struct bmt_header *) file_ctxtents;
+   bs = (struct bmt_suite *) (file_ctxtents + sizeof(struct bmt_header));
+   bt = (struct bmt_test *) (bs + header->n_suites);
+   strings = (char *) (bt + header->n_tests);
+  }
 
-  for(y=0; y<s->n_tests; y++)
+  for(i=0; (failed == 0) && (i<header->n_suites); i++)
   {
-   t = &(s->tests[y]);
+   buffer_length += snprintf(buffer + buffer_length, STREAM_BUFFER_SIZE - buffer_length,
+                             "suite|%s\n", strings + bs[i].name);
 
-   fprintf(output, "test: %s: ", t->name);
-   switch(t->result)
+   for(j=bs[i].first_test; j<bs[i].first_test + bs[i].n_tests; j++)
    {
-    case 1:
-         fprintf(output, "passed");
-         break;
-
-    case 2:
-         fprintf(output, "fail");
-         break;
-
-    case 3:
-         fprintf(output, "incomplete");
-         break;
-
-
-    default:
-         fclose(output);
-         fprintf(stderr, "%s: export_test_results_bldmtrx_format(): "
-                 "suite %s, test %s has invalid result value %d\n", 
-                 ctx->error_prefix, s->name, t->name, t->result);
-         return 1;
+    if(buffer_length > STREAM_BUFFER_SIZE - PROTOCOL_LINE_MAX)
+    {
+     if(send_line(ctx, buffer_length, buffer))
+     {
+      failed = 1;
+      break;
+     }
+     buffer_length = 0;
+    }
 
+    buffer_length += snprintf(buffer + buffer_length, STREAM_BUFFER_SIZE - buffer_length,
+                              "test|%s|%d|%s\n", strings + bt[j].name, (int) bt[j].result,
+                              (bt[j].data == BMT_NO_DATA) ? "" : strings + bt[j].data);
    }
 
-   if(t->data != NULL)
+   if( (failed == 0) && (buffer_length > STREAM_BUFFER_SIZE - PROTOCOL_LINE_MAX) )
    {
-    fprintf(output, ": %s", t->data);
+    if(send_line(ctx, buffer_length, buffer))
+     failed = 1;
+    buffer_length = 0;
    }
-
-   fprintf(output, "\n");
   }
+
+  binary = 1;
  }
- 
- fclose(output);
- return 0;
+
+ open_test_results_reader(&reader, filename, file_ctxtents, filesize);
+
+ while( (failed == 0) && (binary == 0) )
+ {
+  if(read_test_results_record(ctx, &reader, suite_name, &parsed))
+  {
+   failed = 2;
+   break;
+  }
+
+  if(parsed.kind == 0)
+   break;
+
+  if(parsed.kind == 1)
+  {
+   /* add_to_string_array() wants a terminated string, and the mapped file isn't */
+   memcpy(temp, parsed.name, parsed.name_length);
+   temp[parsed.name_length] = 0;
+
+   if(add_to_string_array(&suite_names, n_suites, temp, parsed.name_length, 0))
+   {
+    fprintf(stderr, "%s: stream_test_results(): out of memory\n", ctx->error_prefix);
+    failed = 2;
+    break;
+   }
+   suite_name = suite_names[n_suites];
+
+   if(string_index_lookup(&suite_index, suite_name) != -1)
+   {
+    fprintf(stderr, 
+            "%s: file %s, line %d: suite \"%s\" has already been listed.\n", 
+            ctx->error_prefix, filename, test_results_reader_line(&reader), suite_name);
+    n_suites++;
+    failed = 2;
+    break;
+   }
+
+   if(string_index_insert(&suite_index, suite_name, n_suites++))
+   {
+    fprintf(stderr, "%s: stream_test_results(): out of memory\n", ctx->error_prefix);
+    failed = 2;
+    break;
+   }
+  }
+
+  /* there is always room for one more line of the longest kind */
+  if(buffer_length > STREAM_BUFFER_SIZE - PROTOCOL_LINE_MAX)
+  {
+   if(send_line(ctx, buffer_length, buffer))
+   {
+    failed = 1;
+    break;
+   }
+   buffer_length = 0;
+  }
+
+  if(parsed.kind == 1)
+   length = snprintf(buffer + buffer_length, STREAM_BUFFER_SIZE - buffer_length, "suite|%.*s\n",
+                     parsed.name_length, parsed.name);
+  else
+   length = snprintf(buffer + buffer_length, STREAM_BUFFER_SIZE - buffer_length,
+                     "test|%.*s|%d|%.*s\n", parsed.name_length, parsed.name, parsed.result,
+                     parsed.has_data ? parsed.data_length : 0, parsed.data);
+
+  buffer_length += length;
+ }
+
+ string_index_free(&suite_index);
+ free_string_array(suite_names, n_suites);
+ release_disk_file(file_ctxtents, filesize, mapped);
+
+ if(failed == 1)
+  return 1;
+
+ if(failed == 0)
+  length = snprintf(buffer + buffer_length, STREAM_BUFFER_SIZE - buffer_length, "done\n");
+ else
+  length = snprintf(buffer + buffer_length, STREAM_BUFFER_SIZE - buffer_length, "failed\n");
+ buffer_length += length;
+
+ if(send_line(ctx, buffer_length, buffer))
+  return 1;
+
+ if(failed)
+  return 1;
+
+ if(receive_line(ctx, 32, &n_bytes, reply))
+  return 1;
+
+ if(strncmp(reply, "ok", 2) == 0)
+ {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: test results sent.\n", ctx->error_prefix);
+
+  return 0;
+ }
+
+ fprintf(stderr, "%s: peer rejected test results stream, \"%s\"\n",
+         ctx->error_prefix, reply);
+ return 1;
 }
 
-int file_test_results(struct buildmatrix_context *ctx, struct test_results *results)
+/* The other end of stream_test_results(). Each score is filed as its line arrives. Once
+   something is wrong the rest of the stream is still read, so that the reply to "done" is
+   where the peer expects it. */
+int receive_test_results_stream(struct buildmatrix_context *ctx)
 {
- int suite_i, test_i, code, suite_id, test_id;
- char *sql;
- struct sqlite3_stmt *statement = NULL;
+ struct test_results_filer filer;
+ char buffer[PROTOCOL_LINE_MAX], temp[8], *name, *result, *data;
+ int buffer_length, code, failed = 0;
 
- if(ctx->verbose > 1)
-  fprintf(stderr, 
-          "%s: file_test_results()\n", ctx->error_prefix);
+ if(ctx->verbose)
+  fprintf(stderr, "%s: receiving test results stream\n", ctx->error_prefix);
 
- if(ctx->build_id < 1)
+ if(open_test_results_filer(ctx, &filer))
  {
-  fprintf(stderr, "%s: file_test_results(): I don't have a build id.\n",
-          ctx->error_prefix);
+  send_line(ctx, 7, "failed\n");
   return 1;
  }
 
- for(suite_i = 0; suite_i < results->n_suites; suite_i++)
+ if(send_line(ctx, 3, "ok\n"))
  {
-  sql = "SELECT suite_id FROM suites WHERE name = ?;";
+  close_test_results_filer(&filer);
+  return 1;
+ }
 
-  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ while(1)
+ {
+  /* lines arrive back to back, so leave receive_line() room for what it has buffered */
+  if(receive_line(ctx, PROTOCOL_LINE_MAX - 1, &buffer_length, buffer))
   {
-   fprintf(stderr, "%s: file_test_results(): sqlite3_prepare(%s) failed, '%s'\n",
-           ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
+   close_test_results_filer(&filer);
    return 1;
   }
 
-  if(sqlite3_bind_text(statement, 1, results->suites[suite_i].name, 
-                       strlen(results->suites[suite_i].name), 
-                       SQLITE_TRANSIENT) != SQLITE_OK)
+  if(strncmp(buffer, "done", 4) == 0)
+   break;
+
+  if(strncmp(buffer, "failed", 6) == 0)
   {
-   fprintf(stderr, "%s: file_test_results(): sqlite3_bind_text() failed, '%s'\n",
-           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-   sqlite3_finalize(statement);
+   if(ctx->verbose)
+    fprintf(stderr, "%s: peer abandoned test results stream\n", ctx->error_prefix);
+
+   close_test_results_filer(&filer);
    return 1;
   }
 
-  suite_id = -1;
+  if(failed)
+   continue;
 
-  while((code = sqlite3_step(statement)) == SQLITE_ROW)
+  if(strncmp(buffer, "suite|", 6) == 0)
   {
-
-   if(sqlite3_column_type(statement, 0) != SQLITE_INTEGER)
+   if(check_string(ctx, buffer + 6))
    {
-    fprintf(stderr, "%s: file_test_results(): suites.suite_id is not an integer\n",
-            ctx->error_prefix);
-    sqlite3_finalize(statement);
-    return 1;
+    fprintf(stderr, "%s: invalid suite name, \"%s\"\n",
+            ctx->error_prefix, buffer + 6);
+    failed = 1;
+    continue;
    }
-   suite_id = sqlite3_column_int(statement, 0);
-  }
 
-  if(code != SQLITE_DONE)
-  {
-   fprintf(stderr, "%s: file_test_results(): sqlite3_step() failed, '%s'\n",
-           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-   sqlite3_finalize(statement);
-   return 1;
-  }
+   if(file_test_suite(ctx, &filer, buffer + 6))
+    failed = 1;
 
-  sqlite3_finalize(statement);
+   continue;
+  }
 
-  if(suite_id == -1)
+  if(strncmp(buffer, "test|", 5) == 0)
   {
-   if(ctx->verbose > 1)
-   fprintf(stderr, 
-           "%s: file_test_results(): suite '%s' not in suites table, adding...\n", 
-           ctx->error_prefix, results->suites[suite_i].name);
-
-   sql = "INSERT INTO suites (name) VALUES (?);";
+   /* test|name|result|data */
+   name = buffer + 5;
+   if( ((result = strchr(name, '|')) == NULL) ||
+       ((data = strchr(result + 1, '|')) == NULL) )
+   {
+    fprintf(stderr, "%s: malformed test line, \"%s\"\n", ctx->error_prefix, buffer);
+    failed = 1;
+    continue;
+   }
+   *(result++) = 0;
+   *(data++) = 0;
 
-   if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+   if( ((result - name) < 2) || ((result - name) > 257) || (strlen(data) > TEST_DATA_LIMIT) ||
+       ((data - result) < 2) || ((data - result) > 4) )
    {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_prepare(%s) failed, '%s'\n",
-            ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
-    return 1;
+    fprintf(stderr, "%s: test line field wrong length, \"%s\"\n", ctx->error_prefix, name);
+    failed = 1;
+    continue;
    }
 
-   if(sqlite3_bind_text(statement, 1, results->suites[suite_i].name, 
-                        strlen(results->suites[suite_i].name), 
-                        SQLITE_TRANSIENT) != SQLITE_OK)
+   snprintf(temp, 8, "%s", result);
+   code = -1;
+   sscanf(temp, "%d", &code);
+
+   if( (code < 1) || (code > 3) )
    {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_bind_text() failed, '%s'\n",
-            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-    sqlite3_finalize(statement);
-    return 1;
+    fprintf(stderr, "%s: invalid test result code '%s' for test '%s'\n", 
+            ctx->error_prefix, temp, name);
+    failed = 1;
+    continue;
    }
 
-   code = sqlite3_step(statement);
-   if(code != SQLITE_DONE)
+   if(check_string(ctx, name))
    {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_step() failed, '%s'\n",
-            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-    sqlite3_finalize(statement);
-    close_database(ctx);
-    return 1;
+    fprintf(stderr, "%s: invalid test name, \"%s\"\n", ctx->error_prefix, name);
+    failed = 1;
+    continue;
    }
 
-   sqlite3_finalize(statement);
+   if(file_test_score(ctx, &filer, name, code, (data[0] == 0) ? NULL : data))
+    failed = 1;
 
-   sql = "SELECT suite_id FROM suites WHERE name = ?;";
+   continue;
+  }
 
-   if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
-   {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_prepare(%s) failed, '%s'\n",
-            ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
-    return 1;
-   }
+  fprintf(stderr, "%s: unrecognized results transmission line, \"%s\"\n",
+          ctx->error_prefix, buffer);
+  failed = 1;
+ }
 
-   if(sqlite3_bind_text(statement, 1, results->suites[suite_i].name, 
-                        strlen(results->suites[suite_i].name), 
-                        SQLITE_TRANSIENT) != SQLITE_OK)
-   {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_bind_text() failed, '%s'\n",
-            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-    sqlite3_finalize(statement);
-    return 1;
-   }
+ close_test_results_filer(&filer);
 
-   while((code = sqlite3_step(statement)) == SQLITE_ROW)
-   {
+ if(failed == 0)
+ {
+  if(fold_build_test_history(ctx))
+   failed = 1;
+ }
 
-    if(sqlite3_column_type(statement, 0) != SQLITE_INTEGER)
-    {
-     fprintf(stderr, "%s: file_test_results(): suites.suite_id is not an integer\n",
-             ctx->error_prefix);
-     sqlite3_finalize(statement);
-     return 1;
-    }
-    suite_id = sqlite3_column_int(statement, 0);
-   }
+ if(failed)
+ {
+  send_line(ctx, 7, "failed\n");
+  return 1;
+ }
 
-   if(code != SQLITE_DONE)
-   {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_step() failed, '%s'\n",
-            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-    sqlite3_finalize(statement);
-    return 1;
-   }
+ ctx->test_results_streamed = 1;
+
+ if(send_line(ctx, 3, "ok\n"))
+  return 1;
 
-   sqlite3_finalize(statement);
+ if(ctx->verbose)
+  fprintf(stderr, "%s: test results stream received, %d scores filed\n",
+          ctx->error_prefix, filer.n_scores);
 
-   if(suite_id == -1)
-   {
-    fprintf(stderr, "%s: file_test_results(): failed\n", ctx->error_prefix); 
-    return 1;
-   }
+ return 0;
+}
 
-   if(ctx->verbose > 1)
-   fprintf(stderr, 
-           "%s: file_test_results(): inserted suite '%s' now suite_id %d\n", 
-           ctx->error_prefix, results->suites[suite_i].name, suite_id);
-  }
+int export_test_results_bldmtrx_format(struct buildmatrix_context *ctx, 
+                                       struct test_results *results, char *filename)
+{
+ FILE *output;
+ int x, y;
+ struct test *t;
+ struct suite *s;
 
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: export_test_results_bldmtrx_format()\n", ctx->error_prefix);
 
-  for(test_i = 0; test_i < results->suites[suite_i].n_tests; test_i++)
+ if(results == NULL)
+  return 1;
+ 
+ if((output = fopen(filename, "w")) == NULL)
+ {
+  fprintf(stderr, "%s: fopen(%s, \"w\") failed: %s\n", 
+          ctx->error_prefix, filename, strerror(errno));
+  return 1;
+ } 
+
+
+ for(x=0; x<results->n_suites; x++)
+ {
+  s = &(results->suites[x]);
+
+  fprintf(output, "suite: %s\n", s->name);
+
+  for(y=0; y<s->n_tests; y++)
   {
-   test_id = -1;
-   sql = "SELECT test_id FROM tests WHERE suite_id = ? AND name = ?;";
+   t = &(s->tests[y]);
 
-   if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+   fprintf(output, "test: %s: ", t->name);
+   switch(t->result)
    {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_prepare(%s) failed, '%s'\n",
-            ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
-    return 1;
-   }
+    case 1:
+         fprintf(output, "passed");
+         break;
+
+    case 2:
+         fprintf(output, "failed");
+         break;
+
+    case 3:
+         fprintf(output, "incomplete");
+         break;
+
+
+    default:
+         fclose(output);
+         fprintf(stderr, "%s: export_test_results_bldmtrx_format(): "
+                 "suite %s, test %s has invalid result value %d\n", 
+                 ctx->error_prefix, s->name, t->name, t->result);
+         return 1;
 
-   if(sqlite3_bind_int(statement, 1, suite_id) != SQLITE_OK)
-   {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_bind_int() failed, '%s'\n",
-            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-    sqlite3_finalize(statement);
-    return 1;
    }
 
-   if(sqlite3_bind_text(statement, 2, results->suites[suite_i].tests[test_i].name, 
-                        strlen(results->suites[suite_i].tests[test_i].name), 
-                        SQLITE_TRANSIENT) != SQLITE_OK)
+   if(t->data != NULL)
    {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_bind_text() failed, '%s'\n",
-            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-    sqlite3_finalize(statement);
-    return 1;
+    fprintf(output, ": %s", t->data);
    }
 
-   while((code = sqlite3_step(statement)) == SQLITE_ROW)
-   {
-    if(sqlite3_column_type(statement, 0) != SQLITE_INTEGER)
-    {
-     fprintf(stderr, "%s: file_test_results(): tests.test_id is not an integer\n", 
-             ctx->error_prefix);
-     sqlite3_finalize(statement);
-     return 1;
-    }
-    test_id = sqlite3_column_int(statement, 0);
+   fprintf(output, "\n");
+  }
+ }
+ 
+ fclose(output);
+ return 0;
+}
 
-   }
+/* writes results in the binary form, see struct bmt_header */
+int export_test_results_binary_format(struct buildmatrix_context *ctx, 
+                                      struct test_results *results, char *filename)
+{
+ FILE *output;
+ struct bmt_header header;
+ struct bmt_suite bs;
+ struct bmt_test bt;
+ struct suite *s;
+ struct test *t;
+ uint32_t string_space = 0, first_test = 0, n_tests = 0;
+ int x, y, failed = 0;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: export_test_results_binary_format()\n", ctx->error_prefix);
+
+ if(results == NULL)
+  return 1;
+
+ /* the string table is laid out in the same order the records are written in */
+ for(x=0; x<results->n_suites; x++)
+ {
+  s = &(results->suites[x]);
+  string_space += strlen(s->name) + 1;
+  n_tests += s->n_tests;
+
+  for(y=0; y<s->n_tests; y++)
+  {
+   t = &(s->tests[y]);
 
-   if(code != SQLITE_DONE)
+   if( (t->result < 1) || (t->result > 3) )
    {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_step() failed, '%s'\n",
-            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-    sqlite3_finalize(statement);
+    fprintf(stderr, "%s: export_test_results_binary_format(): "
+            "suite %s, test %s has invalid result value %d\n", 
+            ctx->error_prefix, s->name, t->name, t->result);
     return 1;
    }
 
-   sqlite3_finalize(statement);
+   string_space += strlen(t->name) + 1;
+   if(t->data != NULL)
+    string_space += strlen(t->data) + 1;
+  }
+ }
 
-   if(test_id == -1)
-   {
-    if(ctx->verbose > 1)
-     fprintf(stderr, 
-             "%s: file_test_results(): test '%s.%s' not in tests table, adding...\n", 
-             ctx->error_prefix, results->suites[suite_i].name, 
-             results->suites[suite_i].tests[test_i].name);
+ if((output = fopen(filename, "w")) == NULL)
+ {
+  fprintf(stderr, "%s: fopen(%s, \"w\") failed: %s\n", 
+          ctx->error_prefix, filename, strerror(errno));
+  return 1;
+ } 
 
-    sql = "INSERT INTO tests (suite_id, name) VALUES (?, ?);";
+ memcpy(header.magic, BMT_MAGIC, 4);
+ header.byte_order = BMT_BYTE_ORDER;
+ header.version = BMT_VERSION;
+ header.n_suites = results->n_suites;
+ header.n_tests = n_tests;
+ header.string_space = string_space;
 
-    if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
-    {
-     fprintf(stderr, "%s: file_test_results(): sqlite3_prepare(%s) failed, '%s'\n",
-             ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
-     return 1;
-    }
+ if(fwrite(&header, sizeof(struct bmt_header), 1, output) != 1)
+  failed = 1;
 
-    if(sqlite3_bind_int(statement, 1, suite_id) != SQLITE_OK)
-    {
-     fprintf(stderr, "%s: file_test_results(): sqlite3_bind_int() failed, '%s'\n",
-             ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-     sqlite3_finalize(statement);
-     return 1;
-    }
+ string_space = 0;
+ for(x=0; (failed == 0) && (x<results->n_suites); x++)
+ {
+  s = &(results->suites[x]);
 
-    if(sqlite3_bind_text(statement, 2, results->suites[suite_i].tests[test_i].name, 
-                         strlen(results->suites[suite_i].tests[test_i].name), 
-                         SQLITE_TRANSIENT) != SQLITE_OK)
-    {
-     fprintf(stderr, "%s: file_test_results(): sqlite3_bind_text() failed, '%s'\n",
-             ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-     sqlite3_finalize(statement);
-     return 1;
-    }
+  bs.name = string_space;
+  bs.first_test = first_test;
+  bs.n_tests = s->n_tests;
+  first_test += s->n_tests;
 
-    code = sqlite3_step(statement);
-    if(code != SQLITE_DONE)
-    {
-     fprintf(stderr, "%s: file_test_results(): sqlite3_step() failed, '%s'\n",
-             ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-     sqlite3_finalize(statement);
-     close_database(ctx);
-     return 1;
-    }
+  string_space += strlen(s->name) + 1;
+  for(y=0; y<s->n_tests; y++)
+  {
+   string_space += strlen(s->tests[y].name) + 1;
+   if(s->tests[y].data != NULL)
+    string_space += strlen(s->tests[y].data) + 1;
+  }
+
+  if(fwrite(&bs, sizeof(struct bmt_suite), 1, output) != 1)
+   failed = 1;
+ }
+
+ string_space = 0;
+ for(x=0; (failed == 0) && (x<results->n_suites); x++)
+ {
+  s = &(results->suites[x]);
+  string_space += strlen(s->name) + 1;
+
+  for(y=0; (failed == 0) && (y<s->n_tests); y++)
+  {
+   t = &(s->tests[y]);
+
+   bt.name = string_space;
+   string_space += strlen(t->name) + 1;
+   bt.result = t->result;
+   bt.data = BMT_NO_DATA;
+   if(t->data != NULL)
+   {
+    bt.data = string_space;
+    string_space += strlen(t->data) + 1;
+   }
+
+   if(fwrite(&bt, sizeof(struct bmt_test), 1, output) != 1)
+    failed = 1;
+  }
+ }
+
+ for(x=0; (failed == 0) && (x<results->n_suites); x++)
+ {
+  s = &(results->suites[x]);
+
+  if(fwrite(s->name, strlen(s->name) + 1, 1, output) != 1)
+   failed = 1;
+
+  for(y=0; (failed == 0) && (y<s->n_tests); y++)
+  {
+   t = &(s->tests[y]);
+
+   if(fwrite(t->name, strlen(t->name) + 1, 1, output) != 1)
+    failed = 1;
+
+   if( (failed == 0) && (t->data != NULL) )
+   {
+    if(fwrite(t->data, strlen(t->data) + 1, 1, output) != 1)
+     failed = 1;
+   }
+  }
+ }
+
+ if(fclose(output))
+  failed = 1;
+
+ if(failed)
+ {
+  fprintf(stderr, "%s: export_test_results_binary_format(): writing %s failed: %s\n", 
+          ctx->error_prefix, filename, strerror(errno));
+  return 1;
+ }
+
+ return 0;
+}
+
+/* writes results in the form asked for with --binarytestresults */
+int export_test_results(struct buildmatrix_context *ctx, 
+                        struct test_results *results, char *filename)
+{
+ if(ctx->binary_test_results)
+  return export_test_results_binary_format(ctx, results, filename);
+
+ return export_test_results_bldmtrx_format(ctx, results, filename);
+}
+
+int is_binary_test_results(const char *contents, size_t filesize)
+{
+ if(filesize < sizeof(struct bmt_header))
+  return 0;
+
+ return (memcmp(contents, BMT_MAGIC, 4) == 0);
+}
+
+/* Everything a reader of a binary file relies on is checked once here: the sizes add up,
+   every offset lands in the string table, the table ends terminated, the suites cover the
+   tests in order, and names and data pass the same checks text files get, including no
+   newline, which would end a line of the text format or of a streamed result, and no
+   repeated suite or test. After this the records can be used as they are. */
+int check_binary_test_results(struct buildmatrix_context *ctx, const char *filename,
+                              const char *contents, size_t filesize)
+{
+ const struct bmt_header *header;
+ const struct bmt_suite *bs;
+ const struct bmt_test *bt;
+ const char *strings;
+ struct string_index suite_index, test_index;
+ unsigned long long int expected_size;
+ uint32_t i, j, next_test = 0;
+ size_t length;
+ int failed = 0;
+
+ header = (const struct bmt_header *) contents;
+
+ if(header->byte_order != BMT_BYTE_ORDER)
+ {
+  fprintf(stderr, "%s: file %s: binary test results were written with another byte order\n",
+          ctx->error_prefix, filename);
+  return 1;
+ }
+
+ if(header->version != BMT_VERSION)
+ {
+  fprintf(stderr, "%s: file %s: binary test results version %u is not supported\n",
+          ctx->error_prefix, filename, (unsigned int) header->version);
+  return 1;
+ }
+
+ expected_size = sizeof(struct bmt_header);
+ expected_size += (unsigned long long int) header->n_suites * sizeof(struct bmt_suite);
+ expected_size += (unsigned long long int) header->n_tests * sizeof(struct bmt_test);
+ expected_size += header->string_space;
+
+ if( (expected_size != filesize) || (header->n_suites > INT32_MAX) ||
+     (header->n_tests > INT32_MAX) || (header->string_space > INT32_MAX) )
+ {
+  fprintf(stderr, "%s: file %s: binary test results header does not match file size\n",
+          ctx->error_prefix, filename);
+  return 1;
+ }
+
+ bs = (const struct bmt_suite *) (contents + sizeof(struct bmt_header));
+ bt = (const struct bmt_test *) (bs + header->n_suites);
+ strings = (const char *) (bt + header->n_tests);
+
+ if( (header->string_space > 0) && (strings[header->string_space - 1] != 0) )
+ {
+  fprintf(stderr, "%s: file %s: binary test results string table is not terminated\n",
+          ctx->error_prefix, filename);
+  return 1;
+ }
+
+ if(string_index_create(&suite_index, 16))
+ {
+  fprintf(stderr, "%s: check_binary_test_results(): out of memory\n", ctx->error_prefix);
+  return 1;
+ }
+
+ if(string_index_create(&test_index, 64))
+ {
+  fprintf(stderr, "%s: check_binary_test_results(): out of memory\n", ctx->error_prefix);
+  string_index_free(&suite_index);
+  return 1;
+ }
+
+ for(i=0; (failed == 0) && (i<header->n_suites); i++)
+ {
+  if( (bs[i].name >= header->string_space) || (bs[i].first_test != next_test) ||
+      (bs[i].n_tests > header->n_tests - next_test) )
+  {
+   fprintf(stderr, "%s: file %s: binary test results suite record %u is bad\n",
+           ctx->error_prefix, filename, (unsigned int) i);
+   failed = 1;
+   break;
+  }
+
+  length = strlen(strings + bs[i].name);
+  if( (length > 512) || (scan_line(strings + bs[i].name, length) != length) ||
+      (check_string(ctx, (char *) strings + bs[i].name)) )
+  {
+   fprintf(stderr, "%s: file %s: suite record %u, string validation error\n",
+           ctx->error_prefix, filename, (unsigned int) i);
+   failed = 1;
+   break;
+  }
+
+  if(string_index_lookup(&suite_index, strings + bs[i].name) != -1)
+  {
+   fprintf(stderr, "%s: file %s: suite \"%s\" has already been listed.\n",
+           ctx->error_prefix, filename, strings + bs[i].name);
+   failed = 1;
+   break;
+  }
+
+  if(string_index_insert(&suite_index, strings + bs[i].name, i))
+  {
+   failed = 2;
+   break;
+  }
+
+  for(j=next_test; j<next_test + bs[i].n_tests; j++)
+  {
+   if( (bt[j].name >= header->string_space) || (bt[j].result < 1) || (bt[j].result > 3) ||
+       ((bt[j].data != BMT_NO_DATA) && (bt[j].data >= header->string_space)) )
+   {
+    fprintf(stderr, "%s: file %s: binary test results test record %u is bad\n",
+            ctx->error_prefix, filename, (unsigned int) j);
+    failed = 1;
+    break;
+   }
+
+   length = strlen(strings + bt[j].name);
+   if( (length > 256) || (scan_line(strings + bt[j].name, length) != length) ||
+       (check_string(ctx, (char *) strings + bt[j].name)) )
+    failed = 1;
+
+   if(bt[j].data != BMT_NO_DATA)
+   {
+    length = strlen(strings + bt[j].data);
+    if( (length > TEST_DATA_LIMIT) || (scan_line(strings + bt[j].data, length) != length) )
+     failed = 1;
+   }
+
+   if(failed)
+   {
+    fprintf(stderr, "%s: file %s: test record %u, string validation error\n",
+            ctx->error_prefix, filename, (unsigned int) j);
+    break;
+   }
+
+   /* suites can't repeat, so a test name only collides with one from the current suite */
+   if(string_index_lookup(&test_index, strings + bt[j].name) == (int) i)
+   {
+    fprintf(stderr, "%s: file %s: results for test %s.%s were already given\n",
+            ctx->error_prefix, filename, strings + bs[i].name, strings + bt[j].name);
+    failed = 1;
+    break;
+   }
+
+   if(string_index_insert(&test_index, strings + bt[j].name, i))
+   {
+    failed = 2;
+    break;
+   }
+  }
+
+  next_test += bs[i].n_tests;
+ }
+
+ if(failed == 2)
+  fprintf(stderr, "%s: check_binary_test_results(): out of memory\n", ctx->error_prefix);
+
+ string_index_free(&suite_index);
+ string_index_free(&test_index);
+
+ if(failed)
+  return 1;
+
+ if(next_test != header->n_tests)
+ {
+  fprintf(stderr, "%s: file %s: binary test results suites cover %u of %u tests\n",
+          ctx->error_prefix, filename, (unsigned int) next_test, (unsigned int) header->n_tests);
+  return 1;
+ }
+
+ return 0;
+}
+
+/* Nothing is tokenized. The string table is copied whole behind the suite and test arrays, in
+   the one block layout assemble_test_results() makes, and the records only have their
+   offsets turned into pointers. */
+int load_binary_test_results(struct buildmatrix_context *ctx, const char *filename,
+                             const char *contents, size_t filesize,
+                             struct test_results **results)
+{
+ const struct bmt_header *header;
+ const struct bmt_suite *bs;
+ const struct bmt_test *bt;
+ struct test_results *r;
+ struct suite *suites;
+ struct test *tests;
+ size_t allocation_size;
+ char *strings_base_ptr;
+ uint32_t i;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: load_binary_test_results()\n", ctx->error_prefix);
+
+ if(check_binary_test_results(ctx, filename, contents, filesize))
+  return 1;
+
+ header = (const struct bmt_header *) contents;
+ bs = (const struct bmt_suite *) (contents + sizeof(struct bmt_header));
+ bt = (const struct bmt_test *) (bs + header->n_suites);
+
+ allocation_size = sizeof(struct test_results);
+ allocation_size += sizeof(struct suite) * header->n_suites;
+ allocation_size += sizeof(struct test) * header->n_tests;
+ allocation_size += header->string_space;
+
+ if((r = malloc(allocation_size)) == NULL)
+ {
+  fprintf(stderr, "%s: malloc(%d) failed: %s\n",
+          ctx->error_prefix, (int) allocation_size, strerror(errno));
+  return 1;    
+ }
+
+ suites = (struct suite *) (((char *) r) + sizeof(struct test_results));
+ tests = (struct test *) (((char *) suites) + (sizeof(struct suite) * header->n_suites));
+ strings_base_ptr = ((char *) tests) + (sizeof(struct test) * header->n_tests);
+ memcpy(strings_base_ptr, bt + header->n_tests, header->string_space);
+
+ r->allocation_size = allocation_size;
+ r->n_suites = header->n_suites;
+ r->n_tests = header->n_tests;
+ r->string_space = header->string_space;
+ r->suites = suites;
+
+ for(i=0; i<header->n_suites; i++)
+ {
+  suites[i].name = strings_base_ptr + bs[i].name;
+  suites[i].n_tests = bs[i].n_tests;
+  suites[i].tests = &(tests[bs[i].first_test]);
+ }
+
+ for(i=0; i<header->n_tests; i++)
+ {
+  tests[i].result = bt[i].result;
+  tests[i].name = strings_base_ptr + bt[i].name;
+  if(bt[i].data == BMT_NO_DATA)
+   tests[i].data = NULL;
+  else
+   tests[i].data = strings_base_ptr + bt[i].data;
+ }
+
+ *results = r;
+ return 0;
+}
+
+/* The statements used to file scores for ctx->build_id one suite and test at a time, so results
+   can be filed as they arrive rather than after they have all been received. */
+int open_test_results_filer(struct buildmatrix_context *ctx, struct test_results_filer *filer)
+{
+ struct sqlite3_stmt **statements[8];
+ char *sql[8];
+ int i;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: open_test_results_filer()\n", ctx->error_prefix);
+
+ filer->suite_lookup = NULL;
+ filer->suite_insert = NULL;
+ filer->test_lookup = NULL;
+ filer->test_insert = NULL;
+ filer->score_insert = NULL;
+ filer->blob_lookup = NULL;
+ filer->blob_reference = NULL;
+ filer->blob_insert = NULL;
+ filer->suite_id = -1;
+ filer->n_scores = 0;
+
+ if(ctx->build_id < 1)
+ {
+  fprintf(stderr, "%s: open_test_results_filer(): I don't have a build id.\n",
+          ctx->error_prefix);
+  return 1;
+ }
+
+ /* before this build's scores exist, so an upgrade does not count them twice */
+ if(upgrade_test_history_table(ctx))
+  return 1;
+
+ if(upgrade_blobs_table(ctx))
+  return 1;
+
+ statements[0] = &(filer->suite_lookup);
+ sql[0] = "SELECT suite_id FROM suites WHERE name = ?;";
+ statements[1] = &(filer->suite_insert);
+ sql[1] = "INSERT INTO suites (name) VALUES (?);";
+ statements[2] = &(filer->test_lookup);
+ sql[2] = "SELECT test_id FROM tests WHERE suite_id = ? AND name = ?;";
+ statements[3] = &(filer->test_insert);
+ sql[3] = "INSERT INTO tests (suite_id, name) VALUES (?, ?);";
+ statements[4] = &(filer->score_insert);
+ sql[4] = "INSERT INTO scores (build_id, test_id, result, data, blob_id) VALUES (?, ?, ?, ?, ?);";
+ statements[5] = &(filer->blob_lookup);
+ sql[5] = "SELECT blob_id FROM blobs WHERE digest = ?;";
+ statements[6] = &(filer->blob_reference);
+ sql[6] = "UPDATE blobs SET refs = refs + 1 WHERE blob_id = ?;";
+ statements[7] = &(filer->blob_insert);
+ sql[7] = "INSERT INTO blobs (digest, refs, data) VALUES (?, 1, ?);";
+
+ for(i=0; i<8; i++)
+ {
+  if(sqlite3_prepare_v2(ctx->db_ctx, sql[i], strlen(sql[i]) + 1, statements[i], NULL) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: open_test_results_filer(): sqlite3_prepare(%s) failed, '%s'\n",
+           ctx->error_prefix, sql[i], sqlite3_errmsg(ctx->db_ctx)); 
+   close_test_results_filer(filer);
+   return 1;
+  }
+ }
+
+ return 0;
+}
+
+void close_test_results_filer(struct test_results_filer *filer)
+{
+ if(filer->suite_lookup != NULL)
+  sqlite3_finalize(filer->suite_lookup);
+
+ if(filer->suite_insert != NULL)
+  sqlite3_finalize(filer->suite_insert);
+
+ if(filer->test_lookup != NULL)
+  sqlite3_finalize(filer->test_lookup);
+
+ if(filer->test_insert != NULL)
+  sqlite3_finalize(filer->test_insert);
+
+ if(filer->score_insert != NULL)
+  sqlite3_finalize(filer->score_insert);
+
+ if(filer->blob_lookup != NULL)
+  sqlite3_finalize(filer->blob_lookup);
+
+ if(filer->blob_reference != NULL)
+  sqlite3_finalize(filer->blob_reference);
+
+ if(filer->blob_insert != NULL)
+  sqlite3_finalize(filer->blob_insert);
+
+ filer->suite_lookup = NULL;
+ filer->suite_insert = NULL;
+ filer->test_lookup = NULL;
+ filer->test_insert = NULL;
+ filer->score_insert = NULL;
+ filer->blob_lookup = NULL;
+ filer->blob_reference = NULL;
+ filer->blob_insert = NULL;
+}
+
+/* makes name the suite following tests are filed under, adding it to suites if it is new */
+int file_test_suite(struct buildmatrix_context *ctx, struct test_results_filer *filer,
+                    const char *name)
+{
+ int code;
+
+ sqlite3_reset(filer->suite_lookup);
+
+ if(sqlite3_bind_text(filer->suite_lookup, 1, name, strlen(name), SQLITE_TRANSIENT) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: file_test_suite(): sqlite3_bind_text() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ filer->suite_id = -1;
+
+ while((code = sqlite3_step(filer->suite_lookup)) == SQLITE_ROW)
+ {
+  if(sqlite3_column_type(filer->suite_lookup, 0) != SQLITE_INTEGER)
+  {
+   fprintf(stderr, "%s: file_test_suite(): suites.suite_id is not an integer\n",
+           ctx->error_prefix);
+   return 1;
+  }
+  filer->suite_id = sqlite3_column_int(filer->suite_lookup, 0);
+ }
+
+ if(code != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: file_test_suite(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(filer->suite_id != -1)
+  return 0;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, 
+          "%s: file_test_suite(): suite '%s' not in suites table, adding...\n", 
+          ctx->error_prefix, name);
+
+ sqlite3_reset(filer->suite_insert);
+
+ if(sqlite3_bind_text(filer->suite_insert, 1, name, strlen(name), SQLITE_TRANSIENT) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: file_test_suite(): sqlite3_bind_text() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(sqlite3_step(filer->suite_insert) != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: file_test_suite(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ filer->suite_id = (int) sqlite3_last_insert_rowid(ctx->db_ctx);
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, 
+          "%s: file_test_suite(): inserted suite '%s' now suite_id %d\n", 
+          ctx->error_prefix, name, filer->suite_id);
+
+ return 0;
+}
+
+/* files one score under the current suite, adding the test to tests if it is new */
+int file_test_score(struct buildmatrix_context *ctx, struct test_results_filer *filer,
+                    const char *name, int result, const char *data)
+{
+ int code, test_id = -1, blob_id = -1;
+
+ if(filer->suite_id == -1)
+ {
+  fprintf(stderr, "%s: file_test_score(): test '%s' comes before any suite\n",
+          ctx->error_prefix, name);
+  return 1;
+ }
+
+ sqlite3_reset(filer->test_lookup);
+
+ if( (sqlite3_bind_int(filer->test_lookup, 1, filer->suite_id) != SQLITE_OK) ||
+     (sqlite3_bind_text(filer->test_lookup, 2, name, strlen(name), SQLITE_TRANSIENT) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: file_test_score(): sqlite3_bind() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ while((code = sqlite3_step(filer->test_lookup)) == SQLITE_ROW)
+ {
+  if(sqlite3_column_type(filer->test_lookup, 0) != SQLITE_INTEGER)
+  {
+   fprintf(stderr, "%s: file_test_score(): tests.test_id is not an integer\n", 
+           ctx->error_prefix);
+   return 1;
+  }
+  test_id = sqlite3_column_int(filer->test_lookup, 0);
+ }
+
+ if(code != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: file_test_score(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(test_id == -1)
+ {
+  if(ctx->verbose > 1)
+   fprintf(stderr, 
+           "%s: file_test_score(): test '%s' of suite_id %d not in tests table, adding...\n", 
+           ctx->error_prefix, name, filer->suite_id);
+
+  sqlite3_reset(filer->test_insert);
+
+  if( (sqlite3_bind_int(filer->test_insert, 1, filer->suite_id) != SQLITE_OK) ||
+      (sqlite3_bind_text(filer->test_insert, 2, name, strlen(name), SQLITE_TRANSIENT) != SQLITE_OK) )
+  {
+   fprintf(stderr, "%s: file_test_score(): sqlite3_bind() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   return 1;
+  }
+
+  if(sqlite3_step(filer->test_insert) != SQLITE_DONE)
+  {
+   fprintf(stderr, "%s: file_test_score(): sqlite3_step() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   return 1;
+  }
+
+  test_id = (int) sqlite3_last_insert_rowid(ctx->db_ctx);
+
+  if(ctx->verbose > 1)
+   fprintf(stderr, 
+           "%s: file_test_score(): inserted %s now test_id %d\n", 
+           ctx->error_prefix, name, test_id);
+ }
+
+ sqlite3_reset(filer->score_insert);
+
+ if( (sqlite3_bind_int(filer->score_insert, 1, ctx->build_id) != SQLITE_OK) ||
+     (sqlite3_bind_int(filer->score_insert, 2, test_id) != SQLITE_OK) ||
+     (sqlite3_bind_int(filer->score_insert, 3, result) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: file_test_score(): sqlite3_bind_int() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if( (data != NULL) && (strlen(data) > TEST_DATA_INLINE) )
+ {
+  if(file_test_blob(ctx, filer, data, &blob_id))
+   return 1;
+  data = NULL;
+ }
+
+ if(data != NULL)
+  code = sqlite3_bind_text(filer->score_insert, 4, data, strlen(data), SQLITE_TRANSIENT);
+ else
+  code = sqlite3_bind_null(filer->score_insert, 4);
+
+ if(code == SQLITE_OK)
+ {
+  if(blob_id != -1)
+   code = sqlite3_bind_int(filer->score_insert, 5, blob_id);
+  else
+   code = sqlite3_bind_null(filer->score_insert, 5);
+ }
+
+ if(code != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: file_test_score(): sqlite3_bind() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ /* scores are unique per build and test, which is how a repeated test is noticed */
+ if((code = sqlite3_step(filer->score_insert)) != SQLITE_DONE)
+ {
+  if(code == SQLITE_CONSTRAINT)
+   fprintf(stderr, "%s: file_test_score(): results for test '%s' were already given\n",
+           ctx->error_prefix, name);
+  else
+   fprintf(stderr, "%s: file_test_score(): sqlite3_step() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ filer->n_scores++;
+ return 0;
+}
+
+/* Finds the blob holding data by its MD5 digest, or adds one, and counts one more score using
+   it. The same diagnostics from build after build are only stored once. */
+int file_test_blob(struct buildmatrix_context *ctx, struct test_results_filer *filer,
+                   const char *data, int *blob_id)
+{
+ unsigned char md5[16];
+ char digest[33];
+ int length, code, i;
+
+ length = strlen(data);
+
+ if(build_matrix_md5_wrapper(ctx, (const unsigned char *) data, length, md5))
+  return 1;
+
+ for(i=0; i<16; i++)
+  snprintf(digest + (i * 2), 3, "%02x", md5[i]);
+
+ *blob_id = -1;
+ sqlite3_reset(filer->blob_lookup);
+
+ if(sqlite3_bind_text(filer->blob_lookup, 1, digest, 32, SQLITE_TRANSIENT) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: file_test_blob(): sqlite3_bind_text() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ while((code = sqlite3_step(filer->blob_lookup)) == SQLITE_ROW)
+ {
+  if(sqlite3_column_type(filer->blob_lookup, 0) != SQLITE_INTEGER)
+  {
+   fprintf(stderr, "%s: file_test_blob(): blobs.blob_id is not an integer\n",
+           ctx->error_prefix);
+   return 1;
+  }
+  *blob_id = sqlite3_column_int(filer->blob_lookup, 0);
+ }
+
+ if(code != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: file_test_blob(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(*blob_id != -1)
+ {
+  sqlite3_reset(filer->blob_reference);
+
+  if(sqlite3_bind_int(filer->blob_reference, 1, *blob_id) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: file_test_blob(): sqlite3_bind_int() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   return 1;
+  }
+
+  if(sqlite3_step(filer->blob_reference) != SQLITE_DONE)
+  {
+   fprintf(stderr, "%s: file_test_blob(): sqlite3_step() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   return 1;
+  }
+
+  return 0;
+ }
+
+ sqlite3_reset(filer->blob_insert);
+
+ if( (sqlite3_bind_text(filer->blob_insert, 1, digest, 32, SQLITE_TRANSIENT) != SQLITE_OK) ||
+     (sqlite3_bind_text(filer->blob_insert, 2, data, length, SQLITE_TRANSIENT) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: file_test_blob(): sqlite3_bind_text() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(sqlite3_step(filer->blob_insert) != SQLITE_DONE)
+ {
+  fprintf(stderr, "%s: file_test_blob(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ *blob_id = (int) sqlite3_last_insert_rowid(ctx->db_ctx);
+ return 0;
+}
+
+/* blobs holds test data too long for scores.data, by content. refs counts the scores, archived
+   ones included, that use each blob. */
+int blobs_table_exists(struct buildmatrix_context *ctx, int *exists)
+{
+ char *sql;
+ struct sqlite3_stmt *statement = NULL;
+
+ sql = "SELECT COUNT(*) FROM main.sqlite_master WHERE type = 'table' AND name = 'blobs';";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: blobs_table_exists(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(sqlite3_step(statement) != SQLITE_ROW)
+ {
+  fprintf(stderr, "%s: blobs_table_exists(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ *exists = sqlite3_column_int(statement, 0);
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+int create_blobs_table(struct buildmatrix_context *ctx)
+{
+ char *errmsg;
+
+ if(sqlite3_exec(ctx->db_ctx, 
+                 "CREATE TABLE main.blobs (blob_id INTEGER PRIMARY KEY, digest TEXT UNIQUE, "
+                                          "refs INTEGER, data TEXT);",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: could not create blobs table, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ return 0;
+}
+
+/* projects created before blobs get the table, and scores.blob_id, on first use. Data already
+   in scores.data stays there. */
+int upgrade_blobs_table(struct buildmatrix_context *ctx)
+{
+ char *errmsg;
+ int exists;
+
+ if(blobs_table_exists(ctx, &exists))
+  return 1;
+
+ if(exists)
+  return 0;
+
+ if(ctx->verbose)
+  fprintf(stderr, "%s: adding blobs table\n", ctx->error_prefix);
+
+ if(sqlite3_exec(ctx->db_ctx, "SAVEPOINT upgrade_blobs;", NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: upgrade_blobs_table(): sqlite3_exec(\"SAVEPOINT\"): '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ if(create_blobs_table(ctx))
+ {
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TO upgrade_blobs; RELEASE upgrade_blobs;",
+               NULL, NULL, NULL);
+  return 1;
+ }
+
+ if(sqlite3_exec(ctx->db_ctx, 
+                 "ALTER TABLE main.scores ADD COLUMN blob_id INTEGER REFERENCES blobs(blob_id); "
+                 "RELEASE upgrade_blobs;",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: upgrade_blobs_table(): could not add scores.blob_id, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TO upgrade_blobs; RELEASE upgrade_blobs;",
+               NULL, NULL, NULL);
+  return 1;
+ }
+
+ return 0;
+}
+
+/* Drops the references the scores of the builds in the temp table build_set hold on blobs, and
+   the blobs nothing refers to any more. Like forget_test_history(), this runs before those
+   scores are deleted. Archiving moves scores without coming through here, so an archived score
+   keeps its blob. */
+int release_test_blobs(struct buildmatrix_context *ctx)
+{
+ char *errmsg;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: release_test_blobs()\n", ctx->error_prefix);
+
+ if(upgrade_blobs_table(ctx))
+  return 1;
+
+ if(sqlite3_exec(ctx->db_ctx, 
+                 "CREATE TEMP TABLE IF NOT EXISTS blob_set (blob_id INTEGER PRIMARY KEY, "
+                                                           "n INTEGER); "
+                 "DELETE FROM blob_set; "
+                 "INSERT INTO blob_set SELECT blob_id, COUNT(*) FROM main.scores "
+                 "WHERE build_id IN (SELECT build_id FROM build_set) AND blob_id IS NOT NULL "
+                 "GROUP BY blob_id; "
+                 "UPDATE main.blobs SET refs = refs - "
+                 "(SELECT n FROM blob_set WHERE blob_set.blob_id = blobs.blob_id) "
+                 "WHERE blob_id IN (SELECT blob_id FROM blob_set); "
+                 "DELETE FROM main.blobs WHERE refs < 1 AND blob_id IN (SELECT blob_id FROM blob_set);",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: release_test_blobs(): could not release blobs, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ return 0;
+}
+
+/* brings test_history up to date with the scores just filed for ctx->build_id */
+int fold_build_test_history(struct buildmatrix_context *ctx)
+{
+ char history_sql[512];
+ int n_scores;
+
+ snprintf(history_sql, 512, "SELECT s.test_id, IFNULL(b.job, ''), IFNULL(b.branch, ''), "
+          "s.build_id, s.result FROM main.scores s JOIN main.builds b ON b.build_id = s.build_id "
+          "WHERE s.build_id = %d;", ctx->build_id);
+
+ if(fold_test_history(ctx, history_sql, &n_scores))
+  return 1;
+
+ return 0;
+}
+
+int file_test_results(struct buildmatrix_context *ctx, struct test_results *results)
+{
+ int suite_i, test_i;
+ struct test_results_filer filer;
+ struct test *t;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, 
+          "%s: file_test_results()\n", ctx->error_prefix);
+
+ if(open_test_results_filer(ctx, &filer))
+  return 1;
+
+ for(suite_i = 0; suite_i < results->n_suites; suite_i++)
+ {
+  if(file_test_suite(ctx, &filer, results->suites[suite_i].name))
+  {
+   close_test_results_filer(&filer);
+   return 1;
+  }
+
+  for(test_i = 0; test_i < results->suites[suite_i].n_tests; test_i++)
+  {
+   t = &(results->suites[suite_i].tests[test_i]);
+
+   if(file_test_score(ctx, &filer, t->name, t->result, t->data))
+   {
+    close_test_results_filer(&filer);
+    return 1;
+   }
+  }
+ }
+
+ close_test_results_filer(&filer);
+
+ if(fold_build_test_history(ctx))
+  return 1;
+
+ return 0;
+}
+
+int pull_test_results(struct buildmatrix_context *ctx, struct test_results **results)
+{
+ const char *sql, *suite_name, *test_name, *data;
+ struct sqlite3_stmt *statement = NULL;
+ int code = SQLITE_DONE, result, n_suites = 0, n_tests = 0, have_blobs = 0, failed = 0;
+ struct pulled_suite *ps = NULL;
+ struct pulled_test *pt;
+ struct arena suite_arena = { NULL, 0, 0 }, test_arena = { NULL, 0, 0 },
+              string_arena = { NULL, 0, 0 };
+ size_t offset;
+
+ if(ctx->verbose)
+  fprintf(stderr, "%s: pull_test_results()\n", ctx->error_prefix);
+
+ if(ctx->build_id < 1)
+ {
+  fprintf(stderr, "%s: pull_test_results(): no build_id in context\n", ctx->error_prefix);
+  return 1;
+ }
+
+ if(open_database(ctx))
+  return 1;
+
+ /* from here on every failure falls through to the one cleanup after the loop */
+ if( (attach_archives(ctx, 0, 0, ctx->build_id, ctx->build_id)) ||
+     (blobs_table_exists(ctx, &have_blobs)) )
+  failed = 1;
+
+ /* starts from the (build_id, test_id) index on scores and only touches the tests and suites
+    of this build, ordered so each suite's tests arrive together. Long data is fetched from
+    blobs only for the scores that have it there. */
+ if(have_blobs)
+  sql = "SELECT suites.name, tests.name, scores.result, IFNULL(blobs.data, scores.data) "
+        "FROM all_scores AS scores "
+        "JOIN tests ON tests.test_id = scores.test_id "
+        "JOIN suites ON suites.suite_id = tests.suite_id "
+        "LEFT JOIN main.blobs AS blobs ON blobs.blob_id = scores.blob_id "
+        "WHERE scores.build_id = ? ORDER BY suites.name, tests.name;";
+ else
+  sql = "SELECT suites.name, tests.name, scores.result, scores.data FROM all_scores AS scores "
+        "JOIN tests ON tests.test_id = scores.test_id "
+        "JOIN suites ON suites.suite_id = tests.suite_id "
+        "WHERE scores.build_id = ? ORDER BY suites.name, tests.name;";
+
+ if( (failed == 0) &&
+     (sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: pull_test_results(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
+  failed = 1;
+ }
+
+ if( (failed == 0) &&
+     (sqlite3_bind_int(statement, 1, ctx->build_id) != SQLITE_OK) )
+ {
+  fprintf(stderr, "%s: pull_test_results(): sqlite3_bind_int() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  failed = 1;
+ }
+
+ while( (failed == 0) && ((code = sqlite3_step(statement)) == SQLITE_ROW) )
+ {
+  if(sqlite3_column_type(statement, 0) != SQLITE_TEXT)
+  {
+   fprintf(stderr, "%s: pull_test_results(): suites.name is not TEXT\n",
+           ctx->error_prefix);
+   failed = 1;
+   break;
+  }
+  suite_name = (const char *) sqlite3_column_text(statement, 0);
+
+  if(sqlite3_column_type(statement, 1) != SQLITE_TEXT)
+  {
+   fprintf(stderr, "%s: pull_test_results(): tests.name is not TEXT\n",
+           ctx->error_prefix);
+   failed = 1;
+   break;
+  }
+  test_name = (const char *) sqlite3_column_text(statement, 1);
+
+  if(sqlite3_column_type(statement, 2) != SQLITE_INTEGER)
+  {
+   fprintf(stderr, "%s: pull_test_results(): scores.result is not an integer\n",
+           ctx->error_prefix);
+   failed = 1;
+   break;
+  }
+  result = sqlite3_column_int(statement, 2);
+
+  if( (result < 1) || (result > 3) )
+  {
+   fprintf(stderr, "%s: pull_test_results(): scores.result is unknown value\n",
+           ctx->error_prefix);
+   failed = 1;
+   break;
+  }
+
+  if((code = sqlite3_column_type(statement, 3)) != SQLITE_NULL)
+  {
+   if(code != SQLITE_TEXT)
+   {
+    fprintf(stderr, "%s: pull_test_results(): scores.data is not TEXT\n",
+            ctx->error_prefix);
+    failed = 1;
+    break;
+   }
+   data = (const char *) sqlite3_column_text(statement, 3);
+  } else {
+   data = NULL;
+  }
+
+  /* new suite? ordering means only the previous one needs comparing */
+  if( (n_suites == 0) ||
+      (strcmp(string_arena.base + ps[n_suites - 1].name, suite_name) != 0) )
+  {
+   if(arena_reserve(&suite_arena, sizeof(struct pulled_suite), &offset))
+   {
+    failed = 2;
+    break;
+   }
+   ps = (struct pulled_suite *) suite_arena.base;
+   ps[n_suites].first_test = n_tests;
+   ps[n_suites].n_tests = 0;
+
+   if(arena_append_string(&string_arena, suite_name, &(ps[n_suites].name)))
+   {
+    failed = 2;
+    break;
+   }
+   n_suites++;
+  }
+
+  if(arena_reserve(&test_arena, sizeof(struct pulled_test), &offset))
+  {
+   failed = 2;
+   break;
+  }
+  pt = (struct pulled_test *) (test_arena.base + offset);
+  pt->result = result;
+  pt->has_data = (data != NULL);
+
+  if(arena_append_string(&string_arena, test_name, &(pt->name)))
+  {
+   failed = 2;
+   break;
+  }
+
+  if(data != NULL)
+  {
+   if(arena_append_string(&string_arena, data, &(pt->data)))
+   {
+    failed = 2;
+    break;
+   }
+  }
+
+  ps[n_suites - 1].n_tests++;
+  n_tests++;
+ }
+
+ if(failed == 2)
+  fprintf(stderr, "%s: pull_test_results(): out of memory\n", ctx->error_prefix);
+
+ if( (failed == 0) && (code != SQLITE_DONE) )
+ {
+  fprintf(stderr, "%s: pull_test_results() sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  failed = 1;
+ }
+
+ sqlite3_finalize(statement);
+
+ if(failed)
+ {
+  arena_free(&suite_arena);
+  arena_free(&test_arena);
+  arena_free(&string_arena);
+  close_database(ctx);
+  return 1;
+ }
+
+ if(n_suites == 0)
+ {
+  if(ctx->verbose)
+   fprintf(stderr, "%s: pull_test_results() no test scores found for:"
+           " job \"%s\", branch \"%s\", unique identifier \"%s\", build_id %d\n",
+           ctx->error_prefix, ctx->job_name, ctx->branch_name, ctx->unique_identifier, ctx->build_id);
+
+  close_database(ctx);
+
+  *results = NULL;
+
+  return 0;
+ }
+
+ failed = assemble_test_results(ctx, ps, n_suites, (struct pulled_test *) test_arena.base, n_tests,
+                                string_arena.base, string_arena.used, results);
+
+ arena_free(&suite_arena);
+ arena_free(&test_arena);
+ arena_free(&string_arena);
+ close_database(ctx);
+
+ return failed;
+}
+
+
+/* test_history keeps, per test, job and branch, the counts of each result, the last failure and
+   how many times the result changed from one build to the next. It only covers builds in the
+   main database, so it is folded forward as scores are filed and taken back when builds leave. */
+int test_history_table_exists(struct buildmatrix_context *ctx, int *exists)
+{
+ char *sql;
+ struct sqlite3_stmt *statement = NULL;
+
+ sql = "SELECT COUNT(*) FROM main.sqlite_master WHERE type = 'table' AND name = 'test_history';";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: test_history_table_exists(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(sqlite3_step(statement) != SQLITE_ROW)
+ {
+  fprintf(stderr, "%s: test_history_table_exists(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ *exists = sqlite3_column_int(statement, 0);
+
+ sqlite3_finalize(statement);
+ return 0;
+}
+
+int create_test_history_table(struct buildmatrix_context *ctx)
+{
+ char *errmsg;
+
+ if(sqlite3_exec(ctx->db_ctx, 
+                 "CREATE TABLE main.test_history (test_id INTEGER REFERENCES tests(test_id), "
+                                            "job TEXT, branch TEXT, passed INTEGER, "
+                                            "failed INTEGER, incomplete INTEGER, "
+                                            "last_build_id INTEGER, last_result INTEGER, "
+                                            "last_failure_build_id INTEGER, flips INTEGER, "
+                                            "UNIQUE(test_id, job, branch)); "
+                 "CREATE INDEX IF NOT EXISTS main.scores_test_id ON scores (test_id);",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: could not create test_history table, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
+
+ return 0;
+}
+
+int open_test_history_update(struct buildmatrix_context *ctx, struct test_history_update *update)
+{
+ char *sql;
+
+ update->insert = NULL;
+ update->update = NULL;
+
+ sql = "INSERT OR IGNORE INTO main.test_history "
+       "(test_id, job, branch, passed, failed, incomplete, flips) VALUES (?1, ?2, ?3, 0, 0, 0, 0);";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &(update->insert), NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: open_test_history_update(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ /* every right hand side sees the row as it was before this update */
+ sql = "UPDATE main.test_history SET "
+       "passed = passed + (?5 = 1), failed = failed + (?5 = 2), incomplete = incomplete + (?5 = 3), "
+       "flips = flips + (last_result IS NOT NULL AND ?4 > last_build_id AND last_result != ?5), "
+       "last_failure_build_id = CASE WHEN ?5 = 2 AND ?4 > IFNULL(last_failure_build_id, 0) "
+                                    "THEN ?4 ELSE last_failure_build_id END, "
+       "last_result = CASE WHEN ?4 > IFNULL(last_build_id, 0) THEN ?5 ELSE last_result END, "
+       "last_build_id = MAX(IFNULL(last_build_id, 0), ?4) "
+       "WHERE test_id = ?1 AND job = ?2 AND branch = ?3;";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &(update->update), NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: open_test_history_update(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(update->insert);
+  update->insert = NULL;
+  return 1;
+ }
+
+ return 0;
+}
+
+void close_test_history_update(struct test_history_update *update)
+{
+ if(update->insert != NULL)
+  sqlite3_finalize(update->insert);
+
+ if(update->update != NULL)
+  sqlite3_finalize(update->update);
+
+ update->insert = NULL;
+ update->update = NULL;
+}
+
+/* scores have to be applied in build_id order for last_result and flips to come out right */
+int apply_test_history_update(struct buildmatrix_context *ctx, struct test_history_update *update,
+                              int test_id, const char *job, const char *branch,
+                              int build_id, int result)
+{
+ int i;
+ struct sqlite3_stmt *statements[2];
+
+ statements[0] = update->insert;
+ statements[1] = update->update;
+
+ for(i=0; i<2; i++)
+ {
+  sqlite3_reset(statements[i]);
+
+  if( (sqlite3_bind_int(statements[i], 1, test_id) != SQLITE_OK) ||
+      (sqlite3_bind_text(statements[i], 2, job, strlen(job), SQLITE_TRANSIENT) != SQLITE_OK) ||
+      (sqlite3_bind_text(statements[i], 3, branch, strlen(branch), SQLITE_TRANSIENT) != SQLITE_OK) )
+  {
+   fprintf(stderr, "%s: apply_test_history_update(): sqlite3_bind() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   return 1;
+  }
+
+  if(i == 1)
+  {
+   if( (sqlite3_bind_int(statements[i], 4, build_id) != SQLITE_OK) ||
+       (sqlite3_bind_int(statements[i], 5, result) != SQLITE_OK) )
+   {
+    fprintf(stderr, "%s: apply_test_history_update(): sqlite3_bind_int() failed, '%s'\n",
+            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+    return 1;
+   }
+  }
+
+  if(sqlite3_step(statements[i]) != SQLITE_DONE)
+  {
+   fprintf(stderr, "%s: apply_test_history_update(): sqlite3_step() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   return 1;
+  }
+ }
+
+ return 0;
+}
+
+/* sql yields test_id, job, branch, build_id and result, ordered by build_id */
+int fold_test_history(struct buildmatrix_context *ctx, const char *sql, int *n_scores)
+{
+ struct sqlite3_stmt *statement = NULL;
+ struct test_history_update update;
+ int code, failed = 0;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: fold_test_history()\n", ctx->error_prefix);
+
+ *n_scores = 0;
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: fold_test_history(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
+ }
+
+ if(open_test_history_update(ctx, &update))
+ {
+  sqlite3_finalize(statement);
+  return 1;
+ }
+
+ while( (failed == 0) && ((code = sqlite3_step(statement)) == SQLITE_ROW) )
+ {
+  if( (sqlite3_column_type(statement, 0) != SQLITE_INTEGER) ||
+      (sqlite3_column_type(statement, 1) != SQLITE_TEXT) ||
+      (sqlite3_column_type(statement, 2) != SQLITE_TEXT) ||
+      (sqlite3_column_type(statement, 3) != SQLITE_INTEGER) ||
+      (sqlite3_column_type(statement, 4) != SQLITE_INTEGER) )
+  {
+   fprintf(stderr, "%s: fold_test_history(): unexpected column type in scores\n",
+           ctx->error_prefix);
+   failed = 1;
+   break;
+  }
 
-    sqlite3_finalize(statement);
+  failed = apply_test_history_update(ctx, &update, sqlite3_column_int(statement, 0),
+                                     (const char *) sqlite3_column_text(statement, 1),
+                                     (const char *) sqlite3_column_text(statement, 2),
+                                     sqlite3_column_int(statement, 3),
+                                     sqlite3_column_int(statement, 4));
+  (*n_scores)++;
+ }
 
-    sql = "SELECT test_id FROM tests WHERE suite_id = ? AND name = ?;";
+ if( (failed == 0) && (code != SQLITE_DONE) )
+ {
+  fprintf(stderr, "%s: fold_test_history(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  failed = 1;
+ }
 
-    if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
-    {
-     fprintf(stderr, "%s: file_test_results(): sqlite3_prepare(%s) failed, '%s'\n",
-             ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
-     return 1;
-    }
+ close_test_history_update(&update);
+ sqlite3_finalize(statement);
+ return failed;
+}
 
-    if(sqlite3_bind_int(statement, 1, suite_id) != SQLITE_OK)
-    {
-     fprintf(stderr, "%s: file_test_results(): sqlite3_bind_int() failed, '%s'\n",
-             ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-     sqlite3_finalize(statement);
-     return 1;
-    }
+/* projects created before test_history get the table, filled from their scores, on first use */
+int upgrade_test_history_table(struct buildmatrix_context *ctx)
+{
+ char *errmsg;
+ int exists, n_scores, failed = 0;
 
-    if(sqlite3_bind_text(statement, 2, results->suites[suite_i].tests[test_i].name, 
-                         strlen(results->suites[suite_i].tests[test_i].name), 
-                         SQLITE_TRANSIENT) != SQLITE_OK)
-    {
-     fprintf(stderr, "%s: file_test_results(): sqlite3_bind_text() failed, '%s'\n",
-             ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-     sqlite3_finalize(statement);
-     return 1;
-    }
+ if(test_history_table_exists(ctx, &exists))
+  return 1;
 
-    while((code = sqlite3_step(statement)) == SQLITE_ROW)
-    {
-     if(sqlite3_column_type(statement, 0) != SQLITE_INTEGER)
-     {
-      fprintf(stderr, "%s: file_test_results(): tests.test_id is not an integer\n",
-              ctx->error_prefix);
-      sqlite3_finalize(statement);
-      return 1;
-     }
-     test_id = sqlite3_column_int(statement, 0);
-    }
+ if(exists)
+  return 0;
 
-    if(code != SQLITE_DONE)
-    {
-     fprintf(stderr, "%s: file_test_results(): sqlite3_step() failed, '%s'\n",
-             ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-     sqlite3_finalize(statement);
-     return 1;
-    }
+ if(ctx->verbose)
+  fprintf(stderr, "%s: adding test_history table\n", ctx->error_prefix);
 
-    sqlite3_finalize(statement);
+ /* a savepoint works both inside a submission's transaction and on its own */
+ if(sqlite3_exec(ctx->db_ctx, "SAVEPOINT upgrade_test_history;", NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: upgrade_test_history_table(): sqlite3_exec(\"SAVEPOINT\"): '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
 
-    if(test_id == -1)
-    {
-     fprintf(stderr, "%s: file_test_results(): failed\n", ctx->error_prefix);
-     return 1;
-    }
+ if(create_test_history_table(ctx))
+  failed = 1;
 
-    if(ctx->verbose > 1)
-     fprintf(stderr, 
-             "%s: file_test_results(): inserted %s.%s now test_id %d\n", ctx->error_prefix, 
-             results->suites[suite_i].name, results->suites[suite_i].tests[test_i].name, test_id);
-   }
+ if( (failed == 0) &&
+     (fold_test_history(ctx, "SELECT s.test_id, IFNULL(b.job, ''), IFNULL(b.branch, ''), "
+                             "s.build_id, s.result FROM main.scores s "
+                             "JOIN main.builds b ON b.build_id = s.build_id "
+                             "ORDER BY s.build_id;", &n_scores)) )
+  failed = 1;
 
-   if(results->suites[suite_i].tests[test_i].data != NULL)
-    sql = "INSERT INTO scores (build_id, test_id, result, data) VALUES (?, ?, ?, ?);";
-   else
-    sql = "INSERT INTO scores (build_id, test_id, result) VALUES (?, ?, ?);";
+ if(failed)
+ {
+  sqlite3_exec(ctx->db_ctx, "ROLLBACK TO upgrade_test_history; RELEASE upgrade_test_history;",
+               NULL, NULL, NULL);
+  return 1;
+ }
 
-   if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
-   {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_prepare(%s) failed, '%s'\n",
-            ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
-    return 1;
-   }
+ if(sqlite3_exec(ctx->db_ctx, "RELEASE upgrade_test_history;", NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: upgrade_test_history_table(): sqlite3_exec(\"RELEASE\"): '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
+ }
 
-   if(sqlite3_bind_int(statement, 1, ctx->build_id) != SQLITE_OK)
-   {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_bind_int() failed, '%s'\n",
-            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-    sqlite3_finalize(statement);
-    return 1;
-   }
+ if(ctx->verbose)
+  fprintf(stderr, "%s: test_history filled from %d score(s)\n", ctx->error_prefix, n_scores);
 
-   if(sqlite3_bind_int(statement, 2, test_id) != SQLITE_OK)
-   {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_bind_int() failed, '%s'\n",
-            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-    sqlite3_finalize(statement);
-    return 1;
-   }
+ return 0;
+}
 
-   if(sqlite3_bind_int(statement, 3, results->suites[suite_i].tests[test_i].result) != SQLITE_OK)
-   {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_bind_int() failed, '%s'\n",
-            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-    sqlite3_finalize(statement);
-    return 1;
-   }
+/* Takes the builds in the temp table build_set out of test_history. Must run before their
+   builds and scores rows are deleted, inside the caller's transaction. The removed scores come
+   off the counts. A flip is un-applied by looking at each removed score's neighbours in its
+   job and branch: the changes next to it go, and where a run of removed builds closes up the
+   kept builds on either side may make a new one. last_build_id and last_failure_build_id
+   only move when they point at a removed build. All of this walks the builds_job_branch
+   index from the removed builds, so the cost doesn't grow with the length of the history. */
+int forget_test_history(struct buildmatrix_context *ctx)
+{
+ char *errmsg;
 
-   if(results->suites[suite_i].tests[test_i].data != NULL)
-   {
-    if(sqlite3_bind_text(statement, 4, results->suites[suite_i].tests[test_i].data, 
-                          strlen(results->suites[suite_i].tests[test_i].data), 
-                          SQLITE_TRANSIENT) != SQLITE_OK)
-    {
-     fprintf(stderr, "%s: file_test_results(): sqlite3_bind_text() failed, '%s'\n",
-             ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-     sqlite3_finalize(statement);
-     return 1;
-    }
-   }
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: forget_test_history()\n", ctx->error_prefix);
 
-   code = sqlite3_step(statement);
-   if(code != SQLITE_DONE)
-   {
-    fprintf(stderr, "%s: file_test_results(): sqlite3_step() failed, '%s'\n",
-            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-    sqlite3_finalize(statement);
-    close_database(ctx);
-    return 1;
-   }
+ if(upgrade_test_history_table(ctx))
+  return 1;
 
-   sqlite3_finalize(statement);
-  }
+ if(sqlite3_exec(ctx->db_ctx, 
+                 "CREATE TEMP TABLE IF NOT EXISTS forget_scores (test_id INTEGER, job TEXT, "
+                                                                "branch TEXT, build_id INTEGER, "
+                                                                "result INTEGER, "
+                                                                "prev_build_id INTEGER, "
+                                                                "next_build_id INTEGER, "
+                                                                "next_kept_build_id INTEGER, "
+                                                                "flips INTEGER); "
+                 "CREATE TEMP TABLE IF NOT EXISTS forget_history (test_id INTEGER, job TEXT, "
+                                                                 "branch TEXT, passed INTEGER, "
+                                                                 "failed INTEGER, "
+                                                                 "incomplete INTEGER, "
+                                                                 "flips INTEGER, "
+                                                                 "PRIMARY KEY (test_id, job, branch)); "
+                 "DELETE FROM forget_scores; "
+                 "DELETE FROM forget_history; "
+
+                 "INSERT INTO forget_scores (test_id, job, branch, build_id, result) "
+                 "SELECT s.test_id, IFNULL(b.job, ''), IFNULL(b.branch, ''), s.build_id, s.result "
+                 "FROM build_set r JOIN main.scores s ON s.build_id = r.build_id "
+                 "JOIN main.builds b ON b.build_id = s.build_id; "
+
+                 /* the nearest builds before and after with a score for the same test, and the
+                    nearest one after that stays */
+                 "UPDATE forget_scores SET "
+                 "prev_build_id = (SELECT b.build_id FROM main.builds b JOIN main.scores s "
+                                  "ON s.build_id = b.build_id AND s.test_id = forget_scores.test_id "
+                                  "WHERE b.job = forget_scores.job AND b.branch = forget_scores.branch "
+                                  "AND b.build_id < forget_scores.build_id "
+                                  "ORDER BY b.build_id DESC LIMIT 1), "
+                 "next_build_id = (SELECT b.build_id FROM main.builds b JOIN main.scores s "
+                                  "ON s.build_id = b.build_id AND s.test_id = forget_scores.test_id "
+                                  "WHERE b.job = forget_scores.job AND b.branch = forget_scores.branch "
+                                  "AND b.build_id > forget_scores.build_id "
+                                  "ORDER BY b.build_id LIMIT 1), "
+                 "next_kept_build_id = (SELECT b.build_id FROM main.builds b JOIN main.scores s "
+                                       "ON s.build_id = b.build_id AND s.test_id = forget_scores.test_id "
+                                       "WHERE b.job = forget_scores.job AND b.branch = forget_scores.branch "
+                                       "AND b.build_id > forget_scores.build_id "
+                                       "AND b.build_id NOT IN (SELECT build_id FROM build_set) "
+                                       "ORDER BY b.build_id LIMIT 1); "
+
+                 /* every change with a removed build on either end is counted once, as the one
+                    ending at it or, if the next build stays, the one starting at it. The first
+                    removed build of a run adds the change between the builds around the run. */
+                 "UPDATE forget_scores SET flips = 0 "
+                 "- IFNULL((SELECT s.result != forget_scores.result FROM main.scores s "
+                           "WHERE s.build_id = forget_scores.prev_build_id "
+                           "AND s.test_id = forget_scores.test_id), 0) "
+                 "- CASE WHEN next_build_id IN (SELECT build_id FROM build_set) THEN 0 "
+                 "ELSE IFNULL((SELECT s.result != forget_scores.result FROM main.scores s "
+                              "WHERE s.build_id = forget_scores.next_build_id "
+                              "AND s.test_id = forget_scores.test_id), 0) END "
+                 "+ CASE WHEN prev_build_id IN (SELECT build_id FROM build_set) THEN 0 "
+                 "ELSE IFNULL((SELECT p.result != n.result FROM main.scores p, main.scores n "
+                              "WHERE p.build_id = forget_scores.prev_build_id "
+                              "AND p.test_id = forget_scores.test_id "
+                              "AND n.build_id = forget_scores.next_kept_build_id "
+                              "AND n.test_id = forget_scores.test_id), 0) END; "
+
+                 "INSERT INTO forget_history "
+                 "SELECT test_id, job, branch, SUM(result = 1), SUM(result = 2), SUM(result = 3), "
+                 "SUM(flips) FROM forget_scores GROUP BY test_id, job, branch; "
+
+                 /* every right hand side sees the row as it was before this update */
+                 "UPDATE main.test_history SET "
+                 "passed = passed - (SELECT h.passed FROM forget_history h "
+                                    "WHERE h.test_id = test_history.test_id "
+                                    "AND h.job = test_history.job AND h.branch = test_history.branch), "
+                 "failed = failed - (SELECT h.failed FROM forget_history h "
+                                    "WHERE h.test_id = test_history.test_id "
+                                    "AND h.job = test_history.job AND h.branch = test_history.branch), "
+                 "incomplete = incomplete - (SELECT h.incomplete FROM forget_history h "
+                                            "WHERE h.test_id = test_history.test_id "
+                                            "AND h.job = test_history.job "
+                                            "AND h.branch = test_history.branch), "
+                 "flips = flips + (SELECT h.flips FROM forget_history h "
+                                  "WHERE h.test_id = test_history.test_id "
+                                  "AND h.job = test_history.job AND h.branch = test_history.branch), "
+                 "last_build_id = CASE WHEN last_build_id IN (SELECT build_id FROM build_set) "
+                 "THEN (SELECT b.build_id FROM main.builds b JOIN main.scores s "
+                       "ON s.build_id = b.build_id AND s.test_id = test_history.test_id "
+                       "WHERE b.job = test_history.job AND b.branch = test_history.branch "
+                       "AND b.build_id NOT IN (SELECT build_id FROM build_set) "
+                       "ORDER BY b.build_id DESC LIMIT 1) ELSE last_build_id END, "
+                 "last_result = CASE WHEN last_build_id IN (SELECT build_id FROM build_set) "
+                 "THEN (SELECT s.result FROM main.builds b JOIN main.scores s "
+                       "ON s.build_id = b.build_id AND s.test_id = test_history.test_id "
+                       "WHERE b.job = test_history.job AND b.branch = test_history.branch "
+                       "AND b.build_id NOT IN (SELECT build_id FROM build_set) "
+                       "ORDER BY b.build_id DESC LIMIT 1) ELSE last_result END, "
+                 "last_failure_build_id = "
+                 "CASE WHEN last_failure_build_id IN (SELECT build_id FROM build_set) "
+                 "THEN (SELECT b.build_id FROM main.builds b JOIN main.scores s "
+                       "ON s.build_id = b.build_id AND s.test_id = test_history.test_id "
+                       "WHERE b.job = test_history.job AND b.branch = test_history.branch "
+                       "AND s.result = 2 AND b.build_id NOT IN (SELECT build_id FROM build_set) "
+                       "ORDER BY b.build_id DESC LIMIT 1) ELSE last_failure_build_id END "
+                 "WHERE rowid IN (SELECT t.rowid FROM forget_history h JOIN main.test_history t "
+                                 "ON t.test_id = h.test_id AND t.job = h.job AND t.branch = h.branch); "
+
+                 /* no build left with a score for it */
+                 "DELETE FROM main.test_history "
+                 "WHERE rowid IN (SELECT t.rowid FROM forget_history h JOIN main.test_history t "
+                                 "ON t.test_id = h.test_id AND t.job = h.job AND t.branch = h.branch) "
+                 "AND last_build_id IS NULL;",
+                 NULL, NULL, &errmsg) != SQLITE_OK)
+ {
+  fprintf(stderr, "%s: forget_test_history(): could not update test_history, '%s'\n",
+          ctx->error_prefix, errmsg);
+  sqlite3_free(errmsg);
+  return 1;
  }
 
  return 0;
 }
 
-int pull_test_results(struct buildmatrix_context *ctx, struct test_results **results)
+/* passes a struct test_history_data for each test_history row, honoring the job and branch
+   name, to strategy */
+int read_test_history(struct buildmatrix_context *ctx, struct iterative_strategy *strategy)
 {
- const char *sql, *suite_name, *test_name, *data;
- char *last_suite_name;
+ char *sql;
  struct sqlite3_stmt *statement = NULL;
- int code, result, n_suites = 0, n_tests = 0, string_space = 0, length, next_suite;
- struct test_results *r;
- struct test *tests;
- size_t allocation_size;
- void *base_ptr = NULL;
- char *strings_base_ptr; 
-
- if(ctx->verbose)
-  fprintf(stderr, "%s: pull_test_results()\n", ctx->error_prefix);
+ struct test_history_data data;
+ int i, code, failed = 0;
 
- if(ctx->build_id < 1)
- {
-  fprintf(stderr, "%s: pull_test_results(): no build_id in context\n", ctx->error_prefix);
-  return 1;
- }
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: read_test_history()\n", ctx->error_prefix);
 
- if(open_database(ctx))
+ if(upgrade_test_history_table(ctx))
   return 1;
 
- sql = "SELECT b.suite_name, b.test_name, scores.result, scores.data FROM scores JOIN "
-           "(SELECT tests.test_id, suites.name AS suite_name, tests.name AS test_name from tests "
-                  " JOIN suites ON tests.suite_id = suites.suite_id) AS b "
-       "ON scores.test_id = b.test_id WHERE build_id = ?;"; 
-
+ sql = "SELECT h.test_id, s.name, t.name, h.job, h.branch, h.passed, h.failed, h.incomplete, "
+       "h.last_result, h.flips, h.last_failure_build_id, b.unique_identifier "
+       "FROM main.test_history h JOIN main.tests t ON t.test_id = h.test_id "
+       "JOIN main.suites s ON s.suite_id = t.suite_id "
+       "LEFT JOIN main.builds b ON b.build_id = h.last_failure_build_id "
+       "WHERE (?1 IS NULL OR h.job = ?1) AND (?2 IS NULL OR h.branch = ?2) "
+       "ORDER BY s.name, t.name, h.job, h.branch;";
 
  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
  {
-  fprintf(stderr, "%s: pull_test_results(): sqlite3_prepare(%s) failed, '%s'\n",
-          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
+  fprintf(stderr, "%s: read_test_history(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
   return 1;
  }
 
- if(sqlite3_bind_int(statement, 1, ctx->build_id) != SQLITE_OK)
+ if( ((ctx->job_name != NULL) &&
+      (sqlite3_bind_text(statement, 1, ctx->job_name, strlen(ctx->job_name),
+                         SQLITE_TRANSIENT) != SQLITE_OK)) ||
+     ((ctx->branch_name != NULL) &&
+      (sqlite3_bind_text(statement, 2, ctx->branch_name, strlen(ctx->branch_name),
+                         SQLITE_TRANSIENT) != SQLITE_OK)) )
  {
-  fprintf(stderr, "%s: pull_test_results(): sqlite3_bind_int() failed, '%s'\n",
+  fprintf(stderr, "%s: read_test_history(): sqlite3_bind_text() failed, '%s'\n",
           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
   sqlite3_finalize(statement);
   return 1;
  }
 
- /* first pass just verifies types, and counts the space to allocate */
- last_suite_name = NULL;
- while((code = sqlite3_step(statement)) == SQLITE_ROW)
+ if(strategy->start(ctx, strategy->strategy_context, NULL))
  {
-  if(sqlite3_column_type(statement, 0) != SQLITE_TEXT)
-  {
-   fprintf(stderr, "%s: pull_test_results(): suites.name is not TEXT\n",
-           ctx->error_prefix);
-   sqlite3_finalize(statement);
-   close_database(ctx);
-   return 1;
-  }
-  suite_name = (const char *) sqlite3_column_text(statement, 0);
-
-  if(sqlite3_column_type(statement, 1) != SQLITE_TEXT)
-  {
-   fprintf(stderr, "%s: pull_test_results(): tests.name is not TEXT\n",
-           ctx->error_prefix);
-   sqlite3_finalize(statement);
-   close_database(ctx);
-   return 1;
-  }
-  test_name = (const char *) sqlite3_column_text(statement, 1);
-
-  if(sqlite3_column_type(statement, 2) != SQLITE_INTEGER)
-  {
-   fprintf(stderr, "%s: load_test_results(): tests.result is not an integer\n",
-           ctx->error_prefix);
-   sqlite3_finalize(statement);
-   return 1;
-  }
-  result = sqlite3_column_int(statement, 2);
-
-  if( (result < 1) || (result > 3) )
-  {
-   fprintf(stderr, "%s: pull_test_results(): tests.result is unknown value\n",
-           ctx->error_prefix);
-   sqlite3_finalize(statement);
-   close_database(ctx);
-   return 1;
-  }
+  sqlite3_finalize(statement);
+  return 1;
+ }
 
-  if((code = sqlite3_column_type(statement, 3)) != SQLITE_NULL)
+ while( (failed == 0) && ((code = sqlite3_step(statement)) == SQLITE_ROW) )
+ {
+  for(i=0; i<10; i++)
   {
-   if(code != SQLITE_TEXT)
+   if(sqlite3_column_type(statement, i) != (((i > 0) && (i < 5)) ? SQLITE_TEXT : SQLITE_INTEGER))
    {
-    fprintf(stderr, "%s: pull_test_results(): tests.name is not TEXT\n",
+    fprintf(stderr, "%s: read_test_history(): unexpected column type in test_history\n",
             ctx->error_prefix);
-    sqlite3_finalize(statement);
-    close_database(ctx);
-    return 1;
+    failed = 1;
    }
-   data = (const char *) sqlite3_column_text(statement, 3);
-  } else {
-   data = NULL;
   }
 
-  string_space += strlen(test_name) + 1;
-  n_tests++;
+  if(failed)
+   break;
 
-  if(data != NULL)
-   string_space += strlen(data) + 1;
+  data.test_id = sqlite3_column_int(statement, 0);
+  data.suite = (const char *) sqlite3_column_text(statement, 1);
+  data.test = (const char *) sqlite3_column_text(statement, 2);
+  data.job_name = (const char *) sqlite3_column_text(statement, 3);
+  data.branch = (const char *) sqlite3_column_text(statement, 4);
+  data.passed = sqlite3_column_int(statement, 5);
+  data.failed = sqlite3_column_int(statement, 6);
+  data.incompleted = sqlite3_column_int(statement, 7);
+  data.last_result = sqlite3_column_int(statement, 8);
+  data.flips = sqlite3_column_int(statement, 9);
+  data.last_failure_build_id = sqlite3_column_int(statement, 10);
+
+  if(sqlite3_column_type(statement, 11) == SQLITE_TEXT)
+   data.last_failure = (const char *) sqlite3_column_text(statement, 11);
+  else
+   data.last_failure = NULL;
 
-  if(last_suite_name == NULL)
-  {
-   last_suite_name = strdup(suite_name);
-   n_suites++;
-   string_space += strlen(suite_name) + 1;
-  } else {
-   if(strcmp(last_suite_name, suite_name) != 0)
-   {
-    free(last_suite_name);
-    last_suite_name = strdup(suite_name);
-    string_space += strlen(suite_name) + 1;
-    n_suites++;
-   }
-  }
+  failed = strategy->iterative(ctx, strategy->strategy_context, &data);
  }
 
- if(last_suite_name != NULL)
-  free(last_suite_name);
-
- if(code != SQLITE_DONE)
+ if( (failed == 0) && (code != SQLITE_DONE) )
  {
-  fprintf(stderr, "%s: pull_test_results() sqlite3_step() failed, '%s'\n",
+  fprintf(stderr, "%s: read_test_history(): sqlite3_step() failed, '%s'\n",
           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-  sqlite3_finalize(statement);
-  close_database(ctx);
-  return 1;
+  failed = 1;
  }
 
- if(n_suites == 0)
- {
-  if(ctx->verbose)
-   fprintf(stderr, "%s: pull_test_results() no test scores found for:"
-           " job \"%s\", branch \"%s\", unique identifier \"%s\", build_id %d\n",
-           ctx->error_prefix, ctx->job_name, ctx->branch_name, ctx->unique_identifier, ctx->build_id);
+ sqlite3_finalize(statement);
 
-  close_database(ctx);
+ if(failed)
+  return 1;
 
-  *results = NULL;
+ return strategy->done(ctx, strategy->strategy_context, NULL);
+}
 
-  return 0;
- }
+/* Compares the scores of two builds. Both are read in test_id order, which the scores
+   (build_id, test_id) index gives without sorting, and merged, so only tests whose result
+   changed, or that only one build has, reach the strategy. done gets the totals of each kind
+   of change, indexed by the TEST_DIFF_* values. */
+int read_test_diff(struct buildmatrix_context *ctx, const char *from_identifier,
+                   const char *to_identifier, struct iterative_strategy *strategy)
+{
+ char *sql;
+ const char *identifiers[2];
+ struct sqlite3_stmt *lookup = NULL, *scores[2] = { NULL, NULL };
+ struct test_diff_data data;
+ int build_ids[2], have[2], test_ids[2], results[2], totals[5], i, code, failed = 0;
 
- allocation_size = sizeof(struct suite) * n_suites;
- allocation_size += sizeof(struct test) * n_tests;
- allocation_size += string_space;
- allocation_size += sizeof(struct test_results);
- 
- if((base_ptr = malloc(allocation_size)) == NULL)
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: read_test_diff(%s, %s)\n", 
+          ctx->error_prefix, from_identifier, to_identifier);
+
+ identifiers[0] = from_identifier;
+ identifiers[1] = to_identifier;
+
+ sql = "SELECT build_id FROM main.builds WHERE unique_identifier = ?;";
+
+ if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &lookup, NULL) != SQLITE_OK)
  {
-  fprintf(stderr, "%s: malloc(%d) failed: %s\n",
-          ctx->error_prefix, (int) allocation_size, strerror(errno));
-  sqlite3_finalize(statement);
-  close_database(ctx);
-  return 1;    
+  fprintf(stderr, "%s: read_test_diff(): sqlite3_prepare(%s) failed, '%s'\n",
+          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  return 1;
  }
 
- r = (struct test_results *) base_ptr;
- r->allocation_size = allocation_size;
- r->n_suites = n_suites;
- r->n_tests = n_tests;
+ for(i=0; i<2; i++)
+ {
+  sqlite3_reset(lookup);
+  build_ids[i] = -1;
 
- base_ptr += sizeof(struct test_results);
- r->suites = (struct suite *) base_ptr;
+  if(sqlite3_bind_text(lookup, 1, identifiers[i], strlen(identifiers[i]), 
+                       SQLITE_TRANSIENT) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: read_test_diff(): sqlite3_bind_text() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   sqlite3_finalize(lookup);
+   return 1;
+  }
 
- base_ptr += (sizeof(struct suite) * n_suites);
- tests = (struct test *) base_ptr;
+  if( ((code = sqlite3_step(lookup)) == SQLITE_ROW) &&
+      (sqlite3_column_type(lookup, 0) == SQLITE_INTEGER) )
+   build_ids[i] = sqlite3_column_int(lookup, 0);
 
- base_ptr += (sizeof(struct test) * n_tests);
- strings_base_ptr = (char *) base_ptr;
+  if(build_ids[i] < 1)
+  {
+   fprintf(stderr, "%s: read_test_diff(): could not find build %s.\n",
+           ctx->error_prefix, identifiers[i]);
+   sqlite3_finalize(lookup);
+   return 1;
+  }
+ }
 
- n_suites = 0;
- n_tests = 0;
+ sqlite3_finalize(lookup);
 
- r->string_space = string_space;
+ sql = "SELECT s.test_id, s.result, su.name, t.name FROM main.scores s "
+       "JOIN main.tests t ON t.test_id = s.test_id "
+       "JOIN main.suites su ON su.suite_id = t.suite_id "
+       "WHERE s.build_id = ? ORDER BY s.test_id;";
 
- if(sqlite3_reset(statement) != SQLITE_OK)
+ for(i=0; i<2; i++)
  {
-  fprintf(stderr, "%s: pull_test_results(): sqlite3_reset(%s) failed, '%s'\n",
-          ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx)); 
-  return 1;
+  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &(scores[i]), NULL) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: read_test_diff(): sqlite3_prepare(%s) failed, '%s'\n",
+           ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+   failed = 1;
+   break;
+  }
+
+  if(sqlite3_bind_int(scores[i], 1, build_ids[i]) != SQLITE_OK)
+  {
+   fprintf(stderr, "%s: read_test_diff(): sqlite3_bind_int() failed, '%s'\n",
+           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   failed = 1;
+   break;
+  }
  }
 
- last_suite_name = NULL;
- string_space = 0;
- while((code = sqlite3_step(statement)) == SQLITE_ROW)
- {
-  suite_name = (const char *) sqlite3_column_text(statement, 0);
-  test_name = (const char *) sqlite3_column_text(statement, 1);
-  result = sqlite3_column_int(statement, 2);
+ if(failed == 0)
+  failed = strategy->start(ctx, strategy->strategy_context, NULL);
 
-  if(sqlite3_column_type(statement, 3) != SQLITE_NULL)
-   data = (const char *) sqlite3_column_text(statement, 3);
-  else
-   data = NULL;
+ memset(totals, 0, sizeof(totals));
+ have[0] = 0;
+ have[1] = 0;
 
-  next_suite = 0;
-  if(last_suite_name == NULL)
+ /* have[i] is 1 while scores[i] sits on a row not yet merged, and 2 once it is exhausted */
+ while(failed == 0)
+ {
+  for(i=0; (failed == 0) && (i<2); i++)
   {
-   last_suite_name = strdup(suite_name);
-   next_suite = 1;
-  } else {
-   if(strcmp(last_suite_name, suite_name) != 0)
+   if(have[i] != 0)
+    continue;
+
+   if((code = sqlite3_step(scores[i])) == SQLITE_DONE)
    {
-    free(last_suite_name);
-    last_suite_name = strdup(suite_name);
-    n_suites++;
-    next_suite = 1;
+    have[i] = 2;
+    continue;
    }
-  }
-
-  if(next_suite)
-  {
-   length = strlen(suite_name) + 1;
-
-   r->suites[n_suites].n_tests = 0;
-   r->suites[n_suites].tests = &(tests[n_tests]);
 
-   r->suites[n_suites].name = strings_base_ptr;
-   strings_base_ptr += length;
-   string_space += length;
+   if(code != SQLITE_ROW)
+   {
+    fprintf(stderr, "%s: read_test_diff(): sqlite3_step() failed, '%s'\n",
+            ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+    failed = 1;
+    break;
+   }
 
-   if(r->string_space < string_space)
+   if( (sqlite3_column_type(scores[i], 0) != SQLITE_INTEGER) ||
+       (sqlite3_column_type(scores[i], 1) != SQLITE_INTEGER) ||
+       (sqlite3_column_type(scores[i], 2) != SQLITE_TEXT) ||
+       (sqlite3_column_type(scores[i], 3) != SQLITE_TEXT) )
    {
-    fprintf(stderr, "%s: pull_test_results() string_space indicates problem\n",
+    fprintf(stderr, "%s: read_test_diff(): unexpected column type in scores\n",
             ctx->error_prefix);
-    sqlite3_finalize(statement);
-    close_database(ctx);
-    return 1;
+    failed = 1;
+    break;
    }
 
-   snprintf(r->suites[n_suites].name, length, "%s", suite_name);
+   test_ids[i] = sqlite3_column_int(scores[i], 0);
+   results[i] = sqlite3_column_int(scores[i], 1);
+   have[i] = 1;
   }
 
-  length = strlen(test_name) + 1;
-  r->suites[n_suites].tests[r->suites[n_suites].n_tests].result = result;
-  r->suites[n_suites].tests[r->suites[n_suites].n_tests].name = strings_base_ptr;
-  strings_base_ptr += length;
-  string_space += length;
-
-  if(r->string_space < string_space)
-  {
-   fprintf(stderr, "%s: pull_test_results() string_space indicates problem\n",
-           ctx->error_prefix);
-   sqlite3_finalize(statement);
-   close_database(ctx);
-   return 1;
-  }
+  if( (failed) || ((have[0] == 2) && (have[1] == 2)) )
+   break;
 
-  snprintf(r->suites[n_suites].tests[r->suites[n_suites].n_tests].name, length, "%s", test_name);
+  data.old_result = 0;
+  data.new_result = 0;
 
-  if(data == NULL)
+  if( (have[1] == 2) || ((have[0] == 1) && (test_ids[0] < test_ids[1])) )
   {
-   r->suites[n_suites].tests[r->suites[n_suites].n_tests].data = NULL;
+   data.change = TEST_DIFF_REMOVED;
+   data.old_result = results[0];
+   i = 0;
+   have[0] = 0;
+  } else if( (have[0] == 2) || (test_ids[1] < test_ids[0]) ) {
+   data.change = TEST_DIFF_ADDED;
+   data.new_result = results[1];
+   i = 1;
+   have[1] = 0;
   } else {
-   r->suites[n_suites].tests[r->suites[n_suites].n_tests].data = strings_base_ptr;
-   length = strlen(data) + 1;
-   strings_base_ptr += length;
-   string_space += length;
-  
-   if(r->string_space < string_space)
-   {
-    fprintf(stderr, "%s: pull_test_results() string_space indicates problem\n",
-            ctx->error_prefix);
-    sqlite3_finalize(statement);
-    close_database(ctx);
-    return 1;
-   }
-
-   snprintf(r->suites[n_suites].tests[r->suites[n_suites].n_tests].data, length, "%s", data);
+   have[0] = 0;
+   have[1] = 0;
+
+   if(results[0] == results[1])
+    continue;
+
+   data.old_result = results[0];
+   data.new_result = results[1];
+   if(results[1] == 1)
+    data.change = TEST_DIFF_PASSING;
+   else if(results[1] == 2)
+    data.change = TEST_DIFF_FAILING;
+   else
+    data.change = TEST_DIFF_INCOMPLETE;
+   i = 1;
   }
 
-  r->suites[n_suites].n_tests++;
-  n_tests++;
+  data.test_id = test_ids[i];
+  data.suite = (const char *) sqlite3_column_text(scores[i], 2);
+  data.test = (const char *) sqlite3_column_text(scores[i], 3);
+  totals[data.change]++;
+
+  failed = strategy->iterative(ctx, strategy->strategy_context, &data);
  }
 
- if(code != SQLITE_DONE)
+ for(i=0; i<2; i++)
  {
-  fprintf(stderr, "%s: pull_test_results() sqlite3_step() failed, '%s'\n",
-          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-  sqlite3_finalize(statement);
-  close_database(ctx);
-  return 1;
+  if(scores[i] != NULL)
+   sqlite3_finalize(scores[i]);
  }
 
- sqlite3_finalize(statement);
- close_database(ctx);
-
- *results = r;
+ if(failed)
+  return 1;
 
- return 0;
+ return strategy->done(ctx, strategy->strategy_context, totals);
 }
-
@@ -22,47 +22,81 @@
 #include "prototypes.h"
 
 
-int resolve_user_id(struct buildmatrix_context *ctx)
-{
- const char *sql, *user;
- char *value;
- int code, create = 0;
- struct sqlite3_stmt *statement = NULL;
+/* Everything the server needs to know about the connected user is read with one query the
+   first time it is asked for, and kept in the context for the rest of the connection.
+   Authorization checks are then just a test of the cached mode bitmask. Anything in this
+   process that changes users or aliases calls invalidate_identity_cache(). */
 
- if(ctx->verbose > 1)
-  fprintf(stderr, "%s: resolve_user_id(%s)\n",
-          ctx->error_prefix, ctx->user);
+void invalidate_identity_cache(struct buildmatrix_context *ctx)
+{
+ if(ctx->identity_key != NULL)
+  free(ctx->identity_key);
+
+ if(ctx->identity_name != NULL)
+  free(ctx->identity_name);
+
+ ctx->identity_key = NULL;
+ ctx->identity_name = NULL;
+ ctx->identity_cached = 0;
+ ctx->identity_user_id = -1;
+ ctx->identity_mode_bitmask = 0;
+ ctx->identity_posix_uid = -1;
+}
 
- ctx->user_id = -1;
+/* true when the cache holds whoever ctx->user (or ctx->user_id once resolved) refers to */
+int identity_cache_matches(struct buildmatrix_context *ctx)
+{
+ if(ctx->identity_cached == 0)
+  return 0;
 
  if(ctx->user == NULL)
- {
-  fprintf(stderr, "%s: resolve_user_id(): no user name\n",
-           ctx->error_prefix);
+  return 0;
+
+ if( (strcmp(ctx->user, ctx->identity_key) == 0) ||
+     (strcmp(ctx->user, ctx->identity_name) == 0) )
   return 1;
- }
+
+ return 0;
+}
+
+/* an alias wins over a user of the same name, same as it always has */
+int load_identity(struct buildmatrix_context *ctx)
+{
+ const char *sql;
+ int code;
+ struct sqlite3_stmt *statement = NULL;
+
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: load_identity(%s)\n", ctx->error_prefix, ctx->user);
+
+ invalidate_identity_cache(ctx);
 
  if(open_database(ctx))
   return 1;
 
- /* first see check the aliases table */
-
- sql = "SELECT user_id FROM aliases WHERE name = ?;";
+ sql = "SELECT user_id, name, mode_bitmask, posix_uid, 1 AS by_alias FROM users "
+       "WHERE user_id = (SELECT user_id FROM aliases WHERE name = ?1) "
+       "UNION ALL "
+       "SELECT user_id, name, mode_bitmask, posix_uid, 0 AS by_alias FROM users "
+       "WHERE name = ?1 "
+       "ORDER BY by_alias DESC LIMIT 1;";
 
  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
  {
   fprintf(stderr, 
-          "%s: resolve_user_id(): sqlite3_prepare(%s) failed, '%s'\n",
+          "%s: load_identity(): sqlite3_prepare(%s) failed, '%s'\n",
           ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
+  close_database(ctx);
   return 1;
  }
 
  if(sqlite3_bind_text(statement, 1, ctx->user, strlen(ctx->user),
                       SQLITE_TRANSIENT) != SQLITE_OK)
  {
-  fprintf(stderr, "%s: resolve_user_id(): sqlite3_bind_text() failed, '%s'\n",
+  fprintf(stderr, "%s: load_identity(): sqlite3_bind_text() failed, '%s'\n",
           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
   sqlite3_finalize(statement);
+  close_database(ctx);
   return 1;
  }
 
@@ -70,99 +104,88 @@ int resolve_user_id(struct buildmatrix_context *ctx)
 
  if(code == SQLITE_ROW)
  {
-  if(sqlite3_column_type(statement, 0) != SQLITE_INTEGER)
+  if( (sqlite3_column_type(statement, 0) != SQLITE_INTEGER) ||
+      (sqlite3_column_type(statement, 1) != SQLITE_TEXT) )
   {
-   fprintf(stderr, "%s: resolve_user_id(): aliases.user_id is not an integer\n",
+   fprintf(stderr, "%s: load_identity(): users.user_id or users.name has the wrong type\n",
            ctx->error_prefix);
    sqlite3_finalize(statement);
+   close_database(ctx);
    return 1;
   }
 
-  ctx->user_id = sqlite3_column_int(statement, 0);
- }
-
- sqlite3_finalize(statement);
-
- if(ctx->user_id > 0)
- {
-  /* the alias gave us the user_id, now we need the user name */  
-  sql = "SELECT name FROM users WHERE user_id = ?";
-
-  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
+  if( ((ctx->identity_key = strdup(ctx->user)) == NULL) ||
+      ((ctx->identity_name = strdup((const char *) sqlite3_column_text(statement, 1))) == NULL) )
   {
-   fprintf(stderr, 
-           "%s: resolve_user_id(): sqlite3_prepare(%s) failed, '%s'\n",
-           ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
-   return 1;
-  }
-
-  if(sqlite3_bind_int(statement, 1, ctx->user_id) != SQLITE_OK)
-  {
-   fprintf(stderr, "%s: resolve_user_id(): sqlite3_bind_int() failed, '%s'\n",
-           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+   fprintf(stderr, "%s: load_identity(): strdup() failed\n", ctx->error_prefix);
+   invalidate_identity_cache(ctx);
    sqlite3_finalize(statement);
+   close_database(ctx);
    return 1;
   }
 
-  code = sqlite3_step(statement);
+  ctx->identity_user_id = sqlite3_column_int(statement, 0);
+  ctx->identity_mode_bitmask = sqlite3_column_int(statement, 2);
+  if(sqlite3_column_type(statement, 3) == SQLITE_INTEGER)
+   ctx->identity_posix_uid = sqlite3_column_int(statement, 3);
+  ctx->identity_cached = 1;
 
-  if(code == SQLITE_ROW)
-  {
-   if(sqlite3_column_type(statement, 0) != SQLITE_TEXT)
-   {
-    fprintf(stderr, "%s: resolve_user_id(): name is not text\n",
-            ctx->error_prefix);
-    sqlite3_finalize(statement);
-    return 1;
-   }
-   user = (const char *) sqlite3_column_text(statement, 0);
+ } else if(code != SQLITE_DONE) {
+  fprintf(stderr, "%s: load_identity(): sqlite3_step() failed, '%s'\n",
+          ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
+  sqlite3_finalize(statement);
+  close_database(ctx);
+  return 1;
+ }
 
-   if(ctx->verbose > 1)
-    fprintf(stderr, "%s: resolve_user_id(): %s -> %s.\n", ctx->error_prefix, ctx->user, user);
- 
-   free(ctx->user);
-   ctx->user = strdup(user);
-  }
+ sqlite3_finalize(statement);
+ close_database(ctx);
+ return 0;
+}
 
- } else {
-  /* no alias was used. We still have a username, but no user_id */
-  sql = "SELECT user_id FROM users WHERE name = ?;";
+int resolve_user_id(struct buildmatrix_context *ctx)
+{
+ const char *value;
+ int code, create = 0;
 
-  if(sqlite3_prepare_v2(ctx->db_ctx, sql, strlen(sql) + 1, &statement, NULL) != SQLITE_OK)
-  {
-   fprintf(stderr, 
-           "%s: resolve_user_id(): sqlite3_prepare(%s) failed, '%s'\n",
-           ctx->error_prefix, sql, sqlite3_errmsg(ctx->db_ctx));
-   return 1;
-  }
+ if(ctx->verbose > 1)
+  fprintf(stderr, "%s: resolve_user_id(%s)\n",
+          ctx->error_prefix, ctx->user);
 
-  if(sqlite3_bind_text(statement, 1, ctx->user, strlen(ctx->user),
-                       SQLITE_TRANSIENT) != SQLITE_OK)
-  {
-   fprintf(stderr, "%s: resolve_user_id(): sqlite3_bind_text() failed, '%s'\n",
-           ctx->error_prefix, sqlite3_errmsg(ctx->db_ctx));
-   sqlite3_finalize(statement);
+ ctx->user_id = -1;
+
+ if(ctx->user == NULL)
+ {
+  fprintf(stderr, "%s: resolve_user_id(): no user name\n",
+           ctx->error_prefix);
+  return 1;
+ }
+
+ if(open_database(ctx))
+  return 1;
+
+ if(identity_cache_matches(ctx) == 0)
+ {
+  if(load_identity(ctx))
    return 1;
-  }
+ }
 
-  code = sqlite3_step(statement);
+ if(ctx->identity_cached)
+ {
+  ctx->user_id = ctx->identity_user_id;
 
-  if(code == SQLITE_ROW)
+  /* an alias was used, carry on with the real user name */
+  if(strcmp(ctx->user, ctx->identity_name) != 0)
   {
-   if(sqlite3_column_type(statement, 0) != SQLITE_INTEGER)
-   {
-    fprintf(stderr, "%s: resolve_user_id(): users.user_id is not an integer\n",
-            ctx->error_prefix);
-    sqlite3_finalize(statement);
-    return 1;
-   }
-  
-   ctx->user_id = sqlite3_column_int(statement, 0);
+   if(ctx->verbose > 1)
+    fprintf(stderr, "%s: resolve_user_id(): %s -> %s.\n", ctx->error_prefix, ctx->user,
+            ctx->identity_name);
+
+   free(ctx->user);
+   ctx->user = strdup(ctx->identity_name);
   }
  }
 
- sqlite3_finalize(statement);
-
  code = 1;
  if(ctx->mode == BLDMTRX_MODE_SERVE)
   code = 0;
@@ -182,18 +205,18 @@ int resolve_user_id(struct buildmatrix_context *ctx)
   /* Still no user_id has been found. Check to see if we can add names to the users table, 
      or if we should fail now. */
   code = 1;
-  if((value = resolve_configuration_value(ctx, "autoaddusers")) != NULL)
+  if((value = configuration_string(ctx, "autoaddusers")) != NULL)
   {
    if(strcmp(value, "yes") == 0)
     create = 1;
-   free(value);
 
    if(ctx->mode == BLDMTRX_MODE_PULL)
     create = 1;
 
    if(create == 1)
    {
-    code = add_user(ctx);
+    if((code = add_user(ctx)) == 0)
+     code = load_identity(ctx);
    }
   }
  }
@@ -356,6 +379,7 @@ int add_user(struct buildmatrix_context *ctx)
           ctx->error_prefix, ctx->user, ctx->user_id);
  }
 
+ invalidate_identity_cache(ctx);
  close_database(ctx);
 
  return 0;
@@ -631,6 +655,14 @@ int mod_user(struct buildmatrix_context *ctx)
   }
  }
 
+ /* cached builds lists carry users.name, see open_query_cache() */
+ if(bump_change_counter(ctx, "builds"))
+ {
+  close_database(ctx);
+  return 1;
+ }
+
+ invalidate_identity_cache(ctx);
  close_database(ctx);
 
  return 0;
@@ -787,6 +819,14 @@ int remove_user(struct buildmatrix_context *ctx)
   return 1;
  }
 
+ /* cached builds lists carry users.name, see open_query_cache() */
+ if(bump_change_counter(ctx, "builds"))
+ {
+  close_database(ctx);
+  return 1;
+ }
+
+ invalidate_identity_cache(ctx);
  close_database(ctx);
 
  if(ctx->verbose)
@@ -798,7 +838,8 @@ int remove_user(struct buildmatrix_context *ctx)
 int advanced_security_check(struct buildmatrix_context *ctx)
 {
  int handled, code, uid = -1;
- char *value, *sql;
+ const char *value;
+ char *sql;
  struct sqlite3_stmt *statement = NULL;
 
  if(ctx->verbose > 1)
@@ -810,7 +851,7 @@ int advanced_security_check(struct buildmatrix_context *ctx)
   return 1;
  }
 
- if((value = resolve_configuration_value(ctx, "securitymodel")) == NULL)
+ if((value = configuration_string(ctx, "securitymodel")) == NULL)
  {
   fprintf(stderr, "%s: advanced_security_check(): can not resolve configuration "
           "value for variable \"securitymodel\"\n", ctx->error_prefix);
@@ -819,10 +860,7 @@ int advanced_security_check(struct buildmatrix_context *ctx)
 
  handled = 0;
  if(strcmp(value, "simple") == 0)
- {
-  free(value);
   return 0;
- }
 
  if(strcmp(value, "advanced") == 0)
  {
@@ -833,11 +871,11 @@ int advanced_security_check(struct buildmatrix_context *ctx)
  {
   fprintf(stderr, "%s: advanced_security_check(): invalid value for configuration "
           "variable securitymodel, \"%s\"\n",  ctx->error_prefix, value);
-  free(value);
   return 1;
  }
 
- free(value);
+ if( (ctx->identity_cached) && (ctx->identity_user_id == ctx->user_id) )
+  return check_posix_uid(ctx, ctx->identity_posix_uid);
 
  if(open_database(ctx))
   return 1;
@@ -882,6 +920,11 @@ int advanced_security_check(struct buildmatrix_context *ctx)
 
  close_database(ctx);
 
+ return check_posix_uid(ctx, uid);
+}
+
+int check_posix_uid(struct buildmatrix_context *ctx, int uid)
+{
  if(uid < 1)
  {
   fprintf(stderr, "%s: advanced_security_check(): user %s has no posix uid needed for the "
@@ -915,6 +958,12 @@ int get_mode_bitmask(struct buildmatrix_context *ctx, int *mode)
   return 1;
  }
 
+ if( (ctx->identity_cached) && (ctx->identity_user_id == ctx->user_id) )
+ {
+  *mode = ctx->identity_mode_bitmask;
+  return 0;
+ }
+
  if(open_database(ctx))
   return 1;
 
@@ -1062,9 +1111,9 @@ int authorize_get(struct buildmatrix_context *ctx)
 int derive_mode_bitmask_for_new_user(struct buildmatrix_context *ctx, int *mode)
 {
  int bit_mask = 0, submit = 0, scratch = 0, list = 0, get = 0;
- char *value;
+ const char *value;
 
- if((value = resolve_configuration_value(ctx, "newuserscratchdefault")) == NULL)
+ if((value = configuration_string(ctx, "newuserscratchdefault")) == NULL)
  {
   if(ctx->verbose)
    fprintf(stderr, "%s: derive_mode_bitmask_for_new_user(): can not resolve configuration "
@@ -1072,10 +1121,9 @@ int derive_mode_bitmask_for_new_user(struct buildmatrix_context *ctx, int *mode)
  } else {
   if(strcmp(value, "yes") == 0)
    scratch = 1; 
-  free(value);
  }
 
- if((value = resolve_configuration_value(ctx, "newuseradddefault")) == NULL)
+ if((value = configuration_string(ctx, "newuseradddefault")) == NULL)
  {
   if(ctx->verbose)
    fprintf(stderr, "%s: derive_mode_bitmask_for_new_user(): can not resolve configuration "
@@ -1083,10 +1131,9 @@ int derive_mode_bitmask_for_new_user(struct buildmatrix_context *ctx, int *mode)
  } else {
   if(strcmp(value, "yes") == 0)
    submit = 1; 
-  free(value);
  }
 
- if((value = resolve_configuration_value(ctx, "newuserlistdefault")) == NULL)
+ if((value = configuration_string(ctx, "newuserlistdefault")) == NULL)
  {
   if(ctx->verbose)
    fprintf(stderr, "%s: derive_mode_bitmask_for_new_user(): can not resolve configuration "
@@ -1094,10 +1141,9 @@ int derive_mode_bitmask_for_new_user(struct buildmatrix_context *ctx, int *mode)
  } else {
   if(strcmp(value, "yes") == 0)
    list = 1; 
-  free(value);
  }
 
- if((value = resolve_configuration_value(ctx, "newusergetdefault")) == NULL)
+ if((value = configuration_string(ctx, "newusergetdefault")) == NULL)
  {
   if(ctx->verbose)
    fprintf(stderr, "%s: derive_mode_bitmask_for_new_user(): can not resolve configuration "
@@ -1105,7 +1151,6 @@ int derive_mode_bitmask_for_new_user(struct buildmatrix_context *ctx, int *mode)
  } else {
   if(strcmp(value, "yes") == 0)
    get = 1; 
-  free(value);
  }
 
  if((ctx->user_mode_bits & BLDMTRX_ACCESS_BIT_SUBMIT) == BLDMTRX_ACCESS_BIT_SUBMIT)
@@ -1205,6 +1250,7 @@ int add_alias(struct buildmatrix_context *ctx)
 
  sqlite3_finalize(statement);
 
+ invalidate_identity_cache(ctx);
  close_database(ctx);
 
  return 0;
@@ -1331,6 +1377,7 @@ int remove_alias(struct buildmatrix_context *ctx)
   return 1;
  }
 
+ invalidate_identity_cache(ctx);
  close_database(ctx);
 
  return 1;